@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+// Encodes and decodes a mix of typical events with EventCodec and with a
+// minimal JSON encoding, as an application would otherwise write, and
+// reports the throughput of both and the encoded size per event.
+//
+// Usage: codecbench [rounds]
+
+#include <eventcodec.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock Clock;
+
+static double since(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+namespace json {
+
+void putString(std::string &out, const std::string &s) {
+	out += '"';
+	for(size_t i = 0; i < s.size(); ++i) {
+		char c = s[i];
+		if(c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if((unsigned char)c < 0x20) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			out += esc;
+		} else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+void encode(std::string &out, const std::string &network, const dazeus::IrcEvent &e, uint64_t micros) {
+	char time[32];
+	snprintf(time, sizeof(time), "%llu", (unsigned long long)micros);
+	out += "{\"time\":";
+	out += time;
+	out += ",\"network\":";
+	putString(out, network);
+	out += ",\"event\":";
+	putString(out, e.event);
+	out += ",\"origin\":";
+	putString(out, e.origin);
+	out += ",\"params\":[";
+	for(size_t i = 0; i < e.params.size(); ++i) {
+		if(i)
+			out += ',';
+		putString(out, e.params[i]);
+	}
+	out += "]}\n";
+}
+
+bool getString(const char *&p, const char *end, std::string &s) {
+	s.clear();
+	if(p == end || *p++ != '"')
+		return false;
+	while(p < end && *p != '"') {
+		if(*p == '\\') {
+			if(++p == end)
+				return false;
+			if(*p == 'u') {
+				if(end - p < 5)
+					return false;
+				s += (char)strtol(std::string(p + 1, 4).c_str(), NULL, 16);
+				p += 5;
+				continue;
+			}
+		}
+		s += *p++;
+	}
+	return p++ < end;
+}
+
+bool expect(const char *&p, const char *end, const char *s) {
+	while(*s) {
+		if(p == end || *p++ != *s++)
+			return false;
+	}
+	return true;
+}
+
+// only reads what encode() writes, in that order
+bool decode(const char *&p, const char *end, std::string &network, dazeus::IrcEvent &e, uint64_t &micros) {
+	if(!expect(p, end, "{\"time\":"))
+		return false;
+	char *num;
+	micros = strtoull(p, &num, 10);
+	p = num;
+	if(!expect(p, end, ",\"network\":") || !getString(p, end, network)
+	|| !expect(p, end, ",\"event\":") || !getString(p, end, e.event)
+	|| !expect(p, end, ",\"origin\":") || !getString(p, end, e.origin)
+	|| !expect(p, end, ",\"params\":["))
+		return false;
+	size_t n = 0;
+	while(p < end && *p != ']') {
+		if(n && !expect(p, end, ","))
+			return false;
+		if(e.params.size() <= n)
+			e.params.resize(n + 1);
+		if(!getString(p, end, e.params[n++]))
+			return false;
+	}
+	e.params.resize(n);
+	return expect(p, end, "]}\n");
+}
+
+}
+
+static dazeus::IrcEvent event(const char *name, const char *origin, const char *p1, const char *p2) {
+	dazeus::IrcEvent e;
+	e.event = name;
+	e.origin = origin;
+	if(p1)
+		e.params.push_back(p1);
+	if(p2)
+		e.params.push_back(p2);
+	return e;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long rounds = argc > 1 ? atol(argv[1]) : 200000;
+	std::vector<dazeus::IrcEvent> events;
+	events.push_back(event("PRIVMSG", "alice!~alice@host.example.org", "#channel", "hello there, how is everyone doing today?"));
+	events.push_back(event("JOIN", "bob!~bob@192.0.2.15", "#channel", 0));
+	events.push_back(event("QUIT", "carol!carol@irc.example.net", "hub.example.net leaf.example.net", 0));
+	events.push_back(event("NUMERIC", "irc.example.net", "353", "dazeus = #channel :alice bob @carol +dave"));
+	events.push_back(event("ACTION", "dave!d@host", "#channel", "waves \"hi\""));
+	uint64_t micros = 1400000000000000ULL;
+
+	std::string codec, text;
+	Clock::time_point start = Clock::now();
+	for(unsigned long r = 0; r < rounds; ++r) {
+		codec.clear();
+		for(size_t i = 0; i < events.size(); ++i) {
+			dazeus::EventCodec::encode(codec, "network", events[i].event, events[i].origin, events[i].params, micros + i);
+		}
+	}
+	double codecEncode = since(start);
+	start = Clock::now();
+	for(unsigned long r = 0; r < rounds; ++r) {
+		text.clear();
+		for(size_t i = 0; i < events.size(); ++i) {
+			json::encode(text, "network", events[i], micros + i);
+		}
+	}
+	double jsonEncode = since(start);
+
+	dazeus::EventView view;
+	dazeus::IrcEvent e;
+	std::string network;
+	size_t bytes = 0;
+	start = Clock::now();
+	for(unsigned long r = 0; r < rounds; ++r) {
+		size_t consumed;
+		for(size_t pos = 0; pos < codec.size(); pos += consumed) {
+			if(!dazeus::EventCodec::decode(codec.data() + pos, codec.size() - pos, view, &consumed))
+				abort();
+			bytes += view.origin.size;
+		}
+	}
+	double codecView = since(start);
+	start = Clock::now();
+	for(unsigned long r = 0; r < rounds; ++r) {
+		size_t consumed;
+		for(size_t pos = 0; pos < codec.size(); pos += consumed) {
+			if(!dazeus::EventCodec::decode(codec.data() + pos, codec.size() - pos, view, &consumed))
+				abort();
+			network.assign(view.network.data, view.network.size);
+			view.copyTo(e);
+		}
+	}
+	double codecCopy = since(start);
+	start = Clock::now();
+	for(unsigned long r = 0; r < rounds; ++r) {
+		const char *p = text.data();
+		const char *end = p + text.size();
+		while(p < end) {
+			if(!json::decode(p, end, network, e, micros))
+				abort();
+		}
+	}
+	double jsonDecode = since(start);
+
+	double n = (double)rounds * events.size();
+	printf("%-18s %12s %12s\n", "", "events/s", "bytes/event");
+	printf("%-18s %12.0f %12.1f\n", "codec encode", n / codecEncode, codec.size() / (double)events.size());
+	printf("%-18s %12.0f %12.1f\n", "json encode", n / jsonEncode, text.size() / (double)events.size());
+	printf("%-18s %12.0f\n", "codec decode view", n / codecView);
+	printf("%-18s %12.0f\n", "codec decode copy", n / codecCopy);
+	printf("%-18s %12.0f\n", "json decode", n / jsonDecode);
+	return bytes == 0;
+}
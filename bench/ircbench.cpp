@@ -0,0 +1,339 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+// Drives a Network through scenarios played by an in-process mock IRC
+// server, and reports events per second, the dispatch latency of single
+// events (the time since the previous event in the same pass) and the number
+// of C++ allocations per event.
+//
+// Usage: ircbench [filter [scale]]
+// Only scenarios whose name contains the filter run; the scale multiplies
+// the amount of simulated users and messages.
+
+#include <network.h>
+#include <server.h>
+#include <reconnectscheduler.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "mockircd.h"
+
+// Allocations done by the benchmark thread while the network is processing
+static thread_local bool countAllocations = false;
+static uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+	if(countAllocations)
+		++allocations;
+	void *p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result {
+	std::string name;
+	uint64_t events;
+	double seconds;
+	double p50;
+	double p99;
+	double allocationsPerEvent;
+};
+
+class Bench : public dazeus::NetworkListener {
+public:
+	Bench(const std::string &name)
+	: name_(name)
+	, scheduler_(16, 1, 2)
+	, network_(0)
+	, measuring_(false)
+	, mark_()
+	, events_(0)
+	, connects_(0)
+	, names_(0)
+	, quits_(0)
+	, joins_(0)
+	, privmsgs_(0)
+	, latencies_()
+	{
+		latencies_.reserve(4 * 1024 * 1024);
+	}
+
+	~Bench() {
+		if(network_)
+			network_->disconnectFromNetwork(dazeus::Network::ShutdownReason);
+		delete network_;
+	}
+
+	MockIrcd &ircd() { return ircd_; }
+	dazeus::Network &network() { return *network_; }
+	uint64_t connects() const { return connects_; }
+	uint64_t names() const { return names_; }
+	uint64_t quits() const { return quits_; }
+	uint64_t joins() const { return joins_; }
+	uint64_t privmsgs() const { return privmsgs_; }
+
+	void setUp() {
+		if(!ircd_.start()) {
+			perror("Couldn't start mock IRC server");
+			exit(1);
+		}
+		dazeus::NetworkConfig config;
+		config.name = "bench";
+		config.nickName = "bench";
+		dazeus::ServerConfig server;
+		server.host = "127.0.0.1";
+		server.port = ircd_.port();
+		config.servers.push_back(server);
+		network_ = new dazeus::Network(config);
+		network_->setReconnectScheduler(&scheduler_);
+		network_->addListener(this);
+	}
+
+	void connect() {
+		network_->connectToNetwork();
+		runUntil([this]() { return connects_ > 0; });
+	}
+
+	void join(const std::vector<std::string> &channels) {
+		uint64_t expect = names_ + channels.size();
+		std::vector<std::string>::const_iterator it;
+		for(it = channels.begin(); it != channels.end(); ++it) {
+			network_->joinChannel(*it);
+		}
+		runUntil([this, expect]() { return names_ >= expect; });
+	}
+
+	/**
+	 * Run the event loop until the condition holds, while measuring.
+	 */
+	Result measure(std::function<void()> start, std::function<bool()> done) {
+		allocations = 0;
+		latencies_.clear();
+		uint64_t events = events_;
+		measuring_ = true;
+		Clock::time_point begin = Clock::now();
+		countAllocations = true;
+		start();
+		countAllocations = false;
+		runUntil(done);
+		double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+		measuring_ = false;
+
+		Result r;
+		r.name = name_;
+		r.events = events_ - events;
+		r.seconds = seconds;
+		std::sort(latencies_.begin(), latencies_.end());
+		r.p50 = latencies_.empty() ? 0 : latencies_[latencies_.size() / 2] / 1000.0;
+		r.p99 = latencies_.empty() ? 0 : latencies_[latencies_.size() * 99 / 100] / 1000.0;
+		r.allocationsPerEvent = r.events ? (double)allocations / r.events : 0;
+		return r;
+	}
+
+	virtual void ircEvent(const std::string &event, const std::string &,
+	  const std::vector<std::string> &params, dazeus::Network *) {
+		if(measuring_) {
+			Clock::time_point now = Clock::now();
+			latencies_.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - mark_).count());
+			mark_ = now;
+		}
+		++events_;
+		if(event == "PRIVMSG")
+			++privmsgs_;
+		else if(event == "QUIT")
+			++quits_;
+		else if(event == "NETSPLIT")
+			quits_ += params.size() - 1;
+		else if(event == "NETJOIN")
+			joins_ += params.size() - 1;
+		else if(event == "NAMES")
+			++names_;
+		else if(event == "CONNECT")
+			++connects_;
+	}
+
+	void runUntil(std::function<bool()> done) {
+		Clock::time_point giveUp = Clock::now() + std::chrono::seconds(60);
+		while(!done()) {
+			if(Clock::now() > giveUp) {
+				fprintf(stderr, "%s: scenario stalled after %lu events\n", name_.c_str(), (unsigned long)events_);
+				exit(1);
+			}
+			countAllocations = measuring_;
+			mark_ = Clock::now();
+			network_->checkTimeouts();
+			countAllocations = false;
+
+			fd_set in_set, out_set;
+			int maxfd = 0;
+			FD_ZERO(&in_set);
+			FD_ZERO(&out_set);
+			network_->addDescriptors(&in_set, &out_set, &maxfd);
+			long wait = scheduler_.msUntilDue(network_);
+			if(wait < 0 || wait > 100)
+				wait = 100;
+			struct timeval timeout = {0, wait * 1000};
+			if(select(maxfd + 1, &in_set, &out_set, NULL, &timeout) <= 0)
+				continue;
+
+			countAllocations = measuring_;
+			mark_ = Clock::now();
+			network_->processDescriptors(&in_set, &out_set);
+			countAllocations = false;
+		}
+	}
+
+private:
+	std::string name_;
+	MockIrcd ircd_;
+	dazeus::ReconnectScheduler scheduler_;
+	dazeus::Network *network_;
+	bool measuring_;
+	Clock::time_point mark_;
+	uint64_t events_;
+	uint64_t connects_;
+	uint64_t names_;
+	uint64_t quits_;
+	uint64_t joins_;
+	uint64_t privmsgs_;
+	std::vector<uint32_t> latencies_;
+};
+
+static std::vector<std::string> channelList(const char *prefix, unsigned int count) {
+	std::vector<std::string> res;
+	for(unsigned int i = 0; i < count; ++i) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%s%u", prefix, i);
+		res.push_back(buf);
+	}
+	return res;
+}
+
+// The registration burst with a long MOTD
+static Result motdBurst(unsigned int scale) {
+	Bench b("motd_burst");
+	b.ircd().setMotdLines(5000 * scale);
+	b.setUp();
+	return b.measure([&b]() { b.network().connectToNetwork(); },
+	                 [&b]() { return b.connects() > 0; });
+}
+
+// Joining a single channel with thousands of users
+static Result hugeNames(unsigned int scale) {
+	Bench b("huge_names");
+	b.ircd().setChannelUsers("#huge", 5000 * scale);
+	b.setUp();
+	b.connect();
+	return b.measure([&b]() { b.network().joinChannel("#huge"); },
+	                 [&b]() { return b.names() > 0; });
+}
+
+// Lots of messages from many users in many channels
+static Result privmsgStorm(unsigned int scale) {
+	Bench b("privmsg_storm");
+	std::vector<std::string> channels = channelList("#storm", 50);
+	for(size_t i = 0; i < channels.size(); ++i)
+		b.ircd().setChannelUsers(channels[i], 100 * scale);
+	b.setUp();
+	b.connect();
+	b.join(channels);
+	unsigned int messages = 100000 * scale;
+	std::string storm = MockIrcd::privmsgStorm(channels, 100 * scale, messages);
+	return b.measure([&b, &storm]() { b.ircd().send(storm); },
+	                 [&b, messages]() { return b.privmsgs() >= messages; });
+}
+
+// A netsplit taking thousands of users, all in several of our channels
+static Result massQuit(unsigned int scale) {
+	Bench b("mass_quit");
+	unsigned int users = 2000 * scale;
+	std::vector<std::string> channels = channelList("#split", 10);
+	for(size_t i = 0; i < channels.size(); ++i)
+		b.ircd().setChannelUsers(channels[i], users);
+	b.setUp();
+	b.connect();
+	b.join(channels);
+	std::string split = MockIrcd::netsplit(users);
+	return b.measure([&b, &split]() { b.ircd().send(split); },
+	                 [&b, users]() { return b.quits() >= users; });
+}
+
+// The users of a netsplit coming back to all their channels
+static Result massRejoin(unsigned int scale) {
+	Bench b("mass_rejoin");
+	unsigned int users = 2000 * scale;
+	std::vector<std::string> channels = channelList("#split", 10);
+	for(size_t i = 0; i < channels.size(); ++i)
+		b.ircd().setChannelUsers(channels[i], users);
+	b.setUp();
+	b.connect();
+	b.join(channels);
+	b.ircd().send(MockIrcd::netsplit(users));
+	b.runUntil([&b, users]() { return b.quits() >= users; });
+	std::string rejoin = MockIrcd::netjoin(channels, users);
+	uint64_t joins = (uint64_t)users * channels.size();
+	return b.measure([&b, &rejoin]() { b.ircd().send(rejoin); },
+	                 [&b, joins]() { return b.joins() >= joins; });
+}
+
+// The server drops us right after every registration
+static Result reconnectStorm(unsigned int scale) {
+	Bench b("reconnect_storm");
+	b.ircd().setMotdLines(0);
+	b.ircd().setDropAfterWelcome(true);
+	b.setUp();
+	unsigned int reconnects = 200 * scale;
+	return b.measure([&b]() { b.network().connectToNetwork(); },
+	                 [&b, reconnects]() { return b.connects() >= reconnects; });
+}
+
+struct Scenario {
+	const char *name;
+	Result (*run)(unsigned int scale);
+};
+
+static const Scenario scenarios[] = {
+	{"motd_burst", motdBurst},
+	{"huge_names", hugeNames},
+	{"privmsg_storm", privmsgStorm},
+	{"mass_quit", massQuit},
+	{"mass_rejoin", massRejoin},
+	{"reconnect_storm", reconnectStorm},
+};
+
+int main(int argc, char *argv[]) {
+	const char *filter = argc > 1 ? argv[1] : "";
+	unsigned int scale = argc > 2 ? atoi(argv[2]) : 1;
+	if(scale == 0)
+		scale = 1;
+
+	std::vector<Result> results;
+	for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+		if(strstr(scenarios[i].name, filter) == NULL)
+			continue;
+		results.push_back(scenarios[i].run(scale));
+	}
+
+	printf("\n%-16s %10s %12s %10s %10s %13s\n", "scenario", "events", "events/s", "p50 (us)", "p99 (us)", "allocs/event");
+	std::vector<Result>::const_iterator it;
+	for(it = results.begin(); it != results.end(); ++it) {
+		printf("%-16s %10lu %12.0f %10.2f %10.2f %13.2f\n", it->name.c_str(),
+			(unsigned long)it->events, it->events / it->seconds,
+			it->p50, it->p99, it->allocationsPerEvent);
+	}
+	return 0;
+}
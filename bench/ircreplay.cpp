@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+// Replays recordings made with a TrafficRecorder into Networks, to profile
+// the library and its listeners offline.
+//
+// Usage: ircreplay [-j threads] [-r] recording...
+// With -r, recordings are replayed at the pace they were recorded at.
+
+#include <network.h>
+#include <replaydriver.h>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+	unsigned int threads = std::thread::hardware_concurrency();
+	dazeus::ReplayDriver::Pace pace = dazeus::ReplayDriver::FastPace;
+	int opt;
+	while((opt = getopt(argc, argv, "j:r")) != -1) {
+		switch(opt) {
+		case 'j': threads = atoi(optarg); break;
+		case 'r': pace = dazeus::ReplayDriver::RecordedPace; break;
+		default:
+			fprintf(stderr, "Usage: %s [-j threads] [-r] recording...\n", argv[0]);
+			return 1;
+		}
+	}
+	std::vector<std::string> paths(argv + optind, argv + argc);
+	if(paths.empty()) {
+		fprintf(stderr, "Usage: %s [-j threads] [-r] recording...\n", argv[0]);
+		return 1;
+	}
+
+	dazeus::NetworkConfig config;
+	config.name = "replay";
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<dazeus::ReplayDriver::CorpusResult> results =
+		dazeus::ReplayDriver::replayCorpus(paths, config, threads, pace);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int failed = 0;
+	uint64_t lines = 0, events = 0;
+	std::vector<dazeus::ReplayDriver::CorpusResult>::const_iterator it;
+	for(it = results.begin(); it != results.end(); ++it) {
+		if(!it->ok) {
+			fprintf(stderr, "%s\n", it->error.c_str());
+			++failed;
+			continue;
+		}
+		printf("%-40s %10lu lines %10lu events %10.0f lines/s\n", it->path.c_str(),
+			(unsigned long)it->lines, (unsigned long)it->events, it->lines / it->seconds);
+		lines += it->lines;
+		events += it->events;
+	}
+	printf("total: %lu lines, %lu events in %.3f s on %u threads (%.0f lines/s)\n",
+		(unsigned long)lines, (unsigned long)events, seconds, threads, lines / seconds);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+// Measures how fast a flood of PRIVMSGs is received over TLS, with records
+// decrypted in user space and with kernel TLS, and how much CPU time the
+// client thread spends on it.
+
+#include <network.h>
+#include <server.h>
+#include <tls.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "tlsircd.h"
+
+class FloodListener : public dazeus::NetworkListener {
+public:
+	FloodListener() : messages(0), bytes(0) {}
+	virtual void ircEvent(const std::string &event, const std::string &,
+	  const std::vector<std::string> &params, dazeus::Network *) {
+		if(event == "PRIVMSG" && params.size() >= 2) {
+			messages += 1;
+			bytes += params[1].size();
+		}
+	}
+	size_t messages;
+	size_t bytes;
+};
+
+static double cpuSeconds() {
+	struct rusage usage;
+#ifdef RUSAGE_THREAD
+	getrusage(RUSAGE_THREAD, &usage);
+#else
+	getrusage(RUSAGE_SELF, &usage);
+#endif
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+	     + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void run(const char *title, bool ktls, size_t lines, size_t length) {
+	TlsIrcd ircd(ktls);
+	ircd.setFlood(lines, length);
+	if(!ircd.start()) {
+		perror("Couldn't start TLS server");
+		exit(1);
+	}
+
+	dazeus::NetworkConfig config;
+	config.name = "bench";
+	config.nickName = "bench";
+	dazeus::ServerConfig server;
+	server.host = "127.0.0.1";
+	server.port = ircd.port();
+	server.ssl = true;
+	server.ssl_verify = false;
+	server.ktls = ktls;
+	config.servers.push_back(server);
+
+	dazeus::Network n(config);
+	FloodListener l;
+	n.addListener(&l);
+
+	dazeus::TlsStatistics before = dazeus::TlsContextCache::instance().statistics();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double cpuStart = cpuSeconds();
+	n.connectToNetwork();
+	while(l.messages < lines) {
+		fd_set in_set, out_set;
+		int maxfd = 0;
+		FD_ZERO(&in_set);
+		FD_ZERO(&out_set);
+		n.addDescriptors(&in_set, &out_set, &maxfd);
+		struct timeval timeout = {5, 0};
+		if(select(maxfd + 1, &in_set, &out_set, NULL, &timeout) <= 0) {
+			fprintf(stderr, "Connection stalled after %lu messages\n", (unsigned long)l.messages);
+			exit(1);
+		}
+		n.processDescriptors(&in_set, &out_set);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double cpu = cpuSeconds() - cpuStart;
+	dazeus::TlsStatistics after = dazeus::TlsContextCache::instance().statistics();
+	n.disconnectFromNetwork(dazeus::Network::ShutdownReason);
+
+	double mb = (double)lines * length / (1024 * 1024);
+	printf("%-12s %8lu lines  %7.1f MB/s  %8.0f lines/s  client cpu %6.3f s  ktls send=%lu recv=%lu\n",
+		title, (unsigned long)lines, mb / seconds, lines / seconds, cpu,
+		(unsigned long)(after.ktlsSend - before.ktlsSend),
+		(unsigned long)(after.ktlsReceive - before.ktlsReceive));
+}
+
+int main(int argc, char *argv[]) {
+	size_t lines = argc > 1 ? atol(argv[1]) : 200000;
+	size_t length = argc > 2 ? atol(argv[2]) : 256;
+
+	if(!dazeus::TlsContextCache::ktlsSupported())
+		printf("This OpenSSL has no kernel TLS support; both runs use user space TLS.\n");
+	run("user space", false, lines, length);
+	run("kernel TLS", true, lines, length);
+	return 0;
+}
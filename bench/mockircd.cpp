@@ -0,0 +1,384 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "mockircd.h"
+
+#define SERVERNAME "mock.irc"
+
+static void setNonBlocking(int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+MockIrcd::MockIrcd()
+: mutex_()
+, thread_()
+, stop_(false)
+, connections_(0)
+, listen_(-1)
+, port_(0)
+, motdLines_(20)
+, dropAfterWelcome_(false)
+, channelUsers_()
+, clients_()
+, pending_()
+, broadcast_()
+{
+	wake_[0] = wake_[1] = -1;
+}
+
+MockIrcd::~MockIrcd() {
+	stop_ = true;
+	if(thread_.joinable()) {
+		wake();
+		thread_.join();
+	}
+	std::vector<Client>::iterator it;
+	for(it = clients_.begin(); it != clients_.end(); ++it) {
+		close(it->fd);
+	}
+	if(listen_ >= 0)
+		close(listen_);
+	if(wake_[0] >= 0) {
+		close(wake_[0]);
+		close(wake_[1]);
+	}
+}
+
+bool MockIrcd::start() {
+	listen_ = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if(listen_ < 0 || bind(listen_, (struct sockaddr*)&addr, sizeof(addr)) != 0
+	|| listen(listen_, 128) != 0 || getsockname(listen_, (struct sockaddr*)&addr, &len) != 0
+	|| pipe(wake_) != 0) {
+		return false;
+	}
+	setNonBlocking(listen_);
+	setNonBlocking(wake_[0]);
+	port_ = ntohs(addr.sin_port);
+	thread_ = std::thread(&MockIrcd::serve, this);
+	return true;
+}
+
+void MockIrcd::setMotdLines(unsigned int lines) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	motdLines_ = lines;
+}
+
+/**
+ * Simulate a channel with the given number of other users in it. They are
+ * listed when a client joins it, and are called userNick(0) and onwards.
+ */
+void MockIrcd::setChannelUsers(const std::string &channel, unsigned int users) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	channelUsers_[channel] = users;
+}
+
+/**
+ * Close every connection with an ERROR right after the welcome, so the
+ * client keeps reconnecting.
+ */
+void MockIrcd::setDropAfterWelcome(bool drop) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	dropAfterWelcome_ = drop;
+}
+
+/**
+ * Queue raw IRC lines, including their line endings, for the newest
+ * registered client. If there is none yet, they are sent as soon as one
+ * registers.
+ */
+void MockIrcd::send(const std::string &lines) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_ += lines;
+	}
+	wake();
+}
+
+void MockIrcd::broadcast(const std::string &lines) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		broadcast_ += lines;
+	}
+	wake();
+}
+
+std::string MockIrcd::clientNick() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<Client>::const_reverse_iterator it;
+	for(it = clients_.rbegin(); it != clients_.rend(); ++it) {
+		if(it->registered)
+			return it->nick;
+	}
+	return std::string();
+}
+
+void MockIrcd::wake() {
+	char c = 0;
+	if(write(wake_[1], &c, 1) < 0) {
+		// the pipe is full, so a wakeup is pending anyway
+	}
+}
+
+std::string MockIrcd::userNick(unsigned int i) {
+	std::stringstream ss;
+	ss << "user" << i;
+	return ss.str();
+}
+
+std::string MockIrcd::userPrefix(unsigned int i) {
+	std::stringstream ss;
+	ss << "user" << i << "!~u" << i << "@host" << (i % 251) << ".example.net";
+	return ss.str();
+}
+
+/**
+ * Messages from the first given number of simulated users, spread over the
+ * given channels.
+ */
+std::string MockIrcd::privmsgStorm(const std::vector<std::string> &channels, unsigned int users, unsigned int messages) {
+	std::string res;
+	for(unsigned int i = 0; i < messages; ++i) {
+		std::stringstream ss;
+		ss << ":" << userPrefix(i % users) << " PRIVMSG " << channels[i % channels.size()]
+		   << " :message " << i << " in a storm of " << messages << ", with some padding to make it realistic\r\n";
+		res += ss.str();
+	}
+	return res;
+}
+
+std::string MockIrcd::massQuit(unsigned int users, const std::string &reason) {
+	std::string res;
+	for(unsigned int i = 0; i < users; ++i) {
+		res += ":" + userPrefix(i) + " QUIT :" + reason + "\r\n";
+	}
+	return res;
+}
+
+std::string MockIrcd::netsplit(unsigned int users) {
+	return massQuit(users, "hub.example.net leaf.example.net");
+}
+
+/**
+ * The first given number of simulated users joining all given channels,
+ * like they do when a split server comes back.
+ */
+std::string MockIrcd::netjoin(const std::vector<std::string> &channels, unsigned int users) {
+	std::string res;
+	for(unsigned int i = 0; i < users; ++i) {
+		for(size_t c = 0; c < channels.size(); ++c) {
+			res += ":" + userPrefix(i) + " JOIN :" + channels[c] + "\r\n";
+		}
+	}
+	return res;
+}
+
+void MockIrcd::serve() {
+	while(!stop_) {
+		std::vector<struct pollfd> fds;
+		struct pollfd p;
+		p.fd = listen_; p.events = POLLIN; p.revents = 0;
+		fds.push_back(p);
+		p.fd = wake_[0];
+		fds.push_back(p);
+		for(size_t i = 0; i < clients_.size(); ++i) {
+			p.fd = clients_[i].fd;
+			p.events = POLLIN | (clients_[i].out.empty() ? 0 : POLLOUT);
+			fds.push_back(p);
+		}
+		if(poll(&fds[0], fds.size(), -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			return;
+		}
+
+		if(fds[1].revents & POLLIN) {
+			char buf[256];
+			while(read(wake_[0], buf, sizeof(buf)) > 0) {}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		for(size_t i = 0; i < clients_.size(); ++i) {
+			Client &c = clients_[i];
+			short revents = fds[i + 2].revents;
+			bool gone = false;
+			if(revents & (POLLIN | POLLHUP | POLLERR)) {
+				char buf[16384];
+				ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+				if(r > 0) {
+					c.in.append(buf, r);
+					size_t eol;
+					while((eol = c.in.find('\n')) != std::string::npos) {
+						std::string line = c.in.substr(0, eol);
+						if(!line.empty() && line[line.size() - 1] == '\r')
+							line.resize(line.size() - 1);
+						c.in.erase(0, eol + 1);
+						handleLine(c, line);
+					}
+				} else if(r == 0 || (errno != EAGAIN && errno != EINTR)) {
+					gone = true;
+				}
+			}
+			if(!gone && !flush(c))
+				gone = true;
+			if(gone || (c.closing && c.out.empty())) {
+				close(c.fd);
+				c.fd = -1;
+			}
+		}
+		std::vector<Client>::iterator it = clients_.begin();
+		while(it != clients_.end()) {
+			if(it->fd < 0)
+				it = clients_.erase(it);
+			else
+				++it;
+		}
+
+		if(!pending_.empty()) {
+			std::vector<Client>::reverse_iterator rit;
+			for(rit = clients_.rbegin(); rit != clients_.rend(); ++rit) {
+				if(rit->registered && !rit->closing) {
+					rit->out += pending_;
+					pending_.clear();
+					flush(*rit);
+					break;
+				}
+			}
+		}
+		if(!broadcast_.empty()) {
+			std::vector<Client>::iterator cit;
+			for(cit = clients_.begin(); cit != clients_.end(); ++cit) {
+				if(cit->registered && !cit->closing) {
+					cit->out += broadcast_;
+					flush(*cit);
+				}
+			}
+			broadcast_.clear();
+		}
+
+		if(fds[0].revents & POLLIN) {
+			int fd;
+			while((fd = accept(listen_, NULL, NULL)) >= 0) {
+				setNonBlocking(fd);
+				int one = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				Client c;
+				c.fd = fd;
+				clients_.push_back(c);
+				connections_ += 1;
+			}
+		}
+	}
+}
+
+/**
+ * Write as much of the output of a client as the socket takes. Returns false
+ * if the client is gone.
+ */
+bool MockIrcd::flush(Client &c) {
+	while(!c.out.empty()) {
+		ssize_t w = ::send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+		if(w > 0) {
+			c.out.erase(0, w);
+		} else if(w < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return true;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+void MockIrcd::handleLine(Client &c, const std::string &line) {
+	// mutex_ is held by the caller
+	std::string command = line.substr(0, line.find(' '));
+	std::string arg = line.size() > command.size() ? line.substr(command.size() + 1) : std::string();
+	if(!arg.empty() && arg[0] == ':')
+		arg.erase(0, 1);
+
+	if(command == "NICK") {
+		if(!c.registered) {
+			c.nick = arg;
+			c.registered = true;
+			welcome(c);
+		} else {
+			c.out += ":" + c.nick + "!~" + c.nick + "@client.example.net NICK :" + arg + "\r\n";
+			c.nick = arg;
+		}
+	} else if(command == "PING") {
+		c.out += ":" SERVERNAME " PONG " SERVERNAME " :" + arg + "\r\n";
+	} else if(command == "JOIN") {
+		std::stringstream ss(arg.substr(0, arg.find(' ')));
+		std::string channel;
+		while(std::getline(ss, channel, ',')) {
+			c.out += ":" + c.nick + "!~" + c.nick + "@client.example.net JOIN :" + channel + "\r\n";
+			names(c, channel);
+		}
+	} else if(command == "QUIT") {
+		c.out += "ERROR :Closing link\r\n";
+		c.closing = true;
+	}
+}
+
+void MockIrcd::welcome(Client &c) {
+	// mutex_ is held by the caller
+	const std::string &n = c.nick;
+	c.out += ":" SERVERNAME " 001 " + n + " :Welcome to the mock IRC network " + n + "\r\n";
+	c.out += ":" SERVERNAME " 002 " + n + " :Your host is " SERVERNAME "\r\n";
+	c.out += ":" SERVERNAME " 003 " + n + " :This server was created today\r\n";
+	c.out += ":" SERVERNAME " 004 " + n + " " SERVERNAME " mockircd-1.0 iowghraAsORTVSxNCWqBzvdHtGp lvhopsmntikrRcaqOALQbSeIKVfMCuzNTGj\r\n";
+	c.out += ":" SERVERNAME " 005 " + n + " CHANTYPES=# PREFIX=(ov)@+ NETWORK=Mock :are supported by this server\r\n";
+	c.out += ":" SERVERNAME " 375 " + n + " :- " SERVERNAME " Message of the Day -\r\n";
+	for(unsigned int i = 0; i < motdLines_; ++i) {
+		std::stringstream ss;
+		ss << ":" SERVERNAME " 372 " << n << " :- line " << i << " of a long and boring message of the day\r\n";
+		c.out += ss.str();
+	}
+	c.out += ":" SERVERNAME " 376 " + n + " :End of /MOTD command.\r\n";
+	if(dropAfterWelcome_) {
+		c.out += "ERROR :Closing link (reconnect storm)\r\n";
+		c.closing = true;
+	}
+}
+
+void MockIrcd::names(Client &c, const std::string &channel) {
+	// mutex_ is held by the caller
+	std::map<std::string,unsigned int>::const_iterator it = channelUsers_.find(channel);
+	unsigned int users = it == channelUsers_.end() ? 0 : it->second;
+	std::string head = ":" SERVERNAME " 353 " + c.nick + " = " + channel + " :";
+	std::string line = head + "@" + c.nick;
+	for(unsigned int i = 0; i < users; ++i) {
+		std::string name = userNick(i);
+		if(i % 10 == 0)
+			name = "@" + name;
+		else if(i % 5 == 0)
+			name = "+" + name;
+		if(line.size() + name.size() + 1 > 400) {
+			c.out += line + "\r\n";
+			line = head + name;
+		} else {
+			line += " " + name;
+		}
+	}
+	c.out += line + "\r\n";
+	c.out += ":" SERVERNAME " 366 " + c.nick + " " + channel + " :End of /NAMES list.\r\n";
+}
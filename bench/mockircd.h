@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef BENCH_MOCKIRCD_H
+#define BENCH_MOCKIRCD_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * An IRC server stand-in for benchmarks, running in its own thread on a
+ * loopback port. It registers every client that sends NICK (with a MOTD of
+ * configurable length), answers PING, and answers JOIN with the NAMES of a
+ * simulated channel. Everything else is scripted by the benchmark: send()
+ * queues raw lines for the newest client, and the static helpers generate
+ * the traffic of thousands of simulated users; broadcast() queues them for
+ * every registered client.
+ */
+class MockIrcd {
+public:
+	MockIrcd();
+	~MockIrcd();
+
+	bool start();
+	uint16_t port() const { return port_; }
+
+	void setMotdLines(unsigned int lines);
+	void setChannelUsers(const std::string &channel, unsigned int users);
+	void setDropAfterWelcome(bool drop);
+	void send(const std::string &lines);
+	void broadcast(const std::string &lines);
+
+	unsigned int connections() const { return connections_; }
+	std::string clientNick() const;
+
+	static std::string userNick(unsigned int i);
+	static std::string userPrefix(unsigned int i);
+	static std::string privmsgStorm(const std::vector<std::string> &channels, unsigned int users, unsigned int messages);
+	static std::string massQuit(unsigned int users, const std::string &reason);
+	static std::string netsplit(unsigned int users);
+	static std::string netjoin(const std::vector<std::string> &channels, unsigned int users);
+
+private:
+	// explicitly disable copy constructor
+	MockIrcd(const MockIrcd&);
+	void operator=(const MockIrcd&);
+
+	struct Client {
+		Client() : fd(-1), registered(false), closing(false) {}
+		int fd;
+		bool registered;
+		bool closing;
+		std::string nick;
+		std::string in;
+		std::string out;
+	};
+
+	void serve();
+	void wake();
+	void handleLine(Client &c, const std::string &line);
+	void welcome(Client &c);
+	void names(Client &c, const std::string &channel);
+	bool flush(Client &c);
+
+	mutable std::mutex mutex_;
+	std::thread thread_;
+	std::atomic<bool> stop_;
+	std::atomic<unsigned int> connections_;
+	int listen_;
+	int wake_[2];
+	uint16_t port_;
+	unsigned int motdLines_;
+	bool dropAfterWelcome_;
+	std::map<std::string,unsigned int> channelUsers_;
+	std::vector<Client> clients_;
+	std::string pending_;
+	std::string broadcast_;
+};
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+// Runs many Networks, each with its own connection to an in-process mock IRC
+// server, through a select() loop like Network::run() and through the
+// reactors, and reports messages per second and the system calls the loop
+// itself made: select() for the select loop, epoll_wait() and epoll_ctl()
+// for EpollReactor, io_uring_enter() for IoUringReactor. The recv() and
+// send() calls of libircclient are the same for all of them, and aren't
+// counted.
+//
+// Usage: reactorbench [connections [messages]]
+// Every connection receives the given number of messages.
+
+#include <network.h>
+#include <reconnectscheduler.h>
+#include <logger.h>
+#include <epollreactor.h>
+#include <uringreactor.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+
+#include "mockircd.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// the descriptors of the connections and of the server must fit in an fd_set
+#define MAX_CONNECTIONS 400
+
+struct Counter : public dazeus::NetworkListener {
+	Counter() : connects(0), privmsgs(0) {}
+	uint64_t connects;
+	uint64_t privmsgs;
+	void ircEvent(const std::string &event, const std::string &, const std::vector<std::string> &, dazeus::Network *) {
+		if(event == "CONNECT")
+			++connects;
+		else if(event == "PRIVMSG")
+			++privmsgs;
+	}
+};
+
+/**
+ * A loop to run the networks with: a step waits at most the given time and
+ * handles what happened.
+ */
+class Loop {
+public:
+	virtual ~Loop() {}
+	virtual void add(dazeus::Network *n) = 0;
+	virtual void remove(dazeus::Network *n) = 0;
+	virtual void step(long maxWaitMs) = 0;
+	virtual uint64_t syscalls() const = 0;
+};
+
+class SelectLoop : public Loop {
+public:
+	SelectLoop() : networks_(), syscalls_(0) {}
+	void add(dazeus::Network *n) { networks_.push_back(n); }
+	void remove(dazeus::Network *n) {
+		networks_.erase(std::find(networks_.begin(), networks_.end(), n));
+	}
+	uint64_t syscalls() const { return syscalls_; }
+
+	void step(long maxWaitMs) {
+		fd_set in_set, out_set;
+		int maxfd = 0;
+		FD_ZERO(&in_set);
+		FD_ZERO(&out_set);
+		std::vector<dazeus::Network*>::iterator it;
+		for(it = networks_.begin(); it != networks_.end(); ++it) {
+			(*it)->checkTimeouts();
+			(*it)->addDescriptors(&in_set, &out_set, &maxfd);
+		}
+		struct timeval timeout = {0, maxWaitMs * 1000};
+		++syscalls_;
+		if(select(maxfd + 1, &in_set, &out_set, NULL, &timeout) <= 0)
+			return;
+		for(it = networks_.begin(); it != networks_.end(); ++it) {
+			(*it)->processDescriptors(&in_set, &out_set);
+		}
+	}
+
+private:
+	std::vector<dazeus::Network*> networks_;
+	uint64_t syscalls_;
+};
+
+class ReactorLoop : public Loop {
+public:
+	ReactorLoop(dazeus::Reactor *r) : reactor_(r) {}
+	~ReactorLoop() { delete reactor_; }
+	void add(dazeus::Network *n) { reactor_->add(n); }
+	void remove(dazeus::Network *n) { reactor_->remove(n); }
+	void step(long maxWaitMs) { reactor_->runOnce(maxWaitMs); }
+	uint64_t syscalls() const { return reactor_->syscalls(); }
+
+private:
+	dazeus::Reactor *reactor_;
+};
+
+static void runUntil(Loop &loop, uint64_t *iterations, std::function<bool()> done) {
+	Clock::time_point giveUp = Clock::now() + std::chrono::seconds(60);
+	while(!done()) {
+		if(Clock::now() > giveUp) {
+			fprintf(stderr, "Benchmark stalled\n");
+			exit(1);
+		}
+		loop.step(100);
+		++*iterations;
+	}
+}
+
+static void bench(const char *name, Loop &loop, MockIrcd &ircd, unsigned int connections, unsigned int messages) {
+	dazeus::ReconnectScheduler scheduler(connections, 1, 2);
+	Counter counter;
+	std::vector<dazeus::Network*> networks;
+	for(unsigned int i = 0; i < connections; ++i) {
+		dazeus::NetworkConfig config;
+		std::stringstream nick;
+		nick << "bench" << i;
+		config.name = nick.str();
+		config.nickName = nick.str();
+		dazeus::ServerConfig server;
+		server.host = "127.0.0.1";
+		server.port = ircd.port();
+		config.servers.push_back(server);
+		dazeus::Network *n = new dazeus::Network(config);
+		n->setReconnectScheduler(&scheduler);
+		n->addListener(&counter);
+		loop.add(n);
+		n->connectToNetwork();
+		networks.push_back(n);
+	}
+	uint64_t iterations = 0;
+	runUntil(loop, &iterations, [&]() { return counter.connects == connections; });
+
+	std::string lines;
+	for(unsigned int i = 0; i < messages; ++i) {
+		lines += ":" + MockIrcd::userPrefix(i % 100) + " PRIVMSG #bench :a message on the benchmark channel\r\n";
+	}
+	uint64_t expect = (uint64_t)connections * messages;
+	iterations = 0;
+	uint64_t syscalls = loop.syscalls();
+	Clock::time_point begin = Clock::now();
+	ircd.broadcast(lines);
+	runUntil(loop, &iterations, [&]() { return counter.privmsgs == expect; });
+	double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+	syscalls = loop.syscalls() - syscalls;
+
+	printf("%-10s %10lu %12.0f %12lu %14.2f %16.2f\n", name, (unsigned long)expect, expect / seconds,
+		(unsigned long)iterations, iterations ? (double)syscalls / iterations : 0, syscalls * 1000.0 / expect);
+
+	std::vector<dazeus::Network*>::iterator it;
+	for(it = networks.begin(); it != networks.end(); ++it) {
+		loop.remove(*it);
+		(*it)->disconnectFromNetwork(dazeus::Network::ShutdownReason);
+		delete *it;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	unsigned int connections = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+	unsigned int messages = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+	if(connections == 0 || connections > MAX_CONNECTIONS) {
+		fprintf(stderr, "Between 1 and %d connections are supported\n", MAX_CONNECTIONS);
+		return 1;
+	}
+	dazeus::setLogLevel(dazeus::WarningLevel);
+
+	MockIrcd ircd;
+	ircd.setMotdLines(0);
+	if(!ircd.start()) {
+		perror("Couldn't start mock IRC server");
+		return 1;
+	}
+
+	printf("%-10s %10s %12s %12s %14s %16s\n", "loop", "messages", "messages/s", "iterations",
+		"calls/iter", "calls/1k msgs");
+	SelectLoop select;
+	bench("select", select, ircd, connections, messages);
+	ReactorLoop epoll(new dazeus::EpollReactor());
+	bench("epoll", epoll, ircd, connections, messages);
+	dazeus::IoUringReactor *uring = new dazeus::IoUringReactor();
+	if(uring->valid()) {
+		ReactorLoop loop(uring);
+		bench("io_uring", loop, ircd, connections, messages);
+	} else {
+		printf("%-10s not available\n", "io_uring");
+		delete uring;
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+// Writes events into an EventRing as fast as possible, while reader
+// processes consume them, and reports the events per second written and
+// read, and the events readers lost to overruns.
+//
+// Usage: ringthroughput [readers [events [ring size in KiB]]]
+
+#include <eventring.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static double since(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int reader(const char *path, unsigned int index) {
+	dazeus::EventRingReader r;
+	std::string error;
+	if(!r.open(path, &error)) {
+		fprintf(stderr, "reader %u: %s\n", index, error.c_str());
+		return 1;
+	}
+	dazeus::RingEvent e;
+	uint64_t events = 0;
+	Clock::time_point start;
+	while(true) {
+		if(!r.next(e)) {
+			sched_yield();
+			continue;
+		}
+		if(events == 0)
+			start = Clock::now();
+		if(e.event.event == "END")
+			break;
+		++events;
+	}
+	double seconds = since(start);
+	printf("reader %u: %10lu events %12.0f events/s %10lu lost\n", index,
+		(unsigned long)events, events / seconds, (unsigned long)r.lost());
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned int readers = argc > 1 ? atoi(argv[1]) : 2;
+	unsigned long events = argc > 2 ? atol(argv[2]) : 2000000;
+	size_t size = (argc > 3 ? atol(argv[3]) : 16384) * 1024;
+
+	char path[] = "/tmp/dazeus-ringbench-XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	dazeus::EventRingWriter w;
+	if(!w.open(path, size)) {
+		perror("open");
+		return 1;
+	}
+
+	for(unsigned int i = 0; i < readers; ++i) {
+		fflush(stdout);
+		if(fork() == 0)
+			return reader(path, i);
+	}
+	// wait until all readers have a slot, so they see every event
+	while(w.readers().size() < readers)
+		usleep(1000);
+
+	std::vector<std::string> params;
+	params.push_back("#channel");
+	params.push_back("hello there, how is everyone doing today?");
+	Clock::time_point start = Clock::now();
+	for(unsigned long i = 0; i < events; ++i) {
+		w.write("network", "PRIVMSG", "someone", params);
+	}
+	double seconds = since(start);
+	w.write("network", "END", "", std::vector<std::string>());
+	printf("writer:   %10lu events %12.0f events/s\n", events, events / seconds);
+
+	for(unsigned int i = 0; i < readers; ++i) {
+		wait(NULL);
+	}
+	unlink(path);
+	return 0;
+}
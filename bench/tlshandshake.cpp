@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+// Measures how long it takes to (re)connect to a TLS IRC server, with and
+// without session resumption, against a local TLS IRC stand-in.
+
+#include <network.h>
+#include <server.h>
+#include <tls.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "tlsircd.h"
+
+class ConnectListener : public dazeus::NetworkListener {
+public:
+	ConnectListener() : connected(false) {}
+	virtual void ircEvent(const std::string &event, const std::string &,
+	  const std::vector<std::string> &, dazeus::Network *) {
+		if(event == "CONNECT")
+			connected = true;
+	}
+	bool connected;
+};
+
+static void run(const char *title, uint16_t port, int rounds) {
+	dazeus::NetworkConfig config;
+	config.name = "bench";
+	config.nickName = "bench";
+	dazeus::ServerConfig server;
+	server.host = "127.0.0.1";
+	server.port = port;
+	server.ssl = true;
+	server.ssl_verify = false;
+	config.servers.push_back(server);
+
+	dazeus::Network n(config);
+	ConnectListener l;
+	n.addListener(&l);
+
+	dazeus::TlsStatistics before = dazeus::TlsContextCache::instance().statistics();
+	std::vector<double> times;
+	for(int i = 0; i < rounds; ++i) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		l.connected = false;
+		n.connectToNetwork();
+		while(!l.connected) {
+			fd_set in_set, out_set;
+			int maxfd = 0;
+			FD_ZERO(&in_set);
+			FD_ZERO(&out_set);
+			n.addDescriptors(&in_set, &out_set, &maxfd);
+			struct timeval timeout = {5, 0};
+			if(select(maxfd + 1, &in_set, &out_set, NULL, &timeout) <= 0) {
+				fprintf(stderr, "Connection stalled\n");
+				exit(1);
+			}
+			n.processDescriptors(&in_set, &out_set);
+		}
+		times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		n.disconnectFromNetwork(dazeus::Network::ShutdownReason);
+	}
+	dazeus::TlsStatistics after = dazeus::TlsContextCache::instance().statistics();
+
+	std::sort(times.begin(), times.end());
+	uint64_t handshakes = (after.fullHandshakes - before.fullHandshakes) + (after.resumedHandshakes - before.resumedHandshakes);
+	printf("%-22s %5d connects  full=%-5lu resumed=%-5lu  handshake avg %8.1f us  connect p50 %8.1f us  p99 %8.1f us\n",
+		title, rounds,
+		(unsigned long)(after.fullHandshakes - before.fullHandshakes),
+		(unsigned long)(after.resumedHandshakes - before.resumedHandshakes),
+		handshakes ? (double)(after.handshakeMicros - before.handshakeMicros) / handshakes : 0.0,
+		times[times.size() / 2], times[times.size() * 99 / 100]);
+}
+
+int main(int argc, char *argv[]) {
+	int rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+	TlsIrcd ircd;
+	if(!ircd.start()) {
+		perror("Couldn't start TLS server");
+		return 1;
+	}
+
+	dazeus::TlsContextCache::instance().setSessionCacheEnabled(false);
+	run("full handshakes", ircd.port(), rounds);
+	dazeus::TlsContextCache::instance().setSessionCacheEnabled(true);
+	run("session resumption", ircd.port(), rounds);
+	return 0;
+}
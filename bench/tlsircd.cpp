@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "tlsircd.h"
+
+static SSL_CTX *serverContext(bool ktls) {
+	EVP_PKEY *pkey = 0;
+	EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	EVP_PKEY_keygen_init(pctx);
+	EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+	EVP_PKEY_keygen(pctx, &pkey);
+	EVP_PKEY_CTX_free(pctx);
+
+	X509 *cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_get_notBefore(cert), 0);
+	X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+	X509_set_pubkey(cert, pkey);
+	X509_NAME *name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	X509_sign(cert, pkey, EVP_sha256());
+
+	SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+	SSL_CTX_use_certificate(ctx, cert);
+	SSL_CTX_use_PrivateKey(ctx, pkey);
+#ifdef SSL_OP_ENABLE_KTLS
+	if(ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+	(void)ktls;
+#endif
+	X509_free(cert);
+	EVP_PKEY_free(pkey);
+	return ctx;
+}
+
+TlsIrcd::TlsIrcd(bool ktls)
+: ctx_(serverContext(ktls))
+, thread_()
+, listen_(-1)
+, port_(0)
+, floodLines_(0)
+, floodLength_(0)
+{
+}
+
+TlsIrcd::~TlsIrcd() {
+	if(listen_ >= 0) {
+		// wakes up the accept() in serve()
+		shutdown(listen_, SHUT_RDWR);
+	}
+	if(thread_.joinable())
+		thread_.join();
+	if(listen_ >= 0)
+		close(listen_);
+	SSL_CTX_free(ctx_);
+}
+
+bool TlsIrcd::start() {
+	listen_ = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if(bind(listen_, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_, 16) != 0
+	|| getsockname(listen_, (struct sockaddr*)&addr, &len) != 0) {
+		return false;
+	}
+	port_ = ntohs(addr.sin_port);
+	thread_ = std::thread(&TlsIrcd::serve, this);
+	return true;
+}
+
+void TlsIrcd::serve() {
+	while(1) {
+		int fd = accept(listen_, NULL, NULL);
+		if(fd < 0)
+			return;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		SSL *ssl = SSL_new(ctx_);
+		SSL_set_fd(ssl, fd);
+		if(SSL_accept(ssl) == 1) {
+			std::string in;
+			char buf[4096];
+			int r;
+			while((r = SSL_read(ssl, buf, sizeof(buf))) > 0) {
+				in.append(buf, r);
+				size_t nick = in.find("NICK ");
+				size_t eol = nick == std::string::npos ? nick : in.find("\r\n", nick);
+				if(eol == std::string::npos)
+					continue;
+				std::string n = in.substr(nick + 5, eol - nick - 5);
+				std::string out = ":bench 001 " + n + " :Welcome\r\n:bench 376 " + n + " :End of MOTD\r\n";
+				SSL_write(ssl, out.data(), out.size());
+				in.clear();
+
+				std::string line = ":flood!flood@bench PRIVMSG " + n + " :";
+				if(line.size() + 2 < floodLength_)
+					line.append(floodLength_ - line.size() - 2, 'x');
+				line += "\r\n";
+				out.clear();
+				for(size_t i = 0; i < floodLines_; ++i) {
+					out += line;
+					if(out.size() >= 16384 || i + 1 == floodLines_) {
+						SSL_write(ssl, out.data(), out.size());
+						out.clear();
+					}
+				}
+			}
+			SSL_shutdown(ssl);
+		}
+		SSL_free(ssl);
+		close(fd);
+	}
+}
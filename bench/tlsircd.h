@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef BENCH_TLSIRCD_H
+#define BENCH_TLSIRCD_H
+
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+typedef struct ssl_ctx_st SSL_CTX;
+
+/**
+ * A minimal TLS IRC server on a loopback port, with a self-signed
+ * certificate generated at startup. Clients are served one at a time: they
+ * are registered as soon as they send NICK, optionally flooded with
+ * floodLines PRIVMSGs of floodLength bytes, and then served until they
+ * disconnect. The server stops when it is destroyed; the current client, if
+ * any, must have disconnected by then.
+ */
+class TlsIrcd {
+public:
+	TlsIrcd(bool ktls = false);
+	~TlsIrcd();
+
+	bool start();
+	uint16_t port() const { return port_; }
+	void setFlood(size_t lines, size_t length) { floodLines_ = lines; floodLength_ = length; }
+
+private:
+	void serve();
+
+	// explicitly disable copy constructor
+	TlsIrcd(const TlsIrcd&);
+	void operator=(const TlsIrcd&);
+
+	SSL_CTX *ctx_;
+	std::thread thread_;
+	int listen_;
+	uint16_t port_;
+	size_t floodLines_;
+	size_t floodLength_;
+};
+
+#endif
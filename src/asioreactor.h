@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef ASIOREACTOR_H
+#define ASIOREACTOR_H
+
+#ifdef __linux__
+
+#include <chrono>
+#include <memory>
+#include <poll.h>
+
+#include "reactor.h"
+
+namespace dazeus {
+
+/**
+ * Runs Networks from an Asio io_context. The networks are kept in a Reactor
+ * made by Reactor::create(), whose descriptor the io_context waits on, along
+ * with a timer for the earliest timer of the networks; so the networks are
+ * handled from the thread running the io_context, without a polling thread.
+ * The io_context must be run from one thread only.
+ *
+ * Asio itself isn't included here: the reactor is made with the descriptor
+ * and timer types of Boost.Asio or of standalone Asio, for instance:
+ *
+ *   boost::asio::io_context io;
+ *   dazeus::AsioReactor<boost::asio::posix::stream_descriptor,
+ *                       boost::asio::steady_timer> reactor(io);
+ *   reactor.add(&network);
+ *   network.connectToNetwork();
+ *   io.run();
+ */
+template <typename Descriptor, typename Timer>
+class AsioReactor {
+public:
+	template <typename Context>
+	AsioReactor(Context &context)
+	: reactor_(Reactor::create())
+	, descriptor_(context)
+	, timer_(context)
+	, waiting_(false)
+	{
+		if(!reactor_)
+			return;
+		descriptor_.assign(reactor_->descriptor());
+		reactor_->setWakeupCallback([this]() { this->arm(); });
+	}
+
+	~AsioReactor()
+	{
+		if(!reactor_)
+			return;
+		reactor_->setWakeupCallback(std::function<void()>());
+		timer_.cancel();
+		descriptor_.cancel();
+		// the Reactor closes it
+		descriptor_.release();
+	}
+
+	bool valid() const { return reactor_ != 0; }
+	void add(Network *n) { reactor_->add(n); arm(); }
+	void remove(Network *n) { reactor_->remove(n); }
+	Reactor &reactor() { return *reactor_; }
+
+private:
+	// explicitly disable copy constructor
+	AsioReactor(const AsioReactor&);
+	void operator=(const AsioReactor&);
+
+	// the handlers; when aborted, the reactor may be gone already
+	struct Readable {
+		AsioReactor *reactor;
+		template <typename Error>
+		void operator()(const Error &e) const {
+			if(e)
+				return;
+			reactor->waiting_ = false;
+			reactor->handle();
+		}
+	};
+	struct Expired {
+		AsioReactor *reactor;
+		template <typename Error>
+		void operator()(const Error &e) const {
+			if(!e)
+				reactor->handle();
+		}
+	};
+
+	void handle()
+	{
+		reactor_->runOnce(0);
+		arm();
+	}
+
+	// wait for the descriptor of the reactor, and for the earliest timer
+	void arm()
+	{
+		reactor_->flush();
+		if(!waiting_) {
+			waiting_ = true;
+			Readable r = {this};
+			descriptor_.async_wait(Descriptor::wait_read, r);
+		}
+		long wait = reactor_->timeout();
+		// Asio only wakes up when the descriptor becomes readable, so
+		// events that runOnce() left are handled right away
+		struct pollfd p = {reactor_->descriptor(), POLLIN, 0};
+		if(poll(&p, 1, 0) > 0)
+			wait = 0;
+		if(wait < 0) {
+			timer_.cancel();
+			return;
+		}
+		timer_.expires_after(std::chrono::milliseconds(wait));
+		Expired e = {this};
+		timer_.async_wait(e);
+	}
+
+	std::unique_ptr<Reactor> reactor_;
+	Descriptor descriptor_;
+	Timer timer_;
+	bool waiting_;
+};
+
+}
+
+#endif
+
+#endif
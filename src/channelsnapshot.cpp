@@ -0,0 +1,391 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "channelsnapshot.h"
+#include "logger.h"
+
+#define SNAPSHOT_MAGIC 0x53435a44 // "DZCS"
+#define SNAPSHOT_VERSION 1
+// the header takes a page, so the mapping of the records can be synced
+#define HEADER_SIZE 4096
+#define RECORD_HEADER_SIZE 8
+#define INITIAL_CAPACITY 65536
+// files smaller than this are never compacted
+#define COMPACT_MIN 262144
+#define CHANNEL_RECORD 1
+#define ERASE_RECORD 2
+
+static dazeus::LogCategory snapshotLog("network.snapshot");
+
+namespace dazeus {
+
+struct ChannelSnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t length; // of the committed records
+};
+
+}
+
+static size_t stringSize(const std::string &s)
+{
+	return 4 + s.size();
+}
+
+static char *putString(char *p, const std::string &s)
+{
+	uint32_t length = s.size();
+	memcpy(p, &length, 4);
+	memcpy(p + 4, s.data(), length);
+	return p + 4 + length;
+}
+
+static bool getString(const char *&p, const char *end, std::string &s)
+{
+	uint32_t length;
+	if(end - p < 4)
+		return false;
+	memcpy(&length, p, 4);
+	if((uint64_t)(end - p - 4) < length)
+		return false;
+	s.assign(p + 4, length);
+	p += 4 + length;
+	return true;
+}
+
+/**
+ * Read the size and kind of the record at p, and the network and channel
+ * it is about. Returns false if there is no complete record.
+ */
+static bool getRecord(const char *p, uint64_t available, uint32_t &size, uint32_t &kind,
+	std::string &network, std::string &channel)
+{
+	if(available < RECORD_HEADER_SIZE)
+		return false;
+	memcpy(&size, p, 4);
+	memcpy(&kind, p + 4, 4);
+	if(size < RECORD_HEADER_SIZE || size > available)
+		return false;
+	const char *q = p + RECORD_HEADER_SIZE;
+	return getString(q, p + size, network) && getString(q, p + size, channel);
+}
+
+dazeus::ChannelSnapshot::ChannelSnapshot()
+: path_()
+, fd_(-1)
+, header_(0)
+, data_(0)
+, capacity_(0)
+, length_(0)
+, live_(0)
+, index_()
+, interval_(10)
+{
+}
+
+dazeus::ChannelSnapshot::~ChannelSnapshot()
+{
+	close();
+}
+
+/**
+ * Open a snapshot file, creating it if it doesn't exist, and read which
+ * channels it has. Returns false, and sets the error if one is given, if
+ * it can't be opened or isn't a snapshot.
+ */
+bool dazeus::ChannelSnapshot::open(const std::string &path, std::string *error)
+{
+	close();
+	fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+	struct stat st;
+	if(fd_ < 0 || fstat(fd_, &st) != 0) {
+		if(error)
+			*error = strerror(errno);
+		close();
+		return false;
+	}
+	bool created = st.st_size == 0;
+	if(created && ftruncate(fd_, HEADER_SIZE + INITIAL_CAPACITY) != 0) {
+		if(error)
+			*error = strerror(errno);
+		close();
+		return false;
+	}
+	if(!created && st.st_size < HEADER_SIZE + RECORD_HEADER_SIZE) {
+		if(error)
+			*error = "Not a channel snapshot";
+		close();
+		return false;
+	}
+	if(!map(created ? INITIAL_CAPACITY : st.st_size - HEADER_SIZE)) {
+		if(error)
+			*error = strerror(errno);
+		close();
+		return false;
+	}
+	if(created) {
+		header_->magic = SNAPSHOT_MAGIC;
+		header_->version = SNAPSHOT_VERSION;
+		header_->length = 0;
+	} else if(header_->magic != SNAPSHOT_MAGIC || header_->version != SNAPSHOT_VERSION) {
+		if(error)
+			*error = "Not a channel snapshot";
+		close();
+		return false;
+	}
+	path_ = path;
+
+	uint64_t committed = header_->length < capacity_ ? header_->length : capacity_;
+	uint32_t size, kind;
+	std::string network, channel;
+	while(length_ < committed && getRecord(data_ + length_, committed - length_, size, kind, network, channel)) {
+		index(length_, size);
+		length_ += size;
+	}
+	if(length_ != header_->length) {
+		log(snapshotLog, WarningLevel, "Snapshot has a damaged record, ignoring the rest",
+			{{"path", path}, {"offset", std::to_string(length_)}});
+		header_->length = length_;
+	}
+	return true;
+}
+
+void dazeus::ChannelSnapshot::close()
+{
+	if(header_) {
+		sync();
+		munmap(header_, HEADER_SIZE + capacity_);
+		header_ = 0;
+		data_ = 0;
+	}
+	if(fd_ >= 0) {
+		::close(fd_);
+		fd_ = -1;
+	}
+	capacity_ = length_ = live_ = 0;
+	index_.clear();
+}
+
+bool dazeus::ChannelSnapshot::map(uint64_t capacity)
+{
+	void *m = mmap(NULL, HEADER_SIZE + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if(m == MAP_FAILED)
+		return false;
+	if(header_)
+		munmap(header_, HEADER_SIZE + capacity_);
+	header_ = (ChannelSnapshotHeader*)m;
+	data_ = (char*)m + HEADER_SIZE;
+	capacity_ = capacity;
+	return true;
+}
+
+/**
+ * Make room for a record of the given size, growing the file if needed.
+ */
+bool dazeus::ChannelSnapshot::reserve(uint64_t size)
+{
+	if(length_ + size <= capacity_)
+		return true;
+	uint64_t capacity = capacity_;
+	while(capacity < length_ + size)
+		capacity *= 2;
+	if(ftruncate(fd_, HEADER_SIZE + capacity) != 0 || !map(capacity)) {
+		log(snapshotLog, ErrorLevel, "Couldn't grow snapshot", {{"path", path_}, {"error", strerror(errno)}});
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Account for the record at the given offset, which replaces any earlier
+ * record of its channel.
+ */
+void dazeus::ChannelSnapshot::index(uint64_t offset, uint32_t size)
+{
+	uint32_t kind, oldSize;
+	std::string network, channel;
+	getRecord(data_ + offset, size, size, kind, network, channel);
+	std::map<std::string,uint64_t> &channels = index_[network];
+	std::map<std::string,uint64_t>::iterator it = channels.find(channel);
+	if(it != channels.end()) {
+		memcpy(&oldSize, data_ + it->second, 4);
+		live_ -= oldSize;
+	}
+	if(kind == CHANNEL_RECORD) {
+		channels[channel] = offset;
+		live_ += size;
+	} else if(it != channels.end()) {
+		channels.erase(it);
+	}
+	if(channels.empty())
+		index_.erase(network);
+}
+
+/**
+ * Save the state of a channel. It is written to the file immediately, but
+ * only committed by the next sync().
+ */
+void dazeus::ChannelSnapshot::write(const std::string &network, const std::string &channel,
+	const std::string &topic, const std::vector<std::string> &users)
+{
+	if(!header_)
+		return;
+	uint64_t size = RECORD_HEADER_SIZE + stringSize(network) + stringSize(channel) + stringSize(topic) + 4;
+	for(size_t i = 0; i < users.size(); ++i) {
+		size += stringSize(users[i]);
+	}
+	if(size > UINT32_MAX || !reserve(size))
+		return;
+	char *p = data_ + length_;
+	uint32_t header[2] = { (uint32_t)size, CHANNEL_RECORD };
+	memcpy(p, header, RECORD_HEADER_SIZE);
+	p = putString(p + RECORD_HEADER_SIZE, network);
+	p = putString(p, channel);
+	p = putString(p, topic);
+	uint32_t count = users.size();
+	memcpy(p, &count, 4);
+	p += 4;
+	for(size_t i = 0; i < users.size(); ++i) {
+		p = putString(p, users[i]);
+	}
+	index(length_, size);
+	length_ += size;
+}
+
+/**
+ * Forget a channel, such as one that was left.
+ */
+void dazeus::ChannelSnapshot::erase(const std::string &network, const std::string &channel)
+{
+	std::map<std::string,std::map<std::string,uint64_t> >::const_iterator it = index_.find(network);
+	if(!header_ || it == index_.end() || it->second.count(channel) == 0)
+		return;
+	uint64_t size = RECORD_HEADER_SIZE + stringSize(network) + stringSize(channel);
+	if(!reserve(size))
+		return;
+	uint32_t header[2] = { (uint32_t)size, ERASE_RECORD };
+	memcpy(data_ + length_, header, RECORD_HEADER_SIZE);
+	putString(putString(data_ + length_ + RECORD_HEADER_SIZE, network), channel);
+	index(length_, size);
+	length_ += size;
+}
+
+/**
+ * Commit the records written since the last sync, once they are on disk,
+ * and compact the file if most of it is replaced records.
+ */
+void dazeus::ChannelSnapshot::sync()
+{
+	if(!header_ || header_->length == length_)
+		return;
+	msync(header_, HEADER_SIZE + length_, MS_SYNC);
+	header_->length = length_;
+	msync(header_, HEADER_SIZE, MS_ASYNC);
+	if(length_ > COMPACT_MIN && length_ > live_ * 4)
+		compact();
+}
+
+/**
+ * Write the live records to a new file and rename it over the snapshot.
+ */
+void dazeus::ChannelSnapshot::compact()
+{
+	std::string tmp = path_ + ".tmp";
+	uint64_t capacity = INITIAL_CAPACITY;
+	while(capacity < live_)
+		capacity *= 2;
+	int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	void *m = MAP_FAILED;
+	if(fd >= 0 && ftruncate(fd, HEADER_SIZE + capacity) == 0)
+		m = mmap(NULL, HEADER_SIZE + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(m == MAP_FAILED) {
+		log(snapshotLog, WarningLevel, "Couldn't compact snapshot", {{"path", tmp}, {"error", strerror(errno)}});
+		if(fd >= 0) {
+			::close(fd);
+			unlink(tmp.c_str());
+		}
+		return;
+	}
+
+	char *data = (char*)m + HEADER_SIZE;
+	uint64_t length = 0;
+	std::map<std::string,std::map<std::string,uint64_t> >::iterator nit;
+	std::map<std::string,uint64_t>::iterator cit;
+	for(nit = index_.begin(); nit != index_.end(); ++nit) {
+		for(cit = nit->second.begin(); cit != nit->second.end(); ++cit) {
+			uint32_t size;
+			memcpy(&size, data_ + cit->second, 4);
+			memcpy(data + length, data_ + cit->second, size);
+			cit->second = length;
+			length += size;
+		}
+	}
+	ChannelSnapshotHeader *header = new(m) ChannelSnapshotHeader();
+	header->magic = SNAPSHOT_MAGIC;
+	header->version = SNAPSHOT_VERSION;
+	header->length = length;
+	msync(m, HEADER_SIZE + length, MS_SYNC);
+	if(rename(tmp.c_str(), path_.c_str()) != 0) {
+		log(snapshotLog, WarningLevel, "Couldn't replace snapshot", {{"path", path_}, {"error", strerror(errno)}});
+	}
+
+	// the index now points into the new file, so use it even if the rename
+	// failed; the old file stays valid, if larger
+	munmap(header_, HEADER_SIZE + capacity_);
+	::close(fd_);
+	fd_ = fd;
+	header_ = header;
+	data_ = data;
+	capacity_ = capacity;
+	length_ = length;
+	live_ = length;
+}
+
+/**
+ * Add the channels of a network in the snapshot to the given maps.
+ */
+void dazeus::ChannelSnapshot::restore(const std::string &network,
+	std::map<std::string,std::vector<std::string> > &users,
+	std::map<std::string,std::string> &topics) const
+{
+	std::map<std::string,std::map<std::string,uint64_t> >::const_iterator nit = index_.find(network);
+	if(nit == index_.end())
+		return;
+	std::map<std::string,uint64_t>::const_iterator cit;
+	for(cit = nit->second.begin(); cit != nit->second.end(); ++cit) {
+		uint32_t size, kind, count;
+		std::string net, channel, topic;
+		const char *p = data_ + cit->second;
+		getRecord(p, length_ - cit->second, size, kind, net, channel);
+		const char *end = p + size;
+		p += RECORD_HEADER_SIZE + stringSize(net) + stringSize(channel);
+		if(!getString(p, end, topic) || end - p < 4)
+			continue;
+		memcpy(&count, p, 4);
+		p += 4;
+		// every member takes at least its length, so a corrupt count
+		// can't make the vector huge
+		if(count > (uint64_t)(end - p) / 4)
+			continue;
+		std::vector<std::string> &members = users[channel];
+		members.resize(count);
+		for(uint32_t i = 0; i < count; ++i) {
+			if(!getString(p, end, members[i])) {
+				members.resize(i);
+				break;
+			}
+		}
+		if(!topic.empty())
+			topics[channel] = topic;
+	}
+}
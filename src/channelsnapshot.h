@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef CHANNELSNAPSHOT_H
+#define CHANNELSNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include <stdint.h>
+
+namespace dazeus {
+
+struct ChannelSnapshotHeader;
+
+/**
+ * Keeps the channels of networks, with their topics and members, in a
+ * memory-mapped file, so a restarted process knows them again before it has
+ * rejoined. Give it to networks with Network::setSnapshot(); they save the
+ * channels that changed every interval() seconds, and restore theirs when
+ * the snapshot is set.
+ *
+ * The file is a log: every save appends a record with the whole state of a
+ * changed channel, or one saying a channel was left, and commits them by
+ * storing the new length in the header. Records past the committed length,
+ * such as ones torn by a crash, are ignored. Once most of the file is
+ * records that were replaced, it is rewritten with only the live ones and
+ * renamed over the old one.
+ *
+ * A snapshot can be shared by networks with different names, but must only
+ * be used from one thread, and must outlive the networks it is given to.
+ */
+class ChannelSnapshot {
+public:
+	ChannelSnapshot();
+	~ChannelSnapshot();
+
+	bool open(const std::string &path, std::string *error = 0);
+	void close();
+	bool isOpen() const { return header_ != 0; }
+
+	time_t interval() const { return interval_; }
+	void setInterval(time_t seconds) { interval_ = seconds; }
+
+	void write(const std::string &network, const std::string &channel,
+		const std::string &topic, const std::vector<std::string> &users);
+	void erase(const std::string &network, const std::string &channel);
+	void sync();
+	void restore(const std::string &network, std::map<std::string,std::vector<std::string> > &users,
+		std::map<std::string,std::string> &topics) const;
+
+	uint64_t size() const { return length_; }
+	uint64_t liveBytes() const { return live_; }
+
+private:
+	// explicitly disable copy constructor
+	ChannelSnapshot(const ChannelSnapshot&);
+	void operator=(const ChannelSnapshot&);
+
+	bool map(uint64_t capacity);
+	bool reserve(uint64_t size);
+	void index(uint64_t offset, uint32_t size);
+	void compact();
+
+	std::string path_;
+	int fd_;
+	ChannelSnapshotHeader *header_;
+	char *data_;
+	uint64_t capacity_;
+	// records up to length_ are written, but only committed up to the
+	// length in the header
+	uint64_t length_;
+	uint64_t live_;
+	// offset of the newest record of every channel, by network
+	std::map<std::string,std::map<std::string,uint64_t> > index_;
+	time_t interval_;
+};
+
+}
+
+#endif
@@ -12,7 +12,7 @@
 namespace dazeus {
 
 struct ServerConfig {
-  ServerConfig() : port(6667), priority(5), ssl(false), ssl_verify(true) {}
+  ServerConfig() : port(6667), priority(5), ssl(false), ssl_verify(true), ktls(false) {}
 
   std::string toString() const;
 
@@ -21,11 +21,15 @@ struct ServerConfig {
   uint8_t priority;
   bool ssl;
   bool ssl_verify;
+  // offload TLS records to the kernel once connected, if it supports that
+  bool ktls;
 };
 
 struct NetworkConfig {
   NetworkConfig() : nickName("DaZeus"), userName("dazeus"),
-      fullName("DaZeus"), autoConnect(false), connectTimeout(10), pongTimeout(30) {}
+      fullName("DaZeus"), autoConnect(false), connectTimeout(10), pongTimeout(30),
+      handoff(false), splitUserEvents(false), lazyMembershipThreshold(0),
+      poolSize(1) {}
 
   std::string name;
   std::string displayName;
@@ -37,6 +41,17 @@ struct NetworkConfig {
   bool autoConnect;
   time_t connectTimeout;
   time_t pongTimeout;
+  // carry plain connections through a relay, so they can be handed to
+  // another process with Network::handoff()
+  bool handoff;
+  // also deliver the QUIT and JOIN of every user in a NETSPLIT or NETJOIN
+  bool splitUserEvents;
+  // channels whose NAMES reply lists more users than this get the
+  // lazy membership policy; 0 never does
+  unsigned int lazyMembershipThreshold;
+  // connections to keep to the network, to send more than one connection
+  // may; see ConnectionPool
+  unsigned int poolSize;
 };
 
 }
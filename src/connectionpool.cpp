@@ -0,0 +1,462 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <sstream>
+
+#include "connectionpool.h"
+#include "server.h"
+#include "utils.h"
+#include "logger.h"
+
+// how long a message is remembered, to recognize the copies of lagging
+// connections
+#define SEEN_WINDOW std::chrono::seconds(30)
+// most messages remembered at once
+#define SEEN_LIMIT 16384
+// longest delay before a failed member reconnects, in seconds
+#define MAX_RETRY_DELAY 60
+// alternative nicks a member tries when its nick is taken, before it gives
+// up and reconnects after the longest delay
+#define MAX_NICK_TRIES 5
+
+static dazeus::LogCategory poolLog("network.pool");
+
+static bool isMessage(const std::string &event)
+{
+	return event == "PRIVMSG" || event == "NOTICE" || event == "ACTION"
+	    || event == "CTCP" || event == "CTCP_REP";
+}
+
+static bool isChannel(const std::string &target)
+{
+	return !target.empty() && (target[0] == '#' || target[0] == '&'
+	    || target[0] == '+' || target[0] == '!');
+}
+
+static uint64_t fnv(uint64_t hash, const std::string &s)
+{
+	for(size_t i = 0; i < s.size(); ++i) {
+		hash = (hash ^ (unsigned char)s[i]) * 1099511628211ULL;
+	}
+	// a separator, so "ab" "c" differs from "a" "bc"
+	return (hash ^ 0xff) * 1099511628211ULL;
+}
+
+// the weight of a connection for a target; the finalizer of splitmix64
+static uint64_t weight(uint64_t target, size_t slot)
+{
+	uint64_t w = target + (slot + 1) * 0x9e3779b97f4a7c15ULL;
+	w = (w ^ (w >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	w = (w ^ (w >> 27)) * 0x94d049bb133111ebULL;
+	return w ^ (w >> 31);
+}
+
+dazeus::ConnectionPool::ConnectionPool(Network *n)
+: network_(n)
+, members_()
+, registered_(0)
+, graveyard_()
+, seen_()
+, seenOrder_()
+{
+}
+
+dazeus::ConnectionPool::~ConnectionPool()
+{
+	stop();
+	bury();
+}
+
+/**
+ * Connect the members, as many as NetworkConfig::poolSize asks for besides
+ * the active server.
+ */
+void dazeus::ConnectionPool::start()
+{
+	stop();
+	unsigned int size = network_->config().poolSize;
+	for(unsigned int i = 1; i < size; ++i) {
+		std::stringstream nick;
+		nick << network_->config().nickName << i;
+		Member m;
+		m.baseNick = nick.str();
+		m.nick = m.baseNick;
+		members_.push_back(m);
+	}
+	for(size_t i = 0; i < members_.size(); ++i) {
+		connect(i);
+	}
+}
+
+/**
+ * Disconnect all members. Their servers are deleted the next time the pool
+ * is used from the event loop, as one of them may be on the stack.
+ */
+void dazeus::ConnectionPool::stop(Network::DisconnectReason reason)
+{
+	std::vector<Member>::iterator it;
+	for(it = members_.begin(); it != members_.end(); ++it) {
+		if(it->server) {
+			it->server->disconnectFromServer(reason);
+			graveyard_.push_back(it->server);
+		}
+	}
+	members_.clear();
+	registered_ = 0;
+	seen_.clear();
+	seenOrder_.clear();
+}
+
+void dazeus::ConnectionPool::connect(size_t i)
+{
+	Member &m = members_[i];
+	const NetworkConfig &config = network_->config();
+	m.server = new Server(network_->bestServer(), network_);
+	m.server->setPool(this, m.nick);
+	m.registered = false;
+	m.failed = false;
+	m.nickTries = 0;
+	m.deadline = config.connectTimeout > 0 ? time(NULL) + config.connectTimeout : 0;
+	m.channels.clear();
+	log(poolLog, InfoLevel, "Connecting pool member",
+		{{"network", network_->networkName()}, {"nick", m.nick}, {"server", Server::toString(m.server)}});
+	m.server->connectToServer();
+	if(i < members_.size() && members_[i].failed)
+		reap(i);
+}
+
+/**
+ * Take away the server of a failed member, flag it and plan a reconnect.
+ */
+void dazeus::ConnectionPool::reap(size_t i)
+{
+	Member &m = members_[i];
+	log(poolLog, WarningLevel, "Pool member failed",
+		{{"network", network_->networkName()}, {"nick", m.nick}, {"server", Server::toString(m.server)}});
+	network_->flagUndesirableServer(m.server->config());
+	// one second after the first failure, doubling after every next one
+	int undesirability = network_->serverUndesirability(m.server->config());
+	int delay = undesirability > 6 ? MAX_RETRY_DELAY : 1 << (undesirability - 1);
+	retire(i, time(NULL) + (delay < MAX_RETRY_DELAY ? delay : MAX_RETRY_DELAY));
+}
+
+/**
+ * Take away the server of a member, and plan a reconnect at the given time.
+ */
+void dazeus::ConnectionPool::retire(size_t i, time_t retryAt)
+{
+	Member &m = members_[i];
+	m.retryAt = retryAt;
+	graveyard_.push_back(m.server);
+	m.server = 0;
+	if(m.registered)
+		--registered_;
+	m.registered = false;
+	m.failed = false;
+	m.channels.clear();
+}
+
+void dazeus::ConnectionPool::bury()
+{
+	std::vector<Server*>::iterator it;
+	for(it = graveyard_.begin(); it != graveyard_.end(); ++it) {
+		delete *it;
+	}
+	graveyard_.clear();
+}
+
+/**
+ * The connection of a member failed; called by its Server.
+ */
+void dazeus::ConnectionPool::failed(Server *s)
+{
+	int i = slot(s);
+	if(i > 0)
+		members_[i - 1].failed = true;
+}
+
+/**
+ * The number of a connection: 0 for the active server, 1 and up for the
+ * members, -1 if it isn't one of them.
+ */
+int dazeus::ConnectionPool::slot(Server *s) const
+{
+	if(s == network_->activeServer())
+		return 0;
+	for(size_t i = 0; i < members_.size(); ++i) {
+		if(members_[i].server == s)
+			return i + 1;
+	}
+	return -1;
+}
+
+bool dazeus::ConnectionPool::isMemberNick(const std::string &nick) const
+{
+	std::vector<Member>::const_iterator it;
+	for(it = members_.begin(); it != members_.end(); ++it) {
+		if(it->registered && equals_ci(it->nick, nick))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * The connection to send to the given target over: the active server, or a
+ * registered member that is in the channel. Every connection gets a weight
+ * for the target and the heaviest is chosen, so a member coming or going
+ * moves only its own targets.
+ */
+dazeus::Server *dazeus::ConnectionPool::route(const std::string &target)
+{
+	Server *best = network_->activeServer();
+	if(registered_ == 0)
+		return best;
+	uint64_t key = 14695981039346656037ULL;
+	for(size_t i = 0; i < target.size(); ++i) {
+		key = (key ^ (unsigned char)lowerChar(target[i])) * 1099511628211ULL;
+	}
+	uint64_t bestWeight = weight(key, 0);
+	bool channel = isChannel(target);
+	for(size_t i = 0; i < members_.size(); ++i) {
+		const Member &m = members_[i];
+		if(!m.registered || (channel && !contains_ci(m.channels, target)))
+			continue;
+		uint64_t w = weight(key, i + 1);
+		if(w > bestWeight) {
+			bestWeight = w;
+			best = m.server;
+		}
+	}
+	return best;
+}
+
+void dazeus::ConnectionPool::join(const std::string &channel)
+{
+	std::vector<Member>::iterator it;
+	for(it = members_.begin(); it != members_.end(); ++it) {
+		if(it->registered)
+			it->server->join(channel);
+	}
+}
+
+void dazeus::ConnectionPool::part(const std::string &channel)
+{
+	std::vector<Member>::iterator it;
+	for(it = members_.begin(); it != members_.end(); ++it) {
+		if(it->registered)
+			it->server->part(channel);
+	}
+}
+
+/**
+ * Whether an event received over the given connection is to be delivered:
+ * it isn't something a member did, and if it is a message, it wasn't
+ * delivered from another connection already.
+ */
+bool dazeus::ConnectionPool::firstSeen(Server *s, const std::string &event, const std::string &origin,
+	const std::vector<std::string> &params)
+{
+	if(registered_ == 0)
+		return true;
+	if(isMemberNick(origin))
+		return false;
+	if(!isMessage(event))
+		return true;
+	int i = slot(s);
+	if(i < 0)
+		return false;
+
+	uint64_t hash = fnv(fnv(14695981039346656037ULL, event), origin);
+	std::vector<std::string>::const_iterator it;
+	for(it = params.begin(); it != params.end(); ++it) {
+		hash = fnv(hash, *it);
+	}
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	forget(now);
+	Seen &seen = seen_[hash];
+	if(seen.received.empty())
+		seen.received.resize(members_.size() + 1, 0);
+	seen.last = now;
+	seenOrder_.push_back(std::make_pair(hash, now));
+	if(++seen.received[i] <= seen.delivered)
+		return false;
+	++seen.delivered;
+	return true;
+}
+
+/**
+ * Forget the messages that were last received too long ago.
+ */
+void dazeus::ConnectionPool::forget(std::chrono::steady_clock::time_point now)
+{
+	while(!seenOrder_.empty() && (seenOrder_.size() > SEEN_LIMIT || now - seenOrder_.front().second > SEEN_WINDOW)) {
+		std::unordered_map<uint64_t,Seen>::iterator it = seen_.find(seenOrder_.front().first);
+		if(it != seen_.end() && it->second.last == seenOrder_.front().second)
+			seen_.erase(it);
+		seenOrder_.pop_front();
+	}
+}
+
+/**
+ * Handle an event received by a member; called by its Server.
+ */
+void dazeus::ConnectionPool::receivedEvent(Server *s, const std::string &event, const std::string &origin,
+	const std::vector<std::string> &params)
+{
+	int i = slot(s);
+	if(i <= 0)
+		return;
+	Member &m = members_[i - 1];
+	if(event == "CONNECT") {
+		m.registered = true;
+		m.deadline = 0;
+		m.pingTimer.reset(std::chrono::steady_clock::now());
+		++registered_;
+		network_->serverIsActuallyOkay(s->config());
+		log(poolLog, InfoLevel, "Pool member registered",
+			{{"network", network_->networkName()}, {"nick", m.nick}});
+		std::vector<std::string> channels = network_->joinedChannels();
+		std::vector<std::string>::const_iterator it;
+		for(it = channels.begin(); it != channels.end(); ++it) {
+			s->join(*it);
+		}
+	} else if(event == "NUMERIC" && !m.registered && !params.empty() && (params[0] == "433" || params[0] == "436")) {
+		nickTaken(i - 1);
+	} else if(event == "JOIN" && !params.empty() && equals_ci(origin, m.nick)) {
+		if(!contains_ci(m.channels, params[0]))
+			m.channels.push_back(params[0]);
+	} else if(event == "PART" && !params.empty() && equals_ci(origin, m.nick)) {
+		erase_ci(m.channels, params[0]);
+	} else if(event == "KICK" && params.size() >= 2 && equals_ci(params[1], m.nick)) {
+		erase_ci(m.channels, params[0]);
+	} else if(m.registered && isMessage(event) && firstSeen(s, event, origin, params)) {
+		if(!params.empty() && equals_ci(params[0], m.nick)) {
+			// sent to the member, so to the network
+			std::vector<std::string> copy(params);
+			copy[0] = network_->nick();
+			network_->slotIrcEvent(event, origin, copy);
+		} else {
+			network_->slotIrcEvent(event, origin, params);
+		}
+	}
+}
+
+/**
+ * Called for every line a member received from its server. Once it is
+ * registered, that shows its connection is alive.
+ */
+void dazeus::ConnectionPool::lineReceived(Server *s, const std::string &command)
+{
+	int i = slot(s);
+	if(i <= 0 || !members_[i - 1].registered || command == "ERROR")
+		return;
+	Member &m = members_[i - 1];
+	m.deadline = 0;
+	if(command != "PONG")
+		m.pingTimer.received(std::chrono::steady_clock::now());
+}
+
+/**
+ * The nick of a member that is registering is taken: try another one. That
+ * isn't the fault of the server, so it isn't flagged, and if no nick is
+ * free the member tries again later with its own nick.
+ */
+void dazeus::ConnectionPool::nickTaken(size_t i)
+{
+	Member &m = members_[i];
+	if(++m.nickTries > MAX_NICK_TRIES) {
+		log(poolLog, WarningLevel, "No free nick for pool member",
+			{{"network", network_->networkName()}, {"nick", m.baseNick}});
+		m.server->disconnectFromServer(Network::UnknownReason);
+		m.nick = m.baseNick;
+		retire(i, time(NULL) + MAX_RETRY_DELAY);
+		return;
+	}
+	m.nick = m.baseNick + std::string(m.nickTries, '_');
+	log(poolLog, InfoLevel, "Pool member nick taken, trying another",
+		{{"network", network_->networkName()}, {"nick", m.nick}});
+	m.server->nick(m.nick);
+}
+
+void dazeus::ConnectionPool::addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+	bury();
+	std::vector<Member>::iterator it;
+	for(it = members_.begin(); it != members_.end(); ++it) {
+		if(it->server)
+			it->server->addDescriptors(in_set, out_set, maxfd);
+	}
+}
+
+void dazeus::ConnectionPool::processDescriptors(fd_set *in_set, fd_set *out_set)
+{
+	// a listener may stop the pool while a member is handled
+	for(size_t i = 0; i < members_.size(); ++i) {
+		if(!members_[i].server)
+			continue;
+		members_[i].server->processDescriptors(in_set, out_set);
+		if(i < members_.size() && members_[i].server) {
+			if(!members_[i].server->connected())
+				members_[i].failed = true;
+			if(members_[i].failed)
+				reap(i);
+		}
+	}
+}
+
+/**
+ * Fail the members that didn't register or answer a PING in time, PING the
+ * quiet ones, and reconnect the ones whose delay passed.
+ */
+void dazeus::ConnectionPool::checkTimeouts()
+{
+	bury();
+	time_t now = time(NULL);
+	std::chrono::steady_clock::time_point steadyNow = std::chrono::steady_clock::now();
+	for(size_t i = 0; i < members_.size(); ++i) {
+		Member &m = members_[i];
+		if(!m.server && now >= m.retryAt) {
+			connect(i);
+		} else if(m.server && m.deadline != 0 && now >= m.deadline) {
+			m.server->disconnectFromServer(Network::TimeoutReason);
+			reap(i);
+		} else if(m.server && m.registered && m.deadline == 0 && m.pingTimer.due(steadyNow)) {
+			m.deadline = now + network_->config().pongTimeout;
+			m.server->ping(m.pingTimer.sent(steadyNow));
+		}
+	}
+}
+
+/**
+ * Milliseconds until checkTimeouts() has a member to fail, PING or
+ * reconnect, or -1 if there is none.
+ */
+long dazeus::ConnectionPool::msUntilDue() const
+{
+	time_t now = time(NULL);
+	long wait = -1;
+	std::vector<Member>::const_iterator it;
+	for(it = members_.begin(); it != members_.end(); ++it) {
+		long ms;
+		if(it->server && it->registered && it->deadline == 0) {
+			ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				it->pingTimer.nextDue() - std::chrono::steady_clock::now()).count();
+			if(ms < 0)
+				ms = 0;
+		} else {
+			time_t at;
+			if(!it->server)
+				at = it->retryAt;
+			else if(it->deadline != 0)
+				at = it->deadline;
+			else
+				continue;
+			ms = at > now ? (at - now) * 1000 : 0;
+		}
+		if(wait < 0 || ms < wait)
+			wait = ms;
+	}
+	return wait;
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <ctime>
+#include <sys/select.h>
+#include <stdint.h>
+
+#include "network.h"
+#include "pingtimer.h"
+
+namespace dazeus {
+
+class Server;
+
+/**
+ * Extra connections of a Network, so it can send more lines than the flood
+ * limit of one connection allows; see NetworkConfig::poolSize. The members
+ * of the pool connect once the active server is registered, each with a nick
+ * of its own, and join the channels the network is in. If the nick of a
+ * member is taken, it registers with an alternative one.
+ *
+ * Messages are sent over the active server or one of the members, chosen by
+ * hashing the target, so the messages to one target keep their order. A
+ * channel is only sent to over a member that joined it.
+ *
+ * The channel state is kept from the active server only. Of the members, only
+ * messages are passed on, and a message the network receives over more than
+ * one connection is delivered once. What the members themselves do is not
+ * delivered at all, as the network already echoed it.
+ *
+ * Like the active server, every member is sent PINGs when it's quiet, and
+ * fails if the PONG doesn't come in time. A member that fails is flagged
+ * like a failed active server is, and reconnects to the most desirable
+ * server after a delay that grows with the undesirability of the server it
+ * was on.
+ */
+class ConnectionPool {
+public:
+	ConnectionPool(Network *n);
+	~ConnectionPool();
+
+	void start();
+	void stop(Network::DisconnectReason reason = Network::UnknownReason);
+
+	size_t size() const { return members_.size(); }
+	size_t registered() const { return registered_; }
+	Server *member(size_t i) const { return members_[i].server; }
+	const std::string &nick(size_t i) const { return members_[i].nick; }
+	bool isRegistered(size_t i) const { return members_[i].registered; }
+	Server *route(const std::string &target);
+
+	void join(const std::string &channel);
+	void part(const std::string &channel);
+	bool firstSeen(Server *s, const std::string &event, const std::string &origin,
+		const std::vector<std::string> &params);
+	void receivedEvent(Server *s, const std::string &event, const std::string &origin,
+		const std::vector<std::string> &params);
+	void lineReceived(Server *s, const std::string &command);
+	void failed(Server *s);
+
+	void addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
+	void processDescriptors(fd_set *in_set, fd_set *out_set);
+	void checkTimeouts();
+	long msUntilDue() const;
+
+private:
+	// explicitly disable copy constructor
+	ConnectionPool(const ConnectionPool&);
+	void operator=(const ConnectionPool&);
+
+	struct Member {
+		Member() : server(0), baseNick(), nick(), nickTries(0), registered(false),
+			failed(false), deadline(0), retryAt(0), pingTimer(), channels() {}
+		Server *server;
+		// the nick of the member, and the one it registers with if that
+		// one is taken
+		std::string baseNick;
+		std::string nick;
+		unsigned int nickTries;
+		bool registered;
+		bool failed;
+		// the connect deadline until registered, then the PONG deadline
+		time_t deadline;
+		time_t retryAt;
+		PingTimer pingTimer;
+		// the channels this member joined
+		std::vector<std::string> channels;
+	};
+
+	// how often each connection received a message, and how often it was
+	// delivered; the n-th copy on a connection is the n-th on the others
+	struct Seen {
+		Seen() : delivered(0), received(), last() {}
+		uint32_t delivered;
+		std::vector<uint32_t> received;
+		std::chrono::steady_clock::time_point last;
+	};
+
+	void connect(size_t i);
+	void reap(size_t i);
+	void retire(size_t i, time_t retryAt);
+	void bury();
+	void nickTaken(size_t i);
+	int slot(Server *s) const;
+	bool isMemberNick(const std::string &nick) const;
+	void forget(std::chrono::steady_clock::time_point now);
+
+	Network *network_;
+	std::vector<Member> members_;
+	size_t registered_;
+	// servers of members that are gone, deleted when off the stack
+	std::vector<Server*> graveyard_;
+	std::unordered_map<uint64_t,Seen> seen_;
+	std::deque<std::pair<uint64_t,std::chrono::steady_clock::time_point> > seenOrder_;
+};
+
+}
+
+#endif
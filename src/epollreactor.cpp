@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifdef __linux__
+
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+#include "epollreactor.h"
+#include "logger.h"
+
+// most ready descriptors handled per epoll_wait()
+#define MAX_EVENTS 64
+
+static dazeus::LogCategory reactorLog("network.reactor");
+
+dazeus::EpollReactor::EpollReactor()
+: events_(MAX_EVENTS)
+{
+	descriptor_ = epoll_create1(EPOLL_CLOEXEC);
+	if(descriptor_ < 0)
+		log(reactorLog, ErrorLevel, "Couldn't create epoll instance", {{"error", strerror(errno)}});
+}
+
+dazeus::EpollReactor::~EpollReactor()
+{
+	if(descriptor_ >= 0)
+		close(descriptor_);
+}
+
+bool dazeus::EpollReactor::watch(int fd, unsigned int events)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (events & Readable ? (uint32_t)EPOLLIN : 0) | (events & Writable ? (uint32_t)EPOLLOUT : 0);
+	ev.data.fd = fd;
+	++syscalls_;
+	if(epoll_ctl(descriptor_, EPOLL_CTL_MOD, fd, &ev) == 0)
+		return true;
+	++syscalls_;
+	if(errno == ENOENT && epoll_ctl(descriptor_, EPOLL_CTL_ADD, fd, &ev) == 0)
+		return true;
+	log(reactorLog, ErrorLevel, "Couldn't watch descriptor", {{"error", strerror(errno)}});
+	return false;
+}
+
+void dazeus::EpollReactor::unwatch(int fd)
+{
+	++syscalls_;
+	// fails if the descriptor was closed already, which is fine
+	epoll_ctl(descriptor_, EPOLL_CTL_DEL, fd, NULL);
+}
+
+bool dazeus::EpollReactor::wait(long timeoutMs, std::vector<Ready> &ready)
+{
+	++syscalls_;
+	int n = epoll_wait(descriptor_, &events_[0], events_.size(), timeoutMs > INT_MAX ? INT_MAX : (int)timeoutMs);
+	if(n < 0) {
+		if(errno == EINTR)
+			return true;
+		log(reactorLog, ErrorLevel, "epoll_wait() failed", {{"error", strerror(errno)}});
+		return false;
+	}
+	for(int i = 0; i < n; ++i) {
+		uint32_t e = events_[i].events;
+		Ready r = {events_[i].data.fd, (e & EPOLLIN ? (unsigned int)Readable : 0)
+			| (e & EPOLLOUT ? (unsigned int)Writable : 0)
+			| (e & (EPOLLERR | EPOLLHUP) ? (unsigned int)Failed : 0)};
+		ready.push_back(r);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef EPOLLREACTOR_H
+#define EPOLLREACTOR_H
+
+#ifdef __linux__
+
+#include <vector>
+#include <sys/epoll.h>
+
+#include "reactor.h"
+
+namespace dazeus {
+
+/**
+ * A Reactor that waits for the descriptors with epoll. Every descriptor that
+ * is watched again costs an epoll_ctl(), on top of the epoll_wait() of each
+ * runOnce().
+ *
+ * Only available on Linux.
+ */
+class EpollReactor : public Reactor {
+public:
+	EpollReactor();
+	~EpollReactor();
+
+protected:
+	bool watch(int fd, unsigned int events);
+	void unwatch(int fd);
+	bool wait(long timeoutMs, std::vector<Ready> &ready);
+
+private:
+	std::vector<struct epoll_event> events_;
+};
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <algorithm>
+#include <utility>
+
+#include "eventarena.h"
+
+dazeus::EventArena::EventArena()
+: name_()
+, origin_()
+, params_()
+, spare_()
+{}
+
+void dazeus::EventArena::reset()
+{
+	name_.clear();
+	origin_.clear();
+	truncate(0);
+}
+
+/**
+ * Add an empty parameter and return it. Its buffer is one of an earlier
+ * parameter if there is one.
+ */
+std::string &dazeus::EventArena::push()
+{
+	if(spare_.empty()) {
+		params_.push_back(std::string());
+	} else {
+		// moving a string moves its buffer along
+		params_.push_back(std::move(spare_.back()));
+		spare_.pop_back();
+		params_.back().clear();
+	}
+	return params_.back();
+}
+
+void dazeus::EventArena::insert(size_t pos, const char *s)
+{
+	push(s);
+	std::rotate(params_.begin() + pos, params_.end() - 1, params_.end());
+}
+
+void dazeus::EventArena::erase(size_t pos)
+{
+	std::rotate(params_.begin() + pos, params_.begin() + pos + 1, params_.end());
+	truncate(params_.size() - 1);
+}
+
+/**
+ * Drop the parameters after the first size ones.
+ */
+void dazeus::EventArena::truncate(size_t size)
+{
+	while(params_.size() > size) {
+		spare_.push_back(std::move(params_.back()));
+		params_.pop_back();
+	}
+}
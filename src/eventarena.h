@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef EVENTARENA_H
+#define EVENTARENA_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace dazeus {
+
+/**
+ * Storage for the name, origin and parameters of the event being handled,
+ * reused for the next one. reset() empties it in one go, but keeps the buffers
+ * of its strings and vectors, so once they have grown to fit the largest
+ * events, parsing and dispatching an event allocates nothing.
+ *
+ * Everything in it is only valid until the next reset(); whoever wants to keep
+ * a string or the parameters after that must copy them.
+ */
+class EventArena {
+public:
+	EventArena();
+
+	void reset();
+
+	std::string &name() { return name_; }
+	std::string &origin() { return origin_; }
+	const std::vector<std::string> &params() const { return params_; }
+	std::vector<std::string> &params() { return params_; }
+	size_t size() const { return params_.size(); }
+
+	std::string &push();
+	void push(const char *s, size_t n) { push().assign(s, n); }
+	void push(const char *s) { push(s, strlen(s)); }
+	void push(const std::string &s) { push().assign(s); }
+	void insert(size_t pos, const char *s);
+	void erase(size_t pos);
+	void truncate(size_t size);
+
+private:
+	// explicitly disable copy constructor
+	EventArena(const EventArena&);
+	void operator=(const EventArena&);
+
+	std::string name_;
+	std::string origin_;
+	std::vector<std::string> params_;
+	// cleared strings, kept for their buffers
+	std::vector<std::string> spare_;
+};
+
+}
+
+#endif
@@ -0,0 +1,247 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include "eventcodec.h"
+
+#define TIME_FLAG 0x01
+// size of the hash table of event names, a power of two
+#define NAME_SLOTS 64
+
+#define NAME(s) { s, sizeof(s) - 1 }
+
+struct EventName {
+	const char *name;
+	size_t length;
+};
+
+// IDs of well-known event names; append only, see EventCodec
+static const EventName eventNames[] = {
+	{ 0, 0 }, NAME("CONNECT"), NAME("DISCONNECT"), NAME("ERROR"), NAME("NUMERIC"),
+	NAME("NAMES"), NAME("WHOIS"), NAME("TOPIC"), NAME("JOIN"), NAME("PART"),
+	NAME("KICK"), NAME("QUIT"), NAME("NICK"), NAME("MODE"), NAME("PRIVMSG"),
+	NAME("NOTICE"), NAME("ACTION"), NAME("CTCP"), NAME("CTCP_REP"), NAME("INVITE"),
+	NAME("PONG"), NAME("UMODE"), NAME("PRIVMSG_ME"), NAME("NOTICE_ME"),
+	NAME("ACTION_ME"), NAME("CTCP_ME"), NAME("CTCP_REP_ME")
+};
+static const unsigned int numEventNames = sizeof(eventNames) / sizeof(eventNames[0]);
+
+const unsigned int dazeus::EventCodec::version;
+const uint64_t dazeus::EventCodec::noTime;
+
+static inline size_t varintSize(uint64_t v)
+{
+	if(v < 0x80)
+		return 1;
+	size_t size = 1;
+	while(v >= 0x80) {
+		v >>= 7;
+		++size;
+	}
+	return size;
+}
+
+static inline char *putVarint(char *p, uint64_t v)
+{
+	if(v < 0x80) {
+		*p = (char)v;
+		return p + 1;
+	}
+	while(v >= 0x80) {
+		*p++ = (char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (char)v;
+	return p;
+}
+
+static bool getVarint(const char *&p, const char *end, uint64_t &v)
+{
+	v = 0;
+	for(unsigned int shift = 0; shift < 64 && p < end; shift += 7) {
+		unsigned char c = *p++;
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if(!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static inline size_t stringSize(const std::string &s)
+{
+	return varintSize(s.size()) + s.size();
+}
+
+static inline char *putString(char *p, const std::string &s)
+{
+	p = putVarint(p, s.size());
+	memcpy(p, s.data(), s.size());
+	return p + s.size();
+}
+
+static bool getString(const char *&p, const char *end, dazeus::StringRef &s)
+{
+	uint64_t length;
+	if(!getVarint(p, end, length) || length > (uint64_t)(end - p))
+		return false;
+	s = dazeus::StringRef(p, length);
+	p += length;
+	return true;
+}
+
+void dazeus::EventView::copyTo(IrcEvent &e) const
+{
+	e.event.assign(event.data, event.size);
+	e.origin.assign(origin.data, origin.size);
+	e.params.resize(params.size());
+	for(size_t i = 0; i < params.size(); ++i) {
+		e.params[i].assign(params[i].data, params[i].size);
+	}
+}
+
+static inline unsigned int nameHash(const char *name, size_t length)
+{
+	return (length * 7 + (unsigned char)name[0] * 3 + (unsigned char)name[length - 1]) & (NAME_SLOTS - 1);
+}
+
+struct NameSlots {
+	NameSlots() {
+		memset(ids, 0, sizeof(ids));
+		for(unsigned int i = 1; i < numEventNames; ++i) {
+			unsigned int h = nameHash(eventNames[i].name, eventNames[i].length);
+			while(ids[h])
+				h = (h + 1) & (NAME_SLOTS - 1);
+			ids[h] = i;
+		}
+	}
+	unsigned char ids[NAME_SLOTS];
+};
+
+static_assert(sizeof(eventNames) / sizeof(eventNames[0]) < NAME_SLOTS / 2, "Too many event names for the name slots");
+
+/**
+ * The ID of a well-known event name, or 0 if the name isn't one.
+ */
+unsigned int dazeus::EventCodec::eventId(const std::string &event)
+{
+	static const NameSlots slots;
+	size_t length = event.size();
+	if(length == 0)
+		return 0;
+	for(unsigned int h = nameHash(event.data(), length); slots.ids[h]; h = (h + 1) & (NAME_SLOTS - 1)) {
+		const EventName &e = eventNames[slots.ids[h]];
+		if(e.length == length && memcmp(e.name, event.data(), length) == 0)
+			return slots.ids[h];
+	}
+	return 0;
+}
+
+/**
+ * The name of a well-known event ID, or 0 if there is no event with it.
+ */
+const char *dazeus::EventCodec::eventName(unsigned int id)
+{
+	return id < numEventNames ? eventNames[id].name : 0;
+}
+
+size_t dazeus::EventCodec::encodedSize(const std::string &network, const std::string &event,
+	const std::string &origin, const std::vector<std::string> &params, uint64_t micros)
+{
+	unsigned int id = eventId(event);
+	size_t size = 2 + varintSize(id);
+	if(id == 0)
+		size += stringSize(event);
+	if(micros != noTime)
+		size += varintSize(micros);
+	size += stringSize(network) + stringSize(origin) + varintSize(params.size());
+	for(size_t i = 0; i < params.size(); ++i) {
+		size += stringSize(params[i]);
+	}
+	return size;
+}
+
+/**
+ * Encode an event into the given buffer, which must have room for
+ * encodedSize() bytes. Returns the end of the encoded event.
+ */
+char *dazeus::EventCodec::encode(char *out, const std::string &network, const std::string &event,
+	const std::string &origin, const std::vector<std::string> &params, uint64_t micros)
+{
+	unsigned int id = eventId(event);
+	*out++ = (char)version;
+	*out++ = (char)(micros != noTime ? TIME_FLAG : 0);
+	out = putVarint(out, id);
+	if(id == 0)
+		out = putString(out, event);
+	if(micros != noTime)
+		out = putVarint(out, micros);
+	out = putString(out, network);
+	out = putString(out, origin);
+	out = putVarint(out, params.size());
+	for(size_t i = 0; i < params.size(); ++i) {
+		out = putString(out, params[i]);
+	}
+	return out;
+}
+
+/**
+ * Append an encoded event to a string.
+ */
+void dazeus::EventCodec::encode(std::string &out, const std::string &network, const std::string &event,
+	const std::string &origin, const std::vector<std::string> &params, uint64_t micros)
+{
+	size_t start = out.size();
+	out.resize(start + encodedSize(network, event, origin, params, micros));
+	encode(&out[start], network, event, origin, params, micros);
+}
+
+/**
+ * Decode an event from the start of a buffer, without copying its strings.
+ * Returns false if the buffer doesn't start with a complete event of a
+ * version this decoder knows. If consumed is given, it is set to the size of
+ * the event, so a following one can be decoded.
+ */
+bool dazeus::EventCodec::decode(const char *data, size_t size, EventView &view, size_t *consumed)
+{
+	const char *p = data;
+	const char *end = data + size;
+	if(size < 2)
+		return false;
+	view.version = (unsigned char)*p++;
+	unsigned char flags = *p++;
+	if(view.version == 0 || view.version > version)
+		return false;
+
+	uint64_t id;
+	if(!getVarint(p, end, id))
+		return false;
+	if(id == 0) {
+		if(!getString(p, end, view.event))
+			return false;
+	} else if(id < numEventNames) {
+		view.event = StringRef(eventNames[id].name, eventNames[id].length);
+	} else {
+		return false;
+	}
+
+	view.hasTime = flags & TIME_FLAG;
+	view.micros = 0;
+	if(view.hasTime && !getVarint(p, end, view.micros))
+		return false;
+
+	uint64_t count;
+	if(!getString(p, end, view.network) || !getString(p, end, view.origin) || !getVarint(p, end, count))
+		return false;
+	// every parameter takes at least a byte
+	if(count > (uint64_t)(end - p))
+		return false;
+	view.params.resize(count);
+	for(uint64_t i = 0; i < count; ++i) {
+		if(!getString(p, end, view.params[i]))
+			return false;
+	}
+	if(consumed)
+		*consumed = p - data;
+	return true;
+}
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef EVENTCODEC_H
+#define EVENTCODEC_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+#include "network.h"
+#include "stringref.h"
+
+namespace dazeus {
+
+/**
+ * A decoded event. Its strings point into the buffer it was decoded from,
+ * so it is only valid as long as that is; copyTo() makes a copy that owns
+ * its strings.
+ */
+struct EventView {
+	EventView() : version(0), hasTime(false), micros(0), network(), event(), origin(), params() {}
+
+	void copyTo(IrcEvent &e) const;
+
+	unsigned int version;
+	bool hasTime;
+	uint64_t micros;
+	StringRef network;
+	StringRef event;
+	StringRef origin;
+	std::vector<StringRef> params;
+};
+
+/**
+ * The binary encoding of events used for IPC and archives. An encoded event
+ * is:
+ *
+ *   version    1 byte, the version of the format
+ *   flags      1 byte; bit 0: a timestamp follows the event type
+ *   type       varint; the ID of a well-known event name, or 0 if the name
+ *              follows as a string
+ *   [name]     string, only if type is 0
+ *   [micros]   varint, only if flag bit 0 is set
+ *   network    string
+ *   origin     string
+ *   count      varint, the number of parameters
+ *   params     count strings
+ *
+ * Varints are unsigned LEB128; a string is a varint length and its bytes.
+ * Event IDs are never reused or renumbered: later versions only add names
+ * to the end of the table, and decoders accept every version up to their
+ * own. An event of a newer version than the decoder knows is rejected.
+ */
+class EventCodec {
+public:
+	static const unsigned int version = 1;
+	static const uint64_t noTime = ~(uint64_t)0;
+
+	static size_t encodedSize(const std::string &network, const std::string &event,
+		const std::string &origin, const std::vector<std::string> &params, uint64_t micros = noTime);
+	static char *encode(char *out, const std::string &network, const std::string &event,
+		const std::string &origin, const std::vector<std::string> &params, uint64_t micros = noTime);
+	static void encode(std::string &out, const std::string &network, const std::string &event,
+		const std::string &origin, const std::vector<std::string> &params, uint64_t micros = noTime);
+	static bool decode(const char *data, size_t size, EventView &view, size_t *consumed = 0);
+
+	static unsigned int eventId(const std::string &event);
+	static const char *eventName(unsigned int id);
+};
+
+}
+
+#endif
@@ -0,0 +1,449 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <new>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "eventring.h"
+#include "eventcodec.h"
+
+#define RING_MAGIC 0x52455a44 // "DZER"
+#define RING_VERSION 2
+#define MAX_READERS 32
+// the header takes a page, so the records start page aligned
+#define HEADER_SIZE 4096
+#define RECORD_HEADER_SIZE 16
+#define PADDING_RECORD 1
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics in shared memory must be lock-free");
+
+namespace dazeus {
+
+struct RingReaderSlot {
+	std::atomic<uint64_t> pid; // 0 if the slot is free
+	std::atomic<uint64_t> position;
+	std::atomic<uint64_t> sequence;
+	std::atomic<uint64_t> lost;
+};
+
+/**
+ * Positions are byte offsets since the ring was created; the offset in the
+ * ring is the position modulo the capacity. Records between tail and head
+ * are valid.
+ */
+struct EventRingHeader {
+	std::atomic<uint32_t> magic;
+	uint32_t version;
+	uint64_t capacity;
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+	std::atomic<uint64_t> sequence; // of the last event written
+	RingReaderSlot readers[MAX_READERS];
+};
+
+static_assert(sizeof(EventRingHeader) <= HEADER_SIZE, "Ring header doesn't fit its page");
+
+}
+
+struct RecordHeader {
+	uint32_t size; // of the whole record, padded
+	uint16_t flags;
+	uint16_t reserved;
+	uint64_t sequence;
+};
+
+static_assert(sizeof(RecordHeader) == RECORD_HEADER_SIZE, "Record header has the wrong size");
+
+dazeus::EventRingWriter::EventRingWriter()
+: header_(0)
+, data_(0)
+, mapped_(0)
+, oversized_(0)
+{
+}
+
+dazeus::EventRingWriter::~EventRingWriter()
+{
+	close();
+}
+
+/**
+ * Create a ring in the given file, replacing it if it exists. The capacity
+ * is rounded up to a power of two. Returns false if the file could not be
+ * created or mapped; errno says why.
+ *
+ * The ring is made in a new file that is then renamed over the old one, so
+ * readers still attached to the old ring keep a valid mapping. The old ring
+ * is marked as replaced, so they can see they should open the new one.
+ */
+bool dazeus::EventRingWriter::open(const std::string &path, size_t capacity)
+{
+	close();
+	size_t size = 4096;
+	while(size < capacity)
+		size *= 2;
+
+	std::string tmp = path + ".tmp";
+	int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if(fd < 0)
+		return false;
+	if(ftruncate(fd, HEADER_SIZE + size) != 0) {
+		int error = errno;
+		::close(fd);
+		unlink(tmp.c_str());
+		errno = error;
+		return false;
+	}
+	void *map = mmap(NULL, HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int error = errno;
+	::close(fd);
+	if(map == MAP_FAILED) {
+		unlink(tmp.c_str());
+		errno = error;
+		return false;
+	}
+
+	EventRingHeader *header = new(map) EventRingHeader();
+	header->version = RING_VERSION;
+	header->capacity = size;
+	header->head.store(0, std::memory_order_relaxed);
+	header->tail.store(0, std::memory_order_relaxed);
+	header->sequence.store(0, std::memory_order_relaxed);
+	for(unsigned int i = 0; i < MAX_READERS; ++i) {
+		header->readers[i].pid.store(0, std::memory_order_relaxed);
+	}
+	// readers check the magic last, so they never see a half-made ring
+	header->magic.store(RING_MAGIC, std::memory_order_release);
+
+	int old = ::open(path.c_str(), O_RDWR);
+	if(rename(tmp.c_str(), path.c_str()) != 0) {
+		error = errno;
+		if(old >= 0)
+			::close(old);
+		munmap(map, HEADER_SIZE + size);
+		unlink(tmp.c_str());
+		errno = error;
+		return false;
+	}
+	if(old >= 0) {
+		retire(old);
+		::close(old);
+	}
+
+	mapped_ = HEADER_SIZE + size;
+	header_ = header;
+	data_ = (char*)map + HEADER_SIZE;
+	oversized_ = 0;
+	return true;
+}
+
+/**
+ * Mark the ring in the given file as replaced, if it is one.
+ */
+void dazeus::EventRingWriter::retire(int fd)
+{
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE)
+		return;
+	void *map = mmap(NULL, HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+		return;
+	EventRingHeader *header = (EventRingHeader*)map;
+	uint32_t magic = RING_MAGIC;
+	header->magic.compare_exchange_strong(magic, 0, std::memory_order_release);
+	munmap(map, HEADER_SIZE);
+}
+
+void dazeus::EventRingWriter::close()
+{
+	if(header_) {
+		munmap(header_, mapped_);
+		header_ = 0;
+		data_ = 0;
+	}
+}
+
+void dazeus::EventRingWriter::ircEvent(const std::string &event, const std::string &origin,
+	const std::vector<std::string> &params, Network *n)
+{
+	write(n->config().name, event, origin, params);
+}
+
+/**
+ * Write an event to the ring, overwriting the oldest ones if there is no
+ * room. Events larger than a quarter of the ring are dropped and counted.
+ */
+void dazeus::EventRingWriter::write(const std::string &network, const std::string &event,
+	const std::string &origin, const std::vector<std::string> &params)
+{
+	if(!header_)
+		return;
+	uint64_t capacity = header_->capacity;
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	uint64_t size = RECORD_HEADER_SIZE + EventCodec::encodedSize(network, event, origin, params, micros);
+	size = (size + 7) & ~(uint64_t)7;
+	if(size > capacity / 4) {
+		++oversized_;
+		return;
+	}
+
+	uint64_t head = header_->head.load(std::memory_order_relaxed);
+	uint64_t offset = head & (capacity - 1);
+	// records don't wrap, so the rest of the ring may have to be padded
+	uint64_t padding = capacity - offset < size ? capacity - offset : 0;
+
+	// Free the room, and tell readers before overwriting anything, so a
+	// reader copying a record being overwritten sees it has to skip ahead.
+	uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+	while(head + padding + size - tail > capacity) {
+		const RecordHeader *old = (const RecordHeader*)(data_ + (tail & (capacity - 1)));
+		tail += old->size;
+	}
+	header_->tail.store(tail, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if(padding) {
+		RecordHeader *pad = (RecordHeader*)(data_ + offset);
+		pad->size = padding;
+		pad->flags = PADDING_RECORD;
+		head += padding;
+		offset = 0;
+	}
+
+	uint64_t sequence = header_->sequence.load(std::memory_order_relaxed) + 1;
+	RecordHeader *record = (RecordHeader*)(data_ + offset);
+	record->size = size;
+	record->flags = 0;
+	record->reserved = 0;
+	record->sequence = sequence;
+	EventCodec::encode(data_ + offset + RECORD_HEADER_SIZE, network, event, origin, params, micros);
+
+	header_->sequence.store(sequence, std::memory_order_relaxed);
+	header_->head.store(head + size, std::memory_order_release);
+}
+
+uint64_t dazeus::EventRingWriter::written() const
+{
+	return header_ ? header_->sequence.load(std::memory_order_relaxed) : 0;
+}
+
+/**
+ * The readers of the ring, with how far they are behind and how many events
+ * they lost to overruns.
+ */
+std::vector<dazeus::RingReaderStatus> dazeus::EventRingWriter::readers() const
+{
+	std::vector<RingReaderStatus> res;
+	if(!header_)
+		return res;
+	uint64_t head = header_->head.load(std::memory_order_acquire);
+	uint64_t sequence = header_->sequence.load(std::memory_order_relaxed);
+	for(unsigned int i = 0; i < MAX_READERS; ++i) {
+		const RingReaderSlot &slot = header_->readers[i];
+		RingReaderStatus s;
+		s.pid = slot.pid.load(std::memory_order_acquire);
+		if(s.pid == 0)
+			continue;
+		uint64_t position = slot.position.load(std::memory_order_relaxed);
+		uint64_t readerSequence = slot.sequence.load(std::memory_order_relaxed);
+		s.lagBytes = head > position ? head - position : 0;
+		s.lagEvents = sequence > readerSequence ? sequence - readerSequence : 0;
+		s.lost = slot.lost.load(std::memory_order_relaxed);
+		res.push_back(s);
+	}
+	return res;
+}
+
+dazeus::EventRingReader::EventRingReader()
+: header_(0)
+, data_(0)
+, mapped_(0)
+, slot_(-1)
+, position_(0)
+, sequence_(0)
+, lost_(0)
+, record_()
+{
+}
+
+dazeus::EventRingReader::~EventRingReader()
+{
+	close();
+}
+
+/**
+ * Start reading a ring. Returns false, and sets the error if one is given,
+ * if it can't be opened, isn't a ring, or has no free reader slot.
+ */
+bool dazeus::EventRingReader::open(const std::string &path, std::string *error)
+{
+	close();
+	int fd = ::open(path.c_str(), O_RDWR);
+	if(fd < 0) {
+		if(error)
+			*error = strerror(errno);
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE) {
+		::close(fd);
+		if(error)
+			*error = "Not an event ring";
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(map == MAP_FAILED) {
+		if(error)
+			*error = strerror(errno);
+		return false;
+	}
+	EventRingHeader *header = (EventRingHeader*)map;
+	if(header->magic.load(std::memory_order_acquire) != RING_MAGIC || header->version != RING_VERSION
+	|| HEADER_SIZE + header->capacity != (uint64_t)st.st_size) {
+		munmap(map, st.st_size);
+		if(error)
+			*error = "Not an event ring";
+		return false;
+	}
+
+	// take a free slot, or one of a reader that is gone
+	pid_t pid = getpid();
+	for(int i = 0; i < MAX_READERS && slot_ < 0; ++i) {
+		uint64_t owner = header->readers[i].pid.load(std::memory_order_relaxed);
+		if(owner != 0 && (kill((pid_t)owner, 0) == 0 || errno != ESRCH))
+			continue;
+		if(header->readers[i].pid.compare_exchange_strong(owner, pid))
+			slot_ = i;
+	}
+	if(slot_ < 0) {
+		munmap(map, st.st_size);
+		if(error)
+			*error = "No free reader slot";
+		return false;
+	}
+
+	header_ = header;
+	data_ = (const char*)map + HEADER_SIZE;
+	mapped_ = st.st_size;
+	position_ = header_->head.load(std::memory_order_acquire);
+	sequence_ = header_->sequence.load(std::memory_order_relaxed);
+	lost_ = 0;
+	RingReaderSlot &slot = header_->readers[slot_];
+	slot.position.store(position_, std::memory_order_relaxed);
+	slot.sequence.store(sequence_, std::memory_order_relaxed);
+	slot.lost.store(0, std::memory_order_relaxed);
+	return true;
+}
+
+void dazeus::EventRingReader::close()
+{
+	if(header_) {
+		header_->readers[slot_].pid.store(0, std::memory_order_release);
+		munmap(header_, mapped_);
+		header_ = 0;
+		data_ = 0;
+		slot_ = -1;
+	}
+}
+
+/**
+ * Read the next event, if there is one. Events that were overwritten before
+ * they could be read are skipped, and counted in lost().
+ */
+bool dazeus::EventRingReader::next(RingEvent &e)
+{
+	if(!next(view_, &e.sequence))
+		return false;
+	e.micros = view_.micros;
+	e.network.assign(view_.network.data, view_.network.size);
+	view_.copyTo(e.event);
+	return true;
+}
+
+/**
+ * Read the next event without copying its strings; the view is valid until
+ * the next call.
+ */
+bool dazeus::EventRingReader::next(EventView &view, uint64_t *sequence)
+{
+	if(!header_)
+		return false;
+	uint64_t capacity = header_->capacity;
+	while(true) {
+		uint64_t head = header_->head.load(std::memory_order_acquire);
+		if(position_ == head)
+			return false;
+		uint64_t tail = header_->tail.load(std::memory_order_acquire);
+		if(position_ < tail)
+			position_ = tail;
+
+		uint64_t offset = position_ & (capacity - 1);
+		uint32_t size;
+		memcpy(&size, data_ + offset, 4);
+		bool valid = size >= 8 && size % 8 == 0 && size <= capacity - offset;
+		if(valid) {
+			if(record_.size() < size)
+				record_.resize(size);
+			memcpy(&record_[0], data_ + offset, size);
+		}
+		// if the writer freed the record while it was copied, it may be torn
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(header_->tail.load(std::memory_order_relaxed) > position_)
+			continue;
+		if(!valid) {
+			// can't happen with a working writer; start over at the newest
+			position_ = head;
+			continue;
+		}
+		position_ += size;
+
+		RecordHeader record;
+		memcpy(&record, &record_[0], size < RECORD_HEADER_SIZE ? 8 : RECORD_HEADER_SIZE);
+		if(record.flags & PADDING_RECORD || size < RECORD_HEADER_SIZE)
+			continue;
+		if(!EventCodec::decode(&record_[0] + RECORD_HEADER_SIZE, size - RECORD_HEADER_SIZE, view))
+			continue;
+		if(sequence)
+			*sequence = record.sequence;
+		if(record.sequence > sequence_ + 1)
+			lost_ += record.sequence - sequence_ - 1;
+		sequence_ = record.sequence;
+
+		RingReaderSlot &slot = header_->readers[slot_];
+		slot.position.store(position_, std::memory_order_relaxed);
+		slot.sequence.store(sequence_, std::memory_order_relaxed);
+		slot.lost.store(lost_, std::memory_order_relaxed);
+		return true;
+	}
+}
+
+/**
+ * Whether a writer replaced the ring since it was opened. No events are
+ * written to it anymore; open() the path again to read the new one.
+ */
+bool dazeus::EventRingReader::replaced() const
+{
+	return header_ && header_->magic.load(std::memory_order_acquire) != RING_MAGIC;
+}
+
+/**
+ * Bytes written to the ring that this reader hasn't read yet.
+ */
+uint64_t dazeus::EventRingReader::lagBytes() const
+{
+	if(!header_)
+		return 0;
+	return header_->head.load(std::memory_order_relaxed) - position_;
+}
@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "network.h"
+#include "eventcodec.h"
+
+namespace dazeus {
+
+struct EventRingHeader;
+
+struct RingEvent {
+	RingEvent() : sequence(0), micros(0), network(), event() {}
+
+	uint64_t sequence; // counts from 1 for every event written to the ring
+	uint64_t micros; // wall clock time the event was written
+	std::string network;
+	IrcEvent event;
+};
+
+struct RingReaderStatus {
+	RingReaderStatus() : pid(0), lagBytes(0), lagEvents(0), lost(0) {}
+
+	pid_t pid;
+	uint64_t lagBytes;
+	uint64_t lagEvents;
+	uint64_t lost;
+};
+
+/**
+ * Exports the events of networks to other processes, through a ring buffer
+ * in a memory-mapped file such as one in /dev/shm. Readers in any number of
+ * processes consume them with an EventRingReader, without system calls.
+ *
+ * The writer never waits for readers: when the ring is full, the oldest
+ * events are overwritten, and readers that had not read them yet skip
+ * ahead and count them as lost. Readers report their position in the ring,
+ * so their lag can be seen from the writer.
+ *
+ * Every event is one record: a header with its size and sequence number,
+ * then the event with its time in the EventCodec format. Records are 8-byte
+ * aligned and never wrap; the end of the ring is padded instead.
+ *
+ * Add the writer to networks as a listener. It must only be used from one
+ * thread at a time.
+ */
+class EventRingWriter : public NetworkListener {
+public:
+	EventRingWriter();
+	~EventRingWriter();
+
+	bool open(const std::string &path, size_t capacity);
+	void close();
+	bool isOpen() const { return header_ != 0; }
+
+	virtual void ircEvent(const std::string &event, const std::string &origin,
+		const std::vector<std::string> &params, Network *n);
+	void write(const std::string &network, const std::string &event,
+		const std::string &origin, const std::vector<std::string> &params);
+
+	uint64_t written() const;
+	uint64_t oversized() const { return oversized_; }
+	std::vector<RingReaderStatus> readers() const;
+
+private:
+	// explicitly disable copy constructor
+	EventRingWriter(const EventRingWriter&);
+	void operator=(const EventRingWriter&);
+
+	static void retire(int fd);
+
+	EventRingHeader *header_;
+	char *data_;
+	size_t mapped_;
+	uint64_t oversized_;
+};
+
+/**
+ * Reads the events an EventRingWriter in another process exports. A new
+ * reader starts at the newest event. Every reader takes one of a fixed
+ * number of reader slots in the ring, in which it reports its position.
+ */
+class EventRingReader {
+public:
+	EventRingReader();
+	~EventRingReader();
+
+	bool open(const std::string &path, std::string *error = 0);
+	void close();
+	bool isOpen() const { return header_ != 0; }
+
+	bool next(RingEvent &e);
+	bool next(EventView &view, uint64_t *sequence = 0);
+	uint64_t lost() const { return lost_; }
+	uint64_t lagBytes() const;
+	bool replaced() const;
+
+private:
+	// explicitly disable copy constructor
+	EventRingReader(const EventRingReader&);
+	void operator=(const EventRingReader&);
+
+	EventRingHeader *header_;
+	const char *data_;
+	size_t mapped_;
+	int slot_;
+	uint64_t position_;
+	uint64_t sequence_;
+	uint64_t lost_;
+	std::vector<char> record_;
+	EventView view_;
+};
+
+}
+
+#endif
@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "handoff.h"
+
+#define HANDOFF_MAGIC 0x4f485a44 // "DZHO"
+#define HANDOFF_VERSION 1
+#define HEADER_SIZE 12
+// larger states are refused, they can only come from a broken sender
+#define MAX_STATE_SIZE (64 * 1024 * 1024)
+
+static void putUint(std::string &out, uint32_t v)
+{
+	out.append((const char*)&v, 4);
+}
+
+static void putString(std::string &out, const std::string &s)
+{
+	putUint(out, s.size());
+	out += s;
+}
+
+static bool getUint(const char *&p, const char *end, uint32_t &v)
+{
+	if(end - p < 4)
+		return false;
+	memcpy(&v, p, 4);
+	p += 4;
+	return true;
+}
+
+static bool getString(const char *&p, const char *end, std::string &s)
+{
+	uint32_t length;
+	if(!getUint(p, end, length) || (uint64_t)(end - p) < length)
+		return false;
+	s.assign(p, length);
+	p += length;
+	return true;
+}
+
+static void setError(std::string *error, const std::string &e)
+{
+	if(error)
+		*error = e;
+}
+
+/**
+ * Send the state, and the given socket, to another process. The socket stays
+ * open in this process too. Returns false if the state couldn't be sent.
+ */
+bool dazeus::HandoffState::send(int socket, int fd, std::string *error) const
+{
+	std::string data(HEADER_SIZE, '\0');
+	putString(data, network);
+	putString(data, host);
+	putUint(data, port);
+	putString(data, nick);
+	putUint(data, channels.size());
+	std::map<std::string,std::vector<std::string> >::const_iterator cit;
+	for(cit = channels.begin(); cit != channels.end(); ++cit) {
+		putString(data, cit->first);
+		putUint(data, cit->second.size());
+		for(size_t i = 0; i < cit->second.size(); ++i) {
+			putString(data, cit->second[i]);
+		}
+	}
+	putUint(data, topics.size());
+	std::map<std::string,std::string>::const_iterator tit;
+	for(tit = topics.begin(); tit != topics.end(); ++tit) {
+		putString(data, tit->first);
+		putString(data, tit->second);
+	}
+	putUint(data, identified.size());
+	for(size_t i = 0; i < identified.size(); ++i) {
+		putString(data, identified[i]);
+	}
+	putString(data, inbound);
+	putString(data, outbound);
+	uint32_t header[3] = { HANDOFF_MAGIC, HANDOFF_VERSION, (uint32_t)(data.size() - HEADER_SIZE) };
+	memcpy(&data[0], header, HEADER_SIZE);
+
+	// the socket goes along with the first byte
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov;
+	iov.iov_base = &data[0];
+	iov.iov_len = data.size();
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	size_t sent = 0;
+	while(sent < data.size()) {
+		iov.iov_base = &data[sent];
+		iov.iov_len = data.size() - sent;
+		ssize_t w = sendmsg(socket, &msg, MSG_NOSIGNAL);
+		if(w < 0 && errno == EINTR)
+			continue;
+		if(w <= 0) {
+			setError(error, std::string("Couldn't send handoff: ") + strerror(errno));
+			return false;
+		}
+		sent += w;
+		msg.msg_control = 0;
+		msg.msg_controllen = 0;
+	}
+	return true;
+}
+
+/**
+ * Receive a state sent by send(), and the socket that came with it. Blocks
+ * until it is complete. Returns false if no valid state came.
+ */
+bool dazeus::HandoffState::receive(int socket, int *fd, std::string *error)
+{
+	*fd = -1;
+	char header[HEADER_SIZE] = {0};
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov;
+	iov.iov_base = header;
+	iov.iov_len = HEADER_SIZE;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t r;
+	do {
+		r = recvmsg(socket, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	} while(r < 0 && errno == EINTR);
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	uint32_t h[3];
+	memcpy(h, header, HEADER_SIZE);
+	bool ok = r == HEADER_SIZE && *fd >= 0 && h[0] == HANDOFF_MAGIC;
+	if(ok && (h[1] != HANDOFF_VERSION || h[2] > MAX_STATE_SIZE)) {
+		setError(error, "Unsupported handoff version");
+		close(*fd);
+		*fd = -1;
+		return false;
+	}
+	std::string data(ok ? h[2] : 0, '\0');
+	size_t received = 0;
+	while(ok && received < data.size()) {
+		r = recv(socket, &data[received], data.size() - received, MSG_WAITALL);
+		if(r < 0 && errno == EINTR)
+			continue;
+		ok = r > 0;
+		received += ok ? r : 0;
+	}
+
+	const char *p = data.data();
+	const char *end = p + data.size();
+	uint32_t count = 0, port32 = 0;
+	ok = ok && getString(p, end, network) && getString(p, end, host) && getUint(p, end, port32)
+	  && getString(p, end, nick) && getUint(p, end, count);
+	port = ok ? port32 : 0;
+	channels.clear();
+	for(uint32_t i = 0; ok && i < count; ++i) {
+		std::string channel;
+		uint32_t users;
+		ok = getString(p, end, channel) && getUint(p, end, users) && users <= (uint64_t)(end - p) / 4;
+		std::vector<std::string> &members = channels[channel];
+		members.resize(ok ? users : 0);
+		for(uint32_t j = 0; ok && j < users; ++j) {
+			ok = getString(p, end, members[j]);
+		}
+	}
+	ok = ok && getUint(p, end, count);
+	topics.clear();
+	for(uint32_t i = 0; ok && i < count; ++i) {
+		std::string channel;
+		ok = getString(p, end, channel) && getString(p, end, topics[channel]);
+	}
+	ok = ok && getUint(p, end, count) && count <= (uint64_t)(end - p) / 4;
+	identified.resize(ok ? count : 0);
+	for(uint32_t i = 0; ok && i < count; ++i) {
+		ok = getString(p, end, identified[i]);
+	}
+	ok = ok && getString(p, end, inbound) && getString(p, end, outbound);
+
+	if(!ok) {
+		setError(error, "No valid handoff received");
+		if(*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		return false;
+	}
+	return true;
+}
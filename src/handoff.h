@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+namespace dazeus {
+
+/**
+ * The state of a connected Network, as it is passed to a successor process
+ * with Network::handoff(). It is sent over a Unix socket, with the socket of
+ * the connection attached as SCM_RIGHTS.
+ */
+struct HandoffState {
+	HandoffState() : network(), host(), port(0), nick(), channels(), topics(),
+		identified(), inbound(), outbound() {}
+
+	bool send(int socket, int fd, std::string *error = 0) const;
+	bool receive(int socket, int *fd, std::string *error = 0);
+
+	std::string network;
+	std::string host;
+	uint16_t port;
+	std::string nick;
+	std::map<std::string,std::vector<std::string> > channels;
+	std::map<std::string,std::string> topics;
+	std::vector<std::string> identified;
+	// received from the server, but not parsed yet
+	std::string inbound;
+	// to be sent to the server
+	std::string outbound;
+};
+
+}
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <chrono>
+#include <utility>
+
+#include "listenerpool.h"
+#include "metrics.h"
+#include "utils.h"
+
+// events a worker handles from one shard before it looks at the others again
+#define SHARD_BATCH 64
+
+/**
+ * Start the given number of workers. Every shard holds at most shardCapacity
+ * events; by default there are four shards per worker.
+ */
+dazeus::ListenerPool::ListenerPool(unsigned int threads, size_t shardCapacity,
+	OverflowPolicy policy, unsigned int shards)
+: capacity_(shardCapacity ? shardCapacity : 1)
+, policy_(policy)
+, shards_()
+, numThreads_(threads ? threads : 1)
+, threads_()
+, idleMutex_()
+, workAvailable_()
+, generation_(0)
+, stop_(false)
+, dropped_(0)
+, stolen_(0)
+{
+	if(shards == 0)
+		shards = numThreads_ * 4;
+	for(unsigned int i = 0; i < shards; ++i) {
+		shards_.push_back(new Shard());
+	}
+	for(unsigned int i = 0; i < numThreads_; ++i) {
+		threads_.push_back(std::thread(&ListenerPool::work, this, i));
+	}
+}
+
+/**
+ * Handles the events still queued, then stops the workers.
+ */
+dazeus::ListenerPool::~ListenerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(idleMutex_);
+		stop_ = true;
+	}
+	workAvailable_.notify_all();
+	std::vector<std::thread>::iterator it;
+	for(it = threads_.begin(); it != threads_.end(); ++it) {
+		it->join();
+	}
+	std::vector<Shard*>::iterator sit;
+	for(sit = shards_.begin(); sit != shards_.end(); ++sit) {
+		delete *sit;
+	}
+}
+
+/**
+ * The shard for an event: the one of its channel if the first parameter is
+ * one, otherwise the one of its origin. Channel names are compared case
+ * insensitively.
+ */
+size_t dazeus::ListenerPool::shardFor(Network *n, const std::string &origin, const std::vector<std::string> &params) const
+{
+	const std::string *key = &origin;
+	if(!params.empty() && !params[0].empty()) {
+		char c = params[0][0];
+		if(c == '#' || c == '&' || c == '+' || c == '!')
+			key = &params[0];
+	}
+	// FNV-1a, starting from the network
+	uint64_t hash = 14695981039346656037ULL ^ (uint64_t)(uintptr_t)n;
+	for(size_t i = 0; i < key->size(); ++i) {
+		hash = (hash ^ (unsigned char)lowerChar((*key)[i])) * 1099511628211ULL;
+	}
+	return hash % shards_.size();
+}
+
+/**
+ * Queue an event for a listener. If its shard is full, the overflow policy
+ * decides what happens.
+ */
+void dazeus::ListenerPool::submit(Network *n, NetworkListener *l, const std::string &event,
+	const std::string &origin, const std::vector<std::string> &params)
+{
+	Shard &shard = *shards_[shardFor(n, origin, params)];
+	{
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		if(shard.queue.size() >= capacity_) {
+			switch(policy_) {
+			case BlockPolicy:
+				shard.space.wait(lock, [&]() { return shard.queue.size() < capacity_; });
+				break;
+			case DropNewestPolicy:
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				n->metrics_->listenerDropped();
+				return;
+			case DropOldestPolicy:
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				shard.queue.front().network->metrics_->listenerDropped();
+				done(shard.queue.front().network);
+				shard.queue.pop_front();
+				break;
+			}
+		}
+		Task task;
+		task.network = n;
+		task.listener = l;
+		task.event.event = event;
+		task.event.origin = origin;
+		task.event.params = params;
+		shard.queue.push_back(std::move(task));
+		queued(n);
+	}
+	{
+		std::lock_guard<std::mutex> lock(idleMutex_);
+		++generation_;
+	}
+	workAvailable_.notify_one();
+}
+
+/**
+ * Wait until no events of the given network are queued or being handled.
+ */
+void dazeus::ListenerPool::wait(Network *n)
+{
+	while(n->metrics_->listenerQueueDepth() > 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+/**
+ * The number of events queued in all shards.
+ */
+size_t dazeus::ListenerPool::depth() const
+{
+	size_t depth = 0;
+	std::vector<Shard*>::const_iterator it;
+	for(it = shards_.begin(); it != shards_.end(); ++it) {
+		std::lock_guard<std::mutex> lock((*it)->mutex);
+		depth += (*it)->queue.size();
+	}
+	return depth;
+}
+
+void dazeus::ListenerPool::work(unsigned int worker)
+{
+	size_t numShards = shards_.size();
+	while(true) {
+		uint64_t generation;
+		{
+			std::lock_guard<std::mutex> lock(idleMutex_);
+			generation = generation_;
+		}
+		// first the shards of this worker, then those of the others
+		bool ran = false;
+		for(size_t s = worker; s < numShards; s += numThreads_) {
+			ran = runShard(s) || ran;
+		}
+		for(size_t s = 0; s < numShards; ++s) {
+			if(s % numThreads_ != worker && runShard(s)) {
+				stolen_.fetch_add(1, std::memory_order_relaxed);
+				ran = true;
+			}
+		}
+		if(ran)
+			continue;
+
+		std::unique_lock<std::mutex> lock(idleMutex_);
+		if(stop_ && generation_ == generation)
+			break;
+		// the timeout covers events left in a shard another worker was
+		// handling when this one looked at it
+		workAvailable_.wait_for(lock, std::chrono::milliseconds(10),
+			[&]() { return stop_ || generation_ != generation; });
+	}
+}
+
+/**
+ * Handle events of a shard, unless another worker already is. Returns
+ * whether any were handled.
+ */
+bool dazeus::ListenerPool::runShard(size_t s)
+{
+	Shard &shard = *shards_[s];
+	std::unique_lock<std::mutex> lock(shard.mutex);
+	if(shard.running || shard.queue.empty())
+		return false;
+	shard.running = true;
+	for(unsigned int i = 0; i < SHARD_BATCH && !shard.queue.empty(); ++i) {
+		Task task = std::move(shard.queue.front());
+		shard.queue.pop_front();
+		shard.space.notify_one();
+		lock.unlock();
+		task.listener->ircEvent(task.event.event, task.event.origin, task.event.params, task.network);
+		lock.lock();
+		done(task.network);
+	}
+	shard.running = false;
+	return true;
+}
+
+void dazeus::ListenerPool::queued(Network *n)
+{
+	n->metrics_->listenerQueued();
+}
+
+/**
+ * The event is handled or dropped; the network may be gone after this.
+ */
+void dazeus::ListenerPool::done(Network *n)
+{
+	n->metrics_->listenerDone();
+}
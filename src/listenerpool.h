@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef LISTENERPOOL_H
+#define LISTENERPOOL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "network.h"
+
+namespace dazeus {
+
+/**
+ * Runs NetworkListeners on a pool of worker threads, so a slow listener does
+ * not hold up the event loop of its network. Listeners are added to a network
+ * with Network::addListener(listener, pool).
+ *
+ * Events are put in shards by network and channel, or by network and origin
+ * for events outside of a channel. The events of one shard are handled one
+ * at a time and in order, so a listener sees the events of a channel in the
+ * order they happened, while other channels are handled in parallel. Every
+ * worker has its own shards, and takes over shards of busy workers when it
+ * has nothing to do.
+ *
+ * A listener run by the pool must not use its Network directly, as the
+ * network is not thread-safe; it can have something done on the thread of
+ * the network with Network::post().
+ */
+class ListenerPool {
+public:
+	enum OverflowPolicy {
+		BlockPolicy, // the network waits until there is room
+		DropNewestPolicy, // the new event is dropped
+		DropOldestPolicy // the oldest event in the shard is dropped
+	};
+
+	ListenerPool(unsigned int threads, size_t shardCapacity = 1024,
+		OverflowPolicy policy = BlockPolicy, unsigned int shards = 0);
+	~ListenerPool();
+
+	void submit(Network *n, NetworkListener *l, const std::string &event,
+		const std::string &origin, const std::vector<std::string> &params);
+	void wait(Network *n);
+
+	size_t shardFor(Network *n, const std::string &origin, const std::vector<std::string> &params) const;
+	size_t depth() const;
+	uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+	uint64_t stolen() const { return stolen_.load(std::memory_order_relaxed); }
+
+private:
+	// explicitly disable copy constructor
+	ListenerPool(const ListenerPool&);
+	void operator=(const ListenerPool&);
+
+	struct Task {
+		Network *network;
+		NetworkListener *listener;
+		IrcEvent event;
+	};
+
+	struct Shard {
+		Shard() : mutex(), space(), queue(), running(false) {}
+		std::mutex mutex;
+		std::condition_variable space;
+		std::deque<Task> queue;
+		// whether a worker is handling the events of this shard
+		bool running;
+	};
+
+	void work(unsigned int worker);
+	bool runShard(size_t shard);
+	void queued(Network *n);
+	void done(Network *n);
+
+	size_t capacity_;
+	OverflowPolicy policy_;
+	std::vector<Shard*> shards_;
+	unsigned int numThreads_;
+	std::vector<std::thread> threads_;
+	std::mutex idleMutex_;
+	std::condition_variable workAvailable_;
+	// incremented for every event submitted, so idle workers see new work
+	uint64_t generation_;
+	bool stop_;
+	std::atomic<uint64_t> dropped_;
+	std::atomic<uint64_t> stolen_;
+};
+
+}
+
+#endif
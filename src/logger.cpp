@@ -0,0 +1,250 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <ctime>
+
+#include "logger.h"
+
+dazeus::LogCategory::LogCategory(const char *name, unsigned int perSecond)
+: name_(name)
+, perSecond_(perSecond)
+, window_(-1)
+, count_(0)
+, suppressed_(0)
+, suppressedTotal_(0)
+{}
+
+/**
+ * Whether a message of this category may be logged now. If it may, the number
+ * of messages suppressed since the last one that got through is returned in
+ * suppressed.
+ */
+bool dazeus::LogCategory::admit(uint64_t *suppressed)
+{
+	*suppressed = 0;
+	int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	int64_t window = window_.load(std::memory_order_relaxed);
+	if(window != now && window_.compare_exchange_strong(window, now)) {
+		count_.store(0, std::memory_order_relaxed);
+	}
+	if(count_.fetch_add(1, std::memory_order_relaxed) < perSecond_) {
+		*suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+		return true;
+	}
+	suppressed_.fetch_add(1, std::memory_order_relaxed);
+	suppressedTotal_.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+/**
+ * The capacity is rounded up to a power of two.
+ */
+dazeus::AsyncLogger::AsyncLogger(FILE *out, size_t capacity)
+: out_(out)
+, mask_(0)
+, slots_(0)
+, head_(0)
+, tail_(0)
+, written_(0)
+, enqueued_(0)
+, dropped_(0)
+, stop_(false)
+, mutex_()
+, wakeup_()
+, thread_()
+{
+	size_t size = 2;
+	while(size < capacity)
+		size *= 2;
+	mask_ = size - 1;
+	slots_ = new Slot[size];
+	for(size_t i = 0; i < size; ++i) {
+		slots_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	thread_ = std::thread(&AsyncLogger::drain, this);
+}
+
+dazeus::AsyncLogger::~AsyncLogger()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wakeup_.notify_one();
+	thread_.join();
+	delete [] slots_;
+}
+
+/**
+ * Queue a record for writing. Any number of threads may do this at the same
+ * time; every slot has a sequence number telling writers whether it is free
+ * and the reader whether it is filled, as in Vyukov's bounded queue.
+ */
+void dazeus::AsyncLogger::write(LogRecord &&record)
+{
+	size_t pos = head_.load(std::memory_order_relaxed);
+	Slot *slot;
+	while(true) {
+		slot = &slots_[pos & mask_];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		if(sequence == pos) {
+			if(head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if(sequence < pos) {
+			// full: the reader hasn't emptied this slot yet
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = head_.load(std::memory_order_relaxed);
+		}
+	}
+	slot->record = std::move(record);
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	enqueued_.fetch_add(1, std::memory_order_relaxed);
+	wakeup_.notify_one();
+}
+
+/**
+ * Wait until every record queued so far has been written.
+ */
+void dazeus::AsyncLogger::flush()
+{
+	uint64_t target = enqueued_.load(std::memory_order_relaxed);
+	while(written_.load(std::memory_order_acquire) < target) {
+		wakeup_.notify_one();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void dazeus::AsyncLogger::drain()
+{
+	while(true) {
+		Slot &slot = slots_[tail_ & mask_];
+		if(slot.sequence.load(std::memory_order_acquire) == tail_ + 1) {
+			std::string line = format(slot.record);
+			slot.record = LogRecord();
+			slot.sequence.store(tail_ + mask_ + 1, std::memory_order_release);
+			++tail_;
+			fputs(line.c_str(), out_);
+			if(slots_[tail_ & mask_].sequence.load(std::memory_order_acquire) != tail_ + 1) {
+				// nothing more to write right now
+				fflush(out_);
+			}
+			written_.fetch_add(1, std::memory_order_release);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(mutex_);
+		if(stop_)
+			break;
+		// Writers don't take the mutex before notifying, so a wakeup can
+		// be missed; the timeout bounds how long a record can wait then.
+		wakeup_.wait_for(lock, std::chrono::milliseconds(50));
+	}
+	fflush(out_);
+}
+
+/**
+ * A record as a line of text: time, level, category, message, then the
+ * fields as key=value pairs.
+ */
+std::string dazeus::AsyncLogger::format(const LogRecord &record)
+{
+	char timestamp[32];
+	time_t t = std::chrono::system_clock::to_time_t(record.time);
+	struct tm tm;
+	localtime_r(&t, &tm);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+	std::string line = std::string(timestamp) + " " + logLevelName(record.level) + " "
+		+ record.category + ": " + record.message;
+	LogFields::const_iterator it;
+	for(it = record.fields.begin(); it != record.fields.end(); ++it) {
+		line += " " + it->first + "=";
+		if(it->second.empty() || it->second.find_first_of(" \"=") != std::string::npos) {
+			line += "\"";
+			for(size_t i = 0; i < it->second.size(); ++i) {
+				if(it->second[i] == '"' || it->second[i] == '\\')
+					line += '\\';
+				line += it->second[i];
+			}
+			line += "\"";
+		} else {
+			line += it->second;
+		}
+	}
+	if(record.suppressed > 0) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), " suppressed=%llu", (unsigned long long)record.suppressed);
+		line += buf;
+	}
+	return line + "\n";
+}
+
+static std::atomic<dazeus::Logger*> currentLogger(0);
+static std::atomic<int> currentLevel(dazeus::InfoLevel);
+
+/**
+ * The logger messages go to. Unless another one was set, this is an
+ * AsyncLogger writing to stderr.
+ */
+dazeus::Logger *dazeus::logger()
+{
+	Logger *l = currentLogger.load(std::memory_order_acquire);
+	if(l)
+		return l;
+	static AsyncLogger defaultLogger;
+	return &defaultLogger;
+}
+
+/**
+ * Send log messages somewhere else. The logger is not owned; pass 0 to go back
+ * to the default one.
+ */
+void dazeus::setLogger(Logger *l)
+{
+	currentLogger.store(l, std::memory_order_release);
+}
+
+dazeus::LogLevel dazeus::logLevel()
+{
+	return (LogLevel)currentLevel.load(std::memory_order_relaxed);
+}
+
+/**
+ * Messages below the given level are not logged.
+ */
+void dazeus::setLogLevel(LogLevel level)
+{
+	currentLevel.store(level, std::memory_order_relaxed);
+}
+
+void dazeus::log(LogCategory &category, LogLevel level, const std::string &message, const LogFields &fields)
+{
+	if(level < logLevel())
+		return;
+	uint64_t suppressed;
+	if(!category.admit(&suppressed))
+		return;
+	LogRecord record;
+	record.time = std::chrono::system_clock::now();
+	record.level = level;
+	record.category = category.name();
+	record.message = message;
+	record.fields = fields;
+	record.suppressed = suppressed;
+	logger()->write(std::move(record));
+}
+
+const char *dazeus::logLevelName(LogLevel level)
+{
+	switch(level) {
+	case DebugLevel: return "DEBUG";
+	case InfoLevel: return "INFO";
+	case WarningLevel: return "WARNING";
+	case ErrorLevel: return "ERROR";
+	}
+	return "?";
+}
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <utility>
+#include <cstdio>
+#include <stdint.h>
+
+namespace dazeus {
+
+enum LogLevel {
+	DebugLevel,
+	InfoLevel,
+	WarningLevel,
+	ErrorLevel
+};
+
+typedef std::vector<std::pair<std::string,std::string> > LogFields;
+
+struct LogRecord {
+	LogRecord() : time(), level(InfoLevel), category(""), message(), fields(), suppressed(0) {}
+
+	std::chrono::system_clock::time_point time;
+	LogLevel level;
+	const char *category;
+	std::string message;
+	LogFields fields;
+	// messages of the same category dropped by rate limiting before this one
+	uint64_t suppressed;
+};
+
+/**
+ * A kind of log message, with its own rate limit: at most the given number of
+ * messages per second get through, the rest is counted and reported with the
+ * next message that does. Categories are meant to be static objects at the
+ * place that logs them, and may be used from any thread.
+ */
+class LogCategory {
+public:
+	LogCategory(const char *name, unsigned int perSecond = 20);
+
+	const char *name() const { return name_; }
+	bool admit(uint64_t *suppressed);
+	uint64_t suppressedTotal() const { return suppressedTotal_.load(std::memory_order_relaxed); }
+
+private:
+	// explicitly disable copy constructor
+	LogCategory(const LogCategory&);
+	void operator=(const LogCategory&);
+
+	const char *name_;
+	unsigned int perSecond_;
+	std::atomic<int64_t> window_;
+	std::atomic<unsigned int> count_;
+	std::atomic<uint64_t> suppressed_;
+	std::atomic<uint64_t> suppressedTotal_;
+};
+
+/**
+ * Where log records go. Implementations must accept records from any thread,
+ * and should not block the caller, which is usually an event loop.
+ */
+class Logger {
+public:
+	virtual ~Logger() {}
+	virtual void write(LogRecord &&record) = 0;
+};
+
+/**
+ * The default Logger. Records are put in a bounded lock-free queue and
+ * written to a file by a background thread, so a slow stderr pipe never
+ * blocks the event loop. If the queue is full, records are dropped and
+ * counted instead.
+ */
+class AsyncLogger : public Logger {
+public:
+	AsyncLogger(FILE *out = stderr, size_t capacity = 1024);
+	~AsyncLogger();
+
+	virtual void write(LogRecord &&record);
+	void flush();
+	uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+	static std::string format(const LogRecord &record);
+
+private:
+	// explicitly disable copy constructor
+	AsyncLogger(const AsyncLogger&);
+	void operator=(const AsyncLogger&);
+
+	struct Slot {
+		std::atomic<size_t> sequence;
+		LogRecord record;
+	};
+
+	void drain();
+
+	FILE *out_;
+	size_t mask_;
+	Slot *slots_;
+	std::atomic<size_t> head_; // next slot to write to
+	size_t tail_; // next slot to read from; only used by the thread
+	std::atomic<uint64_t> written_;
+	std::atomic<uint64_t> enqueued_;
+	std::atomic<uint64_t> dropped_;
+	std::atomic<bool> stop_;
+	std::mutex mutex_;
+	std::condition_variable wakeup_;
+	std::thread thread_;
+};
+
+Logger *logger();
+void setLogger(Logger *l);
+LogLevel logLevel();
+void setLogLevel(LogLevel level);
+void log(LogCategory &category, LogLevel level, const std::string &message,
+	const LogFields &fields = LogFields());
+const char *logLevelName(LogLevel level);
+
+}
+
+#endif
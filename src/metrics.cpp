@@ -0,0 +1,310 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <sstream>
+#include <cstdio>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+
+#include "metrics.h"
+
+const uint64_t dazeus::Histogram::bucketBounds[dazeus::Histogram::numBuckets - 1] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500,
+	1000, 2000, 5000, 10000, 20000, 50000,
+	100000, 200000, 500000, 1000000
+};
+
+dazeus::Histogram::Histogram()
+: sum_(0)
+{
+	for(unsigned int i = 0; i < numBuckets; ++i) {
+		buckets_[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void dazeus::Histogram::observe(uint64_t micros)
+{
+	unsigned int i = 0;
+	while(i < numBuckets - 1 && micros > bucketBounds[i])
+		++i;
+	addCounter(buckets_[i], 1);
+	addCounter(sum_, micros);
+}
+
+dazeus::HistogramSnapshot dazeus::Histogram::snapshot() const
+{
+	HistogramSnapshot s;
+	for(unsigned int i = 0; i < numBuckets; ++i) {
+		s.buckets.push_back(buckets_[i].load(std::memory_order_relaxed));
+		s.count += s.buckets.back();
+	}
+	s.sumMicros = sum_.load(std::memory_order_relaxed);
+	return s;
+}
+
+/**
+ * The upper bound of the bucket containing the given quantile, or 0 if
+ * nothing was observed. For the last bucket, which has no upper bound, the
+ * bound of the bucket before it is returned.
+ */
+uint64_t dazeus::HistogramSnapshot::quantileMicros(double q) const
+{
+	if(count == 0)
+		return 0;
+	uint64_t rank = (uint64_t)(q * count);
+	if(rank >= count)
+		rank = count - 1;
+	uint64_t seen = 0;
+	for(unsigned int i = 0; i < buckets.size(); ++i) {
+		seen += buckets[i];
+		if(seen > rank)
+			return Histogram::bucketBounds[i < Histogram::numBuckets - 1 ? i : i - 1];
+	}
+	return Histogram::bucketBounds[Histogram::numBuckets - 2];
+}
+
+static const char *eventTypeNames[dazeus::NetworkMetrics::NumEventTypes] = {
+	"CONNECT", "DISCONNECT", "ERROR", "NUMERIC", "NAMES",
+	"WHOIS", "TOPIC", "JOIN", "PART", "KICK", "QUIT",
+	"NICK", "MODE", "PRIVMSG", "NOTICE", "ACTION",
+	"CTCP", "INVITE", "PONG", "PRIVMSG_ME", "NOTICE_ME",
+	"ACTION_ME", "CTCP_ME", "CTCP_REP_ME", "OTHER"
+};
+
+static const char *reasonNames[dazeus::NetworkMetrics::numReasons] = {
+	"unknown", "shutdown", "configuration_reload", "switching_servers",
+	"error", "timeout", "admin_request"
+};
+
+dazeus::NetworkMetrics::NetworkMetrics()
+: bytesIn_(0)
+, bytesOut_(0)
+, linesIn_(0)
+, linesOut_(0)
+, outboundQueue_(0)
+, connectAttempts_(0)
+, registrations_(0)
+, reconnects_(0)
+, lastPingLag_(0)
+, smoothedPingLag_(0)
+, pingJitter_(0)
+, listenerQueue_(0)
+, listenerDropped_(0)
+{
+	for(unsigned int i = 0; i < NumEventTypes; ++i) {
+		events_[i].store(0, std::memory_order_relaxed);
+	}
+	for(unsigned int i = 0; i < numReasons; ++i) {
+		disconnects_[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+static std::unordered_map<std::string,dazeus::NetworkMetrics::EventType> eventTypeMap()
+{
+	std::unordered_map<std::string,dazeus::NetworkMetrics::EventType> types;
+	for(unsigned int i = 0; i < dazeus::NetworkMetrics::OtherEvent; ++i) {
+		types[eventTypeNames[i]] = (dazeus::NetworkMetrics::EventType)i;
+	}
+	return types;
+}
+
+dazeus::NetworkMetrics::EventType dazeus::NetworkMetrics::eventType(const std::string &event)
+{
+	static const std::unordered_map<std::string,EventType> types = eventTypeMap();
+	std::unordered_map<std::string,EventType>::const_iterator it = types.find(event);
+	return it == types.end() ? OtherEvent : it->second;
+}
+
+const char *dazeus::NetworkMetrics::eventTypeName(EventType type)
+{
+	return eventTypeNames[type];
+}
+
+const char *dazeus::NetworkMetrics::reasonName(Network::DisconnectReason reason)
+{
+	return reasonNames[reason];
+}
+
+void dazeus::NetworkMetrics::dispatched(EventType type, uint64_t micros)
+{
+	addCounter(events_[type], 1);
+	dispatchTime_[type].observe(micros);
+}
+
+void dazeus::NetworkMetrics::disconnected(Network::DisconnectReason reason)
+{
+	addCounter(disconnects_[reason], 1);
+}
+
+void dazeus::NetworkMetrics::pingLag(uint64_t micros)
+{
+	pingLag_.observe(micros);
+	lastPingLag_.store(micros, std::memory_order_relaxed);
+}
+
+void dazeus::NetworkMetrics::setLagEstimate(uint64_t smoothedMicros, uint64_t jitterMicros)
+{
+	smoothedPingLag_.store(smoothedMicros, std::memory_order_relaxed);
+	pingJitter_.store(jitterMicros, std::memory_order_relaxed);
+}
+
+dazeus::NetworkMetricsSnapshot dazeus::NetworkMetrics::snapshot() const
+{
+	NetworkMetricsSnapshot s;
+	s.bytesIn = bytesIn_.load(std::memory_order_relaxed);
+	s.bytesOut = bytesOut_.load(std::memory_order_relaxed);
+	s.linesIn = linesIn_.load(std::memory_order_relaxed);
+	s.linesOut = linesOut_.load(std::memory_order_relaxed);
+	for(unsigned int i = 0; i < NumEventTypes; ++i) {
+		uint64_t n = events_[i].load(std::memory_order_relaxed);
+		if(n == 0)
+			continue;
+		s.events[eventTypeNames[i]] = n;
+		s.dispatchTime[eventTypeNames[i]] = dispatchTime_[i].snapshot();
+	}
+	s.outboundQueueBytes = outboundQueue_.load(std::memory_order_relaxed);
+	s.connectAttempts = connectAttempts_.load(std::memory_order_relaxed);
+	s.registrations = registrations_.load(std::memory_order_relaxed);
+	s.reconnectsScheduled = reconnects_.load(std::memory_order_relaxed);
+	for(unsigned int i = 0; i < numReasons; ++i) {
+		s.disconnects[reasonNames[i]] = disconnects_[i].load(std::memory_order_relaxed);
+	}
+	s.pingLag = pingLag_.snapshot();
+	s.lastPingLagMicros = lastPingLag_.load(std::memory_order_relaxed);
+	s.smoothedPingLagMicros = smoothedPingLag_.load(std::memory_order_relaxed);
+	s.pingJitterMicros = pingJitter_.load(std::memory_order_relaxed);
+	s.listenerQueueDepth = listenerQueue_.load(std::memory_order_relaxed);
+	s.listenerEventsDropped = listenerDropped_.load(std::memory_order_relaxed);
+	return s;
+}
+
+static std::string labelValue(const std::string &v)
+{
+	std::string res;
+	for(size_t i = 0; i < v.size(); ++i) {
+		if(v[i] == '\\' || v[i] == '"') {
+			res += '\\';
+			res += v[i];
+		} else if(v[i] == '\n') {
+			res += "\\n";
+		} else {
+			res += v[i];
+		}
+	}
+	return res;
+}
+
+static std::string seconds(uint64_t micros)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.6f", micros / 1000000.0);
+	return buf;
+}
+
+static void histogram(std::stringstream &ss, const std::string &name, const std::string &labels,
+	const dazeus::HistogramSnapshot &h)
+{
+	uint64_t cumulative = 0;
+	for(unsigned int i = 0; i < h.buckets.size(); ++i) {
+		cumulative += h.buckets[i];
+		std::string le = i < dazeus::Histogram::numBuckets - 1
+			? seconds(dazeus::Histogram::bucketBounds[i]) : "+Inf";
+		ss << name << "_bucket{" << labels << ",le=\"" << le << "\"} " << cumulative << "\n";
+	}
+	ss << name << "_sum{" << labels << "} " << seconds(h.sumMicros) << "\n";
+	ss << name << "_count{" << labels << "} " << h.count << "\n";
+}
+
+/**
+ * The metrics of the given networks in the Prometheus text exposition
+ * format, labeled with the network name.
+ */
+std::string dazeus::prometheusText(const std::vector<Network*> &networks)
+{
+	std::vector<NetworkMetricsSnapshot> snapshots;
+	std::vector<std::string> labels;
+	std::vector<Network*>::const_iterator nit;
+	for(nit = networks.begin(); nit != networks.end(); ++nit) {
+		snapshots.push_back((*nit)->metrics().snapshot());
+		labels.push_back("network=\"" + labelValue((*nit)->networkName()) + "\"");
+	}
+
+	std::stringstream ss;
+#define FAMILY(name, type, help) ss << "# HELP " name " " help "\n# TYPE " name " " type "\n"
+#define SIMPLE(name, type, help, field) \
+	FAMILY(name, type, help); \
+	for(size_t i = 0; i < snapshots.size(); ++i) \
+		ss << name "{" << labels[i] << "} " << snapshots[i].field << "\n";
+
+	SIMPLE("dazeus_irc_received_bytes_total", "counter", "Bytes of IRC lines received.", bytesIn);
+	SIMPLE("dazeus_irc_sent_bytes_total", "counter", "Bytes of IRC lines sent.", bytesOut);
+	SIMPLE("dazeus_irc_received_lines_total", "counter", "IRC lines received.", linesIn);
+	SIMPLE("dazeus_irc_sent_lines_total", "counter", "IRC lines sent.", linesOut);
+	SIMPLE("dazeus_irc_outbound_queue_bytes", "gauge", "Bytes sent but not yet acknowledged by the server.", outboundQueueBytes);
+	SIMPLE("dazeus_irc_connect_attempts_total", "counter", "Connection attempts.", connectAttempts);
+	SIMPLE("dazeus_irc_registrations_total", "counter", "Successful registrations with a server.", registrations);
+	SIMPLE("dazeus_irc_reconnects_scheduled_total", "counter", "Reconnects planned after a connection failed.", reconnectsScheduled);
+	SIMPLE("dazeus_irc_listener_queue_depth", "gauge", "Events waiting for or being handled by a listener pool.", listenerQueueDepth);
+	SIMPLE("dazeus_irc_listener_dropped_events_total", "counter", "Events a full listener pool dropped.", listenerEventsDropped);
+
+	FAMILY("dazeus_irc_events_total", "counter", "Events delivered to listeners.");
+	for(size_t i = 0; i < snapshots.size(); ++i) {
+		std::map<std::string,uint64_t>::const_iterator it;
+		for(it = snapshots[i].events.begin(); it != snapshots[i].events.end(); ++it) {
+			ss << "dazeus_irc_events_total{" << labels[i] << ",event=\"" << it->first << "\"} " << it->second << "\n";
+		}
+	}
+	FAMILY("dazeus_irc_dispatch_seconds", "histogram", "Time spent in listeners per event.");
+	for(size_t i = 0; i < snapshots.size(); ++i) {
+		std::map<std::string,HistogramSnapshot>::const_iterator it;
+		for(it = snapshots[i].dispatchTime.begin(); it != snapshots[i].dispatchTime.end(); ++it) {
+			histogram(ss, "dazeus_irc_dispatch_seconds", labels[i] + ",event=\"" + it->first + "\"", it->second);
+		}
+	}
+	FAMILY("dazeus_irc_disconnects_total", "counter", "Disconnects and connection failures, by reason.");
+	for(size_t i = 0; i < snapshots.size(); ++i) {
+		std::map<std::string,uint64_t>::const_iterator it;
+		for(it = snapshots[i].disconnects.begin(); it != snapshots[i].disconnects.end(); ++it) {
+			ss << "dazeus_irc_disconnects_total{" << labels[i] << ",reason=\"" << it->first << "\"} " << it->second << "\n";
+		}
+	}
+	FAMILY("dazeus_irc_ping_lag_seconds", "histogram", "Time between a PING and its PONG.");
+	for(size_t i = 0; i < snapshots.size(); ++i) {
+		histogram(ss, "dazeus_irc_ping_lag_seconds", labels[i], snapshots[i].pingLag);
+	}
+	FAMILY("dazeus_irc_last_ping_lag_seconds", "gauge", "Time between the last PING and its PONG.");
+	for(size_t i = 0; i < snapshots.size(); ++i) {
+		ss << "dazeus_irc_last_ping_lag_seconds{" << labels[i] << "} " << seconds(snapshots[i].lastPingLagMicros) << "\n";
+	}
+	FAMILY("dazeus_irc_smoothed_ping_lag_seconds", "gauge", "Smoothed time between a PING and its PONG.");
+	for(size_t i = 0; i < snapshots.size(); ++i) {
+		ss << "dazeus_irc_smoothed_ping_lag_seconds{" << labels[i] << "} " << seconds(snapshots[i].smoothedPingLagMicros) << "\n";
+	}
+	FAMILY("dazeus_irc_ping_jitter_seconds", "gauge", "Mean deviation of the time between a PING and its PONG.");
+	for(size_t i = 0; i < snapshots.size(); ++i) {
+		ss << "dazeus_irc_ping_jitter_seconds{" << labels[i] << "} " << seconds(snapshots[i].pingJitterMicros) << "\n";
+	}
+#undef SIMPLE
+#undef FAMILY
+	return ss.str();
+}
+
+/**
+ * Bytes written to a socket that the peer has not acknowledged yet, or 0 if
+ * the platform can't tell.
+ */
+uint64_t dazeus::socketOutboundBytes(int fd)
+{
+#ifdef SIOCOUTQ
+	int queued = 0;
+	if(ioctl(fd, SIOCOUTQ, &queued) == 0 && queued > 0)
+		return queued;
+#else
+	(void)fd;
+#endif
+	return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "network.h"
+
+namespace dazeus {
+
+/**
+ * Add to a counter that only one thread writes to. Other threads may read it
+ * at any time; a plain load and store is enough for that, and is cheaper than
+ * an atomic read-modify-write.
+ */
+inline void addCounter(std::atomic<uint64_t> &counter, uint64_t n) {
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct HistogramSnapshot {
+	HistogramSnapshot() : buckets(), count(0), sumMicros(0) {}
+
+	uint64_t quantileMicros(double q) const;
+
+	std::vector<uint64_t> buckets; // count per bucket, not cumulative
+	uint64_t count;
+	uint64_t sumMicros;
+};
+
+/**
+ * A histogram of durations in microseconds, with fixed exponential buckets.
+ * Only one thread may observe; a snapshot may be taken from any thread.
+ */
+class Histogram {
+public:
+	static const unsigned int numBuckets = 20;
+	// upper bound of every bucket but the last, in microseconds
+	static const uint64_t bucketBounds[numBuckets - 1];
+
+	Histogram();
+	void observe(uint64_t micros);
+	HistogramSnapshot snapshot() const;
+
+private:
+	// explicitly disable copy constructor
+	Histogram(const Histogram&);
+	void operator=(const Histogram&);
+
+	std::atomic<uint64_t> buckets_[numBuckets];
+	std::atomic<uint64_t> sum_;
+};
+
+struct NetworkMetricsSnapshot {
+	NetworkMetricsSnapshot() : bytesIn(0), bytesOut(0), linesIn(0), linesOut(0),
+		outboundQueueBytes(0), connectAttempts(0), registrations(0),
+		reconnectsScheduled(0), lastPingLagMicros(0), smoothedPingLagMicros(0),
+		pingJitterMicros(0), listenerQueueDepth(0), listenerEventsDropped(0) {}
+
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	uint64_t linesIn;
+	uint64_t linesOut;
+	std::map<std::string,uint64_t> events;
+	std::map<std::string,HistogramSnapshot> dispatchTime;
+	uint64_t outboundQueueBytes;
+	uint64_t connectAttempts;
+	uint64_t registrations;
+	uint64_t reconnectsScheduled;
+	std::map<std::string,uint64_t> disconnects; // by reason
+	HistogramSnapshot pingLag;
+	uint64_t lastPingLagMicros;
+	uint64_t smoothedPingLagMicros;
+	uint64_t pingJitterMicros;
+	uint64_t listenerQueueDepth;
+	uint64_t listenerEventsDropped;
+};
+
+/**
+ * Runtime numbers of one Network. They are updated from the thread running
+ * the network without taking locks, and can be read as a snapshot from any
+ * other thread. A snapshot is not taken atomically as a whole, so counters
+ * that are updated together may be off by one against each other.
+ *
+ * Bytes and lines are counted as IRC lines, without the PINGs and PONGs
+ * libircclient handles internally; inbound byte counts are reconstructed
+ * from the parsed lines.
+ */
+class NetworkMetrics {
+public:
+	enum EventType {
+		ConnectEvent, DisconnectEvent, ErrorEvent, NumericEvent, NamesEvent,
+		WhoisEvent, TopicEvent, JoinEvent, PartEvent, KickEvent, QuitEvent,
+		NickEvent, ModeEvent, PrivmsgEvent, NoticeEvent, ActionEvent,
+		CtcpEvent, InviteEvent, PongEvent, PrivmsgMeEvent, NoticeMeEvent,
+		ActionMeEvent, CtcpMeEvent, CtcpReplyMeEvent, OtherEvent,
+		NumEventTypes
+	};
+	static const unsigned int numReasons = Network::AdminRequestReason + 1;
+
+	NetworkMetrics();
+
+	static EventType eventType(const std::string &event);
+	static const char *eventTypeName(EventType type);
+	static const char *reasonName(Network::DisconnectReason reason);
+
+	void received(uint64_t bytes) { addCounter(linesIn_, 1); addCounter(bytesIn_, bytes); }
+	void sent(uint64_t bytes) { addCounter(linesOut_, 1); addCounter(bytesOut_, bytes); }
+	void dispatched(EventType type, uint64_t micros);
+	void setOutboundQueueBytes(uint64_t bytes) { outboundQueue_.store(bytes, std::memory_order_relaxed); }
+	void connectAttempt() { addCounter(connectAttempts_, 1); }
+	void registered() { addCounter(registrations_, 1); }
+	void reconnectScheduled() { addCounter(reconnects_, 1); }
+	void disconnected(Network::DisconnectReason reason);
+	void pingLag(uint64_t micros);
+	void setLagEstimate(uint64_t smoothedMicros, uint64_t jitterMicros);
+	// updated by the workers of a ListenerPool too, so these are atomic
+	void listenerQueued() { listenerQueue_.fetch_add(1, std::memory_order_relaxed); }
+	void listenerDone() { listenerQueue_.fetch_sub(1, std::memory_order_release); }
+	void listenerDropped() { listenerDropped_.fetch_add(1, std::memory_order_relaxed); }
+	uint64_t listenerQueueDepth() const { return listenerQueue_.load(std::memory_order_acquire); }
+
+	NetworkMetricsSnapshot snapshot() const;
+
+private:
+	// explicitly disable copy constructor
+	NetworkMetrics(const NetworkMetrics&);
+	void operator=(const NetworkMetrics&);
+
+	std::atomic<uint64_t> bytesIn_;
+	std::atomic<uint64_t> bytesOut_;
+	std::atomic<uint64_t> linesIn_;
+	std::atomic<uint64_t> linesOut_;
+	std::atomic<uint64_t> events_[NumEventTypes];
+	Histogram dispatchTime_[NumEventTypes];
+	std::atomic<uint64_t> outboundQueue_;
+	std::atomic<uint64_t> connectAttempts_;
+	std::atomic<uint64_t> registrations_;
+	std::atomic<uint64_t> reconnects_;
+	std::atomic<uint64_t> disconnects_[numReasons];
+	Histogram pingLag_;
+	std::atomic<uint64_t> lastPingLag_;
+	std::atomic<uint64_t> smoothedPingLag_;
+	std::atomic<uint64_t> pingJitter_;
+	std::atomic<uint64_t> listenerQueue_;
+	std::atomic<uint64_t> listenerDropped_;
+};
+
+std::string prometheusText(const std::vector<Network*> &networks);
+uint64_t socketOutboundBytes(int fd);
+
+}
+
+#endif
@@ -6,9 +6,28 @@
 #include "network.h"
 #include "server.h"
 #include "utils.h"
+#include "resolver.h"
+#include "reconnectscheduler.h"
+#include "metrics.h"
+#include "logger.h"
+#include "probes.h"
+#include "listenerpool.h"
+#include "channelsnapshot.h"
+#include "handoff.h"
+#include "connectionpool.h"
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <iterator>
 #include <sys/select.h>
 
+static dazeus::LogCategory connectionLog("network.connection");
+static dazeus::LogCategory eventLog("network.event");
+static dazeus::LogCategory loopLog("network.loop");
+
 std::string dazeus::Network::toString(const Network *n)
 {
 	std::stringstream res;
@@ -29,21 +48,117 @@ std::string dazeus::Network::toString(const Network *n)
  */
 dazeus::Network::Network(const NetworkConfig &c)
 : activeServer_(0)
+, resolver_(&Resolver::instance())
+, scheduler_(&ReconnectScheduler::instance())
+, recorder_(0)
+, snapshot_(0)
+, metrics_(new NetworkMetrics())
+, pool_(0)
 , config_(c)
 , undesirables_()
 , deleteServer_(false)
+, failureReason_(UnknownReason)
 , identifiedUsers_()
 , knownUsers_()
 , topics_()
+, membership_()
+, staleChannels_()
+, dirtyChannels_()
+, snapshotDue_(0)
+, coalesced_()
+, coalescedDelivering_()
+, coalescedSize_(0)
+, coalescedFlushing_(false)
+, splitMembers_()
+, lowered_()
+, lower_()
+, merging_()
+, splitKeys_()
+, splitLeft_()
 , networkListeners_()
+, batchListeners_()
+, batch_()
+, delivering_()
+, batchSize_(0)
+, batching_(false)
+, flushing_(false)
+, pooledListeners_()
+, postMutex_()
+, posted_()
+, interestCallback_()
 , nick_(c.nickName)
+, registered_(false)
 , deadline_(0)
-, nextPongDeadline_(0)
-{}
+, pingTimer_()
+{
+	wakeup_[0] = wakeup_[1] = -1;
+}
 
+/**
+ * @brief Apply a new configuration without reconnecting where possible.
+ *
+ * A changed nickname is requested from the server with NICK, changed timeouts
+ * move the running deadlines, and a changed server list is only used at the
+ * next (re)connect. Only if the server we are connected to was removed from
+ * the list, the network switches servers.
+ */
 void dazeus::Network::resetConfig(const NetworkConfig &c)
 {
+	NetworkConfig old = config_;
 	config_ = c;
+
+	// Forget the history of servers that are gone
+	std::map<std::string,int>::iterator uit = undesirables_.begin();
+	while(uit != undesirables_.end()) {
+		bool listed = false;
+		std::vector<ServerConfig>::const_iterator sit;
+		for(sit = c.servers.begin(); sit != c.servers.end(); ++sit) {
+			if(sit->toString() == uit->first) {
+				listed = true;
+				break;
+			}
+		}
+		if(listed)
+			++uit;
+		else
+			undesirables_.erase(uit++);
+	}
+
+	if(!activeServer_) {
+		nick_ = c.nickName;
+		return;
+	}
+
+	bool activeListed = false;
+	std::string active = activeServer_->config().toString();
+	std::vector<ServerConfig>::const_iterator sit;
+	for(sit = c.servers.begin(); sit != c.servers.end(); ++sit) {
+		if(sit->toString() == active) {
+			activeListed = true;
+			break;
+		}
+	}
+	if(!activeListed) {
+		disconnectFromNetwork(ConfigurationReloadReason);
+		nick_ = c.nickName;
+		connectToNetwork();
+		return;
+	}
+
+	if(old.nickName != c.nickName && nick_ != c.nickName) {
+		activeServer_->nick(c.nickName);
+	}
+
+	// A running deadline is either the connect or the PONG deadline
+	if(deadline_ != 0) {
+		if(!registered_ && old.connectTimeout != c.connectTimeout) {
+			deadline_ = c.connectTimeout > 0 ? deadline_ - old.connectTimeout + c.connectTimeout : 0;
+		} else if(registered_ && old.pongTimeout != c.pongTimeout) {
+			deadline_ += c.pongTimeout - old.pongTimeout;
+		}
+		// a loop waiting for the old deadline must wait for the new one
+		interestChanged();
+	}
 }
 
 /**
@@ -51,7 +166,72 @@ void dazeus::Network::resetConfig(const NetworkConfig &c)
  */
 dazeus::Network::~Network()
 {
+	saveSnapshot();
 	disconnectFromNetwork();
+	// pooled listeners may still be handling events of this network
+	std::vector<std::pair<NetworkListener*,ListenerPool*> >::iterator it;
+	for(it = pooledListeners_.begin(); it != pooledListeners_.end(); ++it) {
+		it->second->wait(this);
+	}
+	if(wakeup_[0] >= 0) {
+		close(wakeup_[0]);
+		close(wakeup_[1]);
+	}
+	delete pool_;
+	delete metrics_;
+}
+
+/**
+ * Add a listener that is run on the workers of a pool, instead of on the
+ * thread of the network. See ListenerPool.
+ */
+void dazeus::Network::addListener( NetworkListener *nl, ListenerPool *pool )
+{
+	if(wakeup_[0] < 0) {
+		if(pipe(wakeup_) == 0) {
+			fcntl(wakeup_[0], F_SETFL, O_NONBLOCK);
+			fcntl(wakeup_[1], F_SETFL, O_NONBLOCK);
+		} else {
+			log(loopLog, ErrorLevel, "Couldn't create wakeup pipe", {{"error", strerror(errno)}});
+			wakeup_[0] = wakeup_[1] = -1;
+		}
+	}
+	pooledListeners_.push_back(std::make_pair(nl, pool));
+}
+
+/**
+ * Have the thread of the network call the given function, for instance to
+ * answer an event from a pooled listener. May be called from any thread.
+ * The function runs the next time the network handles its descriptors or
+ * timeouts; if the network has pooled listeners, the event loop is woken up
+ * for it.
+ */
+void dazeus::Network::post( std::function<void(Network*)> f )
+{
+	{
+		std::lock_guard<std::mutex> lock(postMutex_);
+		posted_.push_back(f);
+	}
+	if(wakeup_[1] >= 0) {
+		char c = 0;
+		// if the pipe is full, the loop will wake up anyway
+		if(write(wakeup_[1], &c, 1) < 0) {}
+	}
+}
+
+void dazeus::Network::runPosted()
+{
+	std::vector<std::function<void(Network*)> > posted;
+	{
+		std::lock_guard<std::mutex> lock(postMutex_);
+		if(posted_.empty())
+			return;
+		posted.swap(posted_);
+	}
+	std::vector<std::function<void(Network*)> >::iterator it;
+	for(it = posted.begin(); it != posted.end(); ++it) {
+		(*it)(this);
+	}
 }
 
 
@@ -76,7 +256,7 @@ void dazeus::Network::action( std::string destination, std::string message )
 {
 	if( !activeServer_ )
 		return;
-	activeServer_->ctcpAction( destination, message );
+	sender(destination)->ctcpAction( destination, message );
 }
 
 void dazeus::Network::names( std::string channel )
@@ -169,27 +349,39 @@ void dazeus::Network::connectToNetwork( bool reconnect )
 	if( !reconnect && activeServer_ )
 		return;
 
-	printf("Connecting to network: %s\n", dazeus::Network::toString(this).c_str());
+	log(connectionLog, InfoLevel, "Connecting to network", {{"network", networkName()}});
 
 	// Check if there *is* a server to use
 	if( servers().size() == 0 )
 	{
-		printf("Trying to connect to network '%s', but there are no servers to connect to!\n",
-		config_.displayName.c_str());
+		log(connectionLog, WarningLevel, "No servers to connect to", {{"network", networkName()}});
+		// a reconnect taken from the scheduler must give its slot back
+		scheduler_->cancel(this);
 		return;
 	}
 
-	// Find the best server to use
+	// Find the best server, set it as the active server, and connect.
+	connectToServer( bestServer(), true );
+}
 
-	// First, sort the list by priority and earlier failures
+/**
+ * The server to connect to: the one with the best priority, after earlier
+ * failures are accounted for. There must be at least one server.
+ */
+dazeus::ServerConfig dazeus::Network::bestServer()
+{
 	std::vector<ServerConfig> sortedServers = servers();
 	std::sort( sortedServers.begin(), sortedServers.end(), ServerSorter(this) );
+	return sortedServers[0];
+}
 
-	// Then, take the first one and create a Server around it
-	const ServerConfig &best = sortedServers[0];
-
-	// And set it as the active server, and connect.
-	connectToServer( best, true );
+/**
+ * The connection to send a message to the given target over: the active
+ * server, or a member of the pool.
+ */
+dazeus::Server *dazeus::Network::sender(const std::string &target)
+{
+	return pool_ ? pool_->route(target) : activeServer_;
 }
 
 
@@ -197,9 +389,19 @@ void dazeus::Network::connectToServer(const ServerConfig &server, bool reconnect
 {
 	if( !reconnect && activeServer_ )
 		return;
-	assert(knownUsers_.size() == 0);
+	assert(knownUsers_.size() == staleChannels_.size());
 	assert(identifiedUsers_.size() == 0);
 
+	if( !scheduler_->attemptStarted(this, config_.connectTimeout) )
+	{
+		log(connectionLog, InfoLevel, "Too many connection attempts in progress, connecting later",
+			{{"network", networkName()}});
+		if( activeServer_ )
+			disconnectFromNetwork( SwitchingServersReason );
+		scheduler_->queue(this);
+		return;
+	}
+
 	if( activeServer_ )
 	{
 		activeServer_->disconnectFromServer( SwitchingServersReason );
@@ -208,28 +410,67 @@ void dazeus::Network::connectToServer(const ServerConfig &server, bool reconnect
 	}
 
 	activeServer_ = new Server(server, this);
+	activeServer_->setRecorder(recorder_);
+	nick_ = config_.nickName;
+	registered_ = false;
+	metrics_->connectAttempt();
+	pingTimer_.reset(std::chrono::steady_clock::now());
 	activeServer_->connectToServer();
 	if(config_.connectTimeout > 0) {
 		deadline_ = time(NULL) + config_.connectTimeout;
 	}
+	interestChanged();
+}
+
+/**
+ * Destroy a server that failed, and plan a reconnect to the network. This
+ * must not be called while the server is still on the stack.
+ */
+void dazeus::Network::reapFailedServer()
+{
+	if(!deleteServer_)
+		return;
+	deleteServer_ = false;
+	delete activeServer_;
+	activeServer_ = 0;
+	metrics_->disconnected(failureReason_);
+	metrics_->reconnectScheduled();
+	scheduler_->schedule(this, failureReason_);
+	DAZEUS_PROBE3(reconnect__scheduled, config_.name.c_str(), (int)failureReason_, scheduler_->msUntilDue(this));
 }
 
 void dazeus::Network::joinedChannel(const std::string &user, const std::string &receiver)
 {
 	if(user == nick_ && !contains_ci(knownUsers_, receiver)) {
 		knownUsers_[receiver] = std::vector<std::string>();
+	} else if(user == nick_ && contains_ci(staleChannels_, receiver)) {
+		// rejoined after a restart; NAMES will say who is there now
+		find_ci(knownUsers_, receiver)->second.clear();
+		erase_ci(staleChannels_, receiver);
+	}
+	if(user != nick_ && !membership_.empty()) {
+		std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, receiver);
+		if(mit != membership_.end()) {
+			erase_ci(mit->second.notMembers, user);
+			if(mit->second.policy == NoMembership)
+				return;
+		}
 	}
-	std::vector<std::string> users = find_ci(knownUsers_, receiver)->second;
+	std::vector<std::string> &users = find_ci(knownUsers_, receiver)->second;
 	if(!contains_ci(users, user))
-		find_ci(knownUsers_, receiver)->second.push_back(user);
+		users.push_back(user);
+	channelChanged(receiver);
 }
 
 void dazeus::Network::partedChannel(const std::string &user, const std::string &, const std::string &receiver)
 {
+	channelChanged(receiver);
 	if(user == nick_) {
 		erase_ci(knownUsers_, receiver);
+		erase_ci(staleChannels_, receiver);
 	} else {
 		erase_ci(find_ci(knownUsers_, receiver)->second, user);
+		notMember(user, receiver);
 	}
 	if(!isKnownUser(user)) {
 		erase_ci(identifiedUsers_, user);
@@ -238,9 +479,13 @@ void dazeus::Network::partedChannel(const std::string &user, const std::string &
 
 void dazeus::Network::slotQuit(const std::string &origin, const std::string&, const std::string &)
 {
+	forgetSplitUser(origin);
 	std::map<std::string,std::vector<std::string> >::iterator it;
 	for(it = knownUsers_.begin(); it != knownUsers_.end(); ++it) {
-		erase_ci(it->second, origin);
+		if(contains_ci(it->second, origin)) {
+			erase_ci(it->second, origin);
+			channelChanged(it->first);
+		}
 	}
 	if(!isKnownUser(origin)) {
 		erase_ci(identifiedUsers_, origin);
@@ -251,6 +496,7 @@ void dazeus::Network::slotNickChanged( const std::string &origin, const std::str
 {
 	erase_ci(identifiedUsers_, origin);
 	erase_ci(identifiedUsers_, nick);
+	forgetSplitUser(origin);
 
 	if(nick_ == origin)
 		nick_ = nick;
@@ -260,16 +506,20 @@ void dazeus::Network::slotNickChanged( const std::string &origin, const std::str
 		if(contains_ci(it->second, origin)) {
 			erase_ci(it->second, origin);
 			it->second.push_back(nick);
+			channelChanged(it->first);
 		}
 	}
 }
 
 void dazeus::Network::kickedChannel(const std::string&, const std::string &user, const std::string&, const std::string &receiver)
 {
+	channelChanged(receiver);
 	if(user == nick_) {
 		erase_ci(knownUsers_, receiver);
+		erase_ci(staleChannels_, receiver);
 	} else {
 		erase_ci(find_ci(knownUsers_, receiver)->second, user);
+		notMember(user, receiver);
 	}
 	if(!isKnownUser(user)) {
 		erase_ci(identifiedUsers_, user);
@@ -278,17 +528,28 @@ void dazeus::Network::kickedChannel(const std::string&, const std::string &user,
 
 void dazeus::Network::onFailedConnection()
 {
-	fprintf(stderr, "Connection failed on %s\n", dazeus::Network::toString(this).c_str());
+	log(connectionLog, WarningLevel, "Connection failed", {{"network", networkName()}});
 
+	registered_ = false;
+	flushCoalesced();
+	saveSnapshot();
 	identifiedUsers_.clear();
 	knownUsers_.clear();
+	staleChannels_.clear();
+	splitMembers_.clear();
+	forgetMembers();
 
+	if(pool_)
+		pool_->stop(ErrorReason);
 	slotIrcEvent("DISCONNECT", "", std::vector<std::string>());
 
 	// Flag old server as undesirable
 	// Don't destroy it here yet; it is still in the stack. It will be destroyed
 	// in processDescriptors().
 	flagUndesirableServer(activeServer_->config());
+	scheduler_->attemptFinished(this, false);
+	if(!deleteServer_)
+		failureReason_ = ErrorReason;
 	deleteServer_ = true;
 }
 
@@ -297,7 +558,7 @@ void dazeus::Network::ctcp( std::string destination, std::string message )
 {
 	if( !activeServer_ )
 		return;
-	activeServer_->ctcpRequest( destination, message );
+	sender(destination)->ctcpRequest( destination, message );
 }
 
 
@@ -305,7 +566,7 @@ void dazeus::Network::ctcpReply( std::string destination, std::string message )
 {
 	if( !activeServer_ )
 		return;
-	activeServer_->ctcpReply( destination, message );
+	sender(destination)->ctcpReply( destination, message );
 }
 
 
@@ -314,24 +575,188 @@ void dazeus::Network::ctcpReply( std::string destination, std::string message )
  */
 void dazeus::Network::disconnectFromNetwork( DisconnectReason reason )
 {
+	scheduler_->cancel(this);
 	if( activeServer_ == 0 )
 		return;
 
+	flushCoalesced();
+	saveSnapshot();
 	identifiedUsers_.clear();
 	knownUsers_.clear();
+	staleChannels_.clear();
+	splitMembers_.clear();
+	forgetMembers();
+	registered_ = false;
+	metrics_->disconnected(reason);
+	if(pool_)
+		pool_->stop(reason);
 
 	activeServer_->disconnectFromServer( reason );
 	// TODO: maybe deleteLater?
 	delete activeServer_;
 	activeServer_ = 0;
+	interestChanged();
 }
 
 
+/**
+ * @brief Hand the connection to another process, which calls resume().
+ *
+ * The connection must be registered and carried by a relay, see
+ * NetworkConfig::handoff. Reading from the server stops, and everything
+ * received until then is parsed and dispatched first; the rest goes to the
+ * other process, with the socket and the channel state, over the given Unix
+ * socket. The server sees nothing of this: afterwards the network is
+ * disconnected without sending QUIT, and doesn't reconnect.
+ *
+ * Returns false if the connection couldn't be handed off; it then continues
+ * in this process, if it is still there.
+ */
+bool dazeus::Network::handoff( int socket, std::string *error )
+{
+	if( !activeServer_ || !registered_ || !activeServer_->relay() ) {
+		if(error)
+			*error = "No relayed connection to hand off";
+		return false;
+	}
+
+	activeServer_->relay()->freeze();
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while( !activeServer_->readyForHandoff() ) {
+		if(std::chrono::steady_clock::now() >= deadline) {
+			activeServer_->relay()->thaw();
+			if(error)
+				*error = "Connection didn't drain in time";
+			return false;
+		}
+		fd_set in_set, out_set;
+		int maxfd = 0;
+		FD_ZERO(&in_set);
+		FD_ZERO(&out_set);
+		addDescriptors(&in_set, &out_set, &maxfd);
+		struct timeval timeout = {0, 50000};
+		if(select(maxfd + 1, &in_set, &out_set, NULL, &timeout) > 0)
+			processDescriptors(&in_set, &out_set);
+		if( !activeServer_ || deleteServer_ ) {
+			if(error)
+				*error = "Connection lost while handing off";
+			return false;
+		}
+	}
+
+	flushCoalesced();
+	RelayBridge *relay = activeServer_->relay();
+	HandoffState state;
+	state.network = config_.name;
+	state.host = activeServer_->config().host;
+	state.port = activeServer_->config().port;
+	state.nick = nick_;
+	state.channels = knownUsers_;
+	state.topics = topics_;
+	state.identified = identifiedUsers_;
+	state.inbound = relay->pendingInbound();
+	state.outbound = relay->pendingOutbound();
+	saveSnapshot();
+	if(!state.send(socket, relay->upstreamDescriptor(), error)) {
+		relay->thaw();
+		return false;
+	}
+	log(connectionLog, InfoLevel, "Handed off connection", {{"network", networkName()}});
+	// only the connection itself goes along
+	if(pool_)
+		pool_->stop(ShutdownReason);
+
+	scheduler_->cancel(this);
+	identifiedUsers_.clear();
+	knownUsers_.clear();
+	staleChannels_.clear();
+	splitMembers_.clear();
+	forgetMembers();
+	registered_ = false;
+	deadline_ = 0;
+	// the other process holds the socket now, so closing ours is silent
+	delete activeServer_;
+	activeServer_ = 0;
+	interestChanged();
+	return true;
+}
+
+/**
+ * @brief Continue a connection handed off by another process.
+ *
+ * Blocks until the state sent by handoff() is received from the given Unix
+ * socket. The network must not be connected. Listeners get a CONNECT like
+ * for a new connection; the channels, topics and nickname are as they were
+ * in the other process.
+ */
+bool dazeus::Network::resume( int socket, std::string *error )
+{
+	if( activeServer_ ) {
+		if(error)
+			*error = "Already connected";
+		return false;
+	}
+	HandoffState state;
+	int fd;
+	if(!state.receive(socket, &fd, error))
+		return false;
+	if(state.network != config_.name) {
+		close(fd);
+		if(error)
+			*error = "Handoff is for network " + state.network;
+		return false;
+	}
+
+	ServerConfig server;
+	server.host = state.host;
+	server.port = state.port;
+	std::vector<ServerConfig>::const_iterator it;
+	for(it = config_.servers.begin(); it != config_.servers.end(); ++it) {
+		if(it->host == state.host && it->port == state.port && !it->ssl) {
+			server = *it;
+			break;
+		}
+	}
+
+	log(connectionLog, InfoLevel, "Resuming connection", {{"network", networkName()}});
+	scheduler_->cancel(this);
+	knownUsers_ = state.channels;
+	topics_ = state.topics;
+	identifiedUsers_ = state.identified;
+	staleChannels_.clear();
+	std::map<std::string,std::vector<std::string> >::const_iterator cit;
+	for(cit = knownUsers_.begin(); cit != knownUsers_.end(); ++cit) {
+		channelChanged(cit->first);
+	}
+	nick_ = state.nick;
+	registered_ = false;
+
+	activeServer_ = new Server(server, this);
+	activeServer_->setRecorder(recorder_);
+	// the connection is already there, so it takes no slot of the scheduler
+	metrics_->connectAttempt();
+	pingTimer_.reset(std::chrono::steady_clock::now());
+	if(!activeServer_->resume(fd, state.inbound, state.outbound)) {
+		if(error)
+			*error = "Couldn't resume the connection";
+		onFailedConnection();
+		return false;
+	}
+	if(config_.connectTimeout > 0) {
+		deadline_ = time(NULL) + config_.connectTimeout;
+	}
+	interestChanged();
+	return true;
+}
+
 void dazeus::Network::joinChannel( std::string channel )
 {
 	if( !activeServer_ )
 		return;
 	activeServer_->join( channel );
+	if(pool_)
+		pool_->join( channel );
 }
 
 
@@ -340,6 +765,8 @@ void dazeus::Network::leaveChannel( std::string channel )
 	if( !activeServer_ )
 		return;
 	activeServer_->part( channel );
+	if(pool_)
+		pool_->part( channel );
 }
 
 
@@ -347,7 +774,7 @@ void dazeus::Network::say( std::string destination, std::string message )
 {
 	if( !activeServer_ )
 		return;
-	activeServer_->message( destination, message );
+	sender(destination)->message( destination, message );
 }
 
 
@@ -355,7 +782,7 @@ void dazeus::Network::notice( std::string destination, std::string message )
 {
 	if( !activeServer_ )
 		return;
-	activeServer_->notice( destination, message );
+	sender(destination)->notice( destination, message );
 }
 
 
@@ -383,6 +810,140 @@ std::string dazeus::Network::networkName() const
 }
 
 
+/**
+ * The resolver used to look up server hostnames. By default this is the
+ * process-wide Resolver::instance().
+ */
+dazeus::Resolver *dazeus::Network::resolver() const
+{
+	return resolver_;
+}
+
+void dazeus::Network::setResolver( Resolver *r )
+{
+	assert(r != 0);
+	resolver_ = r;
+}
+
+/**
+ * The scheduler deciding when this network reconnects after a failure. By
+ * default this is the process-wide ReconnectScheduler::instance().
+ */
+dazeus::ReconnectScheduler *dazeus::Network::reconnectScheduler() const
+{
+	return scheduler_;
+}
+
+void dazeus::Network::setReconnectScheduler( ReconnectScheduler *s )
+{
+	assert(s != 0);
+	scheduler_->cancel(this);
+	scheduler_ = s;
+}
+
+bool dazeus::Network::reconnectPending() const
+{
+	return scheduler_->isPending(this);
+}
+
+/**
+ * The recorder writing down the traffic of this network, or 0 if it isn't
+ * being recorded. The recorder is not owned by the network.
+ */
+dazeus::TrafficRecorder *dazeus::Network::recorder() const
+{
+	return recorder_;
+}
+
+/**
+ * The PING schedule of the active server, with its lag estimate.
+ */
+const dazeus::PingTimer &dazeus::Network::pingTimer() const
+{
+	return pingTimer_;
+}
+
+/**
+ * Runtime numbers of this network. They can be read from any thread.
+ */
+const dazeus::NetworkMetrics &dazeus::Network::metrics() const
+{
+	return *metrics_;
+}
+
+/**
+ * The extra connections of this network, or 0 if it has none; see
+ * NetworkConfig::poolSize.
+ */
+dazeus::ConnectionPool *dazeus::Network::pool() const
+{
+	return pool_;
+}
+
+void dazeus::Network::setRecorder( TrafficRecorder *r )
+{
+	recorder_ = r;
+	if(activeServer_)
+		activeServer_->setRecorder(r);
+}
+
+dazeus::ChannelSnapshot *dazeus::Network::snapshot() const
+{
+	return snapshot_;
+}
+
+/**
+ * Save the channels of this network to a snapshot from now on. If the
+ * network isn't connected, its channels are restored from the snapshot
+ * first, and are stale until they are rejoined.
+ */
+void dazeus::Network::setSnapshot( ChannelSnapshot *s )
+{
+	saveSnapshot();
+	snapshot_ = s;
+	snapshotDue_ = 0;
+	if(!s || activeServer_ || !knownUsers_.empty())
+		return;
+	s->restore(config_.name, knownUsers_, topics_);
+	std::map<std::string,std::vector<std::string> >::const_iterator it;
+	for(it = knownUsers_.begin(); it != knownUsers_.end(); ++it) {
+		staleChannels_.push_back(it->first);
+	}
+}
+
+void dazeus::Network::channelChanged(const std::string &channel)
+{
+	if(!snapshot_)
+		return;
+	std::map<std::string,std::vector<std::string> >::const_iterator it = find_ci(knownUsers_, channel);
+	const std::string &name = it == knownUsers_.end() ? channel : it->first;
+	if(!contains_ci(dirtyChannels_, name))
+		dirtyChannels_.push_back(name);
+}
+
+/**
+ * Write the channels that changed since the last time to the snapshot.
+ */
+void dazeus::Network::saveSnapshot()
+{
+	if(!snapshot_ || dirtyChannels_.empty())
+		return;
+	static const std::string noTopic;
+	std::vector<std::string>::const_iterator it;
+	for(it = dirtyChannels_.begin(); it != dirtyChannels_.end(); ++it) {
+		std::map<std::string,std::vector<std::string> >::const_iterator cit = find_ci(knownUsers_, *it);
+		if(cit == knownUsers_.end()) {
+			snapshot_->erase(config_.name, *it);
+			continue;
+		}
+		std::map<std::string,std::string>::const_iterator tit = find_ci(topics_, *it);
+		snapshot_->write(config_.name, cit->first, tit == topics_.end() ? noTopic : tit->second, cit->second);
+	}
+	dirtyChannels_.clear();
+	snapshot_->sync();
+}
+
+
 
 int dazeus::Network::serverUndesirability( const ServerConfig &sc ) const
 {
@@ -410,6 +971,14 @@ bool dazeus::Network::isIdentified(const std::string &user) const {
 	return contains_ci(identifiedUsers_, user);
 }
 
+/**
+ * Whether the channel was restored from the snapshot, and wasn't rejoined
+ * since; its members and topic may be out of date.
+ */
+bool dazeus::Network::isStale(const std::string &channel) const {
+	return contains_ci(staleChannels_, channel);
+}
+
 bool dazeus::Network::isKnownUser(const std::string &user) const {
 	std::map<std::string,std::vector<std::string> >::const_iterator it;
 	for(it = knownUsers_.begin(); it != knownUsers_.end(); ++it) {
@@ -430,41 +999,273 @@ void dazeus::Network::slotWhoisReceived(const std::string &, const std::string &
 
 void dazeus::Network::slotNamesReceived(const std::string&, const std::string &channel, const std::vector<std::string> &names, const std::string & ) {
 	assert(contains_ci(knownUsers_, channel));
+	std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, channel);
+	if(mit != membership_.end()) {
+		// the names went to lazyNamesReceived(); who wasn't in them
+		// isn't in the channel
+		ChannelMembership &m = mit->second;
+		std::vector<std::string>::const_iterator it;
+		for(it = m.queried.begin(); it != m.queried.end(); ++it) {
+			notMember(*it, channel);
+		}
+		m.queried.clear();
+		m.querying = false;
+		return;
+	}
 	std::vector<std::string> &users = find_ci(knownUsers_, channel)->second;
 	std::vector<std::string>::const_iterator it;
 	for(it = names.begin(); it != names.end(); ++it) {
-		std::string n = *it;
+		const std::string &name = *it;
 		unsigned int nickStart;
-		for(nickStart = 0; nickStart < n.length(); ++nickStart) {
-			if(n[nickStart] != '@' && n[nickStart] != '~' && n[nickStart] != '+'
-			&& n[nickStart] != '%' && n[nickStart] != '!') {
+		for(nickStart = 0; nickStart < name.length(); ++nickStart) {
+			if(name[nickStart] != '@' && name[nickStart] != '~' && name[nickStart] != '+'
+			&& name[nickStart] != '%' && name[nickStart] != '!') {
 				break;
 			}
 		}
-		n = n.substr(nickStart);
+		std::string n = name.substr(nickStart);
 		if(!contains_ci(users, n))
 			users.push_back(n);
 	}
+	channelChanged(channel);
+}
+
+/**
+ * Handle a line of a NAMES reply for a channel without FullMembership: only
+ * the users asked about are looked for, the others are forgotten right away.
+ */
+void dazeus::Network::lazyNamesReceived(const std::string &channel, const std::string &names) {
+	std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, channel);
+	if(mit == membership_.end() || mit->second.queried.empty())
+		return;
+	std::vector<std::string> &queried = mit->second.queried;
+	size_t begin = 0;
+	while(begin < names.size() && !queried.empty()) {
+		size_t end = names.find(' ', begin);
+		if(end == std::string::npos)
+			end = names.size();
+		while(begin < end && strchr("@~+%!", names[begin]) != NULL)
+			++begin;
+		std::string name = names.substr(begin, end - begin);
+		std::vector<std::string>::iterator it = find_ci(queried, name);
+		if(it != queried.end()) {
+			queried.erase(it);
+			sawMember(name, channel);
+		}
+		begin = end + 1;
+	}
+}
+
+/**
+ * A NAMES reply passed NetworkConfig::lazyMembershipThreshold halfway, with
+ * the given names received so far: make the channel lazy, but keep the users
+ * that were known in it if the reply lists them. The names received so far
+ * are checked now, the rest as they come in; at the end of the reply, the
+ * others are known not to be in the channel.
+ */
+void dazeus::Network::namesPassedThreshold(const std::string &channel, const std::vector<std::string> &names) {
+	std::vector<std::string> known;
+	std::map<std::string,std::vector<std::string> >::const_iterator cit = find_ci(knownUsers_, channel);
+	// a channel that was already this big isn't checked user by user
+	if(cit != knownUsers_.end() && cit->second.size() <= config_.lazyMembershipThreshold) {
+		known = cit->second;
+		erase_ci(known, nick_);
+	}
+	setMembershipPolicy(channel, LazyMembership);
+	std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, channel);
+	if(mit == membership_.end() || known.empty())
+		return;
+	mit->second.queried.swap(known);
+	std::vector<std::string>::const_iterator it;
+	for(it = names.begin(); it != names.end(); ++it) {
+		lazyNamesReceived(channel, *it);
+	}
+}
+
+/**
+ * Remember a user of a channel without FullMembership, that talked in it or
+ * was asked about.
+ */
+void dazeus::Network::sawMember(const std::string &user, const std::string &channel) {
+	std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, channel);
+	std::map<std::string,std::vector<std::string> >::iterator cit = find_ci(knownUsers_, channel);
+	if(mit == membership_.end() || mit->second.policy != LazyMembership || cit == knownUsers_.end())
+		return;
+	erase_ci(mit->second.notMembers, user);
+	erase_ci(mit->second.queried, user);
+	if(!contains_ci(cit->second, user)) {
+		cit->second.push_back(user);
+		channelChanged(cit->first);
+	}
+}
+
+void dazeus::Network::notMember(const std::string &user, const std::string &channel) {
+	std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, channel);
+	std::map<std::string,std::vector<std::string> >::const_iterator cit = find_ci(knownUsers_, channel);
+	if(mit == membership_.end() || mit->second.policy != LazyMembership
+	|| cit == knownUsers_.end() || contains_ci(cit->second, user))
+		return;
+	std::vector<std::string> &notMembers = mit->second.notMembers;
+	if(notMembers.size() >= 256) {
+		// a cache, not a list of everyone who left
+		notMembers.clear();
+	}
+	if(!contains_ci(notMembers, user))
+		notMembers.push_back(user);
+}
+
+/**
+ * Forget what is known about the members of channels without FullMembership,
+ * when the channels are left; their policies stay.
+ */
+void dazeus::Network::forgetMembers() {
+	std::map<std::string,ChannelMembership>::iterator it;
+	for(it = membership_.begin(); it != membership_.end(); ++it) {
+		it->second.notMembers.clear();
+		it->second.queried.clear();
+		it->second.querying = false;
+	}
+}
+
+dazeus::Network::MembershipPolicy dazeus::Network::membershipPolicy(const std::string &channel) const {
+	if(membership_.empty())
+		return FullMembership;
+	std::map<std::string,ChannelMembership>::const_iterator it = find_ci(membership_, channel);
+	return it == membership_.end() ? FullMembership : it->second.policy;
+}
+
+/**
+ * @brief Choose which members of a channel are kept track of.
+ *
+ * With LazyMembership, the NAMES reply of the channel is not kept; only the
+ * users that join the channel or talk in it are, and the users asked about
+ * with queryMembership(). With NoMembership, no users are kept at all. This
+ * saves the memory of the member lists of huge channels.
+ *
+ * The policy can be set before the channel is joined. Members that are kept
+ * already are forgotten when the policy is lowered; when it is raised to
+ * FullMembership, the members are asked for again.
+ */
+void dazeus::Network::setMembershipPolicy(const std::string &channel, MembershipPolicy p) {
+	std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, channel);
+	MembershipPolicy old = mit == membership_.end() ? FullMembership : mit->second.policy;
+	if(p == old)
+		return;
+	if(p == FullMembership) {
+		membership_.erase(mit);
+	} else if(mit == membership_.end()) {
+		membership_[channel].policy = p;
+	} else {
+		mit->second.policy = p;
+		mit->second.notMembers.clear();
+		mit->second.queried.clear();
+	}
+
+	std::map<std::string,std::vector<std::string> >::iterator cit = find_ci(knownUsers_, channel);
+	if(cit == knownUsers_.end() || contains_ci(staleChannels_, channel))
+		return;
+	if(p == FullMembership) {
+		if(activeServer_)
+			activeServer_->names(cit->first);
+	} else {
+		// swapping frees the memory of the list, clear() wouldn't
+		std::vector<std::string> users;
+		if(contains_ci(cit->second, nick_))
+			users.push_back(nick_);
+		cit->second.swap(users);
+		channelChanged(cit->first);
+	}
+}
+
+/**
+ * @brief Whether a user is in a channel that was joined.
+ *
+ * For a channel with LazyMembership, the answer may not be known yet; the
+ * channel is then asked for its NAMES, and the answer is known once the NAMES
+ * event for it is delivered. Without membership, or if the channel wasn't
+ * joined, the answer is never known.
+ */
+dazeus::Network::Membership dazeus::Network::queryMembership(const std::string &user, const std::string &channel) {
+	std::map<std::string,std::vector<std::string> >::const_iterator cit = find_ci(knownUsers_, channel);
+	if(cit == knownUsers_.end())
+		return MembershipUnknown;
+	if(contains_ci(cit->second, user))
+		return IsMember;
+	std::map<std::string,ChannelMembership>::iterator mit = find_ci(membership_, channel);
+	if(mit == membership_.end())
+		return contains_ci(staleChannels_, channel) ? MembershipUnknown : IsNotMember;
+	ChannelMembership &m = mit->second;
+	if(m.policy == NoMembership)
+		return MembershipUnknown;
+	if(contains_ci(m.notMembers, user))
+		return IsNotMember;
+	if(!contains_ci(m.queried, user))
+		m.queried.push_back(user);
+	if(!m.querying && activeServer_) {
+		m.querying = true;
+		activeServer_->names(cit->first);
+	}
+	return MembershipUnknown;
 }
 
 void dazeus::Network::slotTopicChanged(const std::string&, const std::string &channel, const std::string &topic) {
 	topics_[channel] = topic;
+	channelChanged(channel);
+}
+
+/**
+ * Called for every line the active server sent. Only these count as a sign of
+ * life: the events made by the library itself, such as our own messages and
+ * DISCONNECT, say nothing about the link.
+ */
+void dazeus::Network::lineReceived(const std::string &command) {
+	if(command == "ERROR")
+		return;
+	// a signal from the server means all is OK
+	deadline_ = 0;
+	if(command != "PONG")
+		pingTimer_.received(std::chrono::steady_clock::now());
 }
 
 void dazeus::Network::slotIrcEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params) {
-	std::string receiver;
-	if(params.size() > 0)
-		receiver = params[0];
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	DAZEUS_PROBE3(event__parsed, config_.name.c_str(), event.c_str(), (int)NetworkMetrics::eventType(event));
+	static const std::string noParam;
+	const std::string &receiver = params.size() > 0 ? params[0] : noParam;
+
+	DAZEUS_PROBE2(state__update__start, config_.name.c_str(), event.c_str());
+
+#define MIN(a) if(params.size() < a) { \
+		log(eventLog, WarningLevel, "Too few parameters for event", {{"network", networkName()}, {"event", event}}); \
+		DAZEUS_PROBE2(state__update__end, config_.name.c_str(), event.c_str()); \
+		return; \
+	}
+	if(event == "PONG") {
+		uint64_t rtt;
+		if(!params.empty() && pingTimer_.pong(params.back(), now, &rtt)) {
+			metrics_->pingLag(rtt);
+			metrics_->setLagEstimate(pingTimer_.smoothedLagMicros(), pingTimer_.jitterMicros());
+		}
+	}
 
-	if(event != "ERROR") {
-		// a signal from the server means all is OK
-		deadline_ = 0;
+	if(coalesce(event, origin, params)) {
+		if(!batching_)
+			flushCoalesced();
+		DAZEUS_PROBE2(state__update__end, config_.name.c_str(), event.c_str());
+		return;
 	}
 
-#define MIN(a) if(params.size() < a) { fprintf(stderr, "Too few parameters for event %s\n", event.c_str()); return; }
 	if(event == "CONNECT") {
-		nextPongDeadline_ = time(NULL) + 30;
+		pingTimer_.reset(now);
+		registered_ = true;
+		metrics_->registered();
 		serverIsActuallyOkay(activeServer_->config());
+		scheduler_->attemptFinished(this, true);
+		if(config_.poolSize > 1) {
+			if(!pool_)
+				pool_ = new ConnectionPool(this);
+			pool_->start();
+		}
 	} else if(event == "JOIN") {
 		MIN(1);
 		joinedChannel(origin, receiver);
@@ -475,65 +1276,433 @@ void dazeus::Network::slotIrcEvent(const std::string &event, const std::string &
 		MIN(2);
 		kickedChannel(origin, params[1], std::string(), receiver);
 	} else if(event == "QUIT") {
-		std::string message;
-		if(params.size() > 0) {
-			message = params[0];
-		}
-		slotQuit(origin, message, receiver);
+		// the only parameter of a QUIT is the message
+		slotQuit(origin, receiver, receiver);
 	} else if(event == "NICK") {
 		MIN(1);
 		slotNickChanged(origin, params[0], receiver);
 	} else if(event == "TOPIC") {
 		MIN(2);
 		slotTopicChanged(origin, params[0], params[1]);
+	} else if(!membership_.empty() && (event == "PRIVMSG" || event == "NOTICE" || event == "ACTION")) {
+		MIN(1);
+		sawMember(origin, receiver);
 	}
 #undef MIN
+	DAZEUS_PROBE2(state__update__end, config_.name.c_str(), event.c_str());
+
+	dispatchEvent(event, origin, params);
+}
+
+/**
+ * Deliver an event to all listeners; the state of the network must be
+ * updated for it already.
+ */
+void dazeus::Network::dispatchEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params) {
+	NetworkMetrics::EventType type = NetworkMetrics::eventType(event);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	std::vector<NetworkListener*>::iterator nlit;
 	for(nlit = networkListeners_.begin(); nlit != networkListeners_.end();
 	    nlit++) {
+		DAZEUS_PROBE3(listener__dispatch__start, config_.name.c_str(), event.c_str(), *nlit);
 		(*nlit)->ircEvent(event, origin, params, this);
+		DAZEUS_PROBE3(listener__dispatch__end, config_.name.c_str(), event.c_str(), *nlit);
+	}
+	metrics_->dispatched(type, std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count());
+
+	std::vector<std::pair<NetworkListener*,ListenerPool*> >::iterator pit;
+	for(pit = pooledListeners_.begin(); pit != pooledListeners_.end(); ++pit) {
+		pit->second->submit(this, pit->first, event, origin, params);
+	}
+
+	if(!batchListeners_.empty()) {
+		batchEvent(event, origin, params);
 	}
 }
 
+/**
+ * Whether a QUIT message is the one servers give to the users they lose in a
+ * netsplit: the names of the two servers that split.
+ */
+static bool isSplitMessage(const std::string &message)
+{
+	size_t space = message.find(' ');
+	if(space == std::string::npos || space == 0 || space == message.size() - 1
+	 || message.find(' ', space + 1) != std::string::npos)
+		return false;
+	bool dot[2] = {false, false};
+	for(size_t i = 0; i < message.size(); ++i) {
+		char c = message[i];
+		if(c == '.')
+			dot[i > space] = true;
+		else if(c != ' ' && c != '-' && c != '*' && !isalnum((unsigned char)c))
+			return false;
+	}
+	return dot[0] && dot[1];
+}
+
+static const std::string &lowerInto(const std::string &s, std::string &buf)
+{
+	buf.resize(s.size());
+	for(size_t i = 0; i < s.size(); ++i) {
+		buf[i] = lowerChar(s[i]);
+	}
+	return buf;
+}
+
+/**
+ * Hold back the QUITs of a netsplit, and the JOINs of the users coming back
+ * from one to the channels they left in it (as far as their members are
+ * tracked), so flushCoalesced() can apply them in bulk and deliver them as
+ * one NETSPLIT or NETJOIN event. Any other event delivers what was held back
+ * first, so listeners get the events in order. Returns whether the event was
+ * held back.
+ */
+bool dazeus::Network::coalesce(const std::string &event, const std::string &origin, const std::vector<std::string> &params)
+{
+	bool split = event == "QUIT" && params.size() == 1 && origin != nick_ && isSplitMessage(params[0]);
+	bool rejoin = !split && event == "JOIN" && params.size() == 1 && !splitMembers_.empty()
+	           && origin != nick_ && isSplitMember(origin, params[0]);
+	if(!split && !rejoin) {
+		flushCoalesced();
+		return false;
+	}
+	const char *summary = split ? "NETSPLIT" : "NETJOIN";
+	if(coalescedSize_ > 0 && coalesced_[0].event != summary)
+		flushCoalesced();
+
+	// the split servers, or the channel joined
+	const std::string &key = params[0];
+	IrcEvent *e = 0;
+	for(size_t i = 0; i < coalescedSize_ && !e; ++i) {
+		if(coalesced_[i].params[0] == key)
+			e = &coalesced_[i];
+	}
+	if(!e) {
+		if(coalescedSize_ == coalesced_.size())
+			coalesced_.push_back(IrcEvent());
+		// assigning to a used event reuses its buffers
+		e = &coalesced_[coalescedSize_++];
+		e->event.assign(summary);
+		e->origin.clear();
+		e->params.resize(1);
+		e->params[0].assign(key);
+	}
+	e->params.push_back(origin);
+	return true;
+}
+
+/**
+ * Apply and deliver the netsplits and netjoins held back by coalesce().
+ *
+ * A netsplit is delivered as a NETSPLIT event, without origin, with the
+ * split servers as the first parameter and the nicks of the users that left
+ * as the others. A netjoin is delivered as a NETJOIN event per channel, with
+ * the channel as the first parameter and the nicks that joined it as the
+ * others. With NetworkConfig::splitUserEvents, every QUIT or JOIN is
+ * delivered after it, too.
+ */
+void dazeus::Network::flushCoalesced()
+{
+	if(coalescedFlushing_)
+		return;
+	coalescedFlushing_ = true;
+	while(coalescedSize_ > 0) {
+		size_t count = coalescedSize_;
+		coalesced_.swap(coalescedDelivering_);
+		coalescedSize_ = 0;
+		for(size_t i = 0; i < count; ++i) {
+			const IrcEvent &e = coalescedDelivering_[i];
+			bool split = e.event == "NETSPLIT";
+			if(split)
+				applySplit(e.params);
+			else
+				applyJoin(e.params);
+			dispatchEvent(e.event, e.origin, e.params);
+			if(config_.splitUserEvents) {
+				std::vector<std::string> params(1, e.params[0]);
+				for(size_t j = 1; j < e.params.size(); ++j) {
+					dispatchEvent(split ? "QUIT" : "JOIN", e.params[j], params);
+				}
+			}
+		}
+	}
+	coalescedFlushing_ = false;
+}
+
+/**
+ * Remove the users that left in a netsplit from all channels at once, and
+ * remember the channels they left for the netjoin.
+ */
+void dazeus::Network::applySplit(const std::vector<std::string> &params)
+{
+	lowered_.resize(params.size() - 1);
+	for(size_t i = 1; i < params.size(); ++i) {
+		lowerInto(params[i], lowered_[i - 1]);
+	}
+	std::sort(lowered_.begin(), lowered_.end());
+
+	size_t remembered = 0;
+	std::map<std::string,SplitChannel>::iterator sit;
+	for(sit = splitMembers_.begin(); sit != splitMembers_.end(); ++sit) {
+		remembered += sit->second.nicks.size();
+	}
+	if(remembered > 262144) {
+		// they are not coming back
+		splitMembers_.clear();
+	}
+
+	std::map<std::string,std::vector<std::string> >::iterator it;
+	for(it = knownUsers_.begin(); it != knownUsers_.end(); ++it) {
+		std::vector<std::string> &users = it->second;
+		// mark who left by their place in lowered_, so they come out sorted
+		splitLeft_.assign(lowered_.size(), false);
+		size_t before = users.size();
+		users.erase(std::remove_if(users.begin(), users.end(), [this](const std::string &u) {
+			std::vector<std::string>::const_iterator l = std::lower_bound(lowered_.begin(), lowered_.end(), lowerInto(u, lower_));
+			if(l == lowered_.end() || *l != lower_)
+				return false;
+			splitLeft_[l - lowered_.begin()] = true;
+			return true;
+		}), users.end());
+		if(users.size() == before)
+			continue;
+		channelChanged(it->first);
+
+		size_t left = 0;
+		for(size_t i = 0; i < lowered_.size(); ++i) {
+			if(!splitLeft_[i])
+				continue;
+			if(left == splitKeys_.size())
+				splitKeys_.push_back(std::string());
+			splitKeys_[left++].assign(lowered_[i]);
+		}
+		SplitChannel &c = splitMembers_[lowerInto(it->first, lower_)];
+		c.compact();
+		merging_.resize(c.nicks.size() + left);
+		std::merge(std::make_move_iterator(c.nicks.begin()), std::make_move_iterator(c.nicks.end()),
+			splitKeys_.begin(), splitKeys_.begin() + left, merging_.begin());
+		merging_.erase(std::unique(merging_.begin(), merging_.end()), merging_.end());
+		c.nicks.swap(merging_);
+		c.gone.assign(c.nicks.size(), false);
+	}
+	identifiedUsers_.erase(std::remove_if(identifiedUsers_.begin(), identifiedUsers_.end(), [this](const std::string &u) {
+		return std::binary_search(lowered_.begin(), lowered_.end(), lowerInto(u, lower_)) && !isKnownUser(u);
+	}), identifiedUsers_.end());
+}
+
+/**
+ * Whether the user left the channel in a netsplit, and didn't join it again.
+ */
+bool dazeus::Network::isSplitMember(const std::string &nick, const std::string &channel)
+{
+	std::map<std::string,SplitChannel>::const_iterator it = splitMembers_.find(lowerInto(channel, lower_));
+	if(it == splitMembers_.end())
+		return false;
+	const std::vector<std::string> &nicks = it->second.nicks;
+	std::vector<std::string>::const_iterator n = std::lower_bound(nicks.begin(), nicks.end(), lowerInto(nick, lower_));
+	return n != nicks.end() && *n == lower_ && !it->second.gone[n - nicks.begin()];
+}
+
+/**
+ * Mark a user that left the channel in a netsplit as gone from it. Returns
+ * true if none of them are left.
+ */
+bool dazeus::Network::splitMemberBack(SplitChannel &c, const std::string &lowerNick)
+{
+	std::vector<std::string>::iterator n = std::lower_bound(c.nicks.begin(), c.nicks.end(), lowerNick);
+	if(n == c.nicks.end() || *n != lowerNick || c.gone[n - c.nicks.begin()])
+		return false;
+	c.gone[n - c.nicks.begin()] = true;
+	if(++c.goneCount == c.nicks.size())
+		return true;
+	if(c.goneCount > c.nicks.size() / 2)
+		c.compact();
+	return false;
+}
+
+/**
+ * Take out the users marked gone.
+ */
+void dazeus::Network::SplitChannel::compact()
+{
+	if(goneCount == 0)
+		return;
+	size_t kept = 0;
+	for(size_t i = 0; i < nicks.size(); ++i) {
+		if(!gone[i])
+			nicks[kept++].swap(nicks[i]);
+	}
+	nicks.resize(kept);
+	gone.assign(kept, false);
+	goneCount = 0;
+}
+
+/**
+ * Forget the channels a user left in a netsplit, as they quit or changed
+ * their nick; a JOIN of theirs is no netjoin anymore.
+ */
+void dazeus::Network::forgetSplitUser(const std::string &nick)
+{
+	if(splitMembers_.empty())
+		return;
+	lowerInto(nick, lower_);
+	std::map<std::string,SplitChannel>::iterator it = splitMembers_.begin();
+	while(it != splitMembers_.end()) {
+		if(splitMemberBack(it->second, lower_))
+			splitMembers_.erase(it++);
+		else
+			++it;
+	}
+}
+
+/**
+ * Add the users coming back from a netsplit to a channel at once. They are
+ * back in it, so a later JOIN of theirs is an ordinary one again.
+ */
+void dazeus::Network::applyJoin(const std::vector<std::string> &params)
+{
+	std::map<std::string,SplitChannel>::iterator sit = splitMembers_.find(lowerInto(params[0], lower_));
+	for(size_t i = 1; i < params.size() && sit != splitMembers_.end(); ++i) {
+		if(splitMemberBack(sit->second, lowerInto(params[i], lower_))) {
+			splitMembers_.erase(sit);
+			sit = splitMembers_.end();
+		}
+	}
+
+	std::map<std::string,std::vector<std::string> >::iterator it = find_ci(knownUsers_, params[0]);
+	if(it == knownUsers_.end() || membershipPolicy(it->first) == NoMembership)
+		return;
+	std::vector<std::string> &users = it->second;
+	lowered_.resize(users.size());
+	for(size_t i = 0; i < users.size(); ++i) {
+		lowerInto(users[i], lowered_[i]);
+	}
+	std::sort(lowered_.begin(), lowered_.end());
+	for(size_t i = 1; i < params.size(); ++i) {
+		if(!std::binary_search(lowered_.begin(), lowered_.end(), lowerInto(params[i], lower_)))
+			users.push_back(params[i]);
+	}
+	channelChanged(it->first);
+}
+
+/**
+ * Queue an event for the batch listeners. Outside of a pass of
+ * processDescriptors(), it is delivered right away.
+ */
+void dazeus::Network::batchEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params)
+{
+	if(batchSize_ == batch_.size()) {
+		batch_.push_back(IrcEvent());
+	}
+	// assigning to a used event reuses its buffers
+	IrcEvent &e = batch_[batchSize_++];
+	e.event.assign(event);
+	e.origin.assign(origin);
+	e.params.assign(params.begin(), params.end());
+	if(!batching_) {
+		flushBatch();
+	}
+}
+
+/**
+ * Deliver the queued events to the batch listeners. Events queued while they
+ * are being delivered, because a listener sent a message for example, are
+ * delivered in the next batch.
+ */
+void dazeus::Network::flushBatch()
+{
+	if(flushing_)
+		return;
+	flushing_ = true;
+	while(batchSize_ > 0) {
+		size_t count = batchSize_;
+		batch_.swap(delivering_);
+		batchSize_ = 0;
+		std::vector<BatchNetworkListener*>::iterator it;
+		for(it = batchListeners_.begin(); it != batchListeners_.end(); ++it) {
+			(*it)->ircEvents(&delivering_[0], count, this);
+		}
+	}
+	flushing_ = false;
+}
+
 void dazeus::Network::addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd) {
-	activeServer_->addDescriptors(in_set, out_set, maxfd);
+	reapFailedServer();
+	if(activeServer_)
+		activeServer_->addDescriptors(in_set, out_set, maxfd);
+	if(pool_)
+		pool_->addDescriptors(in_set, out_set, maxfd);
+	if(wakeup_[0] >= 0) {
+		FD_SET(wakeup_[0], in_set);
+		if(wakeup_[0] > *maxfd)
+			*maxfd = wakeup_[0];
+	}
 }
 
 void dazeus::Network::processDescriptors(fd_set *in_set, fd_set *out_set) {
+	if(wakeup_[0] >= 0 && FD_ISSET(wakeup_[0], in_set)) {
+		char buf[64];
+		while(read(wakeup_[0], buf, sizeof(buf)) > 0) {}
+	}
+	runPosted();
 	if(deleteServer_) {
-		deleteServer_ = false;
-		delete activeServer_;
-		activeServer_ = 0;
-		connectToNetwork();
+		reapFailedServer();
 		return;
 	}
-	activeServer_->processDescriptors(in_set, out_set);
+	if(activeServer_) {
+		batching_ = true;
+		activeServer_->processDescriptors(in_set, out_set);
+		if(pool_)
+			pool_->processDescriptors(in_set, out_set);
+		// a netsplit is longer than one read; keep collecting it while
+		// the rest is waiting
+		if(deleteServer_ || !activeServer_->inputPending())
+			flushCoalesced();
+		batching_ = false;
+		flushBatch();
+	}
 }
 
+/**
+ * Handles all timers of this network: the connect and PING deadlines of the
+ * active server, and a planned reconnect if there is no active server.
+ */
 void dazeus::Network::checkTimeouts() {
+	runPosted();
+	reapFailedServer();
+	if(snapshot_ && time(NULL) >= snapshotDue_) {
+		saveSnapshot();
+		snapshotDue_ = time(NULL) + snapshot_->interval();
+	}
+	if(!activeServer_) {
+		if(scheduler_->takeDue(this)) {
+			DAZEUS_PROBE1(reconnect__start, config_.name.c_str());
+			connectToNetwork(true);
+		}
+		return;
+	}
+	if(pool_)
+		pool_->checkTimeouts();
 	if(deadline_ > time(NULL)) {
 		return; // deadline is set, not passed
 	}
 	if(deadline_ == 0) {
-		if(time(NULL) > nextPongDeadline_) {
-			// We've passed the nextPongDeadline, send the next PING
-			nextPongDeadline_ = time(NULL) + 30;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(pingTimer_.due(now)) {
 			deadline_ = time(NULL) + config_.pongTimeout;
-			activeServer_->ping();
+			activeServer_->ping(pingTimer_.sent(now));
 		}
 		return;
 	}
 
-	// Connection didn't finish in time, disconnect and try again
+	// Connection didn't finish in time, disconnect and try again later
 	flagUndesirableServer(activeServer()->config());
 	activeServer_->disconnectFromServer(dazeus::Network::TimeoutReason);
 	onFailedConnection();
-	// no need to delete the server later, though: we can do it from here
-	// TODO: use smart ptrs so this mess gets elegant by refcounting
-	deleteServer_ = false;
-	delete activeServer_;
-	activeServer_ = 0;
-	connectToNetwork(true);
+	failureReason_ = TimeoutReason;
+	reapFailedServer();
 }
 
 void dazeus::Network::run() {
@@ -548,8 +1717,22 @@ void dazeus::Network::run(std::vector<Network*> networks) {
 	std::vector<Network*>::const_iterator nit;
 	struct timeval timeout;
 	while(1) {
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
+		// Fire timers, and sleep no longer than until the next planned
+		// reconnect
+		long wait = 1000;
+		bool pending = false;
+		for(nit = networks.begin(); nit != networks.end(); ++nit) {
+			(*nit)->checkTimeouts();
+			long due = (*nit)->reconnectScheduler()->msUntilDue(*nit);
+			if(due >= 0) {
+				pending = true;
+				if(due < wait)
+					wait = due;
+			}
+		}
+		timeout.tv_sec = wait / 1000;
+		timeout.tv_usec = (wait % 1000) * 1000;
+
 		highest = 0;
 		FD_ZERO(&sockets);
 		FD_ZERO(&out_sockets);
@@ -562,16 +1745,21 @@ void dazeus::Network::run(std::vector<Network*> networks) {
 			}
 		}
 
-		// If all networks are disconnected, nothing will happen
-		// anymore; even the listeners won't be triggered anymore.
-		// In such a case, break the event loop
+		// If all networks are disconnected and none of them will
+		// reconnect, nothing will happen anymore; even the listeners
+		// won't be triggered anymore. In such a case, break the event
+		// loop
 		if(highest == 0) {
-			return;
+			if(!pending) {
+				return;
+			}
+			select(0, NULL, NULL, NULL, &timeout);
+			continue;
 		}
 
 		int socks = select(highest + 1, &sockets, &out_sockets, NULL, &timeout);
 		if(socks < 0) {
-			perror("select() failed");
+			log(loopLog, ErrorLevel, "select() failed", {{"error", strerror(errno)}});
 			return;
 		}
 		else if(socks == 0) {
@@ -584,3 +1772,109 @@ void dazeus::Network::run(std::vector<Network*> networks) {
 		}
 	}
 }
+
+static long earliest(long a, long b)
+{
+	if(a < 0)
+		return b;
+	return b >= 0 && b < a ? b : a;
+}
+
+/**
+ * The descriptors this network wants to be told about, for event loops other
+ * than select(). When a descriptor is ready, call onReadable() or
+ * onWritable() with it; once nextTimeout() passes, call onTimer(). After
+ * any of those, and when the callback of setInterestCallback() was called,
+ * ask for the interests again: descriptors come and go, and may be closed and
+ * reused. Like with addDescriptors(), descriptors must be below FD_SETSIZE.
+ */
+void dazeus::Network::interests(std::vector<Interest> &out)
+{
+	out.clear();
+	fd_set in_set, out_set;
+	int maxfd = -1;
+	FD_ZERO(&in_set);
+	FD_ZERO(&out_set);
+	addDescriptors(&in_set, &out_set, &maxfd);
+	for(int fd = 0; fd <= maxfd; ++fd) {
+		Interest i = {fd, FD_ISSET(fd, &in_set) != 0, FD_ISSET(fd, &out_set) != 0};
+		if(i.read || i.write)
+			out.push_back(i);
+	}
+}
+
+/**
+ * Milliseconds until onTimer() is to be called, or -1 if no timer is
+ * pending: the connect and PING deadlines, the next PING, a planned
+ * reconnect, the snapshot and the connection pool.
+ */
+long dazeus::Network::nextTimeout()
+{
+	{
+		std::lock_guard<std::mutex> lock(postMutex_);
+		if(!posted_.empty())
+			return 0;
+	}
+	if(deleteServer_)
+		return 0;
+	time_t now = time(NULL);
+	long wait = scheduler_->msUntilDue(this);
+	if(snapshot_)
+		wait = earliest(wait, snapshotDue_ > now ? (snapshotDue_ - now) * 1000 : 0);
+	if(!activeServer_)
+		return wait;
+	if(deadline_ != 0) {
+		wait = earliest(wait, deadline_ > now ? (deadline_ - now) * 1000 : 0);
+	} else {
+		long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			pingTimer_.nextDue() - std::chrono::steady_clock::now()).count();
+		wait = earliest(wait, ms > 0 ? ms : 0);
+	}
+	if(pool_)
+		wait = earliest(wait, pool_->msUntilDue());
+	return wait;
+}
+
+void dazeus::Network::onReadable(int fd)
+{
+	ready(fd, false);
+}
+
+void dazeus::Network::onWritable(int fd)
+{
+	ready(fd, true);
+}
+
+void dazeus::Network::onTimer()
+{
+	checkTimeouts();
+}
+
+void dazeus::Network::ready(int fd, bool write)
+{
+	if(fd < 0 || fd >= FD_SETSIZE)
+		return;
+	fd_set in_set, out_set;
+	FD_ZERO(&in_set);
+	FD_ZERO(&out_set);
+	FD_SET(fd, write ? &out_set : &in_set);
+	processDescriptors(&in_set, &out_set);
+}
+
+/**
+ * Have the given function called when interests() may have changed by
+ * something other than onReadable(), onWritable() and onTimer(): when the
+ * network connects or disconnects, or something is sent to the server. The
+ * function may be called from within another call to the network, so it
+ * shouldn't call the network itself, but have its event loop do so later.
+ */
+void dazeus::Network::setInterestCallback( std::function<void(Network*)> f )
+{
+	interestCallback_ = f;
+}
+
+void dazeus::Network::interestChanged()
+{
+	if(interestCallback_)
+		interestCallback_(this);
+}
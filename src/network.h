@@ -11,13 +11,29 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <chrono>
+#include <functional>
+#include <mutex>
 #include "config.h"
+#include "pingtimer.h"
 
 namespace dazeus {
 
 class Network;
 class Server;
+class Resolver;
+class ReconnectScheduler;
+class TrafficRecorder;
+class NetworkMetrics;
+class ListenerPool;
+class ChannelSnapshot;
+class ConnectionPool;
 
+/**
+ * Receives the events of a Network. The strings passed to ircEvent() are
+ * reused for the next event once it returns; a listener that wants to keep
+ * any of them must copy them.
+ */
 class NetworkListener
 {
   public:
@@ -26,10 +42,34 @@ class NetworkListener
                           const std::vector<std::string> &params, Network *n ) = 0;
 };
 
+struct IrcEvent
+{
+  std::string event;
+  std::string origin;
+  std::vector<std::string> params;
+};
+
+/**
+ * Receives the events of a Network in batches: all events of one pass of
+ * processDescriptors(), in the order NetworkListeners got them, after they
+ * got them. Events that happen outside of such a pass, such as the ones for
+ * messages a listener sends, come in a batch of their own. Like with
+ * NetworkListener, the events are reused once ircEvents() returns.
+ */
+class BatchNetworkListener
+{
+  public:
+    virtual ~BatchNetworkListener() {}
+    virtual void ircEvents(const IrcEvent *events, size_t count, Network *n) = 0;
+};
+
 class Network
 {
 
   friend class Server;
+  friend class ReplayDriver;
+  friend class ListenerPool;
+  friend class ConnectionPool;
 
   public:
     Network(const NetworkConfig &c);
@@ -41,6 +81,10 @@ class Network
     void               addListener( NetworkListener *nl ) {
       networkListeners_.push_back(nl);
     }
+    void               addListener( NetworkListener *nl, ListenerPool *pool );
+    void               addBatchListener( BatchNetworkListener *bl ) {
+      batchListeners_.push_back(bl);
+    }
 
     enum DisconnectReason {
       UnknownReason,
@@ -61,6 +105,27 @@ class Network
       OpAndVoiceMode = OpMode | VoiceMode
     };
 
+    // which members of a channel are kept track of
+    enum MembershipPolicy {
+      FullMembership, // everyone, from the NAMES reply
+      LazyMembership, // only users seen joining or talking, or asked about
+      NoMembership    // nobody
+    };
+
+    enum Membership {
+      IsMember,
+      IsNotMember,
+      MembershipUnknown
+    };
+
+    // a descriptor to watch for an event loop other than select(), see
+    // interests()
+    struct Interest {
+      int  fd;
+      bool read;
+      bool write;
+    };
+
     bool                        autoConnectEnabled() const;
     const std::vector<ServerConfig> &servers() const;
     std::string                 nick() const;
@@ -73,9 +138,27 @@ class Network
     std::map<std::string,ChannelMode> usersInChannel(std::string channel) const;
     bool                        isIdentified(const std::string &user) const;
     bool                        isKnownUser(const std::string &user) const;
+    bool                        isStale(const std::string &channel) const;
+    MembershipPolicy            membershipPolicy(const std::string &channel) const;
+    void                        setMembershipPolicy(const std::string &channel, MembershipPolicy p);
+    Membership                  queryMembership(const std::string &user, const std::string &channel);
+    Resolver                   *resolver() const;
+    void                        setResolver( Resolver *r );
+    ReconnectScheduler         *reconnectScheduler() const;
+    void                        setReconnectScheduler( ReconnectScheduler *s );
+    bool                        reconnectPending() const;
+    TrafficRecorder            *recorder() const;
+    void                        setRecorder( TrafficRecorder *r );
+    ChannelSnapshot            *snapshot() const;
+    void                        setSnapshot( ChannelSnapshot *s );
+    const NetworkMetrics       &metrics() const;
+    ConnectionPool             *pool() const;
+    const PingTimer            &pingTimer() const;
 
     void connectToNetwork( bool reconnect = false );
     void disconnectFromNetwork( DisconnectReason reason = UnknownReason );
+    bool handoff( int socket, std::string *error = 0 );
+    bool resume( int socket, std::string *error = 0 );
     void checkTimeouts();
     void joinChannel( std::string channel );
     void leaveChannel( std::string channel );
@@ -90,6 +173,13 @@ class Network
     void processDescriptors(fd_set *in_set, fd_set *out_set);
     void run();
     static void run(std::vector<Network*> networks);
+    void post( std::function<void(Network*)> f );
+    void interests(std::vector<Interest> &out);
+    long nextTimeout();
+    void onReadable(int fd);
+    void onWritable(int fd);
+    void onTimer();
+    void setInterestCallback( std::function<void(Network*)> f );
 
   private:
     // explicitly disable copy constructor
@@ -99,20 +189,113 @@ class Network
     void flagUndesirableServer( const ServerConfig &sc );
     void serverIsActuallyOkay( const ServerConfig &sc );
     void connectToServer(const ServerConfig &conf, bool reconnect);
+    ServerConfig bestServer();
+    Server *sender(const std::string &target);
+    void reapFailedServer();
+    void batchEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params);
+    void flushBatch();
+    void runPosted();
+    void channelChanged(const std::string &channel);
+    void saveSnapshot();
+    bool coalesce(const std::string &event, const std::string &origin, const std::vector<std::string> &params);
+    void flushCoalesced();
+    void applySplit(const std::vector<std::string> &params);
+    void applyJoin(const std::vector<std::string> &params);
+    bool isSplitMember(const std::string &nick, const std::string &channel);
+    void forgetSplitUser(const std::string &nick);
+    void sawMember(const std::string &user, const std::string &channel);
+    void lazyNamesReceived(const std::string &channel, const std::string &names);
+    void namesPassedThreshold(const std::string &channel, const std::vector<std::string> &names);
+    void notMember(const std::string &user, const std::string &channel);
+    void forgetMembers();
+    void dispatchEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params);
+    void ready(int fd, bool write);
+    void interestChanged();
+
+    // the membership state of a channel without FullMembership
+    struct ChannelMembership {
+      ChannelMembership() : policy(FullMembership), notMembers(), queried(), querying(false) {}
+      MembershipPolicy policy;
+      // users known not to be in the channel, and users asked about that
+      // the NAMES reply will tell about
+      std::vector<std::string> notMembers;
+      std::vector<std::string> queried;
+      bool querying;
+    };
+
+    // the users that left a channel in a netsplit: their lowercased nicks,
+    // sorted; the ones that joined it again are marked gone, and only taken
+    // out once they are half of them
+    struct SplitChannel {
+      SplitChannel() : nicks(), gone(), goneCount(0) {}
+      void compact();
+      std::vector<std::string> nicks;
+      std::vector<bool> gone;
+      size_t goneCount;
+    };
+    bool splitMemberBack(SplitChannel &c, const std::string &lowerNick);
 
     Server               *activeServer_;
+    Resolver             *resolver_;
+    ReconnectScheduler   *scheduler_;
+    TrafficRecorder      *recorder_;
+    ChannelSnapshot      *snapshot_;
+    NetworkMetrics       *metrics_;
+    // the extra connections, if NetworkConfig::poolSize asked for them
+    ConnectionPool       *pool_;
     NetworkConfig config_;
     std::map<std::string,int> undesirables_;
     bool                  deleteServer_;
+    DisconnectReason      failureReason_;
     std::vector<std::string>        identifiedUsers_;
     std::map<std::string,std::vector<std::string> > knownUsers_;
     std::map<std::string,std::string> topics_;
+    std::map<std::string,ChannelMembership> membership_;
+    // channels restored from the snapshot that weren't rejoined yet
+    std::vector<std::string>        staleChannels_;
+    // channels that changed since the snapshot was last saved
+    std::vector<std::string>        dirtyChannels_;
+    time_t                snapshotDue_;
+    // netsplits and netjoins held back by coalesce(), as the NETSPLIT and
+    // NETJOIN events they become; only the first coalescedSize_ are queued
+    std::vector<IrcEvent> coalesced_;
+    std::vector<IrcEvent> coalescedDelivering_;
+    size_t                coalescedSize_;
+    bool                  coalescedFlushing_;
+    // the users that left each channel in a netsplit, by lowercased channel
+    std::map<std::string,SplitChannel> splitMembers_;
+    // buffers of flushCoalesced(): sorted lowercased nicks, a lowercased
+    // nick, the next nicks of a channel in splitMembers_, the sorted
+    // lowercased nicks that left a channel, and which of lowered_ did
+    std::vector<std::string> lowered_;
+    std::string           lower_;
+    std::vector<std::string> merging_;
+    std::vector<std::string> splitKeys_;
+    std::vector<bool>     splitLeft_;
     std::vector<NetworkListener*>   networkListeners_;
+    std::vector<BatchNetworkListener*> batchListeners_;
+    // events for the batch listeners; only the first batchSize_ are
+    // queued, the rest are kept for their buffers
+    std::vector<IrcEvent> batch_;
+    std::vector<IrcEvent> delivering_;
+    size_t                batchSize_;
+    bool                  batching_;
+    bool                  flushing_;
+    std::vector<std::pair<NetworkListener*,ListenerPool*> > pooledListeners_;
+    std::mutex            postMutex_;
+    std::vector<std::function<void(Network*)> > posted_;
+    // written to by post() to wake up the event loop; only open if there
+    // are pooled listeners
+    int                   wakeup_[2];
+    // told when interests() may have changed outside of the entry points
+    std::function<void(Network*)> interestCallback_;
     std::string           nick_;
+    bool                  registered_;
     time_t deadline_;
-    time_t nextPongDeadline_;
+    PingTimer             pingTimer_;
 
     void onFailedConnection();
+    void lineReceived(const std::string &command);
     void joinedChannel(const std::string &user, const std::string &receiver);
     void kickedChannel(const std::string &user, const std::string&, const std::string&, const std::string &receiver);
     void partedChannel(const std::string &user, const std::string &, const std::string &receiver);
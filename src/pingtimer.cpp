@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "pingtimer.h"
+
+#define TOKEN_PREFIX "dazeus-"
+
+dazeus::PingTimer::PingTimer(unsigned int minIntervalSecs, unsigned int maxIntervalSecs)
+: minInterval_(std::chrono::seconds(minIntervalSecs))
+, maxInterval_(std::chrono::seconds(maxIntervalSecs < minIntervalSecs ? minIntervalSecs : maxIntervalSecs))
+, interval_(minInterval_)
+, connected_()
+, lastInbound_()
+, lastPing_()
+, lastAnswered_()
+, trafficSincePing_(false)
+, samples_(0)
+, srtt_(0)
+, rttvar_(0)
+{}
+
+/**
+ * Start over for a new connection. Lag samples of the previous one are
+ * forgotten, as the new connection may well be to another server.
+ */
+void dazeus::PingTimer::reset(Clock::time_point now)
+{
+	interval_ = minInterval_;
+	connected_ = now;
+	lastInbound_ = now;
+	lastPing_ = now;
+	lastAnswered_ = now;
+	trafficSincePing_ = false;
+	samples_ = 0;
+	srtt_ = 0;
+	rttvar_ = 0;
+}
+
+/**
+ * Something other than a PONG was received from the server.
+ */
+void dazeus::PingTimer::received(Clock::time_point now)
+{
+	lastInbound_ = now;
+	trafficSincePing_ = true;
+}
+
+bool dazeus::PingTimer::due(Clock::time_point now) const
+{
+	Clock::time_point quietSince = lastInbound_ > lastPing_ ? lastInbound_ : lastPing_;
+	return now - quietSince >= minInterval_ || now - lastPing_ >= interval_;
+}
+
+/**
+ * When due() becomes true, if nothing is received before then.
+ */
+dazeus::PingTimer::Clock::time_point dazeus::PingTimer::nextDue() const
+{
+	Clock::time_point quietSince = lastInbound_ > lastPing_ ? lastInbound_ : lastPing_;
+	Clock::time_point quiet = quietSince + minInterval_;
+	Clock::time_point busy = lastPing_ + interval_;
+	return quiet < busy ? quiet : busy;
+}
+
+/**
+ * A PING is about to be sent; adapts the interval and returns the token to
+ * send with it.
+ */
+std::string dazeus::PingTimer::sent(Clock::time_point now)
+{
+	if(trafficSincePing_) {
+		interval_ = interval_ * 2 > maxInterval_ ? maxInterval_ : interval_ * 2;
+	} else {
+		interval_ = interval_ / 2 < minInterval_ ? minInterval_ : interval_ / 2;
+	}
+	trafficSincePing_ = false;
+	lastPing_ = now;
+
+	char token[64];
+	snprintf(token, sizeof(token), TOKEN_PREFIX "%llu", (unsigned long long)
+		std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count());
+	return token;
+}
+
+/**
+ * A PONG was received with the given token. Returns true and takes a lag
+ * sample if it answers one of our PINGs on this connection that wasn't
+ * answered before; PONGs to earlier PINGs than the last answered one are
+ * ignored too, as the server answers in order.
+ */
+bool dazeus::PingTimer::pong(const std::string &token, Clock::time_point now, uint64_t *rttMicros)
+{
+	if(token.compare(0, strlen(TOKEN_PREFIX), TOKEN_PREFIX) != 0)
+		return false;
+	const char *digits = token.c_str() + strlen(TOKEN_PREFIX);
+	char *end;
+	unsigned long long micros = strtoull(digits, &end, 10);
+	if(end == digits || *end != 0)
+		return false;
+	// a token from the future might not even fit in a time point
+	if(micros > (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count())
+		return false;
+	Clock::time_point sentAt = Clock::time_point(std::chrono::microseconds(micros));
+	if(sentAt <= lastAnswered_ || sentAt < connected_ || sentAt > lastPing_ || sentAt > now)
+		return false;
+	lastAnswered_ = sentAt;
+
+	uint64_t rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - sentAt).count();
+	if(samples_ == 0) {
+		srtt_ = rtt;
+		rttvar_ = rtt / 2;
+	} else {
+		uint64_t deviation = rtt > srtt_ ? rtt - srtt_ : srtt_ - rtt;
+		rttvar_ = (3 * rttvar_ + deviation) / 4;
+		srtt_ = (7 * srtt_ + rtt) / 8;
+	}
+	++samples_;
+	if(rttMicros)
+		*rttMicros = rtt;
+	return true;
+}
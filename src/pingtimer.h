@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef PINGTIMER_H
+#define PINGTIMER_H
+
+#include <string>
+#include <chrono>
+#include <stdint.h>
+
+namespace dazeus {
+
+/**
+ * Decides when a connection needs a PING, and measures the lag to the server
+ * from the PONGs.
+ *
+ * Every PING carries a token with the moment it was sent, read from the
+ * monotonic clock, and the server echoes it in its PONG. A PONG carrying one
+ * of our tokens gives a round-trip sample, from which a smoothed lag and its
+ * jitter are kept like TCP does (RFC 6298).
+ *
+ * Inbound traffic shows the connection is alive as well as a PONG does, so a
+ * busy connection only gets a keepalive PING every interval, to keep the lag
+ * up to date. When there was traffic since the previous PING, that interval
+ * doubles, up to the maximum; when there wasn't, it halves, down to the
+ * minimum. A connection that has been quiet for the minimum interval gets a
+ * PING right away, however busy it was before, so a dead link is noticed as
+ * quickly as on a connection that was always quiet.
+ */
+class PingTimer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	PingTimer(unsigned int minIntervalSecs = 30, unsigned int maxIntervalSecs = 300);
+
+	void reset(Clock::time_point now);
+	void received(Clock::time_point now);
+	bool due(Clock::time_point now) const;
+	Clock::time_point nextDue() const;
+	std::string sent(Clock::time_point now);
+	bool pong(const std::string &token, Clock::time_point now, uint64_t *rttMicros = 0);
+
+	Clock::duration interval() const { return interval_; }
+	uint64_t samples() const { return samples_; }
+	uint64_t smoothedLagMicros() const { return srtt_; }
+	uint64_t jitterMicros() const { return rttvar_; }
+
+private:
+	Clock::duration minInterval_;
+	Clock::duration maxInterval_;
+	Clock::duration interval_;
+	Clock::time_point connected_;
+	Clock::time_point lastInbound_;
+	Clock::time_point lastPing_;
+	Clock::time_point lastAnswered_;
+	bool trafficSincePing_;
+	uint64_t samples_;
+	uint64_t srtt_;
+	uint64_t rttvar_;
+};
+
+}
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/**
+ * Static tracepoints (USDT probes) on the event pipeline, under the provider
+ * name dazeus_irc. A probe is a single nop until a tracer such as bpftrace or
+ * perf attaches to it, so they stay compiled in. Without sys/sdt.h they are
+ * left out entirely.
+ *
+ *   line__received(network, command, bytes)
+ *   event__parsed(network, event, type)
+ *   state__update__start(network, event), state__update__end(network, event)
+ *   listener__dispatch__start(network, event, listener)
+ *   listener__dispatch__end(network, event, listener)
+ *   command__queued(network, line, bytes)
+ *   command__written(network, commands)
+ *   reconnect__scheduled(network, reason, delay_ms)
+ *   reconnect__start(network)
+ *
+ * Strings are passed as C strings, listeners as pointers.
+ */
+
+#ifdef DAZEUS_HAVE_SDT
+#include <sys/sdt.h>
+#define DAZEUS_PROBE1(name, a) DTRACE_PROBE1(dazeus_irc, name, a)
+#define DAZEUS_PROBE2(name, a, b) DTRACE_PROBE2(dazeus_irc, name, a, b)
+#define DAZEUS_PROBE3(name, a, b, c) DTRACE_PROBE3(dazeus_irc, name, a, b, c)
+#else
+#define DAZEUS_PROBE1(name, a) do {} while(0)
+#define DAZEUS_PROBE2(name, a, b) do {} while(0)
+#define DAZEUS_PROBE3(name, a, b, c) do {} while(0)
+#endif
+
+#endif
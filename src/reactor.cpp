@@ -0,0 +1,271 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <algorithm>
+
+#include "reactor.h"
+#include "epollreactor.h"
+#include "uringreactor.h"
+
+dazeus::Reactor::Reactor()
+: descriptor_(-1)
+, syscalls_(0)
+, networks_()
+, changed_()
+, watched_()
+, owners_()
+, wakeup_()
+, running_(false)
+, interests_()
+, ready_()
+{
+}
+
+dazeus::Reactor::~Reactor()
+{
+	std::vector<Network*>::iterator it;
+	for(it = networks_.begin(); it != networks_.end(); ++it) {
+		(*it)->setInterestCallback(std::function<void(Network*)>());
+	}
+}
+
+/**
+ * A reactor with the best backend of the system: io_uring, or epoll if
+ * io_uring isn't available. Returns 0 if neither is.
+ */
+dazeus::Reactor *dazeus::Reactor::create()
+{
+#ifdef __linux__
+	Reactor *r = new IoUringReactor();
+	if(r->valid())
+		return r;
+	delete r;
+	r = new EpollReactor();
+	if(r->valid())
+		return r;
+	delete r;
+#endif
+	return 0;
+}
+
+void dazeus::Reactor::add(Network *n)
+{
+	if(std::find(networks_.begin(), networks_.end(), n) != networks_.end())
+		return;
+	networks_.push_back(n);
+	n->setInterestCallback([this](Network *changed) { this->changed(changed); });
+	changed(n);
+}
+
+void dazeus::Reactor::remove(Network *n)
+{
+	std::vector<Network*>::iterator it = std::find(networks_.begin(), networks_.end(), n);
+	if(it == networks_.end())
+		return;
+	networks_.erase(it);
+	it = std::find(changed_.begin(), changed_.end(), n);
+	if(it != changed_.end())
+		changed_.erase(it);
+	n->setInterestCallback(std::function<void(Network*)>());
+	unwatchNetwork(n, true);
+}
+
+void dazeus::Reactor::changed(Network *n)
+{
+	if(std::find(changed_.begin(), changed_.end(), n) == changed_.end())
+		changed_.push_back(n);
+	if(!running_ && wakeup_)
+		wakeup_();
+}
+
+/**
+ * Stop watching the descriptors of the network that aren't in interests_,
+ * or all of them. Descriptors other networks want too stay watched for them.
+ */
+void dazeus::Reactor::unwatchNetwork(Network *n, bool all)
+{
+	std::map<int,std::vector<Watch> >::iterator it = watched_.begin();
+	while(it != watched_.end()) {
+		bool wanted = false;
+		for(size_t i = 0; !all && i < interests_.size(); ++i) {
+			if(interests_[i].fd == it->first)
+				wanted = true;
+		}
+		std::vector<Watch> &owners = it->second;
+		size_t i = 0;
+		while(i < owners.size() && owners[i].network != n)
+			++i;
+		if(i == owners.size() || wanted) {
+			++it;
+			continue;
+		}
+		owners.erase(owners.begin() + i);
+		if(owners.empty()) {
+			unwatch(it->first);
+			watched_.erase(it++);
+		} else if(!rewatch(it->first, owners)) {
+			watched_.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+/**
+ * Watch a descriptor for the events all its owners want.
+ */
+bool dazeus::Reactor::rewatch(int fd, const std::vector<Watch> &owners)
+{
+	unsigned int events = 0;
+	for(size_t i = 0; i < owners.size(); ++i) {
+		events |= owners[i].events;
+	}
+	return watch(fd, events);
+}
+
+/**
+ * Bring the watched descriptors up to date with the interests of the
+ * networks that changed.
+ */
+void dazeus::Reactor::sync()
+{
+	// asking for the interests may reap a failed server, and a listener
+	// may change the network again while told about it
+	while(!changed_.empty()) {
+		Network *n = changed_.back();
+		changed_.pop_back();
+		n->interests(interests_);
+		unwatchNetwork(n, false);
+		std::vector<Network::Interest>::const_iterator it;
+		for(it = interests_.begin(); it != interests_.end(); ++it) {
+			Watch w = {n, (it->read ? (unsigned int)Readable : 0) | (it->write ? (unsigned int)Writable : 0)};
+			std::vector<Watch> &owners = watched_[it->fd];
+			size_t i = 0;
+			while(i < owners.size() && owners[i].network != n)
+				++i;
+			if(i == owners.size())
+				owners.push_back(w);
+			else
+				owners[i] = w;
+			// a descriptor that was closed and reused isn't watched
+			// anymore, so unchanged ones are watched again too
+			if(!rewatch(it->fd, owners))
+				watched_.erase(it->fd);
+		}
+	}
+}
+
+/**
+ * Whether the descriptor is watched for the network.
+ */
+bool dazeus::Reactor::watching(int fd, Network *n) const
+{
+	std::map<int,std::vector<Watch> >::const_iterator it = watched_.find(fd);
+	if(it == watched_.end())
+		return false;
+	for(size_t i = 0; i < it->second.size(); ++i) {
+		if(it->second[i].network == n)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Milliseconds until runOnce() has timers to fire, or -1 if there are none.
+ */
+long dazeus::Reactor::timeout()
+{
+	if(!changed_.empty())
+		return 0;
+	long wait = -1;
+	std::vector<Network*>::const_iterator it;
+	for(it = networks_.begin(); it != networks_.end(); ++it) {
+		long ms = (*it)->nextTimeout();
+		if(ms >= 0 && (wait < 0 || ms < wait))
+			wait = ms;
+	}
+	return wait;
+}
+
+/**
+ * Wait until a descriptor is ready, a timer is due or maxWaitMs passed (-1
+ * to wait as long as needed), and handle what happened. Returns false if
+ * waiting failed.
+ */
+bool dazeus::Reactor::runOnce(long maxWaitMs)
+{
+	running_ = true;
+	sync();
+	long wait = timeout();
+	if(wait < 0 || (maxWaitMs >= 0 && maxWaitMs < wait))
+		wait = maxWaitMs;
+	ready_.clear();
+	if(!this->wait(wait, ready_)) {
+		running_ = false;
+		return false;
+	}
+
+	for(size_t i = 0; i < ready_.size(); ++i) {
+		int fd = ready_[i].fd;
+		std::map<int,std::vector<Watch> >::const_iterator it = watched_.find(fd);
+		if(it == watched_.end())
+			continue;
+		// the owners may change while they are told
+		owners_ = it->second;
+		for(size_t j = 0; j < owners_.size(); ++j) {
+			Network *n = owners_[j].network;
+			if(!watching(fd, n))
+				continue;
+			unsigned int events = ready_[i].events;
+			if(events & Failed)
+				events |= owners_[j].events;
+			events &= owners_[j].events;
+			changed(n);
+			if(events & Readable)
+				n->onReadable(fd);
+			// a listener may have removed the network
+			if((events & Writable) && watching(fd, n))
+				n->onWritable(fd);
+		}
+	}
+
+	for(size_t i = 0; i < networks_.size(); ++i) {
+		Network *n = networks_[i];
+		if(n->nextTimeout() == 0) {
+			changed(n);
+			n->onTimer();
+		}
+	}
+	// so the descriptor is up to date for a loop that watches it
+	sync();
+	running_ = false;
+	return true;
+}
+
+/**
+ * Run the networks until none of them has a connection with descriptors to
+ * watch or a planned reconnect, like Network::run().
+ */
+void dazeus::Reactor::run()
+{
+	while(1) {
+		sync();
+		bool active = false;
+		std::map<int,std::vector<Watch> >::const_iterator wit;
+		for(wit = watched_.begin(); wit != watched_.end(); ++wit) {
+			for(size_t i = 0; i < wit->second.size(); ++i) {
+				if(wit->second[i].network->activeServer())
+					active = true;
+			}
+		}
+		std::vector<Network*>::const_iterator it;
+		for(it = networks_.begin(); it != networks_.end(); ++it) {
+			if((*it)->reconnectPending())
+				active = true;
+		}
+		if(!active || !runOnce())
+			return;
+	}
+}
@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <vector>
+#include <map>
+#include <functional>
+#include <stdint.h>
+
+#include "network.h"
+
+namespace dazeus {
+
+/**
+ * Runs Networks using their readiness entry points, instead of the select()
+ * loop of Network::run(). Nothing is polled: runOnce() sleeps until a
+ * descriptor is ready or the earliest timer of the networks passes. How the
+ * descriptors are waited for is up to the subclass: EpollReactor uses
+ * epoll, IoUringReactor io_uring; create() picks the best one available.
+ *
+ * The descriptor of a reactor can itself be watched by another event loop,
+ * which then calls runOnce(0) when it is readable or when timeout() passed;
+ * see AsioReactor. Such a loop calls flush() before it waits, and is told
+ * through the wakeup callback when a network changed its interests outside
+ * of runOnce(), so it can call runOnce(0) right away.
+ *
+ * Like the networks themselves, a reactor must only be used from one thread.
+ */
+class Reactor {
+public:
+	virtual ~Reactor();
+
+	static Reactor *create();
+
+	bool valid() const { return descriptor_ >= 0; }
+	int descriptor() const { return descriptor_; }
+	void add(Network *n);
+	void remove(Network *n);
+	void setWakeupCallback(std::function<void()> f) { wakeup_ = f; }
+
+	long timeout();
+	bool runOnce(long maxWaitMs = -1);
+	void run();
+	virtual void flush() {}
+
+	// the system calls made by the reactor itself, not by the networks
+	uint64_t syscalls() const { return syscalls_; }
+
+protected:
+	Reactor();
+
+	enum Events {
+		Readable = 1,
+		Writable = 2,
+		// an error or hangup, noticed while reading or writing
+		Failed = 4
+	};
+	struct Ready {
+		int fd;
+		unsigned int events;
+	};
+
+	// start watching a descriptor, or watch it again: it may have been
+	// closed and reused since the last time
+	virtual bool watch(int fd, unsigned int events) = 0;
+	virtual void unwatch(int fd) = 0;
+	// wait no longer than the given time (-1 for as long as needed); returns
+	// false if waiting failed
+	virtual bool wait(long timeoutMs, std::vector<Ready> &ready) = 0;
+
+	int descriptor_;
+	uint64_t syscalls_;
+
+private:
+	// explicitly disable copy constructor
+	Reactor(const Reactor&);
+	void operator=(const Reactor&);
+
+	struct Watch {
+		Network *network;
+		unsigned int events;
+	};
+
+	void changed(Network *n);
+	void sync();
+	void unwatchNetwork(Network *n, bool all);
+	bool rewatch(int fd, const std::vector<Watch> &owners);
+	bool watching(int fd, Network *n) const;
+
+	std::vector<Network*> networks_;
+	// networks whose interests must be asked for again
+	std::vector<Network*> changed_;
+	// a descriptor may be wanted by more than one network, and each of them
+	// is told when it's ready
+	std::map<int,std::vector<Watch> > watched_;
+	std::vector<Watch> owners_;
+	std::function<void()> wakeup_;
+	bool running_;
+	std::vector<Network::Interest> interests_;
+	std::vector<Ready> ready_;
+};
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <algorithm>
+#include "reconnectscheduler.h"
+
+// how long an attempt of a network without a connect timeout holds its slot
+#define DEFAULT_ATTEMPT_TIMEOUT 60
+
+dazeus::ReconnectScheduler::ReconnectScheduler(unsigned int maxConcurrentAttempts,
+	unsigned int baseDelayMs, unsigned int maxDelayMs)
+: mutex_()
+, pending_()
+, failures_()
+, inProgress_()
+, random_(std::random_device()())
+, maxConcurrent_(maxConcurrentAttempts)
+, baseDelay_(baseDelayMs)
+, maxDelay_(maxDelayMs)
+{
+}
+
+/**
+ * The scheduler shared by all Networks in this process, so the concurrency
+ * cap applies to all of them.
+ */
+dazeus::ReconnectScheduler &dazeus::ReconnectScheduler::instance()
+{
+	static ReconnectScheduler scheduler;
+	return scheduler;
+}
+
+/**
+ * Exponential backoff with "equal jitter": the delay for the n'th failed
+ * attempt is base * 2^(n-1), capped at the maximum, of which the second half
+ * is randomized.
+ */
+unsigned int dazeus::ReconnectScheduler::delayFor(unsigned int attempt)
+{
+	unsigned long delay = baseDelay_;
+	for(unsigned int i = 1; i < attempt && delay < maxDelay_; ++i) {
+		delay *= 2;
+	}
+	if(delay > maxDelay_)
+		delay = maxDelay_;
+	unsigned long half = delay / 2;
+	if(half == 0)
+		return delay;
+	std::uniform_int_distribution<unsigned long> jitter(0, delay - half);
+	return half + jitter(random_);
+}
+
+/**
+ * The number of attempts in progress that still hold their slot.
+ */
+unsigned int dazeus::ReconnectScheduler::busySlots(Clock::time_point now) const
+{
+	unsigned int busy = 0;
+	std::map<const Network*,Clock::time_point>::const_iterator it;
+	for(it = inProgress_.begin(); it != inProgress_.end(); ++it) {
+		if(it->second > now)
+			++busy;
+	}
+	return busy;
+}
+
+/**
+ * Plan a reconnect of the given network, after a delay depending on how many
+ * connection attempts failed in a row. Replaces any earlier planned reconnect.
+ */
+void dazeus::ReconnectScheduler::schedule(Network *n, Network::DisconnectReason reason)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	inProgress_.erase(n);
+
+	unsigned int attempt = failures_[n];
+	PendingReconnect p;
+	p.network = n;
+	p.attempt = attempt;
+	p.reason = reason;
+	p.due = Clock::now() + std::chrono::milliseconds(delayFor(attempt));
+	pending_[n] = p;
+}
+
+/**
+ * Forget everything about a network, e.g. because it is being destroyed or
+ * was disconnected on purpose.
+ */
+void dazeus::ReconnectScheduler::cancel(Network *n)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	pending_.erase(n);
+	inProgress_.erase(n);
+	failures_.erase(n);
+}
+
+/**
+ * Returns true if the reconnect of this network is due and may start now
+ * without exceeding the concurrency cap. In that case, the reconnect is
+ * removed from the queue and counted as an attempt in progress; the caller
+ * must connect.
+ */
+bool dazeus::ReconnectScheduler::takeDue(Network *n)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Clock::time_point now = Clock::now();
+	std::map<const Network*,PendingReconnect>::iterator it = pending_.find(n);
+	if(it == pending_.end() || it->second.due > now)
+		return false;
+	if(busySlots(now) >= maxConcurrent_)
+		return false;
+	pending_.erase(it);
+	inProgress_[n] = now + std::chrono::seconds(DEFAULT_ATTEMPT_TIMEOUT);
+	return true;
+}
+
+bool dazeus::ReconnectScheduler::isPending(const Network *n) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pending_.count(n) != 0;
+}
+
+/**
+ * Milliseconds until this network should check for its reconnect again, or
+ * -1 if it has none pending. If the reconnect is due but held back by the
+ * concurrency cap, a slot can only free up through another network's events,
+ * so the regular one-second loop interval is returned.
+ */
+long dazeus::ReconnectScheduler::msUntilDue(const Network *n) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<const Network*,PendingReconnect>::const_iterator it = pending_.find(n);
+	if(it == pending_.end())
+		return -1;
+	Clock::time_point now = Clock::now();
+	long ms = std::chrono::duration_cast<std::chrono::milliseconds>(it->second.due - now).count();
+	if(ms > 0)
+		return ms;
+	return busySlots(now) >= maxConcurrent_ ? 1000 : 0;
+}
+
+/**
+ * All planned reconnects, the earliest first.
+ */
+std::vector<dazeus::ReconnectScheduler::PendingReconnect> dazeus::ReconnectScheduler::pending() const
+{
+	std::vector<PendingReconnect> res;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::map<const Network*,PendingReconnect>::const_iterator it;
+		for(it = pending_.begin(); it != pending_.end(); ++it) {
+			res.push_back(it->second);
+		}
+	}
+	std::sort(res.begin(), res.end(), [](const PendingReconnect &a, const PendingReconnect &b) {
+		return a.due < b.due;
+	});
+	return res;
+}
+
+/**
+ * A network wants to start a connection attempt, which may take the given
+ * connect timeout in seconds, or 0 if it has none. Returns false if that
+ * would exceed the concurrency cap; the network must not connect then, and
+ * can queue() instead. A network whose reconnect was taken with takeDue()
+ * already holds a slot.
+ */
+bool dazeus::ReconnectScheduler::attemptStarted(Network *n, unsigned int timeout)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Clock::time_point now = Clock::now();
+	std::map<const Network*,Clock::time_point>::iterator it = inProgress_.find(n);
+	if((it == inProgress_.end() || it->second <= now) && busySlots(now) >= maxConcurrent_)
+		return false;
+	pending_.erase(n);
+	inProgress_[n] = now + std::chrono::seconds(timeout > 0 ? timeout : DEFAULT_ATTEMPT_TIMEOUT);
+	return true;
+}
+
+/**
+ * Have the network connect as soon as a slot is free, through takeDue(). An
+ * earlier planned reconnect is brought forward.
+ */
+void dazeus::ReconnectScheduler::queue(Network *n)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	PendingReconnect p;
+	p.network = n;
+	p.attempt = failures_[n];
+	p.reason = Network::UnknownReason;
+	p.due = Clock::now();
+	pending_[n] = p;
+}
+
+/**
+ * A connection attempt ended. A successful registration resets the backoff of
+ * the network; a failure makes its next reconnect wait longer.
+ */
+void dazeus::ReconnectScheduler::attemptFinished(Network *n, bool succeeded)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	inProgress_.erase(n);
+	if(succeeded) {
+		failures_.erase(n);
+	} else {
+		failures_[n] += 1;
+	}
+}
+
+unsigned int dazeus::ReconnectScheduler::attemptsInProgress() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return busySlots(Clock::now());
+}
+
+unsigned int dazeus::ReconnectScheduler::failedAttempts(const Network *n) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<const Network*,unsigned int>::const_iterator it = failures_.find(n);
+	return it == failures_.end() ? 0 : it->second;
+}
+
+void dazeus::ReconnectScheduler::setMaxConcurrentAttempts(unsigned int m)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	maxConcurrent_ = m == 0 ? 1 : m;
+}
+
+void dazeus::ReconnectScheduler::setBaseDelayMs(unsigned int ms)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	baseDelay_ = ms;
+}
+
+void dazeus::ReconnectScheduler::setMaxDelayMs(unsigned int ms)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	maxDelay_ = ms;
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef RECONNECTSCHEDULER_H
+#define RECONNECTSCHEDULER_H
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include "network.h"
+
+namespace dazeus {
+
+/**
+ * Decides when Networks reconnect after losing their server. Every Network
+ * gets an exponential backoff with jitter, so a dead upstream is not hammered
+ * and networks that died together do not all come back in the same instant.
+ * On top of that, the number of connection attempts in progress at the same
+ * time is capped for all networks sharing the scheduler.
+ *
+ * The scheduler does not connect anything by itself: Networks ask it whether
+ * their reconnect is due from checkTimeouts(), which Network::run() calls on
+ * every iteration of the event loop. A Network that is asked to connect while
+ * the cap is reached is queued, and connects as soon as a slot is free.
+ *
+ * An attempt holds its slot until it finishes, or at most for the connect
+ * timeout of the network, so a connection that hangs without one set can't
+ * hold the slot forever.
+ */
+class ReconnectScheduler {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct PendingReconnect {
+		Network *network;
+		Clock::time_point due;
+		unsigned int attempt;
+		Network::DisconnectReason reason;
+	};
+
+	ReconnectScheduler(unsigned int maxConcurrentAttempts = 5,
+		unsigned int baseDelayMs = 1000, unsigned int maxDelayMs = 300000);
+
+	static ReconnectScheduler &instance();
+
+	void schedule(Network *n, Network::DisconnectReason reason);
+	void cancel(Network *n);
+	bool takeDue(Network *n);
+	bool isPending(const Network *n) const;
+	long msUntilDue(const Network *n) const;
+	std::vector<PendingReconnect> pending() const;
+
+	bool attemptStarted(Network *n, unsigned int timeout);
+	void queue(Network *n);
+	void attemptFinished(Network *n, bool succeeded);
+	unsigned int attemptsInProgress() const;
+	unsigned int failedAttempts(const Network *n) const;
+
+	unsigned int maxConcurrentAttempts() const { return maxConcurrent_; }
+	unsigned int baseDelayMs() const { return baseDelay_; }
+	unsigned int maxDelayMs() const { return maxDelay_; }
+	void setMaxConcurrentAttempts(unsigned int m);
+	void setBaseDelayMs(unsigned int ms);
+	void setMaxDelayMs(unsigned int ms);
+
+private:
+	// explicitly disable copy constructor
+	ReconnectScheduler(const ReconnectScheduler&);
+	void operator=(const ReconnectScheduler&);
+
+	unsigned int delayFor(unsigned int attempt);
+	unsigned int busySlots(Clock::time_point now) const;
+
+	mutable std::mutex mutex_;
+	std::map<const Network*,PendingReconnect> pending_;
+	std::map<const Network*,unsigned int> failures_;
+	// the attempts in progress, and until when each holds its slot
+	std::map<const Network*,Clock::time_point> inProgress_;
+	std::minstd_rand random_;
+	unsigned int maxConcurrent_;
+	unsigned int baseDelay_;
+	unsigned int maxDelay_;
+};
+
+}
+
+#endif
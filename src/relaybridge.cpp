@@ -0,0 +1,355 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "relaybridge.h"
+#include "metrics.h"
+
+// Stop reading from one side while this much is waiting for the other side
+#define RELAY_BUFFER_LIMIT 65536
+
+static void setNonBlocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/**
+ * How much of the data from the server can be passed to libircclient: all
+ * complete lines, or everything once the server is gone or a line doesn't
+ * fit the buffer.
+ */
+static size_t deliverable(const std::string &toLocal, bool eof)
+{
+	size_t eol = toLocal.rfind('\n');
+	if(eol != std::string::npos)
+		return eol + 1;
+	return eof || toLocal.size() >= RELAY_BUFFER_LIMIT ? toLocal.size() : 0;
+}
+
+dazeus::RelayBridge::RelayBridge(const ServerConfig &sc)
+: config_(sc)
+, state_(ConnectingState)
+, error_()
+, listen_(-1)
+, local_(-1)
+, upstream_(-1)
+, localPort_(0)
+, peerPort_(0)
+, upstreamEof_(false)
+, frozen_(false)
+, registering_(false)
+, toUpstream_()
+, toLocal_()
+, fromLocal_()
+{
+}
+
+dazeus::RelayBridge::~RelayBridge()
+{
+	if(listen_ >= 0)
+		close(listen_);
+	if(local_ >= 0)
+		close(local_);
+	if(upstream_ >= 0)
+		close(upstream_);
+}
+
+void dazeus::RelayBridge::fail(const std::string &error)
+{
+	error_ = error;
+	state_ = FailedState;
+	if(listen_ >= 0)
+		close(listen_);
+	if(local_ >= 0)
+		close(local_);
+	if(upstream_ >= 0)
+		close(upstream_);
+	listen_ = local_ = upstream_ = -1;
+}
+
+/**
+ * Open the loopback port for libircclient.
+ */
+bool dazeus::RelayBridge::openLocal()
+{
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	local.sin_port = 0;
+	socklen_t locallen = sizeof(local);
+
+	listen_ = socket(AF_INET, SOCK_STREAM, 0);
+	if(listen_ < 0
+	|| bind(listen_, (struct sockaddr*)&local, sizeof(local)) != 0
+	|| listen(listen_, 1) != 0
+	|| getsockname(listen_, (struct sockaddr*)&local, &locallen) != 0) {
+		fail(std::string("Couldn't open local relay port: ") + strerror(errno));
+		return false;
+	}
+	setNonBlocking(listen_);
+	localPort_ = ntohs(local.sin_port);
+	return true;
+}
+
+/**
+ * Open the loopback port for libircclient and start connecting to the given
+ * address of the server. Returns false if either failed immediately.
+ */
+bool dazeus::RelayBridge::start(const ResolvedAddress &address)
+{
+	if(!openLocal())
+		return false;
+
+	struct sockaddr_storage remote;
+	socklen_t remotelen;
+	memset(&remote, 0, sizeof(remote));
+	if(address.family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&remote;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(config_.port);
+		inet_pton(AF_INET6, address.address.c_str(), &sin6->sin6_addr);
+		remotelen = sizeof(*sin6);
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in*)&remote;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(config_.port);
+		inet_pton(AF_INET, address.address.c_str(), &sin->sin_addr);
+		remotelen = sizeof(*sin);
+	}
+
+	upstream_ = socket(address.family, SOCK_STREAM, 0);
+	if(upstream_ < 0) {
+		fail(std::string("Couldn't create socket: ") + strerror(errno));
+		return false;
+	}
+	setNonBlocking(upstream_);
+	int one = 1;
+	setsockopt(upstream_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if(connect(upstream_, (struct sockaddr*)&remote, remotelen) != 0 && errno != EINPROGRESS) {
+		fail(std::string("Couldn't connect: ") + strerror(errno));
+		return false;
+	}
+	state_ = ConnectingState;
+	return true;
+}
+
+/**
+ * Take over the socket of an established connection, with what was received
+ * and not yet parsed, and what was to be sent and not yet sent. The welcome
+ * is given to libircclient in place of what the server said when it
+ * registered.
+ */
+bool dazeus::RelayBridge::resume(int upstream, const std::string &inbound,
+	const std::string &outbound, const std::string &welcome)
+{
+	upstream_ = upstream;
+	if(!openLocal())
+		return false;
+	setNonBlocking(upstream_);
+	toLocal_ = welcome + inbound;
+	toUpstream_ = outbound;
+	registering_ = true;
+	state_ = EstablishedState;
+	return true;
+}
+
+/**
+ * Bytes on their way to the server: not yet written, and sent but not yet
+ * acknowledged.
+ */
+uint64_t dazeus::RelayBridge::queuedBytes() const
+{
+	return toUpstream_.size() + (upstream_ >= 0 ? socketOutboundBytes(upstream_) : 0);
+}
+
+/**
+ * Whether libircclient has parsed every complete line from the server, and
+ * the relay has everything it wrote. Only meaningful while frozen.
+ */
+bool dazeus::RelayBridge::drained() const
+{
+	int unread = 0;
+	return state_ == EstablishedState && local_ >= 0 && !registering_
+	    && deliverable(toLocal_, upstreamEof_) == 0
+	    && ioctl(local_, FIONREAD, &unread) == 0 && unread == 0;
+}
+
+void dazeus::RelayBridge::addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+	int highest = -1;
+#define WATCH(fd, set) do { FD_SET(fd, set); if(fd > highest) highest = fd; } while(0)
+	if(listen_ >= 0)
+		WATCH(listen_, in_set);
+
+	switch(state_) {
+	case ConnectingState:
+		WATCH(upstream_, out_set);
+		break;
+	case EstablishedState:
+	case ClosingState:
+		if(local_ >= 0) {
+			if(state_ == EstablishedState && toUpstream_.size() < RELAY_BUFFER_LIMIT)
+				WATCH(local_, in_set);
+			if(!registering_ && deliverable(toLocal_, upstreamEof_) > 0)
+				WATCH(local_, out_set);
+		}
+		if(upstream_ >= 0) {
+			if(state_ == EstablishedState && !frozen_ && toLocal_.size() < RELAY_BUFFER_LIMIT)
+				WATCH(upstream_, in_set);
+			if(!toUpstream_.empty())
+				WATCH(upstream_, out_set);
+		}
+		break;
+	case ClosedState:
+	case FailedState:
+		break;
+	}
+#undef WATCH
+	if(highest > *maxfd)
+		*maxfd = highest;
+}
+
+void dazeus::RelayBridge::processDescriptors(fd_set *in_set, fd_set *out_set)
+{
+	if(listen_ >= 0 && FD_ISSET(listen_, in_set)) {
+		acceptLocal();
+	}
+
+	if(state_ == ConnectingState && FD_ISSET(upstream_, out_set)) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+		getsockopt(upstream_, SOL_SOCKET, SO_ERROR, &error, &len);
+		if(error != 0) {
+			fail(std::string("Couldn't connect: ") + strerror(error));
+			return;
+		}
+		state_ = EstablishedState;
+	} else if(state_ == EstablishedState || state_ == ClosingState) {
+		pump(in_set, out_set);
+	}
+}
+
+/**
+ * Accept the connection from libircclient. Connections from any other local
+ * socket are refused, so no other process can read along; as long as the port
+ * of libircclient isn't known, every connection is.
+ */
+void dazeus::RelayBridge::acceptLocal()
+{
+	struct sockaddr_in peer;
+	socklen_t len = sizeof(peer);
+	int fd = accept(listen_, (struct sockaddr*)&peer, &len);
+	if(fd < 0)
+		return;
+	if(peerPort_ == 0 || ntohs(peer.sin_port) != peerPort_) {
+		close(fd);
+		return;
+	}
+	setNonBlocking(fd);
+	local_ = fd;
+	close(listen_);
+	listen_ = -1;
+}
+
+/**
+ * Move data between libircclient and the server. When either side closes the
+ * connection, what is left for the other side is delivered first.
+ */
+void dazeus::RelayBridge::pump(fd_set *in_set, fd_set *out_set)
+{
+	char buf[16384];
+
+	// libircclient -> server
+	if(state_ == EstablishedState && local_ >= 0 && FD_ISSET(local_, in_set)) {
+		ssize_t r = recv(local_, buf, sizeof(buf), 0);
+		if(r > 0) {
+			std::string &to = registering_ ? fromLocal_ : toUpstream_;
+			to.append(buf, r);
+		} else if(r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			// libircclient is gone; the server gets what it said last
+			closeLocal();
+			state_ = ClosingState;
+		}
+	}
+	size_t eol;
+	while(registering_ && (eol = fromLocal_.find('\n')) != std::string::npos) {
+		// the server knows us already; USER is the last line libircclient
+		// registers with
+		if(fromLocal_.compare(0, 5, "USER ") == 0)
+			registering_ = false;
+		fromLocal_.erase(0, eol + 1);
+	}
+	if(!registering_ && !fromLocal_.empty()) {
+		toUpstream_ += fromLocal_;
+		fromLocal_.clear();
+	}
+	if(upstream_ >= 0 && !toUpstream_.empty() && FD_ISSET(upstream_, out_set)) {
+		ssize_t w = send(upstream_, toUpstream_.data(), toUpstream_.size(), MSG_NOSIGNAL);
+		if(w > 0) {
+			toUpstream_.erase(0, w);
+		} else if(w < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			upstreamEof_ = true;
+			toUpstream_.clear();
+			state_ = ClosingState;
+		}
+	}
+
+	// server -> libircclient
+	if(state_ == EstablishedState && !frozen_ && upstream_ >= 0 && FD_ISSET(upstream_, in_set)) {
+		ssize_t r = recv(upstream_, buf, sizeof(buf), 0);
+		if(r > 0) {
+			toLocal_.append(buf, r);
+		} else if(r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			upstreamEof_ = true;
+			state_ = ClosingState;
+		}
+	}
+	size_t n = registering_ ? 0 : deliverable(toLocal_, upstreamEof_);
+	if(local_ >= 0 && n > 0) {
+		ssize_t w = send(local_, toLocal_.data(), n, MSG_NOSIGNAL);
+		if(w > 0) {
+			toLocal_.erase(0, w);
+		} else if(w < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			closeLocal();
+			state_ = ClosingState;
+		}
+	}
+
+	if(state_ == ClosingState) {
+		bool localDone = local_ < 0 || (upstreamEof_ && toLocal_.empty());
+		bool upstreamDone = upstreamEof_ || toUpstream_.empty();
+		if(localDone && upstreamDone) {
+			closeLocal();
+			if(upstream_ >= 0) {
+				close(upstream_);
+				upstream_ = -1;
+			}
+			state_ = ClosedState;
+		}
+	}
+}
+
+void dazeus::RelayBridge::closeLocal()
+{
+	if(local_ >= 0) {
+		close(local_);
+		local_ = -1;
+	}
+	if(listen_ >= 0) {
+		close(listen_);
+		listen_ = -1;
+	}
+}
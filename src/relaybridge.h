@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef RELAYBRIDGE_H
+#define RELAYBRIDGE_H
+
+#include <string>
+#include <sys/select.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "resolver.h"
+
+namespace dazeus {
+
+/**
+ * Carries a plain IRC connection on behalf of libircclient, so that it can
+ * be handed to another process; see Network::handoff().
+ *
+ * Like with a TlsBridge, libircclient connects to a loopback port owned by
+ * the relay, and the relay owns the socket to the server. Lines from the
+ * server are only passed on once they are complete, so libircclient never
+ * holds part of a line, and everything it has not seen yet is either in the
+ * socket or in the relay.
+ *
+ * A relay can also be started on the socket of a connection handed over by
+ * another process. The registration libircclient sends is then swallowed,
+ * and libircclient is given a welcome instead, so the server sees nothing
+ * of the new process.
+ */
+class RelayBridge {
+public:
+	enum State {
+		ConnectingState,
+		EstablishedState,
+		ClosingState,
+		ClosedState,
+		FailedState
+	};
+
+	RelayBridge(const ServerConfig &sc);
+	~RelayBridge();
+
+	bool start(const ResolvedAddress &address);
+	bool resume(int upstream, const std::string &inbound, const std::string &outbound,
+		const std::string &welcome);
+	uint16_t localPort() const { return localPort_; }
+	void expectPeerPort(uint16_t port) { peerPort_ = port; }
+	State state() const { return state_; }
+	bool failed() const { return state_ == FailedState; }
+	const std::string &error() const { return error_; }
+	uint64_t queuedBytes() const;
+
+	void addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
+	void processDescriptors(fd_set *in_set, fd_set *out_set);
+
+	void freeze() { frozen_ = true; }
+	void thaw() { frozen_ = false; }
+	bool drained() const;
+	int upstreamDescriptor() const { return upstream_; }
+	// received from the server, but not passed to libircclient
+	const std::string &pendingInbound() const { return toLocal_; }
+	// written by libircclient, but not sent to the server
+	const std::string &pendingOutbound() const { return toUpstream_; }
+
+private:
+	// explicitly disable copy constructor
+	RelayBridge(const RelayBridge&);
+	void operator=(const RelayBridge&);
+
+	bool openLocal();
+	void fail(const std::string &error);
+	void acceptLocal();
+	void pump(fd_set *in_set, fd_set *out_set);
+	void closeLocal();
+
+	ServerConfig config_;
+	State state_;
+	std::string error_;
+	int listen_;
+	int local_;
+	int upstream_;
+	uint16_t localPort_;
+	uint16_t peerPort_;
+	bool upstreamEof_;
+	// not reading from the server, while handing off
+	bool frozen_;
+	// swallowing the registration of libircclient, after a resume
+	bool registering_;
+	std::string toUpstream_;
+	std::string toLocal_;
+	std::string fromLocal_;
+};
+
+}
+
+#endif
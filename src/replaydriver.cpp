@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <strings.h>
+
+#include "replaydriver.h"
+#include "metrics.h"
+#include "network.h"
+#include "server.h"
+#include "reconnectscheduler.h"
+
+namespace {
+
+class EventCounter : public dazeus::NetworkListener {
+public:
+	EventCounter() : events(0) {}
+	virtual void ircEvent(const std::string &, const std::string &,
+	  const std::vector<std::string> &, dazeus::Network *) {
+		++events;
+	}
+	uint64_t events;
+};
+
+}
+
+dazeus::ReplayDriver::ReplayDriver(Network *n)
+: network_(n)
+, motdReceived_(false)
+, lines_(0)
+, prefix_()
+, command_()
+{
+}
+
+dazeus::ReplayDriver::~ReplayDriver()
+{
+	finish();
+}
+
+/**
+ * Start a new connection, like Network::connectToServer() does: the state of
+ * the previous connection is forgotten and a fresh, unconnected Server takes
+ * its place.
+ */
+void dazeus::ReplayDriver::startConnection()
+{
+	finish();
+	Network *n = network_;
+	ServerConfig sc;
+	if(!n->config_.servers.empty())
+		sc = n->config_.servers[0];
+	n->activeServer_ = new Server(sc, n);
+	n->activeServer_->setRecorder(n->recorder_);
+	n->metrics_->connectAttempt();
+	n->pingTimer_.reset(std::chrono::steady_clock::now());
+	n->nick_ = n->config_.nickName;
+	n->registered_ = false;
+	if(n->recorder_)
+		n->recorder_->record(TrafficRecord::Connect, sc.toString());
+	motdReceived_ = false;
+}
+
+/**
+ * Drop the unconnected Server, if there is one, and forget the state of its
+ * connection.
+ */
+void dazeus::ReplayDriver::finish()
+{
+	Network *n = network_;
+	n->flushCoalesced();
+	if(n->activeServer_) {
+		// without a connection, there are only channels from a snapshot
+		n->saveSnapshot();
+		n->knownUsers_.clear();
+		n->staleChannels_.clear();
+	}
+	delete n->activeServer_;
+	n->activeServer_ = 0;
+	n->deleteServer_ = false;
+	n->registered_ = false;
+	n->identifiedUsers_.clear();
+	n->scheduler_->cancel(n);
+}
+
+/**
+ * Deliver one line as if the server sent it. Batch listeners get the events
+ * of the line as one batch, as if it was read on its own.
+ */
+void dazeus::ReplayDriver::feed(const std::string &line)
+{
+	network_->batching_ = true;
+	deliver(line);
+	network_->flushCoalesced();
+	network_->batching_ = false;
+	network_->flushBatch();
+}
+
+/**
+ * Deliver lines as if the server sent them, and they were read at once.
+ */
+void dazeus::ReplayDriver::feed(const std::vector<std::string> &lines)
+{
+	network_->batching_ = true;
+	std::vector<std::string>::const_iterator it;
+	for(it = lines.begin(); it != lines.end(); ++it) {
+		deliver(*it);
+	}
+	network_->flushCoalesced();
+	network_->batching_ = false;
+	network_->flushBatch();
+}
+
+void dazeus::ReplayDriver::deliver(const std::string &line)
+{
+	Network *n = network_;
+	if(!n->activeServer_)
+		startConnection();
+	Server *server = n->activeServer_;
+	++lines_;
+	n->metrics_->received(line.size() + 2);
+	if(n->recorder_)
+		n->recorder_->record(TrafficRecord::Inbound, line);
+
+	// Split the line like libircclient: prefix, command, parameters
+	EventArena &arena = server->arena();
+	arena.reset();
+	prefix_.clear();
+	size_t pos = 0;
+	if(!line.empty() && line[0] == ':') {
+		pos = line.find(' ');
+		if(pos == std::string::npos)
+			return;
+		prefix_.assign(line, 1, pos - 1);
+		++pos;
+	}
+	size_t end = line.find(' ', pos);
+	command_.assign(line, pos, end == std::string::npos ? std::string::npos : end - pos);
+	while(end != std::string::npos) {
+		pos = end + 1;
+		if(pos >= line.size())
+			break;
+		if(line[pos] == ':') {
+			arena.push().assign(line, pos + 1, std::string::npos);
+			break;
+		}
+		end = line.find(' ', pos);
+		arena.push().assign(line, pos, end == std::string::npos ? std::string::npos : end - pos);
+	}
+	std::vector<std::string> &params = arena.params();
+
+	const std::string &command = command_;
+	if(command.size() == 3 && isdigit(command[0]) && isdigit(command[1]) && isdigit(command[2])) {
+		unsigned int code = atoi(command.c_str());
+		if(code == 1 && !params.empty()) {
+			// the recording may have been made with another nick
+			n->nick_ = params[0];
+		}
+		if((code == 376 || code == 422) && !motdReceived_) {
+			motdReceived_ = true;
+			server->receivedEvent("CONNECT", prefix_.c_str());
+		}
+		server->receivedNumeric(prefix_.c_str(), code);
+		return;
+	}
+
+	const char *event = command.c_str();
+	if(command == "PING") {
+		// answered by libircclient itself
+		return;
+	} else if(command == "MODE" && params.size() > 1 && params[0] == n->nick_) {
+		arena.erase(0);
+		arena.truncate(1);
+	} else if((command == "PRIVMSG" || command == "NOTICE") && params.size() > 1) {
+		std::string &text = params[1];
+		bool isCtcp = text.size() > 1 && text[0] == 0x01 && text[text.size() - 1] == 0x01;
+		if(isCtcp) {
+			// strip the CTCP delimiters in place
+			text.erase(text.size() - 1);
+			text.erase(0, 1);
+			if(command == "PRIVMSG" && text.compare(0, 7, "ACTION ") == 0) {
+				event = "ACTION";
+				text.erase(0, 7);
+				arena.truncate(2);
+			} else {
+				event = "CTCP";
+				params[0].swap(text);
+				arena.truncate(1);
+			}
+		} else if(strcasecmp(params[0].c_str(), n->nick_.c_str()) != 0) {
+			event = command == "PRIVMSG" ? "CHANNEL" : "CHANNEL_NOTICE";
+		}
+	}
+	server->receivedEvent(event, prefix_.c_str());
+}
+
+/**
+ * Deliver all inbound records to the network. With RecordedPace, records are
+ * delivered at the moment they were recorded, counting from the start of the
+ * replay; every connect record starts a new connection.
+ */
+void dazeus::ReplayDriver::replay(const std::vector<TrafficRecord> &records, Pace pace)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<TrafficRecord>::const_iterator it;
+	for(it = records.begin(); it != records.end(); ++it) {
+		if(pace == RecordedPace) {
+			std::this_thread::sleep_until(start + std::chrono::microseconds(it->micros));
+		}
+		switch(it->direction) {
+		case TrafficRecord::Connect:
+			startConnection();
+			break;
+		case TrafficRecord::Inbound:
+			feed(it->line);
+			break;
+		case TrafficRecord::Outbound:
+			break;
+		}
+	}
+}
+
+/**
+ * Replay many recordings at once, each into its own Network with the given
+ * configuration, on the given number of threads. The setup function, if
+ * given, is called for every Network before its replay starts, on the thread
+ * that replays it; it can add listeners to profile.
+ */
+std::vector<dazeus::ReplayDriver::CorpusResult> dazeus::ReplayDriver::replayCorpus(
+	const std::vector<std::string> &paths, const NetworkConfig &config,
+	unsigned int threads, Pace pace, std::function<void(Network&)> setup)
+{
+	std::vector<CorpusResult> results(paths.size());
+	std::atomic<size_t> next(0);
+	std::function<void()> worker = [&]() {
+		// per thread, so the replays don't share a lock
+		ReconnectScheduler scheduler;
+		size_t i;
+		while((i = next++) < paths.size()) {
+			CorpusResult &r = results[i];
+			r.path = paths[i];
+			std::vector<TrafficRecord> records;
+			if(!TrafficRecorder::load(paths[i], records, &r.error))
+				continue;
+
+			Network n(config);
+			n.setReconnectScheduler(&scheduler);
+			EventCounter counter;
+			n.addListener(&counter);
+			if(setup)
+				setup(n);
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			{
+				ReplayDriver driver(&n);
+				driver.replay(records, pace);
+				r.lines = driver.linesReplayed();
+			}
+			r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			r.events = counter.events;
+			r.ok = true;
+		}
+	};
+
+	if(threads == 0)
+		threads = 1;
+	if(threads > paths.size())
+		threads = paths.size();
+	std::vector<std::thread> pool;
+	for(unsigned int t = 1; t < threads; ++t) {
+		pool.push_back(std::thread(worker));
+	}
+	worker();
+	for(size_t t = 0; t < pool.size(); ++t) {
+		pool[t].join();
+	}
+	return results;
+}
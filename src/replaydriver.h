@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef REPLAYDRIVER_H
+#define REPLAYDRIVER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+#include "config.h"
+#include "trafficrecorder.h"
+
+namespace dazeus {
+
+class Network;
+
+/**
+ * Feeds recorded IRC traffic into a Network without any sockets, so that
+ * listeners and state tracking can be profiled and tested offline.
+ *
+ * Inbound lines are parsed and turned into events the way libircclient does
+ * it, and delivered through a Server that is never connected. Commands sent
+ * by the network or its listeners during a replay are recorded if the
+ * network has a recorder, but go nowhere. Outbound records in the recording
+ * are skipped. The nick of the network is taken from the welcome message of
+ * the recording, so it does not need to be configured the same.
+ */
+class ReplayDriver {
+public:
+	enum Pace {
+		FastPace, // as fast as possible
+		RecordedPace // with the delays of the recording
+	};
+
+	struct CorpusResult {
+		CorpusResult() : path(), ok(false), error(), lines(0), events(0), seconds(0) {}
+		std::string path;
+		bool ok;
+		std::string error;
+		uint64_t lines;
+		uint64_t events;
+		double seconds;
+	};
+
+	ReplayDriver(Network *n);
+	~ReplayDriver();
+
+	void replay(const std::vector<TrafficRecord> &records, Pace pace = FastPace);
+	void startConnection();
+	void feed(const std::string &line);
+	void feed(const std::vector<std::string> &lines);
+	void finish();
+	uint64_t linesReplayed() const { return lines_; }
+
+	static std::vector<CorpusResult> replayCorpus(const std::vector<std::string> &paths,
+		const NetworkConfig &config, unsigned int threads, Pace pace = FastPace,
+		std::function<void(Network&)> setup = std::function<void(Network&)>());
+
+private:
+	// explicitly disable copy constructor
+	ReplayDriver(const ReplayDriver&);
+	void operator=(const ReplayDriver&);
+
+	void deliver(const std::string &line);
+
+	Network *network_;
+	bool motdReceived_;
+	uint64_t lines_;
+	// the line being fed; kept for their buffers
+	std::string prefix_;
+	std::string command_;
+};
+
+}
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "resolver.h"
+
+dazeus::ResolverQuery::ResolverQuery(const std::string &host)
+: host_(host)
+, finished_(false)
+, error_(0)
+, addresses_()
+{
+	if(pipe(notify_) != 0) {
+		perror("Couldn't create resolver notification pipe");
+		abort();
+	}
+	for(int i = 0; i < 2; ++i) {
+		fcntl(notify_[i], F_SETFL, fcntl(notify_[i], F_GETFL) | O_NONBLOCK);
+		fcntl(notify_[i], F_SETFD, FD_CLOEXEC);
+	}
+}
+
+dazeus::ResolverQuery::~ResolverQuery()
+{
+	close(notify_[0]);
+	close(notify_[1]);
+}
+
+/**
+ * Store the result and make notifyDescriptor() readable. The byte written is
+ * never read, so the descriptor stays readable for as long as the query
+ * exists.
+ */
+void dazeus::ResolverQuery::finish(int error, const std::vector<ResolvedAddress> &addresses)
+{
+	error_ = error;
+	addresses_ = addresses;
+	finished_.store(true, std::memory_order_release);
+	char c = 0;
+	if(write(notify_[1], &c, 1) < 0) {
+		// can't happen on an empty pipe
+	}
+}
+
+dazeus::Resolver::Resolver(unsigned int threads, LookupFunction lookup)
+: lookup_(lookup)
+, threads_()
+, mutex_()
+, wakeup_()
+, queue_()
+, inFlight_()
+, cache_()
+, stopping_(false)
+, cacheTtl_(300)
+, negativeTtl_(30)
+{
+	if(threads == 0)
+		threads = 1;
+	for(unsigned int i = 0; i < threads; ++i) {
+		threads_.push_back(std::thread(&Resolver::worker, this));
+	}
+}
+
+dazeus::Resolver::~Resolver()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wakeup_.notify_all();
+	for(std::vector<std::thread>::iterator it = threads_.begin(); it != threads_.end(); ++it) {
+		it->join();
+	}
+}
+
+/**
+ * The resolver shared by all Networks in this process.
+ */
+dazeus::Resolver &dazeus::Resolver::instance()
+{
+	static Resolver resolver;
+	return resolver;
+}
+
+/**
+ * Returns whether the given host is already an IPv4 or IPv6 address, in which
+ * case no lookup is necessary.
+ */
+bool dazeus::Resolver::isNumericAddress(const std::string &host, int *family)
+{
+	unsigned char buf[sizeof(struct in6_addr)];
+	if(inet_pton(AF_INET, host.c_str(), buf) == 1) {
+		if(family) *family = AF_INET;
+		return true;
+	}
+	if(inet_pton(AF_INET6, host.c_str(), buf) == 1) {
+		if(family) *family = AF_INET6;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Default lookup function: a blocking getaddrinfo() call, which is fine on a
+ * resolver thread. IPv4 addresses are ordered before IPv6 ones, matching what
+ * irc_connect() would have picked itself.
+ */
+int dazeus::Resolver::systemLookup(const std::string &host, std::vector<ResolvedAddress> &result)
+{
+	struct addrinfo hints, *res = 0;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+
+	int error = getaddrinfo(host.c_str(), NULL, &hints, &res);
+	if(error != 0) {
+		return error;
+	}
+
+	std::vector<ResolvedAddress> v6;
+	for(struct addrinfo *ai = res; ai != 0; ai = ai->ai_next) {
+		char buf[INET6_ADDRSTRLEN];
+		const void *addr;
+		if(ai->ai_family == AF_INET) {
+			addr = &((struct sockaddr_in*)ai->ai_addr)->sin_addr;
+		} else if(ai->ai_family == AF_INET6) {
+			addr = &((struct sockaddr_in6*)ai->ai_addr)->sin6_addr;
+		} else {
+			continue;
+		}
+		if(inet_ntop(ai->ai_family, addr, buf, sizeof(buf)) == 0)
+			continue;
+		ResolvedAddress ra(ai->ai_family, buf);
+		std::vector<ResolvedAddress> &target = ai->ai_family == AF_INET ? result : v6;
+		bool seen = false;
+		for(std::vector<ResolvedAddress>::const_iterator it = target.begin(); it != target.end(); ++it) {
+			if(it->address == ra.address) {
+				seen = true;
+				break;
+			}
+		}
+		if(!seen)
+			target.push_back(ra);
+	}
+	freeaddrinfo(res);
+
+	result.insert(result.end(), v6.begin(), v6.end());
+	return result.empty() ? EAI_NONAME : 0;
+}
+
+const dazeus::Resolver::CacheEntry *dazeus::Resolver::freshEntry(const std::string &host, Clock::time_point now) const
+{
+	std::map<std::string,CacheEntry>::const_iterator it = cache_.find(host);
+	if(it == cache_.end() || it->second.expires <= now)
+		return 0;
+	return &it->second;
+}
+
+/**
+ * Start resolving a host. If the answer is cached (positively or negatively)
+ * the returned query is already finished; if another lookup for the same host
+ * is in progress, the query waits for that one.
+ */
+dazeus::Resolver::QueryPtr dazeus::Resolver::resolve(const std::string &host)
+{
+	QueryPtr query = std::make_shared<ResolverQuery>(host);
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	const CacheEntry *entry = freshEntry(host, Clock::now());
+	if(entry) {
+		query->finish(entry->error, entry->addresses);
+		return query;
+	}
+
+	std::vector<QueryPtr> &waiting = inFlight_[host];
+	if(waiting.empty()) {
+		queue_.push_back(host);
+		wakeup_.notify_one();
+	}
+	waiting.push_back(query);
+	return query;
+}
+
+/**
+ * Fills the given vector with all cached addresses of a host. Returns false
+ * if there is no fresh positive cache entry.
+ */
+bool dazeus::Resolver::cachedAddresses(const std::string &host, std::vector<ResolvedAddress> &result)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const CacheEntry *entry = freshEntry(host, Clock::now());
+	if(!entry || entry->error != 0)
+		return false;
+	result = entry->addresses;
+	return true;
+}
+
+bool dazeus::Resolver::isNegativelyCached(const std::string &host)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	const CacheEntry *entry = freshEntry(host, Clock::now());
+	return entry && entry->error != 0;
+}
+
+void dazeus::Resolver::clearCache()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	cache_.clear();
+}
+
+void dazeus::Resolver::worker()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while(1) {
+		while(!stopping_ && queue_.empty()) {
+			wakeup_.wait(lock);
+		}
+		if(stopping_)
+			return;
+
+		std::string host = queue_.front();
+		queue_.pop_front();
+
+		lock.unlock();
+		std::vector<ResolvedAddress> addresses;
+		int error = lookup_(host, addresses);
+		lock.lock();
+
+		CacheEntry &entry = cache_[host];
+		entry.error = error;
+		entry.addresses = addresses;
+		entry.expires = Clock::now() + std::chrono::seconds(error == 0 ? cacheTtl_.load() : negativeTtl_.load());
+
+		std::map<std::string,std::vector<QueryPtr> >::iterator it = inFlight_.find(host);
+		for(size_t i = 0; i < it->second.size(); ++i) {
+			it->second[i]->finish(error, addresses);
+		}
+		inFlight_.erase(it);
+	}
+}
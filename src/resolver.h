@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <chrono>
+
+namespace dazeus {
+
+struct ResolvedAddress {
+	ResolvedAddress() : family(0) {}
+	ResolvedAddress(int f, const std::string &a) : family(f), address(a) {}
+
+	int family; // AF_INET or AF_INET6
+	std::string address; // numeric form, suitable for irc_connect
+};
+
+/**
+ * One outstanding (or finished) hostname lookup, made for one caller: callers
+ * waiting for the same host get queries of their own, which share the
+ * lookup. The result fields may only be read once finished() returns true.
+ *
+ * notifyDescriptor() becomes readable when the query finishes, and stays
+ * readable, so it can be added to the select() set next to the IRC sockets.
+ * Since it belongs to this query alone, no other waiter can take away its
+ * notification.
+ */
+class ResolverQuery {
+	friend class Resolver;
+
+public:
+	ResolverQuery(const std::string &host);
+	~ResolverQuery();
+
+	const std::string &host() const { return host_; }
+	bool finished() const { return finished_.load(std::memory_order_acquire); }
+	// 0 on success, otherwise an EAI_* code as returned by getaddrinfo()
+	int error() const { return error_; }
+	const std::vector<ResolvedAddress> &addresses() const { return addresses_; }
+	int notifyDescriptor() const { return notify_[0]; }
+
+private:
+	// explicitly disable copy constructor
+	ResolverQuery(const ResolverQuery&);
+	void operator=(const ResolverQuery&);
+
+	void finish(int error, const std::vector<ResolvedAddress> &addresses);
+
+	std::string host_;
+	std::atomic<bool> finished_;
+	int error_;
+	std::vector<ResolvedAddress> addresses_;
+	int notify_[2];
+};
+
+/**
+ * Resolves hostnames on a small pool of worker threads, so a slow DNS server
+ * never blocks the event loop. Finished lookups are announced through the
+ * notifyDescriptor() of every query waiting for them.
+ *
+ * Results are cached per host: successful lookups for cacheTtl() seconds,
+ * failed ones for negativeTtl() seconds. getaddrinfo() does not report record
+ * TTLs, so these are fixed durations.
+ */
+class Resolver {
+public:
+	typedef std::shared_ptr<ResolverQuery> QueryPtr;
+	typedef std::function<int(const std::string &host, std::vector<ResolvedAddress> &result)> LookupFunction;
+
+	Resolver(unsigned int threads = 2, LookupFunction lookup = systemLookup);
+	~Resolver();
+
+	static Resolver &instance();
+	static int systemLookup(const std::string &host, std::vector<ResolvedAddress> &result);
+	static bool isNumericAddress(const std::string &host, int *family = 0);
+
+	QueryPtr resolve(const std::string &host);
+	bool cachedAddresses(const std::string &host, std::vector<ResolvedAddress> &result);
+	bool isNegativelyCached(const std::string &host);
+	void clearCache();
+
+	int  cacheTtl() const { return cacheTtl_; }
+	int  negativeTtl() const { return negativeTtl_; }
+	void setCacheTtl(int seconds) { cacheTtl_ = seconds; }
+	void setNegativeTtl(int seconds) { negativeTtl_ = seconds; }
+
+private:
+	// explicitly disable copy constructor
+	Resolver(const Resolver&);
+	void operator=(const Resolver&);
+
+	typedef std::chrono::steady_clock Clock;
+	struct CacheEntry {
+		int error;
+		std::vector<ResolvedAddress> addresses;
+		Clock::time_point expires;
+	};
+
+	void worker();
+	const CacheEntry *freshEntry(const std::string &host, Clock::time_point now) const;
+
+	LookupFunction lookup_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable wakeup_;
+	// the hosts to look up, and the queries waiting for each of them
+	std::deque<std::string> queue_;
+	std::map<std::string,std::vector<QueryPtr> > inFlight_;
+	std::map<std::string,CacheEntry> cache_;
+	bool stopping_;
+	std::atomic<int> cacheTtl_;
+	std::atomic<int> negativeTtl_;
+};
+
+}
+
+#endif
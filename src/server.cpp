@@ -11,14 +11,25 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
 #include <libircclient.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
 
 #include "server.h"
+#include "metrics.h"
+#include "logger.h"
+#include "probes.h"
 
 // #define DEBUG
 
 #define IRC (irc_session_t*)irc_
 
+static dazeus::LogCategory connectionLog("server.connection");
+static dazeus::LogCategory eventLog("server.event");
+
 std::string dazeus::Server::toString(const Server *s)
 {
 	std::stringstream res;
@@ -51,13 +62,26 @@ dazeus::Server::Server(const ServerConfig &sc, Network *n)
 , irc_(0)
 , in_whois_for_()
 , whois_identified_(false)
-, in_names_()
+, event_()
+, derived_()
+, names_()
+, resolving_()
+, tls_(0)
+, relay_(0)
+, recorder_(0)
+, pool_(0)
+, nick_(n->config().nickName)
+, queueSampled_()
+, unflushed_(0)
 {
 }
 
 dazeus::Server::~Server()
 {
-	irc_destroy_session(IRC);
+	if(irc_)
+		irc_destroy_session(IRC);
+	delete tls_;
+	delete relay_;
 }
 
 const dazeus::ServerConfig &dazeus::Server::config() const
@@ -97,18 +121,55 @@ void dazeus::Server::disconnectFromServer( Network::DisconnectReason reason )
 }
 
 
+/**
+ * Make this server a member of a connection pool, with its own nick. Its
+ * events go to the pool instead of the network. Must be called before
+ * connecting.
+ */
+void dazeus::Server::setPool( ConnectionPool *p, const std::string &nick )
+{
+	pool_ = p;
+	nick_ = nick;
+}
+
+/**
+ * Whether the server is connected, or still connecting.
+ */
+bool dazeus::Server::connected()
+{
+	return irc_ && (resolving_ || irc_is_connected(IRC));
+}
+
 std::string dazeus::Server::motd() const
 {
-	fprintf(stderr, "MOTD cannot be retrieved.\n");
+	log(eventLog, WarningLevel, "MOTD cannot be retrieved");
 	return std::string();
 }
 
 void dazeus::Server::quit( const std::string &reason ) {
-	irc_cmd_quit(IRC, reason.c_str());
+	sent("QUIT :" + reason);
+	if(irc_)
+		irc_cmd_quit(IRC, reason.c_str());
 }
 
 void dazeus::Server::whois( const std::string &destination ) {
-	irc_cmd_whois(IRC, destination.c_str());
+	sent("WHOIS " + destination);
+	if(irc_)
+		irc_cmd_whois(IRC, destination.c_str());
+}
+
+/**
+ * Account for a line sent to the server, without its line ending.
+ */
+void dazeus::Server::sent(const std::string &line) {
+	DAZEUS_PROBE3(command__queued, network_->config().name.c_str(), line.c_str(), line.size() + 2);
+#ifdef DAZEUS_HAVE_SDT
+	++unflushed_;
+#endif
+	network_->metrics_->sent(line.size() + 2);
+	if(recorder_)
+		recorder_->record(TrafficRecord::Outbound, line);
+	network_->interestChanged();
 }
 
 /**
@@ -120,35 +181,48 @@ void dazeus::Server::ircEventMe( const std::string &eventname, const std::string
 	std::vector<std::string> parameters;
 	parameters.push_back(destination);
 	parameters.push_back(message);
-	slotIrcEvent(eventname, network_->nick(), parameters);
+	// the echo is the network's, whichever connection sent it
+	network_->slotIrcEvent(eventname, network_->nick(), parameters);
 }
 
 void dazeus::Server::ctcpAction( const std::string &destination, const std::string &message ) {
 	ircEventMe("ACTION_ME", destination, message);
-	irc_cmd_me(IRC, destination.c_str(), message.c_str());
+	sent("PRIVMSG " + destination + " :\x01" "ACTION " + message + "\x01");
+	if(irc_)
+		irc_cmd_me(IRC, destination.c_str(), message.c_str());
 }
 
 void dazeus::Server::names( const std::string &channel ) {
-	irc_cmd_names(IRC, channel.c_str());
+	sent("NAMES " + channel);
+	if(irc_)
+		irc_cmd_names(IRC, channel.c_str());
 }
 
 void dazeus::Server::ctcpRequest( const std::string &destination, const std::string &message ) {
 	ircEventMe("CTCP_ME", destination, message);
-	irc_cmd_ctcp_request(IRC, destination.c_str(), message.c_str());
+	sent("PRIVMSG " + destination + " :\x01" + message + "\x01");
+	if(irc_)
+		irc_cmd_ctcp_request(IRC, destination.c_str(), message.c_str());
 }
 
 void dazeus::Server::ctcpReply( const std::string &destination, const std::string &message ) {
 	ircEventMe("CTCP_REP_ME", destination, message);
-	irc_cmd_ctcp_reply(IRC, destination.c_str(), message.c_str());
+	sent("NOTICE " + destination + " :\x01" + message + "\x01");
+	if(irc_)
+		irc_cmd_ctcp_reply(IRC, destination.c_str(), message.c_str());
 }
 
 void dazeus::Server::join( const std::string &channel, const std::string &key ) {
-	irc_cmd_join(IRC, channel.c_str(), key.c_str());
+	sent("JOIN " + channel + (key.empty() ? "" : " " + key));
+	if(irc_)
+		irc_cmd_join(IRC, channel.c_str(), key.c_str());
 }
 
 void dazeus::Server::part( const std::string &channel, const std::string &) {
 	// TODO: also use "reason" here (patch libircclient for this)
-	irc_cmd_part(IRC, channel.c_str());
+	sent("PART " + channel);
+	if(irc_)
+		irc_cmd_part(IRC, channel.c_str());
 }
 
 void dazeus::Server::message( const std::string &destination, const std::string &message ) {
@@ -156,7 +230,9 @@ void dazeus::Server::message( const std::string &destination, const std::string
 	std::string line;
 	while(std::getline(ss, line)) {
 		ircEventMe("PRIVMSG_ME", destination, message);
-		irc_cmd_msg(IRC, destination.c_str(), line.c_str());
+		sent("PRIVMSG " + destination + " :" + line);
+		if(irc_)
+			irc_cmd_msg(IRC, destination.c_str(), line.c_str());
 	}
 }
 
@@ -165,26 +241,141 @@ void dazeus::Server::notice( const std::string &destination, const std::string &
 	std::string line;
 	while(std::getline(ss, line)) {
 		ircEventMe("NOTICE_ME", destination, message);
-		irc_cmd_notice(IRC, destination.c_str(), line.c_str());
+		sent("NOTICE " + destination + " :" + line);
+		if(irc_)
+			irc_cmd_notice(IRC, destination.c_str(), line.c_str());
 	}
 }
 
-void dazeus::Server::ping() {
-	irc_send_raw(IRC, "PING");
+void dazeus::Server::nick( const std::string &nick ) {
+	sent("NICK " + nick);
+	if(irc_)
+		irc_cmd_nick(IRC, nick.c_str());
+}
+
+void dazeus::Server::ping( const std::string &token ) {
+	sent("PING :" + token);
+	if(irc_)
+		irc_send_raw(IRC, "PING :%s", token.c_str());
+}
+
+/**
+ * The socket libircclient uses for this server, or -1 if it has none. The
+ * library doesn't expose it, so it is taken from the select() sets.
+ */
+int dazeus::Server::ircDescriptor() {
+	fd_set in_set, out_set;
+	int maxfd = 0;
+	FD_ZERO(&in_set);
+	FD_ZERO(&out_set);
+	if(irc_add_select_descriptors(IRC, &in_set, &out_set, &maxfd) != 0)
+		return -1;
+	for(int fd = maxfd; fd >= 0; --fd) {
+		if(FD_ISSET(fd, &in_set) || FD_ISSET(fd, &out_set))
+			return fd;
+	}
+	return -1;
 }
 
 void dazeus::Server::addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd) {
+	if(!irc_) {
+		// not connected, e.g. while a recording is replayed
+		return;
+	}
+	if(resolving_) {
+		// Wait for the resolver instead of the (not yet existing) socket
+		int fd = resolving_->notifyDescriptor();
+		FD_SET(fd, in_set);
+		if(fd > *maxfd)
+			*maxfd = fd;
+		return;
+	}
 	irc_add_select_descriptors(IRC, in_set, out_set, maxfd);
+	if(tls_)
+		tls_->addDescriptors(in_set, out_set, maxfd);
+	if(relay_)
+		relay_->addDescriptors(in_set, out_set, maxfd);
 }
 
 void dazeus::Server::processDescriptors(fd_set *in_set, fd_set *out_set) {
+	if(!irc_) {
+		return;
+	}
+	if(resolving_) {
+		if(resolving_->finished()) {
+			Resolver::QueryPtr query = resolving_;
+			resolving_.reset();
+			if(query->error() != 0) {
+				log(connectionLog, WarningLevel, "Could not resolve server",
+					{{"host", query->host()}, {"error", gai_strerror(query->error())}});
+				slotDisconnected();
+			} else {
+				connectToAddress(query->addresses());
+			}
+		}
+		return;
+	}
+	if(tls_) {
+		tls_->processDescriptors(in_set, out_set);
+		if(tls_->failed()) {
+			log(connectionLog, WarningLevel, "TLS connection failed",
+				{{"server", toString(this)}, {"error", tls_->error()}});
+			slotDisconnected();
+			return;
+		}
+	}
+	if(relay_) {
+		relay_->processDescriptors(in_set, out_set);
+		if(relay_->failed()) {
+			log(connectionLog, WarningLevel, "Relayed connection failed",
+				{{"server", toString(this)}, {"error", relay_->error()}});
+			slotDisconnected();
+			return;
+		}
+	}
 	irc_process_select_descriptors(IRC, in_set, out_set);
+#ifdef DAZEUS_HAVE_SDT
+	if(unflushed_ > 0) {
+		// libircclient writes its buffered commands once the socket is
+		// writable
+		int fd = ircDescriptor();
+		if(fd >= 0 && FD_ISSET(fd, out_set)) {
+			DAZEUS_PROBE2(command__written, network_->config().name.c_str(), unflushed_);
+			unflushed_ = 0;
+		}
+	}
+#endif
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(now - queueSampled_ >= std::chrono::milliseconds(100)) {
+		queueSampled_ = now;
+		int fd = ircDescriptor();
+		uint64_t queued = fd >= 0 ? socketOutboundBytes(fd) : 0;
+		if(tls_)
+			queued += tls_->queuedBytes();
+		if(relay_)
+			queued += relay_->queuedBytes();
+		network_->metrics_->setOutboundQueueBytes(queued);
+	}
 }
 
-void dazeus::Server::slotNumericMessageReceived( const std::string &origin, unsigned int code,
-	const std::vector<std::string> &args )
+/**
+ * Handle a numeric reply, with its parameters in the arena.
+ */
+void dazeus::Server::receivedNumeric(const char *o, unsigned int code)
 {
 	assert( network_ != 0 );
+	const std::vector<std::string> &args = event_.params();
+	std::string &origin = event_.origin();
+	origin.assign(o);
+	if(pool_) {
+		// the state comes from the active server
+		char codestring[16];
+		snprintf(codestring, sizeof(codestring), "%u", code);
+		event_.insert(0, codestring);
+		slotIrcEvent( "NUMERIC", origin, event_.params() );
+		return;
+	}
 	assert( network_->activeServer() == this );
 	// Also send out some other interesting events
 	if(code == 311) {
@@ -199,118 +390,253 @@ void dazeus::Server::slotNumericMessageReceived( const std::string &origin, unsi
 	else if(code == 318)
 	{
 		network_->slotWhoisReceived( origin, in_whois_for_, whois_identified_ );
-		std::vector<std::string> parameters;
-		parameters.push_back(in_whois_for_);
-		parameters.push_back(whois_identified_ ? "true" : "false");
-		slotIrcEvent( "WHOIS", origin, parameters );
+		derived_.reset();
+		derived_.push(in_whois_for_);
+		derived_.push(whois_identified_ ? "true" : "false");
+		slotIrcEvent( "WHOIS", origin, derived_.params() );
 		whois_identified_ = false;
 		in_whois_for_.clear();
 	}
 	// part of NAMES
 	else if(code == 353)
 	{
-		std::vector<std::string> names;
-		std::stringstream ss(args.back());
-		std::string name;
-		while(std::getline(ss, name, ' ')) {
-			in_names_.push_back(name);
+		const std::string &names = args.back();
+		const std::string &channel = args.size() >= 3 ? args.at(2) : names;
+		size_t begin = 0;
+		if(network_->membershipPolicy(channel) != Network::FullMembership) {
+			// the members aren't kept, so they aren't collected either
+			network_->lazyNamesReceived(channel, names);
+			begin = names.size();
+		}
+		while(begin < names.size()) {
+			size_t end = names.find(' ', begin);
+			if(end == std::string::npos)
+				end = names.size();
+			names_.push(names.data() + begin, end - begin);
+			begin = end + 1;
+		}
+		unsigned int threshold = network_->config().lazyMembershipThreshold;
+		if(threshold > 0 && names_.size() > threshold) {
+			network_->namesPassedThreshold(channel, names_.params());
+			names_.reset();
 		}
 	}
 	else if(code == 366)
 	{
-		network_->slotNamesReceived( origin, args.at(1), in_names_, args.at(0) );
-		std::vector<std::string> parameters;
-		parameters.push_back(args.at(1));
+		network_->slotNamesReceived( origin, args.at(1), names_.params(), args.at(0) );
+		derived_.reset();
+		derived_.push(args.at(1));
 		std::vector<std::string>::const_iterator it;
-		for(it = in_names_.begin(); it != in_names_.end(); ++it) {
-			parameters.push_back(*it);
+		for(it = names_.params().begin(); it != names_.params().end(); ++it) {
+			derived_.push(*it);
 		}
-		slotIrcEvent( "NAMES", origin, parameters );
-		in_names_.clear();
+		slotIrcEvent( "NAMES", origin, derived_.params() );
+		names_.reset();
 	}
 	else if(code == 332)
 	{
-		std::vector<std::string> parameters;
-		parameters.push_back(args.at(1));
-		parameters.push_back(args.at(2));
-		slotIrcEvent( "TOPIC", origin, parameters );
+		derived_.reset();
+		derived_.push(args.at(1));
+		derived_.push(args.at(2));
+		slotIrcEvent( "TOPIC", origin, derived_.params() );
 	}
-	std::stringstream codestream;
-	codestream << code;
-	std::vector<std::string> params;
-	params.push_back(codestream.str());
-	std::vector<std::string>::const_iterator it;
-	for(it = args.begin(); it != args.end(); ++it) {
-		params.push_back(*it);
-	}
-	slotIrcEvent( "NUMERIC", origin, params );
+	char codestring[16];
+	snprintf(codestring, sizeof(codestring), "%u", code);
+	event_.insert(0, codestring);
+	slotIrcEvent( "NUMERIC", origin, event_.params() );
 }
 
 void dazeus::Server::slotDisconnected()
 {
-	network_->onFailedConnection();
+	if(pool_)
+		pool_->failed(this);
+	else
+		network_->onFailedConnection();
 }
 
 void dazeus::Server::slotIrcEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &args)
 {
 	assert(network_ != 0);
+	if(pool_) {
+		pool_->receivedEvent(this, event, origin, args);
+		return;
+	}
 	assert(network_->activeServer() == this);
+	ConnectionPool *pool = network_->pool_;
+	if(pool && !pool->firstSeen(this, event, origin, args))
+		return;
 	network_->slotIrcEvent(event, origin, args);
 }
 
-void irc_eventcode_callback(irc_session_t *s, unsigned int event, const char *origin, const char **p, unsigned int count) {
+/**
+ * Account for a line received from the server, reconstructed from the command
+ * and parameters libircclient parsed from it: it keeps the connection alive,
+ * is counted in the metrics of the network, and recorded if there is a
+ * recorder.
+ */
+void dazeus::Server::receivedLine(const char *origin, const std::string &command, const std::vector<std::string> &params)
+{
+	if(pool_)
+		pool_->lineReceived(this, command);
+	else
+		network_->lineReceived(command);
+	if(!recorder_) {
+		// only the length is needed, so don't build the line
+		size_t length = command.size() + 2;
+		if(origin != NULL && *origin != 0) {
+			length += strlen(origin) + 2;
+		}
+		for(unsigned int i = 0; i < params.size(); ++i) {
+			length += params[i].size() + 1;
+		}
+		if(!params.empty()) {
+			length += 1;
+		}
+		network_->metrics_->received(length);
+		DAZEUS_PROBE3(line__received, network_->config().name.c_str(), command.c_str(), length);
+		return;
+	}
+	std::string line;
+	if(origin != NULL && *origin != 0) {
+		line = std::string(":") + origin + " ";
+	}
+	line += command;
+	for(unsigned int i = 0; i < params.size(); ++i) {
+		const std::string &p = params[i];
+		if(i == params.size() - 1 && (p.empty() || p[0] == ':' || p.find(' ') != std::string::npos)) {
+			line += " :" + p;
+		} else {
+			line += " " + p;
+		}
+	}
+	network_->metrics_->received(line.size() + 2);
+	DAZEUS_PROBE3(line__received, network_->config().name.c_str(), command.c_str(), line.size() + 2);
+	recorder_->record(TrafficRecord::Inbound, line);
+}
+
+/**
+ * Handle an event as libircclient delivers it to its callbacks, with the
+ * origin as it was sent by the server and the parameters in the arena.
+ */
+void dazeus::Server::receivedEvent(const char *e, const char *o)
+{
+	std::string &event = event_.name();
+	// From libircclient docs, but CHANNEL_* is bullshit...
+	if(strcmp(e, "CHANNEL_NOTICE") == 0) {
+		event.assign("NOTICE");
+	} else if(strcmp(e, "CHANNEL") == 0) {
+		event.assign("PRIVMSG");
+	} else {
+		event.assign(e);
+	}
+
+	std::string &origin = event_.origin();
+	origin.assign(o, strcspn(o, "!"));
+
+#ifdef DEBUG
+	log(eventLog, DebugLevel, "Event received",
+		{{"server", toString(this)}, {"event", event}, {"origin", origin}});
+#endif
+
+	// TODO: handle disconnects nicely (probably using some ping and LIBIRC_ERR_CLOSED
+	if(event == "ERROR") {
+		log(eventLog, WarningLevel, "Error received from libircclient", {{"origin", origin}});
+		slotDisconnected();
+	} else if(event == "CONNECT") {
+		log(connectionLog, InfoLevel, "Connected to server", {{"server", toString(this)}});
+	}
+
+	slotIrcEvent(event, origin, event_.params());
+}
+
+static dazeus::EventArena &arenaFor(irc_session_t *s, const char **params, unsigned int count) {
 	dazeus::Server *server = (dazeus::Server*) irc_get_ctx(s);
-	std::vector<std::string> params;
+	dazeus::EventArena &arena = server->arena();
+	arena.reset();
 	for(unsigned int i = 0; i < count; ++i) {
-		params.push_back(std::string(p[i]));
+		arena.push(params[i]);
 	}
-	server->slotNumericMessageReceived(std::string(origin), event, params);
+	return arena;
 }
 
-void irc_callback(irc_session_t *s, const char *e, const char *o, const char **params, unsigned int count) {
+void irc_eventcode_callback(irc_session_t *s, unsigned int event, const char *origin, const char **p, unsigned int count) {
 	dazeus::Server *server = (dazeus::Server*) irc_get_ctx(s);
+	dazeus::EventArena &arena = arenaFor(s, p, count);
+	char code[16];
+	snprintf(code, sizeof(code), "%03u", event);
+	server->receivedLine(origin, code, arena.params());
+	server->receivedNumeric(origin ? origin : "", event);
+}
 
-	std::string event(e);
-	// From libircclient docs, but CHANNEL_* is bullshit...
-	if(event == "CHANNEL_NOTICE") {
-		event = "NOTICE";
-	} else if(event == "CHANNEL") {
-		event = "PRIVMSG";
+void irc_callback(irc_session_t *s, const char *e, const char *o, const char **params, unsigned int count) {
+	dazeus::Server *server = (dazeus::Server*) irc_get_ctx(s);
+	dazeus::EventArena &arena = arenaFor(s, params, count);
+	if(strcmp(e, "CONNECT") != 0) {
+		// CONNECT is generated by libircclient at the end of the MOTD
+		const char *command = e;
+		if(strcmp(e, "CHANNEL") == 0) {
+			command = "PRIVMSG";
+		} else if(strcmp(e, "CHANNEL_NOTICE") == 0) {
+			command = "NOTICE";
+		}
+		server->receivedLine(o, command, arena.params());
 	}
+	server->receivedEvent(e, o ? o : "");
+}
 
-	// for now, keep these std::strings:
-	std::string origin;
-	if(o != NULL)
-		origin = std::string(o);
-	size_t exclamMark = origin.find('!');
-	if(exclamMark != std::string::npos) {
-		origin = origin.substr(0, exclamMark);
-	}
+// libircclient gives the following events the same name as others, so they
+// have their own callbacks to record them correctly.
 
-	std::vector<std::string> arguments;
+void irc_umode_callback(irc_session_t *s, const char *e, const char *o, const char **params, unsigned int count) {
+	dazeus::Server *server = (dazeus::Server*) irc_get_ctx(s);
+	arenaFor(s, params, count);
+	std::vector<std::string> line;
+	line.push_back(server->network()->nick());
 	for(unsigned int i = 0; i < count; ++i) {
-		arguments.push_back(std::string(params[i]));
+		line.push_back(params[i]);
 	}
+	server->receivedLine(o, "MODE", line);
+	server->receivedEvent(e, o ? o : "");
+}
 
-#ifdef DEBUG
-	fprintf(stderr, "%s - %s from %s\n", dazeus::Server::toString(server).c_str(), event.c_str(), origin.c_str());
-#endif
+void irc_ctcp_request_callback(irc_session_t *s, const char *e, const char *o, const char **params, unsigned int count) {
+	dazeus::Server *server = (dazeus::Server*) irc_get_ctx(s);
+	arenaFor(s, params, count);
+	if(count > 0) {
+		std::vector<std::string> line;
+		line.push_back(server->network()->nick());
+		line.push_back(std::string("\x01") + params[0] + "\x01");
+		server->receivedLine(o, "PRIVMSG", line);
+	}
+	server->receivedEvent(e, o ? o : "");
+}
 
-	// TODO: handle disconnects nicely (probably using some ping and LIBIRC_ERR_CLOSED
-	if(event == "ERROR") {
-		fprintf(stderr, "Error received from libircclient; origin=%s.\n", origin.c_str());
-		server->slotDisconnected();
-	} else if(event == "CONNECT") {
-		printf("Connected to server: %s\n", dazeus::Server::toString(server).c_str());
+void irc_ctcp_reply_callback(irc_session_t *s, const char *e, const char *o, const char **params, unsigned int count) {
+	dazeus::Server *server = (dazeus::Server*) irc_get_ctx(s);
+	arenaFor(s, params, count);
+	if(count > 0) {
+		std::vector<std::string> line;
+		line.push_back(server->network()->nick());
+		line.push_back(std::string("\x01") + params[0] + "\x01");
+		server->receivedLine(o, "NOTICE", line);
 	}
+	server->receivedEvent(e, o ? o : "");
+}
 
-	server->slotIrcEvent(event, origin, arguments);
+void irc_ctcp_action_callback(irc_session_t *s, const char *e, const char *o, const char **params, unsigned int count) {
+	dazeus::Server *server = (dazeus::Server*) irc_get_ctx(s);
+	arenaFor(s, params, count);
+	if(count > 1) {
+		std::vector<std::string> line;
+		line.push_back(params[0]);
+		line.push_back(std::string("\x01" "ACTION ") + params[1] + "\x01");
+		server->receivedLine(o, "PRIVMSG", line);
+	}
+	server->receivedEvent(e, o ? o : "");
 }
 
-void dazeus::Server::connectToServer()
+void dazeus::Server::createSession()
 {
-	printf("Connecting to server: %s\n", toString(this).c_str());
-
 	irc_callbacks_t callbacks;
 	memset(&callbacks, 0, sizeof(irc_callbacks_t));
 	callbacks.event_connect = irc_callback;
@@ -319,7 +645,7 @@ void dazeus::Server::connectToServer()
 	callbacks.event_join = irc_callback;
 	callbacks.event_part = irc_callback;
 	callbacks.event_mode = irc_callback;
-	callbacks.event_umode = irc_callback;
+	callbacks.event_umode = irc_umode_callback;
 	callbacks.event_topic = irc_callback;
 	callbacks.event_kick = irc_callback;
 	callbacks.event_channel = irc_callback;
@@ -329,9 +655,9 @@ void dazeus::Server::connectToServer()
 	callbacks.event_privmsg = irc_callback;
 	callbacks.event_notice = irc_callback;
 	callbacks.event_invite = irc_callback;
-	callbacks.event_ctcp_req = irc_callback;
-	callbacks.event_ctcp_rep = irc_callback;
-	callbacks.event_ctcp_action = irc_callback;
+	callbacks.event_ctcp_req = irc_ctcp_request_callback;
+	callbacks.event_ctcp_rep = irc_ctcp_reply_callback;
+	callbacks.event_ctcp_action = irc_ctcp_action_callback;
 	callbacks.event_unknown = irc_callback;
 	callbacks.event_numeric = irc_eventcode_callback;
 
@@ -341,26 +667,207 @@ void dazeus::Server::connectToServer()
 		abort();
 	}
 	irc_set_ctx(IRC, this);
+}
 
+void dazeus::Server::connectToServer()
+{
+	log(connectionLog, InfoLevel, "Connecting to server", {{"server", toString(this)}});
+	if(recorder_)
+		recorder_->record(TrafficRecord::Connect, config_.toString());
+
+	createSession();
 	assert(!network_->config().nickName.empty());
-	std::string host = config_.host;
+
+	// Hostnames are resolved off the event loop; numeric addresses can be
+	// connected to right away.
+	int family;
+	if(Resolver::isNumericAddress(config_.host, &family)) {
+		connectToAddress(std::vector<ResolvedAddress>(1, ResolvedAddress(family, config_.host)));
+		return;
+	}
+	Resolver::QueryPtr query = network_->resolver()->resolve(config_.host);
+	if(query->finished() && query->error() == 0) {
+		connectToAddress(query->addresses());
+	} else {
+		// Also for a negatively cached host: the failure is reported from
+		// processDescriptors(), like every other resolution result.
+		resolving_ = query;
+	}
+}
+
+/**
+ * Connect to one of the resolved addresses of this server. Every time the
+ * server is flagged undesirable, the next address is tried, so all A and AAAA
+ * records get their turn before the same one is retried.
+ */
+void dazeus::Server::connectToAddress( const std::vector<ResolvedAddress> &addresses )
+{
+	std::vector<ResolvedAddress> usable;
+	std::vector<ResolvedAddress>::const_iterator it;
+	for(it = addresses.begin(); it != addresses.end(); ++it) {
+#if !(LIBIRC_VERSION_HIGH > 1 || LIBIRC_VERSION_LOW >= 6)
+		if(it->family == AF_INET6)
+			continue;
+#endif
+		usable.push_back(*it);
+	}
+	if(usable.empty()) {
+		log(connectionLog, WarningLevel, "No usable addresses", {{"server", toString(this)}});
+		slotDisconnected();
+		return;
+	}
+	const ResolvedAddress &address = usable[network_->serverUndesirability(config_) % usable.size()];
+
+	std::string host = address.address;
+	uint16_t port = config_.port;
+	int family = address.family;
 	if(config_.ssl) {
-#if defined(LIBIRC_OPTION_SSL_NO_VERIFY)
-		host = "#" + host;
+		// libircclient connects to the TLS bridge in plain text, the
+		// bridge carries the connection to the server over TLS
 		if(!config_.ssl_verify) {
-			std::cerr << "Warning: connecting without SSL certificate verification." << std::endl;
-			irc_option_set(IRC, LIBIRC_OPTION_SSL_NO_VERIFY);
+			log(connectionLog, WarningLevel, "Connecting without SSL certificate verification",
+				{{"server", toString(this)}});
+		}
+		tls_ = new TlsBridge(config_);
+		if(!tls_->start(address)) {
+			log(connectionLog, WarningLevel, "Could not connect",
+				{{"server", toString(this)}, {"error", tls_->error()}});
+			slotDisconnected();
+			return;
+		}
+		host = "127.0.0.1";
+		port = tls_->localPort();
+		family = AF_INET;
+	} else if(network_->config().handoff) {
+		relay_ = new RelayBridge(config_);
+		if(!relay_->start(address)) {
+			log(connectionLog, WarningLevel, "Could not connect",
+				{{"server", toString(this)}, {"error", relay_->error()}});
+			slotDisconnected();
+			return;
+		}
+		host = "127.0.0.1";
+		port = relay_->localPort();
+		family = AF_INET;
+	}
+#if LIBIRC_VERSION_HIGH > 1 || LIBIRC_VERSION_LOW >= 6
+	if(family == AF_INET6) {
+		if(irc_connect6(IRC, host.c_str(),
+			port,
+			network_->config().password.c_str(),
+			nick_.c_str(),
+			network_->config().userName.c_str(),
+			network_->config().fullName.c_str()) != 0) {
+			log(connectionLog, WarningLevel, "Could not connect",
+				{{"server", toString(this)}, {"error", irc_strerror(irc_errno(IRC))}});
+			slotDisconnected();
 		}
-#else
-		std::cerr << "Error: Your version of libircclient does not support SSL. Failing connection." << std::endl;
-		slotDisconnected();
 		return;
-#endif
 	}
-	irc_connect(IRC, host.c_str(),
-		config_.port,
+#endif
+	if(irc_connect(IRC, host.c_str(),
+		port,
 		network_->config().password.c_str(),
-		network_->config().nickName.c_str(),
+		nick_.c_str(),
+		network_->config().userName.c_str(),
+		network_->config().fullName.c_str()) != 0) {
+		log(connectionLog, WarningLevel, "Could not connect",
+			{{"server", toString(this)}, {"error", irc_strerror(irc_errno(IRC))}});
+		slotDisconnected();
+		return;
+	}
+
+	if(!expectOwnPeer())
+		slotDisconnected();
+}
+
+/**
+ * Only let our own libircclient socket into the TLS bridge or relay. Returns
+ * false if its port can't be found out, as the bridge would then have to let
+ * any local socket in.
+ */
+bool dazeus::Server::expectOwnPeer()
+{
+	if(!tls_ && !relay_)
+		return true;
+	struct sockaddr_in local;
+	socklen_t len = sizeof(local);
+	int fd = ircDescriptor();
+	if(fd < 0 || getsockname(fd, (struct sockaddr*)&local, &len) != 0) {
+		log(connectionLog, WarningLevel, "Could not find the local port of the bridged connection",
+			{{"server", toString(this)}, {"error", strerror(errno)}});
+		return false;
+	}
+	if(tls_)
+		tls_->expectPeerPort(ntohs(local.sin_port));
+	else
+		relay_->expectPeerPort(ntohs(local.sin_port));
+	return true;
+}
+
+/**
+ * Continue a connection handed over by another process, on its socket fd.
+ * inbound is what was received from the server but not yet parsed, outbound
+ * what was to be sent to it. libircclient registers with the relay as usual,
+ * and is welcomed by the relay instead of the server, which sees nothing of
+ * it. Returns false if the connection couldn't be continued; fd is closed
+ * either way.
+ */
+bool dazeus::Server::resume(int fd, const std::string &inbound, const std::string &outbound)
+{
+	log(connectionLog, InfoLevel, "Resuming connection to server", {{"server", toString(this)}});
+	if(recorder_)
+		recorder_->record(TrafficRecord::Connect, config_.toString());
+
+	createSession();
+	const std::string &nick = network_->nick();
+	// libircclient fires CONNECT on the 001 or at the end of the MOTD
+	std::string welcome = ":" + config_.host + " 001 " + nick + " :Resumed\r\n"
+		":" + config_.host + " 422 " + nick + " :Resumed\r\n";
+	relay_ = new RelayBridge(config_);
+	if(!relay_->resume(fd, inbound, outbound, welcome)) {
+		log(connectionLog, WarningLevel, "Could not resume",
+			{{"server", toString(this)}, {"error", relay_->error()}});
+		return false;
+	}
+	if(irc_connect(IRC, "127.0.0.1", relay_->localPort(), NULL, nick.c_str(),
 		network_->config().userName.c_str(),
-		network_->config().fullName.c_str());
+		network_->config().fullName.c_str()) != 0) {
+		log(connectionLog, WarningLevel, "Could not resume",
+			{{"server", toString(this)}, {"error", irc_strerror(irc_errno(IRC))}});
+		return false;
+	}
+	return expectOwnPeer();
+}
+
+/**
+ * Whether more has been received from the server than libircclient read.
+ */
+bool dazeus::Server::inputPending()
+{
+	if(!irc_ || resolving_)
+		return false;
+	int fd = ircDescriptor();
+	int unread = 0;
+	return fd >= 0 && ioctl(fd, FIONREAD, &unread) == 0 && unread > 0;
+}
+
+/**
+ * Whether the connection can be handed to another process now: everything
+ * from the server that libircclient may have seen is parsed, and everything
+ * it wrote is in the relay. The relay must be frozen for this to last.
+ */
+bool dazeus::Server::readyForHandoff()
+{
+	if(!irc_ || !relay_ || !relay_->drained())
+		return false;
+	fd_set in_set, out_set;
+	int maxfd = 0;
+	FD_ZERO(&in_set);
+	FD_ZERO(&out_set);
+	irc_add_select_descriptors(IRC, &in_set, &out_set, &maxfd);
+	int fd = ircDescriptor();
+	int unread = 0;
+	return fd >= 0 && !FD_ISSET(fd, &out_set)
+	    && ioctl(fd, FIONREAD, &unread) == 0 && unread == 0;
 }
@@ -12,9 +12,16 @@
 #include <string>
 #include <stdint.h>
 #include <memory>
+#include <chrono>
 
 #include "network.h"
 #include "config.h"
+#include "resolver.h"
+#include "tlsbridge.h"
+#include "relaybridge.h"
+#include "trafficrecorder.h"
+#include "eventarena.h"
+#include "connectionpool.h"
 
 // #define SERVER_FULLDEBUG
 
@@ -26,12 +33,17 @@ public:
 	Server(const ServerConfig &sc, Network *n);
 	~Server();
 	const ServerConfig &config() const;
+	Network *network() const { return network_; }
 	std::string motd() const;
 	void addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
 	void processDescriptors(fd_set *in_set, fd_set *out_set);
 	static std::string toString(const Server*);
 
 	void connectToServer();
+	bool resume(int fd, const std::string &inbound, const std::string &outbound);
+	bool readyForHandoff();
+	bool inputPending();
+	RelayBridge *relay() const { return relay_; }
 	void disconnectFromServer( Network::DisconnectReason );
 	void quit( const std::string &reason );
 	void whois( const std::string &destination );
@@ -43,8 +55,19 @@ public:
 	void message( const std::string &destination, const std::string &message );
 	void notice( const std::string &destination, const std::string &message );
 	void names( const std::string &channel );
-	void ping();
-	void slotNumericMessageReceived( const std::string &origin, unsigned int code, const std::vector<std::string> &params);
+	void nick( const std::string &nick );
+	void ping( const std::string &token );
+	// where the parameters of a received event go before receivedEvent() or
+	// receivedNumeric() is called
+	EventArena &arena() { return event_; }
+	void receivedNumeric(const char *origin, unsigned int code);
+	void receivedEvent(const char *event, const char *origin);
+	void receivedLine(const char *origin, const std::string &command, const std::vector<std::string> &params);
+	TrafficRecorder *recorder() const { return recorder_; }
+	void setRecorder( TrafficRecorder *r ) { recorder_ = r; }
+	ConnectionPool *pool() const { return pool_; }
+	void setPool( ConnectionPool *p, const std::string &nick );
+	bool connected();
 	void slotIrcEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params);
 	void slotDisconnected();
 
@@ -53,7 +76,12 @@ private:
 	Server(const Server&);
 	void operator=(const Server&);
 
+	void sent(const std::string &line);
 	void ircEventMe( const std::string &eventname, const std::string &destination, const std::string &message);
+	void createSession();
+	bool expectOwnPeer();
+	void connectToAddress( const std::vector<ResolvedAddress> &addresses );
+	int ircDescriptor();
 
 	ServerConfig config_;
 	std::string   motd_;
@@ -61,7 +89,21 @@ private:
 	void *irc_;
 	std::string in_whois_for_;
 	bool whois_identified_;
-	std::vector<std::string> in_names_;
+	EventArena event_;
+	// parameters of events derived from the received one
+	EventArena derived_;
+	// names of the NAMES reply being received
+	EventArena names_;
+	Resolver::QueryPtr resolving_;
+	TlsBridge *tls_;
+	RelayBridge *relay_;
+	TrafficRecorder *recorder_;
+	// the pool this server is a member of, and its nick there
+	ConnectionPool *pool_;
+	std::string nick_;
+	std::chrono::steady_clock::time_point queueSampled_;
+	// commands handed to libircclient since it last wrote to the socket
+	unsigned int unflushed_;
 };
 
 }
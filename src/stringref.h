@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef STRINGREF_H
+#define STRINGREF_H
+
+#include <string>
+#include <cstring>
+
+namespace dazeus {
+
+/**
+ * A string inside a buffer that is not owned, such as a decoded event or a
+ * part of a line. It is only valid as long as the buffer is.
+ */
+struct StringRef {
+	StringRef() : data(0), size(0) {}
+	StringRef(const char *d, size_t s) : data(d), size(s) {}
+	StringRef(const char *s) : data(s), size(strlen(s)) {}
+	StringRef(const std::string &s) : data(s.data()), size(s.size()) {}
+
+	std::string str() const { return std::string(data, size); }
+	bool empty() const { return size == 0; }
+	bool operator==(const StringRef &s) const { return s.size == size && (size == 0 || memcmp(data, s.data, size) == 0); }
+	bool operator!=(const StringRef &s) const { return !(*this == s); }
+	bool operator==(const char *s) const { return *this == StringRef(s); }
+	bool operator!=(const char *s) const { return !(*this == s); }
+
+	const char *data;
+	size_t size;
+};
+
+}
+
+#endif
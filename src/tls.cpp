@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <cstdio>
+#include <cstdlib>
+
+#include "tls.h"
+#include "config.h"
+#include "resolver.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define TLS_client_method SSLv23_client_method
+#endif
+
+// Kernel TLS needs OpenSSL 3 built with KTLS support
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send) && defined(BIO_get_ktls_recv)
+#define DAZEUS_HAVE_KTLS
+#endif
+
+static void freeSessionKey(void *, void *ptr, CRYPTO_EX_DATA *, int, long, void *)
+{
+	delete static_cast<std::string*>(ptr);
+}
+
+static int sessionKeyIndex()
+{
+	static int index = SSL_get_ex_new_index(0, NULL, NULL, NULL, freeSessionKey);
+	return index;
+}
+
+dazeus::TlsContextCache::TlsContextCache()
+: mutex_()
+, contexts_()
+, sessions_()
+, sessionCacheEnabled_(true)
+, fullHandshakes_(0)
+, resumedHandshakes_(0)
+, failedHandshakes_(0)
+, handshakeMicros_(0)
+, ktlsRequested_(0)
+, ktlsSend_(0)
+, ktlsReceive_(0)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	SSL_library_init();
+	SSL_load_error_strings();
+#endif
+}
+
+dazeus::TlsContextCache::~TlsContextCache()
+{
+	clearSessions();
+	std::map<std::pair<bool,bool>,SSL_CTX*>::iterator it;
+	for(it = contexts_.begin(); it != contexts_.end(); ++it) {
+		SSL_CTX_free(it->second);
+	}
+}
+
+dazeus::TlsContextCache &dazeus::TlsContextCache::instance()
+{
+	static TlsContextCache cache;
+	return cache;
+}
+
+/**
+ * Sessions are cached per server and per trust configuration, so a session
+ * established without verification is never resumed on a verified connection.
+ */
+std::string dazeus::TlsContextCache::sessionKey(const ServerConfig &sc)
+{
+	return sc.toString() + (sc.ssl_verify ? "/verify" : "/noverify");
+}
+
+/**
+ * Whether this build of OpenSSL can hand connections to kernel TLS at all.
+ * Even so, the kernel may refuse, in which case the connection silently
+ * keeps doing TLS in user space.
+ */
+bool dazeus::TlsContextCache::ktlsSupported()
+{
+#ifdef DAZEUS_HAVE_KTLS
+	return true;
+#else
+	return false;
+#endif
+}
+
+SSL_CTX *dazeus::TlsContextCache::context(bool verify, bool ktls)
+{
+	// mutex_ is held by the caller
+	std::pair<bool,bool> key(verify, ktls);
+	std::map<std::pair<bool,bool>,SSL_CTX*>::iterator it = contexts_.find(key);
+	if(it != contexts_.end())
+		return it->second;
+
+	SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+	if(!ctx) {
+		fprintf(stderr, "Couldn't create SSL context.\n");
+		abort();
+	}
+	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef DAZEUS_HAVE_KTLS
+	if(ktls) {
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	}
+#endif
+	if(verify) {
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+		SSL_CTX_set_default_verify_paths(ctx);
+	} else {
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	}
+	// Sessions are stored in sessions_ by newSessionCallback, so they
+	// survive the SSL objects and can be looked up by server
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, newSessionCallback);
+	SSL_CTX_set_app_data(ctx, this);
+
+	contexts_[key] = ctx;
+	return ctx;
+}
+
+/**
+ * Create a client SSL object for a connection to the given server, set up
+ * for SNI and hostname verification, and primed with the cached session of
+ * the server if there is one.
+ */
+SSL *dazeus::TlsContextCache::newConnection(const ServerConfig &sc)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::string key = sessionKey(sc);
+	SSL *ssl = SSL_new(context(sc.ssl_verify, sc.ktls));
+	if(!ssl)
+		return 0;
+	SSL_set_ex_data(ssl, sessionKeyIndex(), new std::string(key));
+
+	bool numeric = Resolver::isNumericAddress(sc.host);
+	if(!numeric) {
+		SSL_set_tlsext_host_name(ssl, sc.host.c_str());
+	}
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if(sc.ssl_verify) {
+		X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
+		if(numeric) {
+			X509_VERIFY_PARAM_set1_ip_asc(param, sc.host.c_str());
+		} else {
+			X509_VERIFY_PARAM_set1_host(param, sc.host.c_str(), 0);
+		}
+	}
+#endif
+
+	if(sessionCacheEnabled_) {
+		std::map<std::string,SSL_SESSION*>::iterator it = sessions_.find(key);
+		if(it != sessions_.end()) {
+			SSL_set_session(ssl, it->second);
+		}
+	}
+	return ssl;
+}
+
+int dazeus::TlsContextCache::newSessionCallback(SSL *ssl, SSL_SESSION *session)
+{
+	TlsContextCache *cache = static_cast<TlsContextCache*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+	std::string *key = static_cast<std::string*>(SSL_get_ex_data(ssl, sessionKeyIndex()));
+	if(!cache || !key || !cache->sessionCacheEnabled_)
+		return 0;
+	std::lock_guard<std::mutex> lock(cache->mutex_);
+	cache->storeSession(*key, session);
+	// we keep the reference OpenSSL gave us
+	return 1;
+}
+
+void dazeus::TlsContextCache::storeSession(const std::string &key, SSL_SESSION *session)
+{
+	// mutex_ is held by the caller
+	std::map<std::string,SSL_SESSION*>::iterator it = sessions_.find(key);
+	if(it != sessions_.end()) {
+		SSL_SESSION_free(it->second);
+		it->second = session;
+	} else {
+		sessions_[key] = session;
+	}
+}
+
+void dazeus::TlsContextCache::handshakeFinished(SSL *ssl, uint64_t micros, bool ktlsRequested)
+{
+	if(SSL_session_reused(ssl)) {
+		resumedHandshakes_ += 1;
+	} else {
+		fullHandshakes_ += 1;
+	}
+	handshakeMicros_ += micros;
+
+	if(ktlsRequested) {
+		ktlsRequested_ += 1;
+#ifdef DAZEUS_HAVE_KTLS
+		if(BIO_get_ktls_send(SSL_get_wbio(ssl)))
+			ktlsSend_ += 1;
+		if(BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+			ktlsReceive_ += 1;
+#endif
+	}
+}
+
+/**
+ * A handshake failed. The cached session of the server is dropped, in case it
+ * was the cause.
+ */
+void dazeus::TlsContextCache::handshakeFailed(SSL *ssl)
+{
+	failedHandshakes_ += 1;
+	std::string *key = static_cast<std::string*>(SSL_get_ex_data(ssl, sessionKeyIndex()));
+	if(!key)
+		return;
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<std::string,SSL_SESSION*>::iterator it = sessions_.find(*key);
+	if(it != sessions_.end()) {
+		SSL_SESSION_free(it->second);
+		sessions_.erase(it);
+	}
+}
+
+void dazeus::TlsContextCache::forgetSession(const ServerConfig &sc)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<std::string,SSL_SESSION*>::iterator it = sessions_.find(sessionKey(sc));
+	if(it != sessions_.end()) {
+		SSL_SESSION_free(it->second);
+		sessions_.erase(it);
+	}
+}
+
+void dazeus::TlsContextCache::clearSessions()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<std::string,SSL_SESSION*>::iterator it;
+	for(it = sessions_.begin(); it != sessions_.end(); ++it) {
+		SSL_SESSION_free(it->second);
+	}
+	sessions_.clear();
+}
+
+size_t dazeus::TlsContextCache::cachedSessions()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return sessions_.size();
+}
+
+void dazeus::TlsContextCache::setSessionCacheEnabled(bool enabled)
+{
+	sessionCacheEnabled_ = enabled;
+	if(!enabled)
+		clearSessions();
+}
+
+dazeus::TlsStatistics dazeus::TlsContextCache::statistics() const
+{
+	TlsStatistics s;
+	s.fullHandshakes = fullHandshakes_;
+	s.resumedHandshakes = resumedHandshakes_;
+	s.failedHandshakes = failedHandshakes_;
+	s.handshakeMicros = handshakeMicros_;
+	s.ktlsRequested = ktlsRequested_;
+	s.ktlsSend = ktlsSend_;
+	s.ktlsReceive = ktlsReceive_;
+	return s;
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef TLS_H
+#define TLS_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_session_st SSL_SESSION;
+
+namespace dazeus {
+
+struct ServerConfig;
+
+struct TlsStatistics {
+	TlsStatistics() : fullHandshakes(0), resumedHandshakes(0), failedHandshakes(0),
+		handshakeMicros(0), ktlsRequested(0), ktlsSend(0), ktlsReceive(0) {}
+
+	uint64_t fullHandshakes;
+	uint64_t resumedHandshakes;
+	uint64_t failedHandshakes;
+	uint64_t handshakeMicros; // total time spent in successful handshakes
+	uint64_t ktlsRequested; // connections that asked for kernel TLS
+	uint64_t ktlsSend; // ...and got it for sending
+	uint64_t ktlsReceive; // ...and got it for receiving
+};
+
+/**
+ * Process-wide TLS state for client connections. There is one SSL_CTX per
+ * trust configuration (certificate verification on or off, kernel TLS on or
+ * off), shared by all connections, and a cache of the last session per server
+ * so reconnects can resume it instead of doing a full handshake.
+ */
+class TlsContextCache {
+public:
+	TlsContextCache();
+	~TlsContextCache();
+
+	static TlsContextCache &instance();
+	static std::string sessionKey(const ServerConfig &sc);
+	static bool ktlsSupported();
+
+	SSL *newConnection(const ServerConfig &sc);
+	void handshakeFinished(SSL *ssl, uint64_t micros, bool ktlsRequested = false);
+	void handshakeFailed(SSL *ssl);
+	void forgetSession(const ServerConfig &sc);
+	void clearSessions();
+	size_t cachedSessions();
+
+	bool sessionCacheEnabled() const { return sessionCacheEnabled_; }
+	void setSessionCacheEnabled(bool enabled);
+	TlsStatistics statistics() const;
+
+private:
+	// explicitly disable copy constructor
+	TlsContextCache(const TlsContextCache&);
+	void operator=(const TlsContextCache&);
+
+	static int newSessionCallback(SSL *ssl, SSL_SESSION *session);
+	SSL_CTX *context(bool verify, bool ktls);
+	void storeSession(const std::string &key, SSL_SESSION *session);
+
+	std::mutex mutex_;
+	std::map<std::pair<bool,bool>,SSL_CTX*> contexts_;
+	std::map<std::string,SSL_SESSION*> sessions_;
+	std::atomic<bool> sessionCacheEnabled_;
+	std::atomic<uint64_t> fullHandshakes_;
+	std::atomic<uint64_t> resumedHandshakes_;
+	std::atomic<uint64_t> failedHandshakes_;
+	std::atomic<uint64_t> handshakeMicros_;
+	std::atomic<uint64_t> ktlsRequested_;
+	std::atomic<uint64_t> ktlsSend_;
+	std::atomic<uint64_t> ktlsReceive_;
+};
+
+}
+
+#endif
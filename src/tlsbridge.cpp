@@ -0,0 +1,366 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "tlsbridge.h"
+#include "metrics.h"
+
+// Stop reading from one side while this much is waiting for the other side
+#define TLSBRIDGE_BUFFER_LIMIT 65536
+
+static void setNonBlocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static std::string sslErrorString()
+{
+	unsigned long e = ERR_get_error();
+	if(e == 0)
+		return "unknown error";
+	char buf[256];
+	ERR_error_string_n(e, buf, sizeof(buf));
+	ERR_clear_error();
+	return buf;
+}
+
+dazeus::TlsBridge::TlsBridge(const ServerConfig &sc, TlsContextCache *cache)
+: config_(sc)
+, cache_(cache)
+, state_(ConnectingState)
+, error_()
+, listen_(-1)
+, local_(-1)
+, upstream_(-1)
+, localPort_(0)
+, peerPort_(0)
+, ssl_(0)
+, sslWantsWrite_(false)
+, upstreamEof_(false)
+, toUpstream_()
+, toLocal_()
+, handshakeStart_()
+{
+}
+
+dazeus::TlsBridge::~TlsBridge()
+{
+	if(ssl_) {
+		// Without a close_notify, OpenSSL considers the session unsafe
+		// to resume
+		if(state_ == EstablishedState || state_ == ClosingState)
+			SSL_shutdown(ssl_);
+		SSL_free(ssl_);
+	}
+	if(listen_ >= 0)
+		close(listen_);
+	if(local_ >= 0)
+		close(local_);
+	if(upstream_ >= 0)
+		close(upstream_);
+}
+
+void dazeus::TlsBridge::fail(const std::string &error)
+{
+	error_ = error;
+	state_ = FailedState;
+	if(listen_ >= 0)
+		close(listen_);
+	if(local_ >= 0)
+		close(local_);
+	if(upstream_ >= 0)
+		close(upstream_);
+	listen_ = local_ = upstream_ = -1;
+}
+
+/**
+ * Open the loopback port for libircclient and start connecting to the given
+ * address of the server. Returns false if either failed immediately.
+ */
+bool dazeus::TlsBridge::start(const ResolvedAddress &address)
+{
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	local.sin_port = 0;
+	socklen_t locallen = sizeof(local);
+
+	listen_ = socket(AF_INET, SOCK_STREAM, 0);
+	if(listen_ < 0
+	|| bind(listen_, (struct sockaddr*)&local, sizeof(local)) != 0
+	|| listen(listen_, 1) != 0
+	|| getsockname(listen_, (struct sockaddr*)&local, &locallen) != 0) {
+		fail(std::string("Couldn't open local TLS port: ") + strerror(errno));
+		return false;
+	}
+	setNonBlocking(listen_);
+	localPort_ = ntohs(local.sin_port);
+
+	struct sockaddr_storage remote;
+	socklen_t remotelen;
+	memset(&remote, 0, sizeof(remote));
+	if(address.family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&remote;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(config_.port);
+		inet_pton(AF_INET6, address.address.c_str(), &sin6->sin6_addr);
+		remotelen = sizeof(*sin6);
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in*)&remote;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(config_.port);
+		inet_pton(AF_INET, address.address.c_str(), &sin->sin_addr);
+		remotelen = sizeof(*sin);
+	}
+
+	upstream_ = socket(address.family, SOCK_STREAM, 0);
+	if(upstream_ < 0) {
+		fail(std::string("Couldn't create socket: ") + strerror(errno));
+		return false;
+	}
+	setNonBlocking(upstream_);
+	// Whatever libircclient wrote is sent in one record right away
+	int one = 1;
+	setsockopt(upstream_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if(connect(upstream_, (struct sockaddr*)&remote, remotelen) != 0 && errno != EINPROGRESS) {
+		fail(std::string("Couldn't connect: ") + strerror(errno));
+		return false;
+	}
+	state_ = ConnectingState;
+	return true;
+}
+
+/**
+ * Bytes on their way to the server: waiting to be encrypted, and sent but not
+ * yet acknowledged.
+ */
+uint64_t dazeus::TlsBridge::queuedBytes() const
+{
+	return toUpstream_.size() + (upstream_ >= 0 ? socketOutboundBytes(upstream_) : 0);
+}
+
+void dazeus::TlsBridge::addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd)
+{
+	int highest = -1;
+#define WATCH(fd, set) do { FD_SET(fd, set); if(fd > highest) highest = fd; } while(0)
+	if(listen_ >= 0)
+		WATCH(listen_, in_set);
+
+	switch(state_) {
+	case ConnectingState:
+		WATCH(upstream_, out_set);
+		break;
+	case HandshakeState:
+		WATCH(upstream_, sslWantsWrite_ ? out_set : in_set);
+		break;
+	case EstablishedState:
+	case ClosingState:
+		if(local_ >= 0) {
+			if(toUpstream_.empty() && state_ == EstablishedState)
+				WATCH(local_, in_set);
+			if(!toLocal_.empty())
+				WATCH(local_, out_set);
+		}
+		if(state_ == EstablishedState) {
+			if(toLocal_.size() < TLSBRIDGE_BUFFER_LIMIT)
+				WATCH(upstream_, in_set);
+			if(!toUpstream_.empty() || sslWantsWrite_)
+				WATCH(upstream_, out_set);
+		}
+		break;
+	case ClosedState:
+	case FailedState:
+		break;
+	}
+#undef WATCH
+	if(highest > *maxfd)
+		*maxfd = highest;
+}
+
+void dazeus::TlsBridge::processDescriptors(fd_set *in_set, fd_set *out_set)
+{
+	if(listen_ >= 0 && FD_ISSET(listen_, in_set)) {
+		acceptLocal();
+	}
+
+	if(state_ == ConnectingState && FD_ISSET(upstream_, out_set)) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+		getsockopt(upstream_, SOL_SOCKET, SO_ERROR, &error, &len);
+		if(error != 0) {
+			fail(std::string("Couldn't connect: ") + strerror(error));
+			return;
+		}
+		ssl_ = cache_->newConnection(config_);
+		if(!ssl_) {
+			fail("Couldn't create SSL connection: " + sslErrorString());
+			return;
+		}
+		SSL_set_fd(ssl_, upstream_);
+		handshakeStart_ = std::chrono::steady_clock::now();
+		state_ = HandshakeState;
+		continueHandshake();
+	} else if(state_ == HandshakeState
+	       && (FD_ISSET(upstream_, in_set) || FD_ISSET(upstream_, out_set))) {
+		continueHandshake();
+	} else if(state_ == EstablishedState || state_ == ClosingState) {
+		pump(in_set, out_set);
+	}
+}
+
+/**
+ * Accept the connection from libircclient. Connections from any other local
+ * socket are refused, so no other process can read along; as long as the port
+ * of libircclient isn't known, every connection is.
+ */
+void dazeus::TlsBridge::acceptLocal()
+{
+	struct sockaddr_in peer;
+	socklen_t len = sizeof(peer);
+	int fd = accept(listen_, (struct sockaddr*)&peer, &len);
+	if(fd < 0)
+		return;
+	if(peerPort_ == 0 || ntohs(peer.sin_port) != peerPort_) {
+		close(fd);
+		return;
+	}
+	setNonBlocking(fd);
+	local_ = fd;
+	close(listen_);
+	listen_ = -1;
+}
+
+void dazeus::TlsBridge::continueHandshake()
+{
+	sslWantsWrite_ = false;
+	int r = SSL_connect(ssl_);
+	if(r == 1) {
+		uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - handshakeStart_).count();
+		cache_->handshakeFinished(ssl_, micros, config_.ktls);
+		state_ = EstablishedState;
+		return;
+	}
+	switch(SSL_get_error(ssl_, r)) {
+	case SSL_ERROR_WANT_READ:
+		break;
+	case SSL_ERROR_WANT_WRITE:
+		sslWantsWrite_ = true;
+		break;
+	default: {
+		std::string error = "TLS handshake failed: ";
+		long verify = SSL_get_verify_result(ssl_);
+		if(verify != X509_V_OK) {
+			error += X509_verify_cert_error_string(verify);
+		} else {
+			error += sslErrorString();
+		}
+		cache_->handshakeFailed(ssl_);
+		fail(error);
+	}
+	}
+}
+
+/**
+ * Move data between libircclient and the server. When the server closes the
+ * connection, the local socket is closed as soon as everything is delivered,
+ * so libircclient sees the same end of stream as on a plain connection.
+ */
+void dazeus::TlsBridge::pump(fd_set *in_set, fd_set *out_set)
+{
+	char buf[16384];
+	bool upstreamReady = FD_ISSET(upstream_, in_set) || FD_ISSET(upstream_, out_set);
+	sslWantsWrite_ = false;
+
+	// libircclient -> server
+	if(state_ == EstablishedState && local_ >= 0 && toUpstream_.empty() && FD_ISSET(local_, in_set)) {
+		ssize_t r = recv(local_, buf, sizeof(buf), 0);
+		if(r > 0) {
+			toUpstream_.append(buf, r);
+		} else if(r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			// libircclient is gone, say goodbye to the server
+			SSL_shutdown(ssl_);
+			closeLocal();
+			state_ = ClosedState;
+			return;
+		}
+	}
+	while(state_ == EstablishedState && !toUpstream_.empty()) {
+		int w = SSL_write(ssl_, toUpstream_.data(), toUpstream_.size());
+		if(w > 0) {
+			toUpstream_.erase(0, w);
+			continue;
+		}
+		int e = SSL_get_error(ssl_, w);
+		if(e == SSL_ERROR_WANT_WRITE) {
+			sslWantsWrite_ = true;
+		} else if(e != SSL_ERROR_WANT_READ) {
+			upstreamEof_ = true;
+			state_ = ClosingState;
+		}
+		break;
+	}
+
+	// server -> libircclient
+	if(state_ == EstablishedState && (upstreamReady || SSL_pending(ssl_) > 0)) {
+		while(toLocal_.size() < TLSBRIDGE_BUFFER_LIMIT) {
+			int r = SSL_read(ssl_, buf, sizeof(buf));
+			if(r > 0) {
+				toLocal_.append(buf, r);
+				continue;
+			}
+			int e = SSL_get_error(ssl_, r);
+			if(e == SSL_ERROR_WANT_WRITE) {
+				sslWantsWrite_ = true;
+			} else if(e != SSL_ERROR_WANT_READ) {
+				// closed by the server, or broken
+				ERR_clear_error();
+				upstreamEof_ = true;
+				state_ = ClosingState;
+			}
+			break;
+		}
+	}
+	if(local_ >= 0 && !toLocal_.empty()) {
+		ssize_t w = send(local_, toLocal_.data(), toLocal_.size(), MSG_NOSIGNAL);
+		if(w > 0) {
+			toLocal_.erase(0, w);
+		} else if(w < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			SSL_shutdown(ssl_);
+			closeLocal();
+			state_ = ClosedState;
+			return;
+		}
+	}
+
+	if(upstreamEof_ && toLocal_.empty()) {
+		closeLocal();
+		state_ = ClosedState;
+	}
+}
+
+void dazeus::TlsBridge::closeLocal()
+{
+	if(local_ >= 0) {
+		close(local_);
+		local_ = -1;
+	}
+	if(listen_ >= 0) {
+		close(listen_);
+		listen_ = -1;
+	}
+}
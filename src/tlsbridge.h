@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef TLSBRIDGE_H
+#define TLSBRIDGE_H
+
+#include <string>
+#include <chrono>
+#include <sys/select.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "resolver.h"
+#include "tls.h"
+
+namespace dazeus {
+
+/**
+ * Carries an IRC connection over TLS on behalf of libircclient.
+ *
+ * libircclient creates its own SSL objects for every connection, so it can
+ * not share contexts or resume sessions. Instead, a TLS server is connected
+ * to through a TlsBridge: libircclient makes a plain connection to a
+ * loopback port owned by the bridge, and the bridge speaks TLS to the real
+ * server using the shared TlsContextCache. Only the libircclient socket is
+ * accepted on the loopback port.
+ *
+ * The bridge is driven from the same select() loop as the IRC sockets.
+ *
+ * If the server configuration asks for kernel TLS and both OpenSSL and the
+ * kernel support it, records are encrypted and decrypted by the kernel once
+ * the handshake is done, and SSL_read/SSL_write become plain socket calls.
+ * Otherwise the bridge keeps doing TLS in user space.
+ */
+class TlsBridge {
+public:
+	enum State {
+		ConnectingState,
+		HandshakeState,
+		EstablishedState,
+		ClosingState,
+		ClosedState,
+		FailedState
+	};
+
+	TlsBridge(const ServerConfig &sc, TlsContextCache *cache = &TlsContextCache::instance());
+	~TlsBridge();
+
+	bool start(const ResolvedAddress &address);
+	uint16_t localPort() const { return localPort_; }
+	void expectPeerPort(uint16_t port) { peerPort_ = port; }
+	State state() const { return state_; }
+	bool failed() const { return state_ == FailedState; }
+	const std::string &error() const { return error_; }
+	uint64_t queuedBytes() const;
+
+	void addDescriptors(fd_set *in_set, fd_set *out_set, int *maxfd);
+	void processDescriptors(fd_set *in_set, fd_set *out_set);
+
+private:
+	// explicitly disable copy constructor
+	TlsBridge(const TlsBridge&);
+	void operator=(const TlsBridge&);
+
+	void fail(const std::string &error);
+	void acceptLocal();
+	void continueHandshake();
+	void pump(fd_set *in_set, fd_set *out_set);
+	void closeLocal();
+
+	ServerConfig config_;
+	TlsContextCache *cache_;
+	State state_;
+	std::string error_;
+	int listen_;
+	int local_;
+	int upstream_;
+	uint16_t localPort_;
+	uint16_t peerPort_;
+	SSL *ssl_;
+	bool sslWantsWrite_;
+	bool upstreamEof_;
+	std::string toUpstream_;
+	std::string toLocal_;
+	std::chrono::steady_clock::time_point handshakeStart_;
+};
+
+}
+
+#endif
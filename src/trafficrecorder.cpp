@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+
+#include "trafficrecorder.h"
+
+#define RECORDING_HEADER "# dazeus-irc recording 1"
+
+dazeus::TrafficRecorder::TrafficRecorder()
+: file_(0)
+, start_()
+, lastMicros_(0)
+, records_(0)
+{
+}
+
+dazeus::TrafficRecorder::~TrafficRecorder()
+{
+	close();
+}
+
+/**
+ * Start a new recording in the given file, replacing it if it exists.
+ * Returns false if the file could not be opened; errno says why.
+ */
+bool dazeus::TrafficRecorder::open(const std::string &path)
+{
+	close();
+	file_ = fopen(path.c_str(), "w");
+	if(!file_)
+		return false;
+	fprintf(file_, RECORDING_HEADER "\n");
+	start_ = std::chrono::steady_clock::now();
+	lastMicros_ = 0;
+	records_ = 0;
+	return true;
+}
+
+void dazeus::TrafficRecorder::close()
+{
+	if(file_) {
+		fclose(file_);
+		file_ = 0;
+	}
+}
+
+void dazeus::TrafficRecorder::record(TrafficRecord::Direction direction, const std::string &line)
+{
+	if(!file_)
+		return;
+	uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start_).count();
+	char d = direction == TrafficRecord::Inbound ? '<'
+	       : direction == TrafficRecord::Outbound ? '>' : '*';
+	fprintf(file_, "%lu %c %s\n", (unsigned long)(micros - lastMicros_), d, line.c_str());
+	lastMicros_ = micros;
+	++records_;
+}
+
+void dazeus::TrafficRecorder::flush()
+{
+	if(file_)
+		fflush(file_);
+}
+
+/**
+ * Read a recording made by a TrafficRecorder. Returns false, and sets the
+ * error if one is given, if the file can't be read or is malformed.
+ */
+bool dazeus::TrafficRecorder::load(const std::string &path, std::vector<TrafficRecord> &records, std::string *error)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	if(!f) {
+		if(error)
+			*error = path + ": " + strerror(errno);
+		return false;
+	}
+
+	bool ok = true;
+	uint64_t micros = 0;
+	unsigned long lineno = 0;
+	std::string line;
+	char buf[4096];
+	while(fgets(buf, sizeof(buf), f)) {
+		line += buf;
+		if(line[line.size() - 1] != '\n' && !feof(f))
+			continue;
+		++lineno;
+		if(line[line.size() - 1] == '\n')
+			line.resize(line.size() - 1);
+		if(lineno == 1 && line != RECORDING_HEADER) {
+			if(error)
+				*error = path + ": not a recording";
+			ok = false;
+			break;
+		}
+		if(lineno == 1 || line.empty()) {
+			line.clear();
+			continue;
+		}
+
+		char *end;
+		unsigned long delta = strtoul(line.c_str(), &end, 10);
+		size_t pos = end - line.c_str();
+		if(pos == 0 || pos + 2 > line.size() || line[pos] != ' '
+		|| (line[pos + 1] != '<' && line[pos + 1] != '>' && line[pos + 1] != '*')) {
+			if(error) {
+				std::stringstream ss;
+				ss << path << ":" << lineno << ": malformed record";
+				*error = ss.str();
+			}
+			ok = false;
+			break;
+		}
+		micros += delta;
+		TrafficRecord::Direction d = line[pos + 1] == '<' ? TrafficRecord::Inbound
+		                           : line[pos + 1] == '>' ? TrafficRecord::Outbound : TrafficRecord::Connect;
+		records.push_back(TrafficRecord(micros, d, pos + 3 <= line.size() ? line.substr(pos + 3) : std::string()));
+		line.clear();
+	}
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef TRAFFICRECORDER_H
+#define TRAFFICRECORDER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <stdint.h>
+
+namespace dazeus {
+
+struct TrafficRecord {
+	enum Direction {
+		Inbound,
+		Outbound,
+		Connect // a new connection to the server in line
+	};
+
+	TrafficRecord() : micros(0), direction(Inbound), line() {}
+	TrafficRecord(uint64_t m, Direction d, const std::string &l) : micros(m), direction(d), line(l) {}
+
+	uint64_t micros; // since the start of the recording
+	Direction direction;
+	std::string line;
+};
+
+/**
+ * Writes the IRC lines sent and received by a Network to a file, with
+ * monotonic timestamps, so the session can be replayed later by a
+ * ReplayDriver.
+ *
+ * libircclient does not expose the byte stream, so inbound lines are
+ * reconstructed from its events. Replaying them produces the same events
+ * again, but the lines may differ in formatting from what the server sent.
+ * PINGs are answered inside libircclient and are not recorded.
+ *
+ * The file has one record per line: the microseconds since the previous
+ * record, a direction character ('<' inbound, '>' outbound, '*' connect),
+ * and the IRC line. A recorder must only be used from one thread.
+ */
+class TrafficRecorder {
+public:
+	TrafficRecorder();
+	~TrafficRecorder();
+
+	bool open(const std::string &path);
+	void close();
+	bool isOpen() const { return file_ != 0; }
+	void record(TrafficRecord::Direction direction, const std::string &line);
+	void flush();
+	uint64_t records() const { return records_; }
+
+	static bool load(const std::string &path, std::vector<TrafficRecord> &records, std::string *error = 0);
+
+private:
+	// explicitly disable copy constructor
+	TrafficRecorder(const TrafficRecorder&);
+	void operator=(const TrafficRecorder&);
+
+	FILE *file_;
+	std::chrono::steady_clock::time_point start_;
+	uint64_t lastMicros_;
+	uint64_t records_;
+};
+
+}
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifdef __linux__
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <endian.h>
+#ifdef DAZEUS_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "uringreactor.h"
+#include "logger.h"
+
+static dazeus::LogCategory reactorLog("network.reactor");
+
+dazeus::IoUringReactor::IoUringReactor(unsigned int entries)
+: sqRing_(0)
+, sqRingSize_(0)
+, cqRing_(0)
+, cqRingSize_(0)
+, sqes_(0)
+, sqesSize_(0)
+, sqHead_(0)
+, sqTail_(0)
+, sqArray_(0)
+, sqMask_(0)
+, sqEntries_(0)
+, cqHead_(0)
+, cqTail_(0)
+, cqMask_(0)
+, cqes_(0)
+, queued_(0)
+, polls_()
+, generation_(0)
+{
+#ifdef DAZEUS_HAVE_IO_URING
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if(fd < 0) {
+		log(reactorLog, InfoLevel, "io_uring not available", {{"error", strerror(errno)}});
+		return;
+	}
+	if(!(p.features & IORING_FEAT_EXT_ARG)) {
+		log(reactorLog, InfoLevel, "io_uring can't wait with a timeout");
+		close(fd);
+		return;
+	}
+
+	sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if(single) {
+		if(cqRingSize_ > sqRingSize_)
+			sqRingSize_ = cqRingSize_;
+		cqRingSize_ = sqRingSize_;
+	}
+	sqesSize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqRing_ = mmap(0, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	cqRing_ = single ? sqRing_ : mmap(0, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	sqes_ = mmap(0, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(sqRing_ == MAP_FAILED || cqRing_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+		log(reactorLog, ErrorLevel, "Couldn't map io_uring", {{"error", strerror(errno)}});
+		if(sqes_ != MAP_FAILED)
+			munmap(sqes_, sqesSize_);
+		if(cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+			munmap(cqRing_, cqRingSize_);
+		if(sqRing_ != MAP_FAILED)
+			munmap(sqRing_, sqRingSize_);
+		sqRing_ = cqRing_ = sqes_ = 0;
+		close(fd);
+		return;
+	}
+
+	char *sq = (char*)sqRing_;
+	sqHead_ = (unsigned int*)(sq + p.sq_off.head);
+	sqTail_ = (unsigned int*)(sq + p.sq_off.tail);
+	sqArray_ = (unsigned int*)(sq + p.sq_off.array);
+	sqMask_ = *(unsigned int*)(sq + p.sq_off.ring_mask);
+	sqEntries_ = p.sq_entries;
+	char *cq = (char*)cqRing_;
+	cqHead_ = (unsigned int*)(cq + p.cq_off.head);
+	cqTail_ = (unsigned int*)(cq + p.cq_off.tail);
+	cqMask_ = *(unsigned int*)(cq + p.cq_off.ring_mask);
+	cqes_ = cq + p.cq_off.cqes;
+	descriptor_ = fd;
+#else
+	(void)entries;
+	log(reactorLog, InfoLevel, "io_uring support not compiled in");
+#endif
+}
+
+dazeus::IoUringReactor::~IoUringReactor()
+{
+	if(descriptor_ < 0)
+		return;
+	munmap(sqes_, sqesSize_);
+	if(cqRing_ != sqRing_)
+		munmap(cqRing_, cqRingSize_);
+	munmap(sqRing_, sqRingSize_);
+	close(descriptor_);
+}
+
+#ifdef DAZEUS_HAVE_IO_URING
+
+// the user data of a poll request: its generation and descriptor; removals
+// have generation 0
+static uint64_t pollData(int fd, uint32_t generation)
+{
+	return (uint64_t)generation << 32 | (uint32_t)fd;
+}
+
+/**
+ * Put a request in the submission ring; it is submitted with the next
+ * wait() or flush(), or right away if the ring is full.
+ */
+void dazeus::IoUringReactor::queue(uint8_t opcode, int fd, uint64_t addr, uint32_t pollEvents, uint64_t userData)
+{
+	unsigned int tail = *sqTail_;
+	if(tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+		flush();
+	unsigned int index = tail & sqMask_;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe*)sqes_ + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = addr;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	// the halves of the poll mask are swapped on big endian machines
+	pollEvents = pollEvents << 16 | pollEvents >> 16;
+#endif
+	sqe->poll32_events = pollEvents;
+	sqe->user_data = userData;
+	sqArray_[index] = index;
+	__atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+	++queued_;
+}
+
+/**
+ * Submit the queued requests, and wait for the given number of completions.
+ */
+int dazeus::IoUringReactor::enter(unsigned int wait, unsigned int flags, void *arg, size_t argSize)
+{
+	++syscalls_;
+	int submitted = syscall(__NR_io_uring_enter, descriptor_, queued_, wait, flags, arg, argSize);
+	if(submitted > 0)
+		queued_ -= (unsigned int)submitted < queued_ ? submitted : queued_;
+	return submitted;
+}
+
+void dazeus::IoUringReactor::flush()
+{
+	if(queued_ > 0 && enter(0, 0, NULL, 0) < 0)
+		log(reactorLog, ErrorLevel, "Couldn't submit to io_uring", {{"error", strerror(errno)}});
+}
+
+/**
+ * Watch the descriptor with a new one-shot poll request, removing the
+ * previous one. Every ready descriptor is watched again by Reactor anyway,
+ * which also checks whether it still is ready.
+ */
+bool dazeus::IoUringReactor::watch(int fd, unsigned int events)
+{
+	std::unordered_map<int,uint32_t>::iterator it = polls_.find(fd);
+	if(it != polls_.end())
+		queue(IORING_OP_POLL_REMOVE, -1, pollData(fd, it->second), 0, 0);
+	if(++generation_ == 0)
+		++generation_;
+	polls_[fd] = generation_;
+	queue(IORING_OP_POLL_ADD, fd, 0, (events & Readable ? POLLIN : 0) | (events & Writable ? POLLOUT : 0),
+		pollData(fd, generation_));
+	return true;
+}
+
+void dazeus::IoUringReactor::unwatch(int fd)
+{
+	std::unordered_map<int,uint32_t>::iterator it = polls_.find(fd);
+	if(it == polls_.end())
+		return;
+	queue(IORING_OP_POLL_REMOVE, -1, pollData(fd, it->second), 0, 0);
+	polls_.erase(it);
+}
+
+bool dazeus::IoUringReactor::wait(long timeoutMs, std::vector<Ready> &ready)
+{
+	bool completed = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) != *cqHead_;
+	if(queued_ > 0 || (!completed && timeoutMs != 0)) {
+		struct __kernel_timespec ts;
+		ts.tv_sec = timeoutMs / 1000;
+		ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+		struct io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = timeoutMs >= 0 ? (uint64_t)(uintptr_t)&ts : 0;
+		if(enter(completed || timeoutMs == 0 ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			&arg, sizeof(arg)) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+			log(reactorLog, ErrorLevel, "io_uring_enter() failed", {{"error", strerror(errno)}});
+			return false;
+		}
+	}
+
+	unsigned int head = *cqHead_;
+	unsigned int tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+	for(; head != tail; ++head) {
+		struct io_uring_cqe *cqe = (struct io_uring_cqe*)cqes_ + (head & cqMask_);
+		uint32_t generation = cqe->user_data >> 32;
+		int fd = (int)(uint32_t)cqe->user_data;
+		std::unordered_map<int,uint32_t>::iterator it = polls_.find(fd);
+		if(generation == 0 || it == polls_.end() || it->second != generation)
+			continue;
+		polls_.erase(it);
+		// a descriptor that is gone is noticed by its network
+		if(cqe->res < 0)
+			continue;
+		Ready r = {fd, (cqe->res & POLLIN ? (unsigned int)Readable : 0)
+			| (cqe->res & POLLOUT ? (unsigned int)Writable : 0)
+			| (cqe->res & (POLLERR | POLLHUP) ? (unsigned int)Failed : 0)};
+		ready.push_back(r);
+	}
+	__atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+	return true;
+}
+
+#else
+
+void dazeus::IoUringReactor::flush()
+{
+}
+
+bool dazeus::IoUringReactor::watch(int, unsigned int)
+{
+	return false;
+}
+
+void dazeus::IoUringReactor::unwatch(int)
+{
+}
+
+bool dazeus::IoUringReactor::wait(long, std::vector<Ready> &)
+{
+	return false;
+}
+
+#endif
+
+#endif
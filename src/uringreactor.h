@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) Sjors Gielen, 2010-2014
+ * See LICENSE for license.
+ */
+
+#ifndef URINGREACTOR_H
+#define URINGREACTOR_H
+
+#ifdef __linux__
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "reactor.h"
+
+namespace dazeus {
+
+/**
+ * A Reactor that waits for the descriptors with io_uring poll requests.
+ * Watching a descriptor only queues a request in the submission ring, so the
+ * changes made while handling the ready descriptors are submitted together
+ * with the next wait, in one io_uring_enter(). With hundreds of connections,
+ * a loop iteration takes one system call of its own, where EpollReactor
+ * takes an epoll_ctl() for every descriptor it watches again.
+ *
+ * Needs Linux 5.11 or later, for waiting with a timeout; if io_uring isn't
+ * available, valid() is false and Reactor::create() falls back to epoll.
+ * The socket I/O itself is still done by libircclient.
+ */
+class IoUringReactor : public Reactor {
+public:
+	IoUringReactor(unsigned int entries = 1024);
+	~IoUringReactor();
+
+	void flush();
+
+protected:
+	bool watch(int fd, unsigned int events);
+	void unwatch(int fd);
+	bool wait(long timeoutMs, std::vector<Ready> &ready);
+
+private:
+	void queue(uint8_t opcode, int fd, uint64_t addr, uint32_t pollEvents, uint64_t userData);
+	int enter(unsigned int wait, unsigned int flags, void *arg, size_t argSize);
+
+	void *sqRing_;
+	size_t sqRingSize_;
+	void *cqRing_;
+	size_t cqRingSize_;
+	void *sqes_;
+	size_t sqesSize_;
+	unsigned int *sqHead_;
+	unsigned int *sqTail_;
+	unsigned int *sqArray_;
+	unsigned int sqMask_;
+	unsigned int sqEntries_;
+	unsigned int *cqHead_;
+	unsigned int *cqTail_;
+	unsigned int cqMask_;
+	void *cqes_;
+	// requests in the submission ring that weren't submitted yet
+	unsigned int queued_;
+	// the poll request of each watched descriptor, by its generation; a
+	// completion of an older one is ignored
+	std::unordered_map<int,uint32_t> polls_;
+	uint32_t generation_;
+};
+
+}
+
+#endif
+
+#endif
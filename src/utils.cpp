@@ -3,6 +3,8 @@
  * See LICENSE for license.
  */
 
+#include <cstring>
+
 #include "utils.h"
 
 std::string strToLower(const std::string &f) {
@@ -33,66 +35,57 @@ std::string strToIdentifier(const std::string &f) {
 	return res;
 }
 
-std::string trim(const std::string &s) {
-	std::string str;
-	bool alpha = true;
-	for(unsigned i = 0; i < s.length(); ++i) {
-		if(alpha && isspace(s[i]))
-			continue;
-		alpha = false;
-		str += s[i];
-	}
-	for(int i = str.length() - 1; i >= 0; --i) {
-		if(isspace(str[i]))
-			str.resize(i);
-		else break;
-	}
-	return str;
+dazeus::StringRef trim(dazeus::StringRef s) {
+	size_t begin = 0;
+	while(begin < s.size && isSpace(s.data[begin]))
+		++begin;
+	size_t end = s.size;
+	while(end > begin && isSpace(s.data[end - 1]))
+		--end;
+	return dazeus::StringRef(s.data + begin, end - begin);
 }
 
-bool contains(std::string x, char v) {
-	return find(x.begin(), x.end(), v) != x.end();
+bool contains(const std::string &x, char v) {
+	return x.find(v) != std::string::npos;
 }
 
-bool startsWith(std::string x, std::string y, bool caseInsensitive)
+// the first occurrence of sep in [begin, end), or 0
+static const char *find(const char *begin, const char *end, dazeus::StringRef sep)
 {
-	std::string z = x.substr(0, y.length());
-	if(caseInsensitive)
-		return strToLower(z) == strToLower(y);
-	else	return z == y;
+	while((size_t)(end - begin) >= sep.size) {
+		const char *match = (const char*)memchr(begin, sep.data[0], end - begin - sep.size + 1);
+		if(!match)
+			return 0;
+		if(memcmp(match, sep.data, sep.size) == 0)
+			return match;
+		begin = match + 1;
+	}
+	return 0;
 }
 
-std::vector<std::string> split(const std::string &s, const std::string &sep)
+/**
+ * Replace the contents of out with the parts of s between the separators.
+ * The vector keeps its storage, so splitting into the same one again doesn't
+ * allocate.
+ */
+void split(dazeus::StringRef s, dazeus::StringRef sep, std::vector<dazeus::StringRef> &out)
 {
-	std::vector<std::string> res;
-	std::string s_ = s;
-	int len = sep.length();
-	int remaining = s.length();
-	for(int i = 0; i <= remaining - len; ++i) {
-		if(s_.substr(i, len) == sep) {
-			res.push_back(s_.substr(0, i));
-			s_ = s_.substr(i + sep.length());
-			remaining -= i + sep.length();
-			i = -1;
-		}
+	out.clear();
+	if(sep.empty()) {
+		out.push_back(s);
+		return;
 	}
-	res.push_back(s_);
-	return res;
+	const char *begin = s.data;
+	const char *end = s.data + s.size;
+	const char *match;
+	while((match = find(begin, end, sep)) != 0) {
+		out.push_back(dazeus::StringRef(begin, match - begin));
+		begin = match + sep.size;
+	}
+	out.push_back(dazeus::StringRef(begin, end - begin));
 }
 
 std::vector<std::string> &operator<<(std::vector<std::string> &x, const char *v) {
-	x << std::string(v);
+	x.push_back(v);
 	return x;
 }
-
-std::vector<std::string>::iterator find_ci(std::vector<std::string> &v, const std::string &s) {
-	std::string sl = strToLower(s);
-	std::vector<std::string>::iterator it;
-	for(it = v.begin(); it != v.end(); ++it) {
-		if(strToLower(*it) == sl) {
-			return it;
-		}
-	}
-	return v.end();
-}
-
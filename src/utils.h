@@ -7,88 +7,170 @@
 #define LIBDAZEUS_UTILS_H
 
 #include <string>
+#include <cstring>
 #include <vector>
 #include <sstream>
 #include <algorithm>
 #include <map>
 
+#include "stringref.h"
+
 std::string strToLower(const std::string &f);
 std::string strToUpper(const std::string &f);
 std::string strToIdentifier(const std::string &f);
-std::string trim(const std::string &s);
-std::vector<std::string> split(const std::string &s, const std::string &sep);
-bool contains(std::string x, char v);
+// the results of trim() and split() point into their argument, so they are
+// only valid as long as that is
+dazeus::StringRef trim(dazeus::StringRef s);
+void split(dazeus::StringRef s, dazeus::StringRef sep, std::vector<dazeus::StringRef> &out);
+bool contains(const std::string &x, char v);
+
+// ASCII case folding, independent of the locale and without a copy
+inline char lowerChar(char c) {
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// isspace() in the C locale, without a call
+inline bool isSpace(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+inline bool equals_ci(const std::string &a, const std::string &b) {
+	if(a.size() != b.size())
+		return false;
+	const char *x = a.data();
+	const char *y = b.data();
+	for(size_t i = 0; i < a.size(); ++i) {
+		// characters equal but for case differ only in bit 0x20
+		char d = x[i] ^ y[i];
+		if(d != 0 && (d != 0x20 || lowerChar(x[i]) != lowerChar(y[i])))
+			return false;
+	}
+	return true;
+}
+
 // does X start with Y?
-bool startsWith(std::string x, std::string y, bool caseInsensitive);
-std::vector<std::string>::iterator find_ci(std::vector<std::string> &v, const std::string &s);
+inline bool startsWith(dazeus::StringRef x, dazeus::StringRef y, bool caseInsensitive) {
+	if(x.size < y.size)
+		return false;
+	if(!caseInsensitive)
+		return y.size == 0 || memcmp(x.data, y.data, y.size) == 0;
+	for(size_t i = 0; i < y.size; ++i) {
+		if(lowerChar(x.data[i]) != lowerChar(y.data[i]))
+			return false;
+	}
+	return true;
+}
+
+struct EqualsCi {
+	EqualsCi(const std::string &s) : s_(s) {}
+	bool operator()(const std::string &x) const { return equals_ci(x, s_); }
+	template <typename Value>
+	bool operator()(const std::pair<const std::string,Value> &x) const { return equals_ci(x.first, s_); }
+	const std::string &s_;
+};
 
 template <typename Container, typename Key>
-bool contains(Container x, Key k) {
+bool contains(const Container &x, const Key &k) {
 	return x.count(k) != 0;
 }
 
 template <typename Value>
-bool contains(std::vector<Value> x, Value v) {
-	return find(x.begin(), x.end(), v) != x.end();
+bool contains(const std::vector<Value> &x, const Value &v) {
+	return std::find(x.begin(), x.end(), v) != x.end();
 }
 
 template <typename Container, typename Value>
-void erase(Container &x, Value v) {
-	x.erase(remove(x.begin(), x.end(), v), x.end());
+void erase(Container &x, const Value &v) {
+	x.erase(std::remove(x.begin(), x.end(), v), x.end());
 }
 
+// a copy of the first element; the container itself is left alone
 template <typename Container, typename Value>
-Value takeFirst(Container c) {
-	Value v = c[0];
-	c.erase(c.begin());
-	return v;
+Value takeFirst(const Container &c) {
+	return c[0];
+}
+
+inline std::vector<std::string>::iterator find_ci(std::vector<std::string> &v, const std::string &s) {
+	return std::find_if(v.begin(), v.end(), EqualsCi(s));
+}
+
+inline std::vector<std::string>::const_iterator find_ci(const std::vector<std::string> &v, const std::string &s) {
+	return std::find_if(v.begin(), v.end(), EqualsCi(s));
 }
 
 template <typename Value>
 typename std::map<std::string,Value>::iterator find_ci(std::map<std::string,Value> &m, const std::string &s) {
-	std::string sl = strToLower(s);
-	typename std::map<std::string,Value>::iterator it;
-	for(it = m.begin(); it != m.end(); ++it) {
-		if(strToLower(it->first) == sl) {
-			return it;
-		}
-	}
-	return m.end();
+	// the exact key is the common case, and doesn't need a scan
+	typename std::map<std::string,Value>::iterator it = m.find(s);
+	return it != m.end() ? it : std::find_if(m.begin(), m.end(), EqualsCi(s));
+}
+
+template <typename Value>
+typename std::map<std::string,Value>::const_iterator find_ci(const std::map<std::string,Value> &m, const std::string &s) {
+	typename std::map<std::string,Value>::const_iterator it = m.find(s);
+	return it != m.end() ? it : std::find_if(m.begin(), m.end(), EqualsCi(s));
 }
 
 template <typename Container, typename Key>
-bool contains_ci(Container x, Key s) {
+bool contains_ci(const Container &x, const Key &s) {
 	return find_ci(x, s) != x.end();
 }
 
-template <typename Container>
-void erase_ci(Container &x, const std::string &s) {
-	std::string sl = strToLower(s);
-	typename Container::iterator it = find_ci(x, s);
-	// TODO: use erase-remove idiom
+template <typename Value>
+void erase_ci(std::vector<Value> &x, const std::string &s) {
+	x.erase(std::remove_if(x.begin(), x.end(), EqualsCi(s)), x.end());
+}
+
+template <typename Value>
+void erase_ci(std::map<std::string,Value> &x, const std::string &s) {
+	typename std::map<std::string,Value>::iterator it = x.begin();
 	while(it != x.end()) {
-		x.erase(it);
-		it = find_ci(x, s);
+		if(equals_ci(it->first, s))
+			x.erase(it++);
+		else
+			++it;
 	}
 }
 
+// appends the elements, strings or StringRefs, to out with s between them
 template <typename Container>
-std::string join(Container c, std::string s) {
-	std::stringstream ss;
-	typename Container::const_iterator it;
-	bool first = true;
+void join(const Container &c, dazeus::StringRef s, std::string &out) {
+	typename Container::const_iterator it = c.begin();
+	if(it == c.end())
+		return;
+	size_t size = 0;
+	for(; it != c.end(); ++it) {
+		size += dazeus::StringRef(*it).size + s.size;
+	}
+	// copied in place, without a capacity check per part
+	size_t pos = out.size();
+	out.resize(pos + size - s.size);
+	char *p = &out[pos];
 	for(it = c.begin(); it != c.end(); ++it) {
-		if(!first)
-			ss << s;
-		ss << *it;
-		first = false;
+		if(it == c.begin()) {
+			// no separator before the first
+		} else if(s.size == 1) {
+			*p++ = s.data[0];
+		} else {
+			memcpy(p, s.data, s.size);
+			p += s.size;
+		}
+		dazeus::StringRef e(*it);
+		memcpy(p, e.data, e.size);
+		p += e.size;
 	}
-	return ss.str();
+}
+
+template <typename Container>
+std::string join(const Container &c, dazeus::StringRef s) {
+	std::string res;
+	join(c, s, res);
+	return res;
 }
 
 std::vector<std::string> &operator<<(std::vector<std::string> &x, const char *v);
 template <typename T>
-std::vector<T> &operator<<(std::vector<T> &x, T v) {
+std::vector<T> &operator<<(std::vector<T> &x, const T &v) {
 	x.push_back(v);
 	return x;
 }
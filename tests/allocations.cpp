@@ -0,0 +1,198 @@
+#include <network.h>
+#include <replaydriver.h>
+#include <logger.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sstream>
+#include <new>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+// Allocations done by the test thread while counting is on
+static thread_local bool counting = false;
+static uint64_t allocations = 0;
+static uint64_t allocatedBytes = 0;
+
+void *operator new(size_t size) {
+	if(counting) {
+		++allocations;
+		allocatedBytes += size;
+	}
+	void *p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+class Listener : public dazeus::NetworkListener {
+public:
+	Listener() : events(0) {}
+	virtual void ircEvent(const std::string &, const std::string &,
+	  const std::vector<std::string> &, dazeus::Network *) {
+		++events;
+	}
+	uint64_t events;
+};
+
+/**
+ * Maximum allocations and allocated bytes per event of a scenario. Events
+ * include the line parsing the replay driver does in place of libircclient.
+ * Lower these when an optimization lands, so the gain can't silently be
+ * lost again.
+ */
+struct Budget {
+	const char *name;
+	double allocations;
+	double bytes;
+};
+
+static std::string user(unsigned int i) {
+	std::stringstream ss;
+	ss << "user" << i;
+	return ss.str();
+}
+
+static std::string prefix(unsigned int i) {
+	return user(i) + "!~u@host.example.net";
+}
+
+static std::vector<std::string> namesReply(const std::string &channel, unsigned int users) {
+	std::vector<std::string> lines;
+	std::string line;
+	for(unsigned int i = 0; i < users; ++i) {
+		line += (line.empty() ? "" : " ") + user(i);
+		if(line.size() > 400 || i == users - 1) {
+			lines.push_back(":irc.test 353 tester = " + channel + " :" + line);
+			line.clear();
+		}
+	}
+	lines.push_back(":irc.test 366 tester " + channel + " :End of NAMES list");
+	return lines;
+}
+
+class Scenario {
+public:
+	Scenario() : network_(0), driver_(0) {
+		dazeus::NetworkConfig config;
+		config.name = "test";
+		config.nickName = "tester";
+		network_ = new dazeus::Network(config);
+		network_->addListener(&listener_);
+		driver_ = new dazeus::ReplayDriver(network_);
+		driver_->feed(":irc.test 001 tester :Welcome");
+		driver_->feed(":irc.test 376 tester :End of MOTD");
+	}
+	~Scenario() {
+		delete driver_;
+		delete network_;
+	}
+
+	void feed(const std::vector<std::string> &lines) {
+		for(size_t i = 0; i < lines.size(); ++i)
+			driver_->feed(lines[i]);
+	}
+
+	void join(const std::string &channel, unsigned int users) {
+		driver_->feed(":tester!t@test.host JOIN " + channel);
+		feed(namesReply(channel, users));
+	}
+
+	/**
+	 * Replay the lines, and check the allocations per event against the
+	 * budget. With oneRead, the lines are replayed as if they were read at
+	 * once, and the allocations are counted per line.
+	 */
+	void measure(const Budget &budget, const std::vector<std::string> &lines, bool oneRead = false) {
+		uint64_t events = listener_.events;
+		allocations = 0;
+		allocatedBytes = 0;
+		counting = true;
+		if(oneRead)
+			driver_->feed(lines);
+		else
+			feed(lines);
+		counting = false;
+		events = listener_.events - events;
+		mustbe(events > 0, "No events in scenario");
+		if(oneRead)
+			events = lines.size();
+		double perEvent = (double)allocations / events;
+		double bytesPerEvent = (double)allocatedBytes / events;
+		printf("%-16s %8lu %s %10.2f allocations/event %10.0f bytes/event\n", budget.name,
+			(unsigned long)events, oneRead ? "lines " : "events", perEvent, bytesPerEvent);
+		if(perEvent > budget.allocations || bytesPerEvent > budget.bytes) {
+			fprintf(stderr, "Test error: %s over its allocation budget of %.2f allocations and %.0f bytes per event\n",
+				budget.name, budget.allocations, budget.bytes);
+			exit(9);
+		}
+	}
+
+	dazeus::Network &network() { return *network_; }
+
+private:
+	Listener listener_;
+	dazeus::Network *network_;
+	dazeus::ReplayDriver *driver_;
+};
+
+static const Budget privmsgBudget = {"privmsg", 0, 0};
+static const Budget joinBudget = {"join_big", 0.1, 400};
+// the users that left are remembered until the netjoin, like joined ones
+static const Budget quitBudget = {"netsplit_quit", 0.1, 400};
+static const Budget namesBudget = {"names", 2, 13000};
+
+int main() {
+	dazeus::setLogLevel(dazeus::WarningLevel);
+
+	// Messages in a channel, the most common event
+	{
+		Scenario s;
+		s.join("#chan", 100);
+		std::vector<std::string> lines;
+		for(unsigned int i = 0; i < 2000; ++i) {
+			lines.push_back(":" + prefix(i % 100) + " PRIVMSG #chan :hello there, how is everyone doing today?");
+		}
+		s.measure(privmsgBudget, lines);
+	}
+
+	// Users joining a channel that already has a lot of them
+	{
+		Scenario s;
+		s.join("#big", 2000);
+		std::vector<std::string> lines;
+		for(unsigned int i = 2000; i < 2500; ++i) {
+			lines.push_back(":" + prefix(i) + " JOIN #big");
+		}
+		s.measure(joinBudget, lines);
+		mustbe(s.network().usersInChannel("#big").size() == 2501, "Joins not tracked");
+	}
+
+	// A netsplit taking users out of several big channels
+	{
+		Scenario s;
+		for(unsigned int c = 0; c < 4; ++c) {
+			std::stringstream channel;
+			channel << "#split" << c;
+			s.join(channel.str(), 1000);
+		}
+		std::vector<std::string> lines;
+		for(unsigned int i = 0; i < 500; ++i) {
+			lines.push_back(":" + prefix(i) + " QUIT :hub.example.net leaf.example.net");
+		}
+		s.measure(quitBudget, lines, true);
+		mustbe(s.network().usersInChannel("#split0").size() == 501, "Quits not tracked");
+	}
+
+	// NAMES replies for a channel, counted per 353 and 366 line
+	{
+		Scenario s;
+		s.join("#names", 10);
+		s.measure(namesBudget, namesReply("#names", 1000));
+	}
+	return 0;
+}
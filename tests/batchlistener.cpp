@@ -0,0 +1,66 @@
+#include <network.h>
+#include <replaydriver.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+class Listener : public dazeus::NetworkListener {
+public:
+	virtual void ircEvent(const std::string &event, const std::string &,
+	  const std::vector<std::string> &, dazeus::Network *) {
+		events.push_back(event);
+	}
+	std::vector<std::string> events;
+};
+
+class BatchListener : public dazeus::BatchNetworkListener {
+public:
+	virtual void ircEvents(const dazeus::IrcEvent *e, size_t count, dazeus::Network *n) {
+		batches.push_back(count);
+		for(size_t i = 0; i < count; ++i) {
+			events.push_back(e[i].event);
+			if(e[i].event == "PRIVMSG" && e[i].params.size() > 1 && e[i].params[1] == "!hi") {
+				n->say(e[i].params[0], "hi " + e[i].origin);
+				// the event of our own message comes in the next batch, so
+				// the rest of this one must be unaffected
+				mustbe(e[i].params[1] == "!hi", "Batch changed while delivering it");
+			}
+		}
+	}
+	std::vector<size_t> batches;
+	std::vector<std::string> events;
+};
+
+int main() {
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+	dazeus::Network n(config);
+	Listener l;
+	BatchListener b;
+	n.addListener(&l);
+	n.addBatchListener(&b);
+
+	dazeus::ReplayDriver driver(&n);
+	driver.feed(":irc.test 001 tester :Welcome");
+	driver.feed(":irc.test 376 tester :End of MOTD");
+	mustbe(b.batches.size() == 2 && b.batches[1] == 2, "CONNECT and its NUMERIC not in one batch");
+
+	driver.feed(":tester!t@test.host JOIN #chan");
+	driver.feed(":irc.test 353 tester = #chan :@tester alice");
+	driver.feed(":irc.test 366 tester #chan :End of NAMES list");
+	mustbe(b.batches.back() == 2, "NAMES and its NUMERIC not in one batch");
+
+	size_t batches = b.batches.size();
+	driver.feed(":alice!a@test.host PRIVMSG #chan :!hi");
+	mustbe(b.batches.size() == batches + 2, "Own message not in a batch of its own");
+	mustbe(b.events.back() == "PRIVMSG_ME", "Own message not delivered");
+
+	n.say("#chan", "outside of a pass");
+	mustbe(b.batches.back() == 1 && b.events.back() == "PRIVMSG_ME", "Event outside of a pass not delivered");
+
+	mustbe(l.events == b.events, "Batch listener got other events than the listener");
+	return 0;
+}
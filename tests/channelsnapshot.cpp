@@ -0,0 +1,158 @@
+#include <channelsnapshot.h>
+#include <network.h>
+#include <replaydriver.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+typedef std::map<std::string,std::vector<std::string> > Users;
+typedef std::map<std::string,std::string> Topics;
+
+static std::vector<std::string> users(const char *a, const char *b) {
+	std::vector<std::string> u;
+	u.push_back(a);
+	u.push_back(b);
+	return u;
+}
+
+int main() {
+	char path[] = "/tmp/dazeus-snapshot-XXXXXX";
+	int fd = mkstemp(path);
+	mustbe(fd >= 0, "Couldn't create temporary file");
+	close(fd);
+	unlink(path);
+
+	{
+		dazeus::ChannelSnapshot s;
+		std::string error;
+		mustbe(s.open(path, &error), "Couldn't create snapshot");
+		s.write("net", "#chan", "the topic", users("alice", "bob"));
+		s.write("net", "#other", "", users("alice", "carol"));
+		s.write("net", "#chan", "new topic", users("alice", "dave"));
+		s.write("elsewhere", "#chan", "", users("eve", "mallory"));
+		s.erase("net", "#other");
+		s.sync();
+
+		// records written but not synced are lost in a crash
+		if(fork() == 0) {
+			s.write("net", "#lost", "", users("x", "y"));
+			_exit(0);
+		}
+		wait(NULL);
+	}
+
+	{
+		dazeus::ChannelSnapshot s;
+		mustbe(s.open(path), "Couldn't reopen snapshot");
+		Users u;
+		Topics t;
+		s.restore("net", u, t);
+		mustbe(u.size() == 1 && u["#chan"] == users("alice", "dave"), "Channels restored wrong");
+		mustbe(t.size() == 1 && t["#chan"] == "new topic", "Topics restored wrong");
+		u.clear();
+		s.restore("elsewhere", u, t);
+		mustbe(u.size() == 1 && u["#chan"] == users("eve", "mallory"), "Other network restored wrong");
+
+		// a file of replaced records is compacted
+		for(int i = 0; i < 5000; ++i) {
+			s.write("net", "#chan", "topic " + std::to_string(i), users("alice", "dave"));
+			s.sync();
+		}
+		mustbe(s.size() < 262144 && s.liveBytes() < 200, "Snapshot not compacted");
+		mustbe(access((std::string(path) + ".tmp").c_str(), F_OK) != 0, "Compaction file left behind");
+	}
+
+	{
+		dazeus::ChannelSnapshot s;
+		mustbe(s.open(path), "Couldn't reopen compacted snapshot");
+		Users u;
+		Topics t;
+		s.restore("net", u, t);
+		mustbe(u.size() == 1 && t["#chan"] == "topic 4999", "Compacted snapshot restored wrong");
+	}
+	unlink(path);
+
+	// a corrupt member count is ignored, not believed
+	{
+		dazeus::ChannelSnapshot s;
+		mustbe(s.open(path), "Couldn't create snapshot to corrupt");
+		s.write("net", "#chan", "corrupt me", users("alice", "bob"));
+		s.write("net", "#fine", "", users("carol", "dave"));
+		s.sync();
+	}
+	{
+		FILE *f = fopen(path, "r+b");
+		mustbe(f != NULL, "Couldn't open snapshot to corrupt");
+		std::string data;
+		char buf[4096];
+		size_t r;
+		while((r = fread(buf, 1, sizeof(buf), f)) > 0)
+			data.append(buf, r);
+		size_t pos = data.find("corrupt me");
+		mustbe(pos != std::string::npos, "Topic not found in snapshot");
+		uint32_t count = 0xffffffff;
+		fseek(f, pos + 10, SEEK_SET);
+		mustbe(fwrite(&count, 4, 1, f) == 1, "Couldn't corrupt snapshot");
+		fclose(f);
+
+		dazeus::ChannelSnapshot s;
+		mustbe(s.open(path), "Couldn't open corrupt snapshot");
+		Users u;
+		Topics t;
+		s.restore("net", u, t);
+		mustbe(u.size() == 1 && u["#fine"] == users("carol", "dave"), "Corrupt channel restored");
+	}
+	unlink(path);
+
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+	dazeus::ChannelSnapshot s;
+	mustbe(s.open(path), "Couldn't create network snapshot");
+
+	// A network saves its channels, and a new one restores them as stale
+	{
+		dazeus::Network n(config);
+		n.setSnapshot(&s);
+		dazeus::ReplayDriver d(&n);
+		d.feed(":irc.test 001 tester :Welcome");
+		d.feed(":tester!t@host JOIN #chan");
+		d.feed(":irc.test 332 tester #chan :the topic");
+		d.feed(":irc.test 353 tester = #chan :@tester alice +bob");
+		d.feed(":irc.test 366 tester #chan :End of NAMES list");
+		d.feed(":tester!t@host JOIN #gone");
+		d.feed(":tester!t@host PART #gone");
+		mustbe(!n.isStale("#chan"), "Joined channel is stale");
+	}
+	{
+		dazeus::Network n(config);
+		n.setSnapshot(&s);
+		mustbe(n.joinedChannels().size() == 1 && n.joinedChannels()[0] == "#chan", "Channels not restored");
+		mustbe(n.isStale("#chan"), "Restored channel not stale");
+		mustbe(n.usersInChannel("#chan").size() == 3 && n.isKnownUser("alice"), "Users not restored");
+		mustbe(n.topics()["#chan"] == "the topic", "Topic not restored");
+
+		// rejoining reconciles the channel with what the server says
+		dazeus::ReplayDriver d(&n);
+		d.feed(":irc.test 001 tester :Welcome");
+		mustbe(n.isStale("#chan") && n.usersInChannel("#chan").size() == 3, "Stale channel lost on connect");
+		d.feed(":tester!t@host JOIN #chan");
+		mustbe(!n.isStale("#chan") && n.usersInChannel("#chan").size() == 1, "Rejoined channel not reset");
+		d.feed(":irc.test 353 tester = #chan :@tester carol");
+		d.feed(":irc.test 366 tester #chan :End of NAMES list");
+		mustbe(n.usersInChannel("#chan").size() == 2 && !n.isKnownUser("alice"), "Rejoined channel wrong");
+	}
+	{
+		dazeus::Network n(config);
+		n.setSnapshot(&s);
+		std::map<std::string,dazeus::Network::ChannelMode> u = n.usersInChannel("#chan");
+		mustbe(u.size() == 2 && u.count("carol"), "Reconciled channel not saved");
+	}
+	s.close();
+	unlink(path);
+	return 0;
+}
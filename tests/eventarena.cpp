@@ -0,0 +1,31 @@
+#include <eventarena.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+int main() {
+	dazeus::EventArena a;
+	a.push("#channel");
+	a.push(std::string("a message long enough not to fit in the string itself"));
+	mustbe(a.size() == 2 && a.params()[0] == "#channel", "Parameters not added");
+	const char *buffer = a.params()[1].data();
+
+	a.reset();
+	mustbe(a.size() == 0 && a.name().empty() && a.origin().empty(), "Arena not reset");
+	a.push("x");
+	a.push("y");
+	mustbe(a.params()[1].data() == buffer, "Buffer not reused");
+	mustbe(a.params()[1] == "y", "Reused buffer not cleared");
+
+	a.insert(0, "first");
+	mustbe(a.size() == 3 && a.params()[0] == "first" && a.params()[1] == "x" && a.params()[2] == "y", "Insert wrong");
+	a.erase(1);
+	mustbe(a.size() == 2 && a.params()[0] == "first" && a.params()[1] == "y", "Erase wrong");
+	a.truncate(1);
+	mustbe(a.size() == 1 && a.params()[0] == "first", "Truncate wrong");
+	a.truncate(5);
+	mustbe(a.size() == 1, "Truncate added parameters");
+	return 0;
+}
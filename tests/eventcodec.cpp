@@ -0,0 +1,60 @@
+#include <eventcodec.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+int main() {
+	std::vector<std::string> params;
+	params.push_back("#chan");
+	params.push_back("hello there");
+	std::string buf;
+	dazeus::EventCodec::encode(buf, "net", "PRIVMSG", "alice!a@host", params, 1400000000123456ULL);
+	mustbe(buf.size() == dazeus::EventCodec::encodedSize("net", "PRIVMSG", "alice!a@host", params, 1400000000123456ULL),
+		"Encoded size wrong");
+
+	dazeus::EventView v;
+	size_t consumed = 0;
+	mustbe(dazeus::EventCodec::decode(buf.data(), buf.size(), v, &consumed), "Event not decoded");
+	mustbe(consumed == buf.size(), "Consumed size wrong");
+	mustbe(v.version == dazeus::EventCodec::version && v.hasTime && v.micros == 1400000000123456ULL, "Header decoded wrong");
+	mustbe(v.network == "net" && v.event == "PRIVMSG" && v.origin == "alice!a@host", "Strings decoded wrong");
+	mustbe(v.params.size() == 2 && v.params[0] == "#chan" && v.params[1] == "hello there", "Params decoded wrong");
+	mustbe(v.origin.data >= buf.data() && v.origin.data < buf.data() + buf.size(), "Decoding copied the strings");
+
+	// well-known names take one byte, others are stored
+	std::string literal;
+	dazeus::EventCodec::encode(literal, "net", "SOMETHING", "", std::vector<std::string>());
+	mustbe(dazeus::EventCodec::eventId("PRIVMSG") != 0 && dazeus::EventCodec::eventId("SOMETHING") == 0, "Event IDs wrong");
+	mustbe(dazeus::EventCodec::eventName(dazeus::EventCodec::eventId("JOIN")) == std::string("JOIN"), "Event name wrong");
+	mustbe(literal.size() == 2 + 1 + 10 + 4 + 1 + 1, "Literal event size wrong");
+
+	// events can be decoded back to back, and copied out
+	size_t first = buf.size();
+	buf += literal;
+	mustbe(dazeus::EventCodec::decode(buf.data() + first, buf.size() - first, v, &consumed), "Second event not decoded");
+	mustbe(consumed == literal.size() && v.event == "SOMETHING" && !v.hasTime && v.params.empty(), "Second event decoded wrong");
+	dazeus::IrcEvent e;
+	dazeus::EventCodec::decode(buf.data(), first, v);
+	v.copyTo(e);
+	mustbe(e.event == "PRIVMSG" && e.origin == "alice!a@host" && e.params == params, "Event copied wrong");
+
+	// long strings need multi-byte lengths
+	std::vector<std::string> big(1, std::string(100000, 'x'));
+	std::string bigbuf;
+	dazeus::EventCodec::encode(bigbuf, "net", "NOTICE", "bob", big);
+	mustbe(dazeus::EventCodec::decode(bigbuf.data(), bigbuf.size(), v) && v.params[0].size == 100000, "Long string decoded wrong");
+
+	// truncated, newer or corrupt events are rejected
+	for(size_t i = 0; i < first; ++i) {
+		mustbe(!dazeus::EventCodec::decode(buf.data(), i, v), "Truncated event decoded");
+	}
+	std::string newer = literal;
+	newer[0] = dazeus::EventCodec::version + 1;
+	mustbe(!dazeus::EventCodec::decode(newer.data(), newer.size(), v), "Newer version decoded");
+	std::string unknown = literal;
+	unknown[2] = 0x7f;
+	mustbe(!dazeus::EventCodec::decode(unknown.data(), unknown.size(), v), "Unknown event ID decoded");
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <eventring.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+static std::vector<std::string> params(const std::string &a, const std::string &b) {
+	std::vector<std::string> p;
+	p.push_back(a);
+	p.push_back(b);
+	return p;
+}
+
+int main() {
+	char path[] = "/tmp/dazeus-ring-XXXXXX";
+	int fd = mkstemp(path);
+	mustbe(fd >= 0, "Couldn't create temporary file");
+	close(fd);
+
+	dazeus::EventRingWriter w;
+	mustbe(w.open(path, 4096), "Couldn't create ring");
+	w.write("net", "PRIVMSG", "before", params("#chan", "not seen by the reader"));
+
+	dazeus::EventRingReader r;
+	std::string error;
+	mustbe(r.open(path, &error), "Couldn't open ring");
+	dazeus::RingEvent e;
+	mustbe(!r.next(e), "Reader didn't start at the newest event");
+
+	w.write("net", "PRIVMSG", "alice", params("#chan", "hello there"));
+	w.write("other", "JOIN", "bob", std::vector<std::string>(1, "#chan"));
+	mustbe(w.readers().size() == 1 && w.readers()[0].lagEvents == 2, "Reader lag wrong");
+	mustbe(r.next(e), "Event not read");
+	mustbe(e.sequence == 2 && e.network == "net" && e.event.event == "PRIVMSG" && e.event.origin == "alice"
+		&& e.event.params == params("#chan", "hello there"), "Event read wrong");
+	mustbe(r.next(e), "Second event not read");
+	mustbe(e.network == "other" && e.event.event == "JOIN" && e.event.params.size() == 1, "Second event read wrong");
+	mustbe(!r.next(e), "Event read twice");
+	mustbe(w.readers()[0].lagEvents == 0 && w.readers()[0].lagBytes == 0, "Reader lag not updated");
+
+	// overrun the reader
+	unsigned int read = 0;
+	for(unsigned int i = 0; i < 1000; ++i) {
+		w.write("net", "PRIVMSG", "alice", params("#chan", "a message that takes some room in the ring"));
+		if(i % 100 == 0 && r.next(e))
+			++read;
+	}
+	while(r.next(e)) {
+		++read;
+	}
+	mustbe(r.lost() > 0, "No events lost in an overrun");
+	mustbe(read + r.lost() == 1000, "Events neither read nor lost");
+	mustbe(e.sequence == w.written(), "Last event not read");
+	mustbe(w.readers()[0].lost == r.lost(), "Lost events not reported");
+
+	w.write("net", "PRIVMSG", "alice", params("#chan", std::string(2000, 'x')));
+	mustbe(w.oversized() == 1, "Oversized event written");
+
+	dazeus::EventRingReader r2;
+	mustbe(r2.open(path), "Couldn't open ring twice");
+	mustbe(w.readers().size() == 2, "Second reader not seen");
+	r2.close();
+	mustbe(w.readers().size() == 1, "Closed reader still seen");
+
+	// a new ring replaces the file, and the attached reader keeps the old one
+	mustbe(!r.replaced(), "Ring replaced before it was");
+	mustbe(w.open(path, 4096), "Couldn't replace ring");
+	mustbe(r.replaced(), "Replacement not seen by the reader");
+	mustbe(!r.next(e) && r.lagBytes() == 0, "Reader of the old ring broke");
+	mustbe(r.open(path), "Couldn't open replacement ring");
+	mustbe(!r.replaced(), "Replacement ring seen as replaced");
+	w.write("net", "PRIVMSG", "alice", params("#chan", "in the new ring"));
+	mustbe(r.next(e) && e.sequence == 1 && e.event.params[1] == "in the new ring", "Replacement ring not read");
+
+	r.close();
+	w.close();
+	mustbe(!r2.open("/nonexistent/ring", &error) && !error.empty(), "Opened nonexistent ring");
+	unlink(path);
+	return 0;
+}
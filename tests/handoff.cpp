@@ -0,0 +1,168 @@
+#include <network.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+struct Listener : public dazeus::NetworkListener {
+	std::vector<std::string> events;
+	void ircEvent(const std::string &event, const std::string &, const std::vector<std::string> &params, dazeus::Network *) {
+		std::string e = event;
+		for(size_t i = 0; i < params.size(); ++i)
+			e += " " + params[i];
+		events.push_back(e);
+	}
+	bool got(const std::string &e) const {
+		for(size_t i = 0; i < events.size(); ++i) {
+			if(events[i].compare(0, e.size(), e) == 0)
+				return true;
+		}
+		return false;
+	}
+};
+
+// the IRC server: one listening socket, and the connection to it
+static int listenFd = -1;
+static int clientFd = -1;
+static int accepted = 0;
+static std::string received;
+
+static void serverSend(const std::string &data) {
+	mustbe(write(clientFd, data.data(), data.size()) == (ssize_t)data.size(), "Couldn't send to client");
+}
+
+static size_t count(const std::string &needle) {
+	size_t n = 0;
+	for(size_t pos = received.find(needle); pos != std::string::npos; pos = received.find(needle, pos + 1))
+		++n;
+	return n;
+}
+
+/**
+ * Run the network and the server until the condition holds, or a few seconds
+ * have passed.
+ */
+template <typename F>
+static bool runUntil(dazeus::Network *n, F done) {
+	for(int i = 0; i < 300 && !done(); ++i) {
+		fd_set in_set, out_set;
+		int maxfd = listenFd;
+		FD_ZERO(&in_set);
+		FD_ZERO(&out_set);
+		if(n->activeServer())
+			n->addDescriptors(&in_set, &out_set, &maxfd);
+		FD_SET(listenFd, &in_set);
+		if(clientFd >= 0) {
+			FD_SET(clientFd, &in_set);
+			if(clientFd > maxfd)
+				maxfd = clientFd;
+		}
+		struct timeval timeout = {0, 10000};
+		if(select(maxfd + 1, &in_set, &out_set, NULL, &timeout) <= 0)
+			continue;
+		if(FD_ISSET(listenFd, &in_set)) {
+			int fd = accept(listenFd, NULL, NULL);
+			if(fd >= 0) {
+				++accepted;
+				clientFd = fd;
+			}
+		}
+		if(clientFd >= 0 && FD_ISSET(clientFd, &in_set)) {
+			char buf[4096];
+			ssize_t r = read(clientFd, buf, sizeof(buf));
+			mustbe(r > 0, "Client closed the connection");
+			received.append(buf, r);
+		}
+		if(n->activeServer())
+			n->processDescriptors(&in_set, &out_set);
+	}
+	return done();
+}
+
+int main() {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	mustbe(listenFd >= 0 && bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+		&& listen(listenFd, 4) == 0 && getsockname(listenFd, (struct sockaddr*)&addr, &len) == 0,
+		"Couldn't open server socket");
+
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+	config.handoff = true;
+	dazeus::ServerConfig server;
+	server.host = "127.0.0.1";
+	server.port = ntohs(addr.sin_port);
+	config.servers.push_back(server);
+
+	int pair[2];
+	mustbe(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0, "Couldn't create socket pair");
+
+	dazeus::Network a(config);
+	Listener la;
+	a.addListener(&la);
+	mustbe(!a.handoff(pair[0]), "Handed off without a connection");
+
+	// connect and join a channel in the old process
+	a.connectToNetwork();
+	mustbe(runUntil(&a, [] { return received.find("USER ") != std::string::npos; }), "No registration received");
+	serverSend(":irc.test 001 tester :Welcome\r\n:irc.test 376 tester :End of MOTD\r\n");
+	mustbe(runUntil(&a, [&] { return la.got("CONNECT"); }), "Old process didn't connect");
+	a.joinChannel("#chan");
+	mustbe(runUntil(&a, [] { return received.find("JOIN #chan") != std::string::npos; }), "No JOIN received");
+	serverSend(":tester!t@host JOIN #chan\r\n"
+		":irc.test 332 tester #chan :the topic\r\n"
+		":irc.test 353 tester = #chan :@tester alice\r\n"
+		":irc.test 366 tester #chan :End of NAMES list\r\n"
+		":alice!a@host PRIVMSG #chan :hel");
+	mustbe(runUntil(&a, [&] { return a.usersInChannel("#chan").size() == 2; }), "Old process didn't join");
+	int rounds = 0;
+	runUntil(&a, [&] { return ++rounds > 20; });
+	mustbe(la.events.back().find("PRIVMSG") == std::string::npos, "Partial line delivered");
+
+	// hand the connection to the new process
+	std::string error;
+	mustbe(a.handoff(pair[0], &error), "Handoff failed");
+	mustbe(a.activeServer() == 0 && a.joinedChannels().empty(), "Old process still connected");
+	mustbe(!a.reconnectPending(), "Old process reconnects");
+
+	dazeus::Network b(config);
+	Listener lb;
+	b.addListener(&lb);
+	mustbe(b.resume(pair[1], &error), "Resume failed");
+	mustbe(b.usersInChannel("#chan").size() == 2 && b.topics()["#chan"] == "the topic", "Channels not handed off");
+	mustbe(runUntil(&b, [&] { return lb.got("CONNECT"); }), "New process didn't connect");
+
+	// the rest of the line, and new commands, use the same connection
+	serverSend("lo\r\n");
+	mustbe(runUntil(&b, [&] { return lb.got("PRIVMSG #chan hello"); }), "Split line not received");
+	b.say("#chan", "still here");
+	mustbe(runUntil(&b, [] { return received.find("PRIVMSG #chan :still here\r\n") != std::string::npos; }),
+		"Message not sent");
+	mustbe(accepted == 1, "Server saw a new connection");
+	mustbe(count("NICK ") == 1 && count("USER ") == 1 && count("QUIT") == 0, "Server saw the handoff");
+
+	// garbage isn't resumed
+	dazeus::Network c(config);
+	mustbe(write(pair[0], "garbage!", 8) == 8, "Couldn't write garbage");
+	shutdown(pair[0], SHUT_WR);
+	mustbe(!c.resume(pair[1]) && c.activeServer() == 0, "Garbage resumed");
+
+	close(pair[0]);
+	close(pair[1]);
+	close(clientFd);
+	close(listenFd);
+	return 0;
+}
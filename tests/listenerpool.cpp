@@ -0,0 +1,125 @@
+#include <network.h>
+#include <listenerpool.h>
+#include <metrics.h>
+#include <replaydriver.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sstream>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+// Checks that the messages of every channel come in order
+class OrderListener : public dazeus::NetworkListener {
+public:
+	OrderListener() : mutex(), last(), messages(0), running(0), maxRunning(0), outOfOrder(false) {}
+	virtual void ircEvent(const std::string &event, const std::string &,
+	  const std::vector<std::string> &params, dazeus::Network *) {
+		if(event != "PRIVMSG")
+			return;
+		int now = ++running;
+		int max = maxRunning.load();
+		while(now > max && !maxRunning.compare_exchange_weak(max, now)) {}
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+		--running;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		int seq = atoi(params[1].c_str());
+		if(last.count(params[0]) && last[params[0]] + 1 != seq)
+			outOfOrder = true;
+		last[params[0]] = seq;
+		++messages;
+	}
+	std::mutex mutex;
+	std::map<std::string,int> last;
+	int messages;
+	std::atomic<int> running;
+	std::atomic<int> maxRunning;
+	bool outOfOrder;
+};
+
+// Blocks on the first message until released, and answers messages through
+// post()
+class SlowListener : public dazeus::NetworkListener {
+public:
+	SlowListener() : release(false), handled(0) {}
+	virtual void ircEvent(const std::string &event, const std::string &origin,
+	  const std::vector<std::string> &params, dazeus::Network *n) {
+		if(event != "PRIVMSG")
+			return;
+		while(!release)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		++handled;
+		if(params[1] == "!hi") {
+			std::string channel = params[0];
+			std::string nick = origin;
+			n->post([channel, nick](dazeus::Network *n) { n->say(channel, "hi " + nick); });
+		}
+	}
+	std::atomic<bool> release;
+	std::atomic<int> handled;
+};
+
+static dazeus::NetworkConfig config() {
+	dazeus::NetworkConfig c;
+	c.name = "test";
+	c.nickName = "tester";
+	return c;
+}
+
+int main() {
+	{
+		dazeus::ListenerPool pool(4);
+		OrderListener l;
+		dazeus::Network n(config());
+		n.addListener(&l, &pool);
+		dazeus::ReplayDriver driver(&n);
+		driver.feed(":irc.test 001 tester :Welcome");
+		driver.feed(":irc.test 376 tester :End of MOTD");
+		for(int i = 0; i < 100; ++i) {
+			for(int c = 0; c < 8; ++c) {
+				std::stringstream line;
+				line << ":alice!a@test.host PRIVMSG #Chan" << c << " :" << i;
+				driver.feed(line.str());
+			}
+		}
+		pool.wait(&n);
+		mustbe(l.messages == 800, "Not all messages handled");
+		mustbe(!l.outOfOrder, "Messages of a channel out of order");
+		mustbe(l.maxRunning > 1, "Channels not handled in parallel");
+		mustbe(n.metrics().snapshot().listenerQueueDepth == 0, "Queue depth not back to zero");
+	}
+
+	{
+		dazeus::ListenerPool pool(1, 2, dazeus::ListenerPool::DropNewestPolicy);
+		SlowListener l;
+		dazeus::Network n(config());
+		n.addListener(&l, &pool);
+		dazeus::ReplayDriver driver(&n);
+		driver.feed(":irc.test 001 tester :Welcome");
+		driver.feed(":irc.test 376 tester :End of MOTD");
+		pool.wait(&n);
+		// the numerics of the MOTD may already have overflowed the shard
+		uint64_t dropped = pool.dropped();
+		for(int i = 0; i < 10; ++i) {
+			driver.feed(":alice!a@test.host PRIVMSG #chan :!hi");
+			// let the worker pick up the first one
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		mustbe(n.metrics().snapshot().listenerQueueDepth == 3, "Queue depth wrong");
+		mustbe(pool.dropped() == dropped + 7, "Events not dropped");
+		mustbe(n.metrics().snapshot().listenerEventsDropped == dropped + 7, "Dropped events not counted");
+		uint64_t sent = n.metrics().snapshot().linesOut;
+		l.release = true;
+		pool.wait(&n);
+		mustbe(l.handled == 3, "Queued events not handled");
+		mustbe(n.metrics().snapshot().linesOut == sent, "Posted function ran on a worker");
+		n.checkTimeouts();
+		mustbe(n.metrics().snapshot().linesOut == sent + 3, "Posted functions not run");
+	}
+	return 0;
+}
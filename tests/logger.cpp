@@ -0,0 +1,112 @@
+#include <logger.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+class Collector : public dazeus::Logger {
+public:
+	virtual void write(dazeus::LogRecord &&record) {
+		records.push_back(std::move(record));
+	}
+	std::vector<dazeus::LogRecord> records;
+};
+
+static unsigned int countLines(FILE *f) {
+	rewind(f);
+	unsigned int lines = 0;
+	int c;
+	while((c = fgetc(f)) != EOF) {
+		if(c == '\n')
+			++lines;
+	}
+	return lines;
+}
+
+int main() {
+	// Records reach a pluggable logger with their fields
+	Collector c;
+	dazeus::setLogger(&c);
+	dazeus::LogCategory category("test.category", 5);
+	dazeus::log(category, dazeus::InfoLevel, "Hello", {{"network", "test"}, {"event", "JOIN"}});
+	mustbe(c.records.size() == 1, "Record not logged");
+	mustbe(c.records[0].level == dazeus::InfoLevel && c.records[0].message == "Hello", "Wrong record");
+	mustbe(strcmp(c.records[0].category, "test.category") == 0, "Wrong category");
+	mustbe(c.records[0].fields.size() == 2 && c.records[0].fields[1].second == "JOIN", "Wrong fields");
+
+	// Levels below the threshold are not logged
+	dazeus::log(category, dazeus::DebugLevel, "Debugging");
+	mustbe(c.records.size() == 1, "Debug record logged");
+	dazeus::setLogLevel(dazeus::DebugLevel);
+	dazeus::log(category, dazeus::DebugLevel, "Debugging");
+	mustbe(c.records.size() == 2, "Debug record not logged");
+	dazeus::setLogLevel(dazeus::InfoLevel);
+
+	// A storm is rate limited, and the suppressed messages are counted
+	dazeus::LogCategory storm("test.storm", 10);
+	for(int i = 0; i < 1000; ++i) {
+		dazeus::log(storm, dazeus::WarningLevel, "Too few parameters");
+	}
+	size_t logged = c.records.size() - 2;
+	mustbe(logged >= 10 && logged <= 20, "Storm not rate limited");
+	mustbe(storm.suppressedTotal() == 1000 - logged, "Suppressed messages not counted");
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	dazeus::log(storm, dazeus::WarningLevel, "Too few parameters");
+	mustbe(c.records.back().suppressed > 0, "Suppressed count not reported");
+	dazeus::setLogger(0);
+
+	std::string line = dazeus::AsyncLogger::format(c.records[0]);
+	mustbe(strstr(line.c_str(), " INFO test.category: Hello network=test event=JOIN\n") != NULL, "Wrong format");
+	c.records[0].fields[0].second = "two \"words\"";
+	line = dazeus::AsyncLogger::format(c.records[0]);
+	mustbe(strstr(line.c_str(), " network=\"two \\\"words\\\"\" ") != NULL, "Field not quoted");
+
+	// The asynchronous logger writes everything from several threads
+	{
+		FILE *f = tmpfile();
+		mustbe(f != NULL, "Couldn't create temporary file");
+		{
+			dazeus::AsyncLogger async(f, 64);
+			std::vector<std::thread> threads;
+			for(int t = 0; t < 4; ++t) {
+				threads.push_back(std::thread([&async]() {
+					for(int i = 0; i < 500; ++i) {
+						dazeus::LogRecord r;
+						r.message = "message";
+						async.write(std::move(r));
+						if(i % 32 == 0)
+							std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					}
+				}));
+			}
+			for(size_t t = 0; t < threads.size(); ++t)
+				threads[t].join();
+			async.flush();
+			mustbe(countLines(f) + async.dropped() == 2000, "Records lost");
+		}
+		fclose(f);
+	}
+
+	// When the queue is full, records are dropped and counted
+	{
+		FILE *f = tmpfile();
+		mustbe(f != NULL, "Couldn't create temporary file");
+		{
+			dazeus::AsyncLogger async(f, 2);
+			for(int i = 0; i < 10000; ++i) {
+				dazeus::LogRecord r;
+				r.message = "message";
+				async.write(std::move(r));
+			}
+			async.flush();
+			mustbe(async.dropped() > 0, "Nothing dropped");
+			mustbe(countLines(f) + async.dropped() == 10000, "Dropped records not counted");
+		}
+		fclose(f);
+	}
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include <network.h>
+#include <replaydriver.h>
+#include <trafficrecorder.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sstream>
+#include <new>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+// Bytes allocated and not yet freed
+static int64_t liveBytes = 0;
+
+void *operator new(size_t size) {
+	void *p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	liveBytes += malloc_usable_size(p);
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	if(p)
+		liveBytes -= malloc_usable_size(p);
+	free(p);
+}
+
+static std::string tempFile() {
+	char path[] = "/tmp/dazeus-membership-XXXXXX";
+	int fd = mkstemp(path);
+	mustbe(fd >= 0, "Couldn't create temporary file");
+	close(fd);
+	return path;
+}
+
+static void setUp(dazeus::ReplayDriver &d) {
+	d.feed(":irc.test 001 tester :Welcome");
+	d.feed(":irc.test 376 tester :End of MOTD");
+}
+
+/**
+ * Join a channel with the given number of users, and return the bytes the
+ * network kept for it.
+ */
+static int64_t joinBig(dazeus::ReplayDriver &d, const std::string &channel, unsigned int users) {
+	int64_t before = liveBytes;
+	d.feed(":tester!t@host JOIN " + channel);
+	std::stringstream names;
+	for(unsigned int i = 0; i < users; ++i) {
+		names << (i % 50 == 0 ? "" : " ") << "someuser" << i;
+		if(i % 50 == 49 || i == users - 1) {
+			d.feed(":irc.test 353 tester = " + channel + " :" + names.str());
+			names.str("");
+		}
+	}
+	d.feed(":irc.test 366 tester " + channel + " :End of NAMES list");
+	return liveBytes - before;
+}
+
+static unsigned int namesSent(const std::string &path, const std::string &channel) {
+	std::vector<dazeus::TrafficRecord> records;
+	mustbe(dazeus::TrafficRecorder::load(path, records), "Couldn't load recording");
+	unsigned int n = 0;
+	for(size_t i = 0; i < records.size(); ++i) {
+		if(records[i].direction == dazeus::TrafficRecord::Outbound && records[i].line == "NAMES " + channel)
+			++n;
+	}
+	return n;
+}
+
+int main() {
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+
+	// the members of a huge channel take megabytes, unless they're lazy; the
+	// full channel is smaller to keep the test quick, and joined last as the
+	// event buffers keep the size of its NAMES event
+	{
+		dazeus::Network n(config);
+		dazeus::ReplayDriver d(&n);
+		setUp(d);
+		n.setMembershipPolicy("#lazy", dazeus::Network::LazyMembership);
+		int64_t lazy = joinBig(d, "#lazy", 50000);
+		int64_t full = joinBig(d, "#full", 10000);
+		mustbe(n.usersInChannel("#full").size() == 10001, "Full channel not tracked");
+		mustbe(full > 256 * 1024, "Full channel unexpectedly small");
+		mustbe(n.usersInChannel("#lazy").size() == 1, "Lazy channel tracked");
+	mustbe(lazy < 16 * 1024, "Lazy channel too large");
+
+		// lowering the policy frees the members
+		int64_t before = liveBytes;
+		n.setMembershipPolicy("#full", dazeus::Network::NoMembership);
+		mustbe(before - liveBytes > 256 * 1024, "Members not freed");
+		d.feed(":someone!s@host JOIN #full");
+		mustbe(n.usersInChannel("#full").size() == 1, "Member tracked without membership");
+		mustbe(n.queryMembership("someone", "#full") == dazeus::Network::MembershipUnknown, "Membership known");
+	}
+
+	// the threshold makes huge channels lazy by themselves
+	{
+		config.lazyMembershipThreshold = 1000;
+		dazeus::Network n(config);
+		dazeus::ReplayDriver d(&n);
+		setUp(d);
+		joinBig(d, "#small", 500);
+		int64_t big = joinBig(d, "#big", 50000);
+		mustbe(n.membershipPolicy("#small") == dazeus::Network::FullMembership
+			&& n.usersInChannel("#small").size() == 501, "Small channel made lazy");
+		mustbe(n.membershipPolicy("#big") == dazeus::Network::LazyMembership
+			&& n.usersInChannel("#big").size() == 1, "Big channel not made lazy");
+		// the names up to the threshold were collected before it was passed
+		mustbe(big < 256 * 1024, "Big channel too large");
+
+		// users known before a NAMES reply passes the threshold are kept if
+		// it lists them, also in the lines before it was passed
+		d.feed(":tester!t@host JOIN #grows");
+		d.feed(":irc.test 353 tester = #grows :@tester alice bob");
+		d.feed(":irc.test 366 tester #grows :End of NAMES list");
+		std::stringstream names;
+		for(unsigned int i = 0; i < 2000; ++i) {
+			names << (i % 50 == 0 ? "" : " ");
+			if(i == 10)
+				names << "+alice";
+			else
+				names << "someuser" << i;
+			if(i % 50 == 49) {
+				d.feed(":irc.test 353 tester = #grows :" + names.str());
+				names.str("");
+			}
+		}
+		d.feed(":irc.test 366 tester #grows :End of NAMES list");
+		mustbe(n.membershipPolicy("#grows") == dazeus::Network::LazyMembership, "Growing channel not made lazy");
+		mustbe(n.queryMembership("alice", "#grows") == dazeus::Network::IsMember, "Known user in first lines lost");
+		mustbe(n.queryMembership("bob", "#grows") == dazeus::Network::IsNotMember, "Known user that left kept");
+		config.lazyMembershipThreshold = 0;
+	}
+
+	// users are known when they talk, or after asking the channel
+	std::string path = tempFile();
+	{
+		dazeus::TrafficRecorder r;
+		mustbe(r.open(path), "Couldn't open recording");
+		dazeus::Network n(config);
+		n.setRecorder(&r);
+		dazeus::ReplayDriver d(&n);
+		setUp(d);
+		n.setMembershipPolicy("#chan", dazeus::Network::LazyMembership);
+		d.feed(":tester!t@host JOIN #chan");
+		d.feed(":irc.test 353 tester = #chan :@tester alice bob +carol");
+		d.feed(":irc.test 366 tester #chan :End of NAMES list");
+		mustbe(n.usersInChannel("#chan").size() == 1, "Names kept");
+
+		d.feed(":alice!a@host PRIVMSG #chan :hi");
+		mustbe(n.queryMembership("alice", "#chan") == dazeus::Network::IsMember, "Talking user not known");
+		mustbe(n.queryMembership("carol", "#chan") == dazeus::Network::MembershipUnknown
+			&& n.queryMembership("dave", "#chan") == dazeus::Network::MembershipUnknown, "Membership guessed");
+		d.feed(":irc.test 353 tester = #chan :@tester alice bob +carol");
+		d.feed(":irc.test 366 tester #chan :End of NAMES list");
+		mustbe(n.queryMembership("carol", "#chan") == dazeus::Network::IsMember, "Queried member not known");
+		mustbe(n.queryMembership("dave", "#chan") == dazeus::Network::IsNotMember, "Queried non-member not known");
+		mustbe(n.usersInChannel("#chan").size() == 3, "Unqueried users kept");
+
+		d.feed(":carol!c@host PART #chan");
+		mustbe(n.queryMembership("carol", "#chan") == dazeus::Network::IsNotMember, "Parted user still member");
+		d.feed(":dave!d@host JOIN #chan");
+		mustbe(n.queryMembership("dave", "#chan") == dazeus::Network::IsMember, "Joined user not member");
+		mustbe(n.queryMembership("alice", "#other") == dazeus::Network::MembershipUnknown, "Unjoined channel known");
+
+		// back to full membership asks for everyone
+		n.setMembershipPolicy("#chan", dazeus::Network::FullMembership);
+		d.feed(":irc.test 353 tester = #chan :@tester alice bob dave");
+		d.feed(":irc.test 366 tester #chan :End of NAMES list");
+		mustbe(n.usersInChannel("#chan").size() == 4, "Full membership not restored");
+		mustbe(n.queryMembership("erin", "#chan") == dazeus::Network::IsNotMember, "Full membership unknown");
+	}
+	mustbe(namesSent(path, "#chan") == 2, "NAMES not asked once per query");
+	unlink(path.c_str());
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include <network.h>
+#include <server.h>
+#include <replaydriver.h>
+#include <metrics.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+class Listener : public dazeus::NetworkListener {
+public:
+	virtual void ircEvent(const std::string &event, const std::string &,
+	  const std::vector<std::string> &params, dazeus::Network *n) {
+		if(event == "PRIVMSG" && params.size() > 1 && params[1] == "!ping")
+			n->say(params[0], "pong");
+	}
+};
+
+static const char *session[] = {
+	":irc.test 001 tester :Welcome to the test network",
+	":irc.test 376 tester :End of MOTD",
+	":tester!t@test.host JOIN #chan",
+	":irc.test 353 tester = #chan :@tester alice",
+	":irc.test 366 tester #chan :End of NAMES list",
+	":alice!a@test.host PRIVMSG #chan :hello",
+	":alice!a@test.host PRIVMSG #chan :!ping",
+	":alice!a@test.host QUIT :bye",
+	0
+};
+
+static bool contains(const std::string &haystack, const std::string &needle) {
+	return haystack.find(needle) != std::string::npos;
+}
+
+int main() {
+	// Histograms
+	{
+		dazeus::Histogram h;
+		mustbe(h.snapshot().count == 0 && h.snapshot().quantileMicros(0.5) == 0, "Empty histogram not empty");
+		for(int i = 0; i < 90; ++i)
+			h.observe(3);
+		for(int i = 0; i < 10; ++i)
+			h.observe(40000);
+		h.observe(5000000);
+		dazeus::HistogramSnapshot s = h.snapshot();
+		mustbe(s.count == 101, "Wrong histogram count");
+		mustbe(s.sumMicros == 90 * 3 + 10 * 40000 + 5000000, "Wrong histogram sum");
+		mustbe(s.buckets.size() == dazeus::Histogram::numBuckets, "Wrong number of buckets");
+		mustbe(s.buckets.back() == 1, "Overflow not in last bucket");
+		mustbe(s.quantileMicros(0.5) == 5, "Wrong median");
+		mustbe(s.quantileMicros(0.95) == 50000, "Wrong 95th percentile");
+		mustbe(s.quantileMicros(1) == 1000000, "Wrong maximum");
+	}
+
+	mustbe(dazeus::NetworkMetrics::eventType("PRIVMSG") == dazeus::NetworkMetrics::PrivmsgEvent, "Event type not found");
+	mustbe(dazeus::NetworkMetrics::eventType("WALLOPS") == dazeus::NetworkMetrics::OtherEvent, "Unknown event not other");
+	mustbe(strcmp(dazeus::NetworkMetrics::reasonName(dazeus::Network::TimeoutReason), "timeout") == 0, "Wrong reason name");
+
+	dazeus::NetworkConfig config;
+	config.name = "test \"net\"";
+	config.nickName = "tester";
+	dazeus::Network n(config);
+	Listener l;
+	n.addListener(&l);
+
+	uint64_t bytes = 0;
+	unsigned int lines = 0;
+	{
+		dazeus::ReplayDriver d(&n);
+		for(int i = 0; session[i]; ++i) {
+			d.feed(session[i]);
+			bytes += strlen(session[i]) + 2;
+			++lines;
+		}
+
+		dazeus::NetworkMetricsSnapshot s = n.metrics().snapshot();
+		mustbe(s.linesIn == lines && s.bytesIn == bytes, "Inbound traffic not counted");
+		mustbe(s.linesOut == 1 && s.bytesOut == strlen("PRIVMSG #chan :pong") + 2, "Outbound traffic not counted");
+		mustbe(s.connectAttempts == 1 && s.registrations == 1, "Connection not counted");
+		mustbe(s.events["NUMERIC"] == 4 && s.events["CONNECT"] == 1, "Numerics not counted");
+		mustbe(s.events["PRIVMSG"] == 2 && s.events["PRIVMSG_ME"] == 1, "Messages not counted");
+		mustbe(s.events["JOIN"] == 1 && s.events["NAMES"] == 1 && s.events["QUIT"] == 1, "Events not counted");
+		mustbe(s.events.count("KICK") == 0, "Unseen event counted");
+		mustbe(s.dispatchTime["PRIVMSG"].count == 2, "Dispatch time not measured");
+
+		n.disconnectFromNetwork(dazeus::Network::AdminRequestReason);
+	}
+
+	dazeus::NetworkMetricsSnapshot s = n.metrics().snapshot();
+	mustbe(s.disconnects["admin_request"] == 1 && s.disconnects["timeout"] == 0, "Disconnect not counted");
+	mustbe(s.linesOut == 2, "QUIT not counted");
+
+	std::vector<dazeus::Network*> networks;
+	networks.push_back(&n);
+	std::string text = dazeus::prometheusText(networks);
+	mustbe(contains(text, "# TYPE dazeus_irc_received_bytes_total counter\n"), "Counter type missing");
+	mustbe(contains(text, "dazeus_irc_received_lines_total{network=\"test \\\"net\\\"\"} 8\n"), "Line counter wrong");
+	mustbe(contains(text, "dazeus_irc_events_total{network=\"test \\\"net\\\"\",event=\"PRIVMSG\"} 2\n"), "Event counter wrong");
+	mustbe(contains(text, "dazeus_irc_dispatch_seconds_count{network=\"test \\\"net\\\"\",event=\"PRIVMSG\"} 2\n"), "Histogram count wrong");
+	mustbe(contains(text, "dazeus_irc_dispatch_seconds_bucket{network=\"test \\\"net\\\"\",event=\"PRIVMSG\",le=\"+Inf\"} 2\n"), "Histogram buckets wrong");
+	mustbe(contains(text, "dazeus_irc_disconnects_total{network=\"test \\\"net\\\"\",reason=\"admin_request\"} 1\n"), "Disconnect counter wrong");
+	mustbe(contains(text, "# TYPE dazeus_irc_ping_lag_seconds histogram\n"), "Ping lag missing");
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <network.h>
+#include <replaydriver.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+struct Listener : public dazeus::NetworkListener {
+	std::vector<std::string> events;
+	void ircEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params, dazeus::Network *) {
+		if(event == "NUMERIC" || event == "NAMES" || event == "CONNECT" || event == "TOPIC")
+			return;
+		std::string e = event + " " + origin;
+		for(size_t i = 0; i < params.size(); ++i)
+			e += " " + params[i];
+		events.push_back(e);
+	}
+};
+
+static std::vector<std::string> lines(const char *a, const char *b, const char *c = 0, const char *d = 0) {
+	std::vector<std::string> l;
+	l.push_back(a);
+	l.push_back(b);
+	if(c)
+		l.push_back(c);
+	if(d)
+		l.push_back(d);
+	return l;
+}
+
+static void setUp(dazeus::ReplayDriver &d) {
+	d.feed(":irc.test 001 tester :Welcome");
+	d.feed(":irc.test 376 tester :End of MOTD");
+	d.feed(":tester!t@host JOIN #a");
+	d.feed(":irc.test 353 tester = #a :@tester alice bob carol +dave");
+	d.feed(":irc.test 366 tester #a :End of NAMES list");
+	d.feed(":tester!t@host JOIN #b");
+	d.feed(":irc.test 353 tester = #b :@tester alice eve");
+	d.feed(":irc.test 366 tester #b :End of NAMES list");
+}
+
+int main() {
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+
+	{
+		dazeus::Network n(config);
+		Listener l;
+		n.addListener(&l);
+		dazeus::ReplayDriver d(&n);
+		setUp(d);
+		l.events.clear();
+
+		// the QUITs of a split become one NETSPLIT
+		d.feed(lines(":alice!a@host QUIT :hub.example.net leaf.example.net",
+			":bob!b@host QUIT :hub.example.net leaf.example.net",
+			":eve!e@host QUIT :hub.example.net leaf.example.net"));
+		mustbe(l.events.size() == 1, "Split not coalesced");
+		mustbe(l.events[0] == "NETSPLIT  hub.example.net leaf.example.net alice bob eve", "Wrong NETSPLIT event");
+		mustbe(n.usersInChannel("#a").size() == 3 && n.usersInChannel("#b").size() == 1, "Split users not removed");
+		mustbe(!n.isKnownUser("alice") && n.isKnownUser("carol"), "Split users still known");
+
+		// other QUITs, and events in between, keep their place
+		l.events.clear();
+		d.feed(lines(":dave!d@host QUIT :Quit: leaving. bye.",
+			":carol!c@host QUIT :hub.example.net leaf.example.net",
+			":tester!t@host PRIVMSG #a :hi",
+			":frank!f@host JOIN #a"));
+		mustbe(l.events.size() == 4 && l.events[0] == "QUIT dave Quit: leaving. bye."
+			&& l.events[1] == "NETSPLIT  hub.example.net leaf.example.net carol"
+			&& l.events[2] == "PRIVMSG tester #a hi" && l.events[3] == "JOIN frank #a", "Events out of order");
+
+		// the users coming back become a NETJOIN per channel
+		l.events.clear();
+		d.feed(lines(":alice!a@host JOIN #a", ":alice!a@host JOIN #b",
+			":Bob!b@host JOIN #a", ":eve!e@host JOIN #b"));
+		mustbe(l.events.size() == 2, "Netjoin not coalesced");
+		mustbe(l.events[0] == "NETJOIN  #a alice Bob" && l.events[1] == "NETJOIN  #b alice eve", "Wrong NETJOIN event");
+		mustbe(n.usersInChannel("#a").size() == 4 && n.usersInChannel("#b").size() == 3, "Netjoin users not added");
+		mustbe(n.isKnownUser("bob"), "Netjoin users not known");
+
+		// once back, users join like anyone else
+		l.events.clear();
+		d.feed(":tester!t@host JOIN #c");
+		d.feed(":irc.test 353 tester = #c :@tester");
+		d.feed(":irc.test 366 tester #c :End of NAMES list");
+		l.events.clear();
+		d.feed(lines(":alice!a@host JOIN #c", ":alice!a@host PART #a", ":alice!a@host JOIN #a"));
+		mustbe(l.events.size() == 3 && l.events[0] == "JOIN alice #c" && l.events[2] == "JOIN alice #a",
+			"Join after netjoin not an ordinary JOIN");
+
+		// a netjoin interrupted by other events continues in the next channel
+		d.feed(lines(":alice!a@host QUIT :hub.example.net leaf.example.net",
+			":eve!e@host QUIT :hub.example.net leaf.example.net"));
+		l.events.clear();
+		d.feed(lines(":alice!a@host JOIN #a", ":irc.test MODE #a +o alice",
+			":alice!a@host JOIN #b", ":eve!e@host JOIN #b"));
+		mustbe(l.events.size() == 3 && l.events[0] == "NETJOIN  #a alice"
+			&& l.events[2] == "NETJOIN  #b alice eve", "Interrupted netjoin not coalesced");
+
+		// lines fed one by one are a read of their own
+		l.events.clear();
+		d.feed(":alice!a@host QUIT :a.example.net b.example.net");
+		d.feed(":eve!e@host QUIT :a.example.net b.example.net");
+		mustbe(l.events.size() == 2 && n.usersInChannel("#b").size() == 1, "Split not delivered per read");
+	}
+
+	// every QUIT and JOIN is available on request
+	{
+		config.splitUserEvents = true;
+		dazeus::Network n(config);
+		Listener l;
+		n.addListener(&l);
+		dazeus::ReplayDriver d(&n);
+		setUp(d);
+		l.events.clear();
+		d.feed(lines(":alice!a@host QUIT :hub.example.net leaf.example.net",
+			":bob!b@host QUIT :hub.example.net leaf.example.net"));
+		d.feed(lines(":alice!a@host JOIN #a", ":bob!b@host JOIN #a"));
+		mustbe(l.events.size() == 6 && l.events[1] == "QUIT alice hub.example.net leaf.example.net"
+			&& l.events[2] == "QUIT bob hub.example.net leaf.example.net"
+			&& l.events[3] == "NETJOIN  #a alice bob" && l.events[5] == "JOIN bob #a", "No per-user events");
+		mustbe(n.usersInChannel("#a").size() == 5, "Per-user events changed the state");
+	}
+	return 0;
+}
@@ -0,0 +1,82 @@
+#include <pingtimer.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+typedef dazeus::PingTimer::Clock Clock;
+
+static Clock::time_point at(Clock::time_point start, unsigned int ms) {
+	return start + std::chrono::milliseconds(ms);
+}
+
+int main() {
+	dazeus::PingTimer p(30, 240);
+	Clock::time_point t0 = Clock::now();
+	p.reset(t0);
+	mustbe(!p.due(at(t0, 29000)), "PING due too early");
+	mustbe(p.due(at(t0, 30000)), "PING not due on a quiet link");
+	mustbe(p.nextDue() == at(t0, 30000), "Wrong next PING");
+
+	// Tokens are answered with a lag sample
+	std::string token = p.sent(at(t0, 30000));
+	mustbe(p.interval() == std::chrono::seconds(30), "Interval below minimum");
+	uint64_t rtt = 0;
+	mustbe(p.pong(token, at(t0, 30100), &rtt), "Own PONG not matched");
+	mustbe(rtt == 100000, "Wrong lag sample");
+	mustbe(p.samples() == 1 && p.smoothedLagMicros() == 100000 && p.jitterMicros() == 50000, "Wrong first estimate");
+	mustbe(!p.pong(token, at(t0, 30200)), "Duplicate PONG matched");
+	mustbe(!p.pong("irc.test", at(t0, 30200)), "Foreign PONG matched");
+	mustbe(!p.pong("dazeus-12x", at(t0, 30200)), "Malformed token matched");
+	mustbe(!p.pong("dazeus-99999999999999999", at(t0, 30200)), "Token from the future matched");
+
+	// Inbound traffic postpones the PING until the keepalive, and makes the
+	// keepalive interval grow
+	p.received(at(t0, 50000));
+	mustbe(!p.due(at(t0, 59000)), "PING due while traffic came in");
+	mustbe(p.due(at(t0, 60000)), "Keepalive PING not due");
+	mustbe(p.nextDue() == at(t0, 60000), "Wrong next keepalive PING");
+	token = p.sent(at(t0, 60000));
+	mustbe(p.interval() == std::chrono::seconds(60), "Interval didn't grow");
+	mustbe(p.pong(token, at(t0, 60300), &rtt) && rtt == 300000, "Second PONG not matched");
+	mustbe(p.smoothedLagMicros() == (7 * 100000 + 300000) / 8, "Wrong smoothed lag");
+	mustbe(p.jitterMicros() == (3 * 50000 + 200000) / 4, "Wrong jitter");
+	p.received(at(t0, 90000));
+	mustbe(!p.due(at(t0, 110000)), "PING due while traffic came in");
+	mustbe(p.due(at(t0, 120000)), "Keepalive PING not due after grown interval");
+
+	// A busy link still gets a PING every maximum interval
+	for(unsigned int s = 120; s < 600; s += 10) {
+		p.received(at(t0, s * 1000));
+		if(p.due(at(t0, s * 1000)))
+			p.sent(at(t0, s * 1000));
+	}
+	mustbe(p.interval() == std::chrono::seconds(240), "Interval not capped");
+	mustbe(!p.due(at(t0, 599000)), "PING due too soon on busy link");
+
+	// A busy link that goes quiet is probed after the minimum interval
+	mustbe(!p.due(at(t0, 619000)), "PING due too soon after busy link went quiet");
+	mustbe(p.due(at(t0, 620000)), "Busy link that went quiet not probed");
+	mustbe(p.nextDue() == at(t0, 620000), "Wrong next PING after busy link went quiet");
+
+	// A quiet link brings the interval back down
+	Clock::time_point quiet = at(t0, 600000);
+	unsigned int pings = 0;
+	for(unsigned int s = 0; s < 1200; ++s) {
+		Clock::time_point now = quiet + std::chrono::seconds(s);
+		if(p.due(now)) {
+			p.sent(now);
+			++pings;
+		}
+	}
+	mustbe(p.interval() == std::chrono::seconds(30), "Interval didn't shrink");
+	mustbe(pings > 20, "Quiet link not pinged often enough");
+
+	// PONGs from before a reset are ignored
+	token = p.sent(at(t0, 2000000));
+	p.reset(at(t0, 2000001));
+	mustbe(p.samples() == 0 && p.smoothedLagMicros() == 0, "Estimate not reset");
+	mustbe(!p.pong(token, at(t0, 2000002)), "PONG of old connection matched");
+	return 0;
+}
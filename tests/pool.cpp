@@ -0,0 +1,299 @@
+#include <network.h>
+#include <connectionpool.h>
+#include <server.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <map>
+#include <set>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+struct Listener : public dazeus::NetworkListener {
+	std::vector<std::string> events;
+	void ircEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params, dazeus::Network *) {
+		std::string e = event + " " + origin;
+		for(size_t i = 0; i < params.size(); ++i)
+			e += " " + params[i];
+		events.push_back(e);
+	}
+	size_t count(const std::string &e) const {
+		size_t n = 0;
+		for(size_t i = 0; i < events.size(); ++i) {
+			if(events[i].compare(0, e.size(), e) == 0)
+				++n;
+		}
+		return n;
+	}
+};
+
+// a small IRC server: it welcomes every client with a free nick, and passes
+// JOINs and messages to channels on to the clients in them
+struct Client {
+	Client() : fd(-1), nick(), user(false), welcomed(false), buffer(), channels(), sent() {}
+	int fd;
+	std::string nick;
+	bool user;
+	bool welcomed;
+	std::string buffer;
+	std::set<std::string> channels;
+	// the messages this client sent, as "target text"
+	std::vector<std::string> sent;
+};
+
+static int listenFd = -1;
+static std::vector<Client> clients;
+
+static void send(Client &c, const std::string &line) {
+	std::string data = line + "\r\n";
+	mustbe(write(c.fd, data.data(), data.size()) == (ssize_t)data.size(), "Couldn't send to client");
+}
+
+static void broadcast(const std::string &channel, const std::string &line, Client *except = 0) {
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(&clients[i] != except && clients[i].fd >= 0 && clients[i].channels.count(channel))
+			send(clients[i], line);
+	}
+}
+
+static Client *client(const std::string &nick) {
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(clients[i].nick == nick && clients[i].fd >= 0)
+			return &clients[i];
+	}
+	return 0;
+}
+
+static void handle(Client &c, const std::string &line) {
+	std::string prefix = ":" + c.nick + "!u@host ";
+	if(line.compare(0, 5, "NICK ") == 0) {
+		std::string nick = line.substr(5);
+		if(client(nick) && client(nick) != &c) {
+			send(c, ":irc.test 433 " + (c.nick.empty() ? "*" : c.nick) + " " + nick + " :Nickname is already in use");
+			return;
+		}
+		c.nick = nick;
+	} else if(line.compare(0, 5, "USER ") == 0) {
+		c.user = true;
+	} else if(line.compare(0, 5, "JOIN ") == 0) {
+		std::string channel = line.substr(5);
+		c.channels.insert(channel);
+		broadcast(channel, prefix + line);
+	} else if(line.compare(0, 8, "PRIVMSG ") == 0) {
+		size_t colon = line.find(" :");
+		std::string target = line.substr(8, colon - 8);
+		c.sent.push_back(target + " " + line.substr(colon + 2));
+		broadcast(target, prefix + line, &c);
+	}
+	if(c.user && !c.nick.empty() && !c.welcomed) {
+		c.welcomed = true;
+		send(c, ":irc.test 001 " + c.nick + " :Welcome");
+		send(c, ":irc.test 376 " + c.nick + " :End of MOTD");
+	}
+}
+
+/**
+ * Run the network and the server until the condition holds, or ten seconds
+ * have passed.
+ */
+template <typename F>
+static bool runUntil(dazeus::Network *n, F done) {
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while(!done() && std::chrono::steady_clock::now() < end) {
+		n->checkTimeouts();
+		fd_set in_set, out_set;
+		int maxfd = listenFd;
+		FD_ZERO(&in_set);
+		FD_ZERO(&out_set);
+		if(n->activeServer())
+			n->addDescriptors(&in_set, &out_set, &maxfd);
+		FD_SET(listenFd, &in_set);
+		for(size_t i = 0; i < clients.size(); ++i) {
+			if(clients[i].fd < 0)
+				continue;
+			FD_SET(clients[i].fd, &in_set);
+			if(clients[i].fd > maxfd)
+				maxfd = clients[i].fd;
+		}
+		struct timeval timeout = {0, 10000};
+		if(select(maxfd + 1, &in_set, &out_set, NULL, &timeout) <= 0)
+			continue;
+		if(FD_ISSET(listenFd, &in_set)) {
+			Client c;
+			c.fd = accept(listenFd, NULL, NULL);
+			if(c.fd >= 0)
+				clients.push_back(c);
+		}
+		for(size_t i = 0; i < clients.size(); ++i) {
+			if(clients[i].fd < 0 || !FD_ISSET(clients[i].fd, &in_set))
+				continue;
+			char buf[4096];
+			ssize_t r = read(clients[i].fd, buf, sizeof(buf));
+			if(r <= 0) {
+				close(clients[i].fd);
+				clients[i].fd = -1;
+				continue;
+			}
+			clients[i].buffer.append(buf, r);
+			size_t eol;
+			while((eol = clients[i].buffer.find("\r\n")) != std::string::npos) {
+				std::string line = clients[i].buffer.substr(0, eol);
+				clients[i].buffer.erase(0, eol + 2);
+				handle(clients[i], line);
+			}
+		}
+		if(n->activeServer())
+			n->processDescriptors(&in_set, &out_set);
+	}
+	return done();
+}
+
+static void settle(dazeus::Network *n) {
+	int rounds = 0;
+	runUntil(n, [&] { return ++rounds > 20; });
+}
+
+static size_t sentTotal() {
+	size_t total = 0;
+	for(size_t i = 0; i < clients.size(); ++i)
+		total += clients[i].sent.size();
+	return total;
+}
+
+int main() {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	mustbe(listenFd >= 0 && bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+		&& listen(listenFd, 8) == 0 && getsockname(listenFd, (struct sockaddr*)&addr, &len) == 0,
+		"Couldn't open server socket");
+
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+	config.poolSize = 3;
+	dazeus::ServerConfig server;
+	server.host = "127.0.0.1";
+	server.port = ntohs(addr.sin_port);
+	config.servers.push_back(server);
+
+	// the members connect with their own nicks once the network is connected
+	dazeus::Network n(config);
+	Listener l;
+	n.addListener(&l);
+	n.connectToNetwork();
+	// only lines from the server show the connection is alive, our own
+	// messages don't
+	mustbe(n.nextTimeout() >= 0 && n.nextTimeout() <= 10000, "No connect deadline");
+	n.notice("tester", "hello");
+	mustbe(n.nextTimeout() >= 0 && n.nextTimeout() <= 10000, "Own message cleared the connect deadline");
+	mustbe(runUntil(&n, [&] { return n.pool() && n.pool()->registered() == 2; }), "Pool didn't connect");
+	mustbe(clients.size() == 3 && client("tester") && client("tester1") && client("tester2"), "Wrong pool nicks");
+	mustbe(l.count("CONNECT") == 1, "Pool connections delivered");
+	// the members are kept alive like the active server
+	long due = n.pool()->msUntilDue();
+	mustbe(due > 25000 && due <= 30000, "No PING planned for the members");
+
+	n.joinChannel("#chan");
+	mustbe(runUntil(&n, [] { return client("tester1")->channels.size() == 1 && client("tester2")->channels.size() == 1
+		&& client("tester")->channels.size() == 1; }), "Pool didn't join");
+	settle(&n);
+	mustbe(l.count("JOIN") == 1 && n.usersInChannel("#chan").size() == 1, "Pool joins delivered");
+
+	// messages are spread over the connections, per target
+	for(int round = 0; round < 3; ++round) {
+		for(int i = 0; i < 30; ++i) {
+			char target[16];
+			snprintf(target, sizeof(target), "user%d", i);
+			char text[16];
+			snprintf(text, sizeof(text), "m%d", round);
+			n.say(target, text);
+		}
+		n.say("#chan", round == 0 ? "a" : round == 1 ? "b" : "c");
+	}
+	mustbe(runUntil(&n, [] { return sentTotal() == 93; }), "Messages not sent");
+	settle(&n);
+	size_t used = 0;
+	std::map<std::string,int> owner;
+	for(size_t i = 0; i < clients.size(); ++i) {
+		const std::vector<std::string> &sent = clients[i].sent;
+		used += sent.empty() ? 0 : 1;
+		std::string last;
+		for(size_t j = 0; j < sent.size(); ++j) {
+			std::string target = sent[j].substr(0, sent[j].find(' '));
+			mustbe(!owner.count(target) || owner[target] == (int)i, "Target spread over connections");
+			owner[target] = i;
+			if(target == "#chan") {
+				mustbe(sent[j] > last, "Channel messages out of order");
+				last = sent[j];
+			}
+		}
+	}
+	mustbe(used == 3, "Not all connections used");
+	mustbe(l.count("PRIVMSG_ME") == 93, "Messages not echoed once");
+	mustbe(l.count("PRIVMSG tester") == 0, "Messages of the pool delivered");
+
+	// a message the whole pool receives is delivered once; a repeat too
+	l.events.clear();
+	broadcast("#chan", ":alice!a@host PRIVMSG #chan :hello");
+	settle(&n);
+	mustbe(l.count("PRIVMSG alice #chan hello") == 1, "Message not delivered once");
+	broadcast("#chan", ":alice!a@host PRIVMSG #chan :hello");
+	settle(&n);
+	mustbe(l.count("PRIVMSG alice #chan hello") == 2, "Repeated message not delivered");
+	send(*client("tester2"), ":bob!b@host PRIVMSG tester2 :psst");
+	settle(&n);
+	mustbe(l.count("PRIVMSG bob tester psst") == 1, "Message to a member not delivered to the network");
+
+	// a failed member is flagged, and comes back
+	close(client("tester1")->fd);
+	client("tester1")->fd = -1;
+	mustbe(runUntil(&n, [&] { return n.pool()->registered() == 1; }), "Failed member not noticed");
+	mustbe(n.serverUndesirability(server) == 1, "Failed member not flagged");
+	size_t before = sentTotal();
+	for(int i = 0; i < 30; ++i) {
+		char target[16];
+		snprintf(target, sizeof(target), "user%d", i);
+		n.say(target, "again");
+	}
+	mustbe(runUntil(&n, [&] { return sentTotal() == before + 30; }), "Messages lost with a failed member");
+	mustbe(runUntil(&n, [&] { return n.pool()->registered() == 2; }), "Failed member didn't come back");
+	mustbe(n.serverUndesirability(server) == 0, "Member back, server still undesirable");
+
+	// the pool goes with the network
+	n.disconnectFromNetwork();
+	mustbe(n.pool()->registered() == 0 && n.pool()->size() == 0, "Pool left connected");
+	settle(&n);
+
+	// a member whose nick is taken registers with another one, and the
+	// server isn't flagged for it
+	int squatter[2];
+	mustbe(socketpair(AF_UNIX, SOCK_STREAM, 0, squatter) == 0, "Couldn't create squatter");
+	Client c;
+	c.fd = squatter[0];
+	c.nick = "tester1";
+	c.user = c.welcomed = true;
+	clients.push_back(c);
+	n.connectToNetwork();
+	mustbe(runUntil(&n, [&] { return n.pool() && n.pool()->registered() == 2; }), "Pool with a taken nick didn't connect");
+	mustbe(n.pool()->nick(0) == "tester1_" && client("tester1_"), "Member didn't take another nick");
+	mustbe(n.serverUndesirability(server) == 0, "Server flagged for a taken nick");
+	n.disconnectFromNetwork();
+	close(squatter[1]);
+
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(clients[i].fd >= 0)
+			close(clients[i].fd);
+	}
+	close(listenFd);
+	return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Checks that the USDT probes listed in src/probes.h are in the given library.
+LIBRARY="$1"
+NOTES=`readelf -n "$LIBRARY"` || exit 1
+STATUS=0
+for PROBE in line__received event__parsed state__update__start state__update__end \
+             listener__dispatch__start listener__dispatch__end command__queued \
+             command__written reconnect__scheduled reconnect__start; do
+	if ! echo "$NOTES" | grep -q "Name: $PROBE\$"; then
+		echo "Test error: probe $PROBE missing from $LIBRARY"
+		STATUS=9
+	fi
+done
+if ! echo "$NOTES" | grep -q "Provider: dazeus_irc"; then
+	echo "Test error: no probes of provider dazeus_irc in $LIBRARY"
+	STATUS=9
+fi
+exit $STATUS
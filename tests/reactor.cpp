@@ -0,0 +1,299 @@
+#include <network.h>
+#include <epollreactor.h>
+#include <uringreactor.h>
+#include <reconnectscheduler.h>
+#include <resolver.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <set>
+#include <memory>
+#include <thread>
+#ifdef DAZEUS_HAVE_ASIO
+#include <boost/asio.hpp>
+#include <asioreactor.h>
+#endif
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+struct Listener : public dazeus::NetworkListener {
+	std::vector<std::string> events;
+	void ircEvent(const std::string &event, const std::string &origin, const std::vector<std::string> &params, dazeus::Network *) {
+		std::string e = event + " " + origin;
+		for(size_t i = 0; i < params.size(); ++i)
+			e += " " + params[i];
+		events.push_back(e);
+	}
+	size_t count(const std::string &e) const {
+		size_t n = 0;
+		for(size_t i = 0; i < events.size(); ++i) {
+			if(events[i].compare(0, e.size(), e) == 0)
+				++n;
+		}
+		return n;
+	}
+};
+
+// a small IRC server: it welcomes every client, and passes JOINs and
+// messages to channels on to the clients in them
+struct Client {
+	int fd;
+	std::string nick;
+	std::string buffer;
+	std::set<std::string> channels;
+	// the messages this client sent, as "target text"
+	std::vector<std::string> sent;
+};
+
+static int listenFd = -1;
+static std::vector<Client> clients;
+// whether clients are left waiting for their welcome
+static bool silent = false;
+
+static void send(Client &c, const std::string &line) {
+	std::string data = line + "\r\n";
+	mustbe(write(c.fd, data.data(), data.size()) == (ssize_t)data.size(), "Couldn't send to client");
+}
+
+static void broadcast(const std::string &channel, const std::string &line, Client *except = 0) {
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(&clients[i] != except && clients[i].fd >= 0 && clients[i].channels.count(channel))
+			send(clients[i], line);
+	}
+}
+
+static void handle(Client &c, const std::string &line) {
+	std::string prefix = ":" + c.nick + "!u@host ";
+	if(line.compare(0, 5, "NICK ") == 0) {
+		c.nick = line.substr(5);
+	} else if(line.compare(0, 5, "USER ") == 0 && !silent) {
+		send(c, ":irc.test 001 " + c.nick + " :Welcome");
+		send(c, ":irc.test 376 " + c.nick + " :End of MOTD");
+	} else if(line.compare(0, 5, "JOIN ") == 0) {
+		std::string channel = line.substr(5);
+		c.channels.insert(channel);
+		broadcast(channel, prefix + line);
+	} else if(line.compare(0, 8, "PRIVMSG ") == 0) {
+		size_t colon = line.find(" :");
+		c.sent.push_back(line.substr(8, colon - 8) + " " + line.substr(colon + 2));
+	}
+}
+
+// handle what the clients sent, without waiting
+static void serve() {
+	fd_set in_set;
+	int maxfd = listenFd;
+	FD_ZERO(&in_set);
+	FD_SET(listenFd, &in_set);
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(clients[i].fd < 0)
+			continue;
+		FD_SET(clients[i].fd, &in_set);
+		if(clients[i].fd > maxfd)
+			maxfd = clients[i].fd;
+	}
+	struct timeval timeout = {0, 0};
+	if(select(maxfd + 1, &in_set, NULL, NULL, &timeout) <= 0)
+		return;
+	if(FD_ISSET(listenFd, &in_set)) {
+		Client c;
+		c.fd = accept(listenFd, NULL, NULL);
+		if(c.fd >= 0)
+			clients.push_back(c);
+	}
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(clients[i].fd < 0 || !FD_ISSET(clients[i].fd, &in_set))
+			continue;
+		char buf[4096];
+		ssize_t r = read(clients[i].fd, buf, sizeof(buf));
+		if(r <= 0) {
+			close(clients[i].fd);
+			clients[i].fd = -1;
+			continue;
+		}
+		clients[i].buffer.append(buf, r);
+		size_t eol;
+		while((eol = clients[i].buffer.find("\r\n")) != std::string::npos) {
+			std::string line = clients[i].buffer.substr(0, eol);
+			clients[i].buffer.erase(0, eol + 2);
+			handle(clients[i], line);
+		}
+	}
+}
+
+/**
+ * Let the reactor run a short while, and the server, until the condition
+ * holds or ten seconds have passed.
+ */
+template <typename Step, typename F>
+static bool runUntil(Step step, F done) {
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while(!done() && std::chrono::steady_clock::now() < end) {
+		step();
+		serve();
+	}
+	return done();
+}
+
+/**
+ * Connect, talk and reconnect, with a reactor added to the network and run
+ * by the step function.
+ */
+template <typename Step>
+static void exercise(dazeus::Network &n, Listener &l, Step step) {
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(clients[i].fd >= 0)
+			close(clients[i].fd);
+	}
+	clients.clear();
+	l.events.clear();
+	n.connectToNetwork();
+	mustbe(runUntil(step, [&] { return l.count("CONNECT") == 1; }), "Didn't connect");
+	std::vector<dazeus::Network::Interest> interests;
+	n.interests(interests);
+	mustbe(interests.size() == 1 && interests[0].read, "Connection not in interests");
+	// the next timer is the first PING
+	long timeout = n.nextTimeout();
+	mustbe(timeout > 25000 && timeout <= 30000, "Wrong next timeout");
+
+	// output from outside the reactor is sent without waiting for a timer
+	n.joinChannel("#chan");
+	mustbe(runUntil(step, [] { return clients.size() == 1 && clients[0].channels.count("#chan"); }), "Didn't join");
+	mustbe(runUntil(step, [&] { return l.count("JOIN tester #chan") == 1; }), "Join not received");
+	send(clients[0], ":alice!a@host PRIVMSG #chan :hello");
+	mustbe(runUntil(step, [&] { return l.count("PRIVMSG alice #chan hello") == 1; }), "Message not received");
+	n.say("#chan", "hi");
+	mustbe(runUntil(step, [] { return clients[0].sent.size() == 1 && clients[0].sent[0] == "#chan hi"; }), "Message not sent");
+
+	// a server that doesn't answer times out, and is reconnected to, from
+	// the timer
+	n.disconnectFromNetwork();
+	silent = true;
+	n.connectToNetwork();
+	timeout = n.nextTimeout();
+	mustbe(timeout >= 0 && timeout <= 1000, "Connect timeout not next");
+	mustbe(runUntil(step, [&] { return n.reconnectPending(); }), "Connect timeout didn't pass");
+	mustbe(n.nextTimeout() >= 0, "No timeout for the reconnect");
+	silent = false;
+	mustbe(runUntil(step, [&] { return l.count("CONNECT") == 2; }), "Didn't reconnect");
+	mustbe(clients.size() == 3, "Wrong number of connections");
+
+	n.disconnectFromNetwork();
+	n.interests(interests);
+	mustbe(interests.empty() && n.nextTimeout() == -1, "Disconnected network still waits");
+}
+
+static void runReactor(dazeus::Reactor &r, const dazeus::NetworkConfig &config, dazeus::ReconnectScheduler *scheduler) {
+	dazeus::Network n(config);
+	n.setReconnectScheduler(scheduler);
+	Listener l;
+	n.addListener(&l);
+	r.add(&n);
+	exercise(n, l, [&] { mustbe(r.runOnce(10), "runOnce() failed"); });
+	// nothing to wait for anymore
+	r.run();
+	r.remove(&n);
+	mustbe(r.syscalls() > 0, "System calls not counted");
+}
+
+// knows only irc.test, and takes a while to find it
+static int slowLookup(const std::string &host, std::vector<dazeus::ResolvedAddress> &result) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	if(host != "irc.test")
+		return EAI_NONAME;
+	result.push_back(dazeus::ResolvedAddress(AF_INET, "127.0.0.1"));
+	return 0;
+}
+
+/**
+ * Two networks waiting for the same hostname at once both connect, even
+ * without a connect timeout to fall back on.
+ */
+static void resolveTogether(dazeus::Reactor &r, dazeus::NetworkConfig config, dazeus::ReconnectScheduler *scheduler) {
+	dazeus::Resolver resolver(1, slowLookup);
+	config.servers[0].host = "irc.test";
+	config.connectTimeout = 0;
+	dazeus::Network a(config), b(config);
+	Listener la, lb;
+	a.setResolver(&resolver);
+	b.setResolver(&resolver);
+	a.setReconnectScheduler(scheduler);
+	b.setReconnectScheduler(scheduler);
+	a.addListener(&la);
+	b.addListener(&lb);
+	r.add(&a);
+	r.add(&b);
+	a.connectToNetwork();
+	b.connectToNetwork();
+	mustbe(runUntil([&] { mustbe(r.runOnce(10), "runOnce() failed"); },
+		[&] { return la.count("CONNECT") == 1 && lb.count("CONNECT") == 1; }), "Networks resolving together didn't connect");
+	a.disconnectFromNetwork();
+	b.disconnectFromNetwork();
+	r.remove(&a);
+	r.remove(&b);
+}
+
+int main() {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	mustbe(listenFd >= 0 && bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+		&& listen(listenFd, 8) == 0 && getsockname(listenFd, (struct sockaddr*)&addr, &len) == 0,
+		"Couldn't open server socket");
+
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+	dazeus::ServerConfig server;
+	server.host = "127.0.0.1";
+	server.port = ntohs(addr.sin_port);
+	config.servers.push_back(server);
+	config.connectTimeout = 1;
+	dazeus::ReconnectScheduler scheduler(5, 50, 100);
+
+	dazeus::EpollReactor epoll;
+	mustbe(epoll.valid(), "Couldn't create epoll reactor");
+	runReactor(epoll, config, &scheduler);
+	resolveTogether(epoll, config, &scheduler);
+	// io_uring may be unavailable or disabled here
+	dazeus::IoUringReactor uring;
+	if(uring.valid()) {
+		runReactor(uring, config, &scheduler);
+	}
+	std::unique_ptr<dazeus::Reactor> best(dazeus::Reactor::create());
+	mustbe(best && best->valid(), "No reactor created");
+
+#ifdef DAZEUS_HAVE_ASIO
+	{
+		dazeus::Network n(config);
+		n.setReconnectScheduler(&scheduler);
+		Listener l;
+		n.addListener(&l);
+		boost::asio::io_context io;
+		dazeus::AsioReactor<boost::asio::posix::stream_descriptor, boost::asio::steady_timer> r(io);
+		mustbe(r.valid(), "Couldn't create Asio reactor");
+		r.add(&n);
+		exercise(n, l, [&] {
+			io.restart();
+			io.run_for(std::chrono::milliseconds(10));
+		});
+	}
+#endif
+
+	for(size_t i = 0; i < clients.size(); ++i) {
+		if(clients[i].fd >= 0)
+			close(clients[i].fd);
+	}
+	close(listenFd);
+	return 0;
+}
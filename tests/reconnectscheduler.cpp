@@ -0,0 +1,99 @@
+#include <network.h>
+#include <reconnectscheduler.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+int main() {
+	dazeus::ReconnectScheduler s(1, 100, 1000);
+	dazeus::NetworkConfig config;
+	dazeus::Network a(config), b(config);
+	a.setReconnectScheduler(&s);
+	b.setReconnectScheduler(&s);
+
+	// Backoff grows exponentially, with jitter in the upper half, and is capped
+	unsigned int expected[] = {100, 100, 200, 400, 800, 1000, 1000};
+	for(unsigned int i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+		s.schedule(&a, dazeus::Network::ErrorReason);
+		long due = s.msUntilDue(&a);
+		mustbe(due <= (long)expected[i], "Reconnect delay too long");
+		mustbe(due >= (long)expected[i] / 2 - 5, "Reconnect delay too short");
+		mustbe(a.reconnectPending(), "Reconnect not pending");
+		s.attemptFinished(&a, false);
+	}
+
+	// A successful attempt resets the backoff
+	s.attemptFinished(&a, true);
+	mustbe(s.failedAttempts(&a) == 0, "Backoff not reset");
+	s.cancel(&a);
+	mustbe(!a.reconnectPending(), "Cancelled reconnect still pending");
+	mustbe(s.msUntilDue(&a) == -1, "Cancelled reconnect still has a due time");
+
+	// The pending queue is exposed in order
+	s.schedule(&b, dazeus::Network::TimeoutReason);
+	usleep(1000);
+	s.schedule(&a, dazeus::Network::ErrorReason);
+	std::vector<dazeus::ReconnectScheduler::PendingReconnect> p = s.pending();
+	mustbe(p.size() == 2, "Wrong number of pending reconnects");
+	mustbe(p[0].due <= p[1].due, "Pending reconnects not ordered");
+	mustbe(p[0].network == &b || p[0].network == &a, "Unknown network pending");
+
+	// Not due yet
+	mustbe(!s.takeDue(&a) && !s.takeDue(&b), "Reconnect fired early");
+	usleep(110 * 1000);
+
+	// Only one attempt may be in progress at the same time
+	mustbe(s.takeDue(&a), "Due reconnect not fired");
+	mustbe(!s.takeDue(&b), "Concurrency cap exceeded");
+	mustbe(s.attemptsInProgress() == 1, "Attempt not counted");
+	mustbe(s.msUntilDue(&b) > 0, "Capped reconnect would busy-loop");
+	s.attemptFinished(&a, true);
+	mustbe(s.takeDue(&b), "Reconnect not fired after slot freed");
+	mustbe(s.pending().empty(), "Reconnects left in queue");
+
+	// A network without servers gives its slot back instead of connecting
+	dazeus::ReconnectScheduler t(1, 1, 2);
+	dazeus::Network empty(config), other(config);
+	empty.setReconnectScheduler(&t);
+	other.setReconnectScheduler(&t);
+	t.schedule(&empty, dazeus::Network::ErrorReason);
+	t.schedule(&other, dazeus::Network::ErrorReason);
+	usleep(10 * 1000);
+	empty.checkTimeouts();
+	mustbe(t.attemptsInProgress() == 0, "Slot leaked by network without servers");
+	mustbe(!empty.reconnectPending(), "Reconnect without servers still pending");
+	mustbe(t.takeDue(&other), "Reconnect stalled after network without servers");
+
+	// An attempt started outside the scheduler respects the cap as well
+	dazeus::ReconnectScheduler u(1, 1, 2);
+	dazeus::NetworkConfig withServer;
+	dazeus::ServerConfig server;
+	server.host = "irc.test";
+	withServer.servers.push_back(server);
+	dazeus::Network busy(withServer), direct(withServer);
+	busy.setReconnectScheduler(&u);
+	direct.setReconnectScheduler(&u);
+	mustbe(u.attemptStarted(&busy, 0), "First attempt refused");
+	mustbe(!u.attemptStarted(&direct, 0), "Attempt started beyond the cap");
+	mustbe(u.attemptsInProgress() == 1, "Refused attempt counted");
+	direct.connectToNetwork();
+	mustbe(direct.activeServer() == 0, "Direct connect exceeded the cap");
+	mustbe(direct.reconnectPending() && !u.takeDue(&direct), "Direct connect not queued");
+	u.attemptFinished(&busy, false);
+	mustbe(u.takeDue(&direct), "Queued connect not started after slot freed");
+	u.cancel(&direct);
+
+	// An attempt that hangs gives its slot back after its connect timeout
+	mustbe(u.attemptStarted(&busy, 1), "Attempt refused with a free slot");
+	mustbe(!u.attemptStarted(&direct, 1), "Attempt started beyond the cap");
+	usleep(1100 * 1000);
+	mustbe(u.attemptsInProgress() == 0, "Hanging attempt still holds its slot");
+	mustbe(u.attemptStarted(&direct, 1), "Slot of a hanging attempt not released");
+	u.cancel(&busy);
+	u.cancel(&direct);
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+#include <network.h>
+#include <server.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+class ReloadListener : public dazeus::NetworkListener {
+public:
+	ReloadListener(const dazeus::NetworkConfig &c)
+	: config_(c)
+	, server_(0) {}
+
+	virtual void ircEvent(const std::string &event, const std::string &,
+	  const std::vector<std::string> &params, dazeus::Network *n )
+	{
+		if(event == "CONNECT") {
+			mustbe(n->nick() == "reloadone", "Initial nick incorrect");
+			server_ = n->activeServer();
+
+			// New nick, an extra server and other timeouts; none of
+			// these should cause a reconnect
+			config_.nickName = "reloadtwo";
+			config_.pongTimeout = 60;
+			dazeus::ServerConfig extra;
+			extra.host = "irc.example.org";
+			config_.servers.push_back(extra);
+			n->resetConfig(config_);
+			mustbe(n->activeServer() == server_, "Config reload caused a reconnect");
+		} else if(event == "NICK") {
+			mustbe(params.size() == 1 && params[0] == "reloadtwo", "Wrong NICK event");
+			mustbe(n->nick() == "reloadtwo", "Nick not updated");
+			mustbe(n->activeServer() == server_, "Nick change caused a reconnect");
+			mustbe(n->config().servers.size() == 2, "Server list not updated");
+			exit(0);
+		} else if(event == "DISCONNECT") {
+			mustbe(false, "Disconnected during reload");
+		}
+	}
+
+private:
+	dazeus::NetworkConfig config_;
+	dazeus::Server *server_;
+};
+
+int main(int argc, char *argv[]) {
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s host port\n", argv[0]);
+		return 10;
+	}
+
+	uint16_t port = strtoul(argv[2], NULL, 10);
+
+	try {
+		dazeus::NetworkConfig config;
+		config.name = "test";
+		config.displayName = "test";
+		config.nickName = "reloadone";
+
+		dazeus::ServerConfig server;
+		server.host = argv[1];
+		server.port = port;
+		config.servers.push_back(server);
+
+		dazeus::Network n(config);
+		ReloadListener l(config);
+		n.addListener(&l);
+		n.connectToNetwork(false);
+		n.run();
+
+		return 1;
+	} catch(const std::runtime_error &e) {
+		return 1;
+	}
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/perl
+use strict;
+use warnings;
+use lib "../tests";
+use DaZeusTest;
+
+# Run an IRC server that registers a client; this test succeeds if the
+# client changes its nickname on the same connection after its
+# configuration was reloaded, and the reload process exits with 0.
+
+my ($chld, $ircd, $pid) = startTest(@ARGV);
+
+my $childdone = 0;
+my $renamed = 0;
+sub serverdone {
+	return $renamed == 1;
+}
+
+eval {
+	local $SIG{ALRM} = sub { warn "# Timeout\n"; stopTest($pid); exit 2; };
+	alarm 10;
+	my $irc = $ircd->accept();
+	debug("[P] Accepted socket.");
+	set_nonblock($irc);
+	set_nonblock($chld);
+	set_nonblock($ircd);
+	while(1) {
+		handle_child($chld, $pid, \$childdone);
+		if($ircd->accept()) {
+			warn "# Client reconnected during reload. Failing test.\n";
+			stopTest($pid);
+			exit 4;
+		}
+		my $ircinput = <$irc> if $irc;
+		if($ircinput) {
+			$ircinput =~ s/[\n\r]+//g;
+			if($ircinput =~ /^pass/i || $ircinput =~ /^user/i || $ircinput =~ /^ping/i) {
+				# that's ok
+			} elsif($ircinput =~ /^nick (.+)$/i && $1 eq "reloadone") {
+				print $irc ":server 001 reloadone :Welcome to this test server\r\n";
+				print $irc ":server 376 reloadone :End of message of the day.\r\n";
+			} elsif($ircinput =~ /^nick (.+)$/i && $1 eq "reloadtwo") {
+				debug("Nick change received on the same connection. Succeeding test.");
+				print $irc ":reloadone!user\@host NICK :reloadtwo\r\n";
+				$renamed = 1;
+			} else {
+				warn "# IRC input not understood: $ircinput\n";
+			}
+		}
+
+		if($childdone && serverdone()) {
+			debug("Child and server are both done\n");
+			# Success
+			last;
+		}
+	}
+	alarm 0;
+};
+
+if($@) {
+	die $@;
+}
+
+stopTest($pid);
+exit 0;
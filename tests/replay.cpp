@@ -0,0 +1,184 @@
+#include <network.h>
+#include <server.h>
+#include <trafficrecorder.h>
+#include <replaydriver.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+struct Event {
+	std::string event;
+	std::string origin;
+	std::vector<std::string> params;
+};
+
+class Listener : public dazeus::NetworkListener {
+public:
+	Listener() : reply(false) {}
+	virtual void ircEvent(const std::string &event, const std::string &origin,
+	  const std::vector<std::string> &params, dazeus::Network *n) {
+		Event e;
+		e.event = event;
+		e.origin = origin;
+		e.params = params;
+		events.push_back(e);
+		if(reply && event == "PRIVMSG")
+			n->say(params[0], "hi " + origin);
+	}
+	std::vector<Event> events;
+	bool reply;
+};
+
+static const char *session[] = {
+	":irc.test 001 tester :Welcome to the test network",
+	":irc.test 376 tester :End of MOTD",
+	":tester!t@test.host JOIN #chan",
+	":irc.test 353 tester = #chan :@tester alice +bob",
+	":irc.test 366 tester #chan :End of NAMES list",
+	":alice!a@test.host PRIVMSG #chan :hello there",
+	":alice!a@test.host PRIVMSG tester :private",
+	":alice!a@test.host PRIVMSG #chan :\x01" "ACTION waves\x01",
+	":alice!a@test.host PRIVMSG tester :\x01VERSION\x01",
+	":irc.test MODE tester :+i",
+	":bob!b@test.host QUIT :bye",
+	":tester!t@test.host NICK tester2",
+	"PING :irc.test",
+	0
+};
+
+static const char *expected[] = {
+	"NUMERIC", "CONNECT", "NUMERIC", "JOIN", "NUMERIC", "NAMES", "NUMERIC",
+	"PRIVMSG", "PRIVMSG", "ACTION", "CTCP", "MODE", "QUIT", "NICK", 0
+};
+
+static std::string tempFile() {
+	char path[] = "/tmp/dazeus-replay-XXXXXX";
+	int fd = mkstemp(path);
+	mustbe(fd >= 0, "Couldn't create temporary file");
+	close(fd);
+	return path;
+}
+
+int main() {
+	std::string path = tempFile();
+	{
+		dazeus::TrafficRecorder r;
+		mustbe(r.open(path), "Couldn't open recording");
+		r.record(dazeus::TrafficRecord::Connect, "ServerConfig[irc://irc.test:6667]");
+		for(int i = 0; session[i]; ++i) {
+			r.record(dazeus::TrafficRecord::Inbound, session[i]);
+		}
+		r.record(dazeus::TrafficRecord::Outbound, "QUIT :done");
+		mustbe(r.records() == 15, "Wrong number of records written");
+	}
+
+	std::vector<dazeus::TrafficRecord> records;
+	std::string error;
+	mustbe(dazeus::TrafficRecorder::load(path, records, &error), error.c_str());
+	mustbe(records.size() == 15, "Wrong number of records read");
+	mustbe(records[0].direction == dazeus::TrafficRecord::Connect, "Connect record lost");
+	mustbe(records[1].line == session[0], "Line not read back");
+	mustbe(records[14].direction == dazeus::TrafficRecord::Outbound, "Outbound record lost");
+	for(size_t i = 1; i < records.size(); ++i) {
+		mustbe(records[i].micros >= records[i - 1].micros, "Timestamps not monotonic");
+	}
+
+	dazeus::NetworkConfig config;
+	config.name = "test";
+	config.nickName = "tester";
+
+	// Replaying produces the events libircclient would have produced
+	dazeus::Network n(config);
+	Listener l;
+	n.addListener(&l);
+	{
+		dazeus::ReplayDriver d(&n);
+		d.replay(records);
+		mustbe(d.linesReplayed() == 13, "Not all inbound lines replayed");
+		mustbe(l.events.size() == 14, "Wrong number of events");
+		for(int i = 0; expected[i]; ++i) {
+			mustbe(l.events[i].event == expected[i], "Wrong event");
+		}
+		mustbe(l.events[7].origin == "alice" && l.events[7].params[0] == "#chan", "Channel message wrong");
+		mustbe(l.events[8].params[0] == "tester", "Private message wrong");
+		mustbe(l.events[9].params.size() == 2 && l.events[9].params[1] == "waves", "ACTION wrong");
+		mustbe(l.events[10].params.size() == 1 && l.events[10].params[0] == "VERSION", "CTCP wrong");
+		mustbe(l.events[11].params.size() == 1 && l.events[11].params[0] == "+i", "User mode wrong");
+
+		mustbe(n.joinedChannels().size() == 1 && n.joinedChannels()[0] == "#chan", "Channel not joined");
+		std::map<std::string,dazeus::Network::ChannelMode> users = n.usersInChannel("#chan");
+		mustbe(users.size() == 2 && users.count("alice") && users.count("tester2"), "Users not tracked");
+		mustbe(n.nick() == "tester2", "Nick change not tracked");
+	}
+	mustbe(n.activeServer() == 0, "Replay server left behind");
+	mustbe(n.joinedChannels().empty(), "Replay state left behind");
+
+	// The nick comes from the recording, not from the configuration
+	{
+		dazeus::NetworkConfig other = config;
+		other.nickName = "someone";
+		dazeus::Network n3(other);
+		dazeus::ReplayDriver d(&n3);
+		d.replay(records);
+		mustbe(n3.joinedChannels().size() == 1, "Channel not joined under recorded nick");
+		mustbe(n3.nick() == "tester2", "Recorded nick not used");
+	}
+
+	// Replaying into a recording network records the same traffic, plus what
+	// the listeners sent in response
+	std::string path2 = tempFile();
+	{
+		dazeus::TrafficRecorder r;
+		mustbe(r.open(path2), "Couldn't open second recording");
+		dazeus::Network n2(config);
+		n2.setRecorder(&r);
+		Listener l2;
+		l2.reply = true;
+		n2.addListener(&l2);
+		dazeus::ReplayDriver d(&n2);
+		d.replay(records);
+
+		std::vector<std::string> params;
+		params.push_back("#chan");
+		params.push_back("two words");
+		n2.activeServer()->receivedLine("carol!c@test.host", "PRIVMSG", params);
+	}
+	std::vector<dazeus::TrafficRecord> rerecorded;
+	mustbe(dazeus::TrafficRecorder::load(path2, rerecorded, &error), error.c_str());
+	std::vector<std::string> inbound, outbound;
+	for(size_t i = 0; i < rerecorded.size(); ++i) {
+		if(rerecorded[i].direction == dazeus::TrafficRecord::Inbound)
+			inbound.push_back(rerecorded[i].line);
+		else if(rerecorded[i].direction == dazeus::TrafficRecord::Outbound)
+			outbound.push_back(rerecorded[i].line);
+	}
+	mustbe(inbound.size() == 14, "Inbound lines not re-recorded");
+	for(int i = 0; session[i]; ++i) {
+		mustbe(inbound[i] == session[i], "Re-recorded line differs");
+	}
+	mustbe(inbound[13] == ":carol!c@test.host PRIVMSG #chan :two words", "Reconstructed line wrong");
+	mustbe(outbound.size() == 2, "Replies not recorded");
+	mustbe(outbound[0] == "PRIVMSG #chan :hi alice", "Channel reply wrong");
+	mustbe(outbound[1] == "PRIVMSG tester :hi alice", "Private reply wrong");
+
+	// A corpus replays on several threads
+	std::vector<std::string> corpus;
+	corpus.push_back(path);
+	corpus.push_back(path2);
+	corpus.push_back(path);
+	corpus.push_back("/nonexistent/recording");
+	std::vector<dazeus::ReplayDriver::CorpusResult> results =
+		dazeus::ReplayDriver::replayCorpus(corpus, config, 2);
+	mustbe(results.size() == 4, "Wrong number of corpus results");
+	mustbe(results[0].ok && results[0].lines == 13 && results[0].events == 14, "Corpus replay wrong");
+	mustbe(results[2].ok && results[2].events == results[0].events, "Corpus replays differ");
+	mustbe(results[1].ok && results[1].lines == 14, "Second recording not replayed");
+	mustbe(!results[3].ok && !results[3].error.empty(), "Missing recording not reported");
+
+	unlink(path.c_str());
+	unlink(path2.c_str());
+	return 0;
+}
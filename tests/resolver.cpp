@@ -0,0 +1,88 @@
+#include <resolver.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+static int lookups = 0;
+
+// Stub resolver: knows two hosts, fails everything else
+int stubLookup(const std::string &host, std::vector<dazeus::ResolvedAddress> &result) {
+	++lookups;
+	if(host == "irc.example.org") {
+		result.push_back(dazeus::ResolvedAddress(AF_INET, "192.0.2.1"));
+		result.push_back(dazeus::ResolvedAddress(AF_INET, "192.0.2.2"));
+		result.push_back(dazeus::ResolvedAddress(AF_INET6, "2001:db8::1"));
+		return 0;
+	} else if(host == "short.example.org") {
+		result.push_back(dazeus::ResolvedAddress(AF_INET, "192.0.2.3"));
+		return 0;
+	}
+	return EAI_NONAME;
+}
+
+void waitFor(dazeus::Resolver::QueryPtr q) {
+	fd_set in;
+	FD_ZERO(&in);
+	FD_SET(q->notifyDescriptor(), &in);
+	struct timeval timeout = {5, 0};
+	mustbe(select(q->notifyDescriptor() + 1, &in, NULL, NULL, &timeout) > 0, "Resolver did not notify");
+	mustbe(q->finished(), "Query notified before it finished");
+}
+
+int main() {
+	mustbe(dazeus::Resolver::isNumericAddress("127.0.0.1"), "IPv4 address not numeric");
+	mustbe(dazeus::Resolver::isNumericAddress("::1"), "IPv6 address not numeric");
+	mustbe(!dazeus::Resolver::isNumericAddress("localhost"), "Hostname is numeric");
+
+	dazeus::Resolver r(2, stubLookup);
+
+	dazeus::Resolver::QueryPtr q = r.resolve("irc.example.org");
+	waitFor(q);
+	mustbe(q->error() == 0, "Lookup failed");
+	mustbe(q->addresses().size() == 3, "Not all records returned");
+	mustbe(q->addresses()[2].family == AF_INET6, "AAAA record missing");
+	mustbe(lookups == 1, "Wrong number of lookups");
+
+	// Second lookup comes from the cache
+	q = r.resolve("irc.example.org");
+	mustbe(q->finished(), "Cached lookup not finished immediately");
+	mustbe(q->addresses().size() == 3, "Cached lookup incomplete");
+	mustbe(lookups == 1, "Cached lookup hit the resolver");
+	std::vector<dazeus::ResolvedAddress> cached;
+	mustbe(r.cachedAddresses("irc.example.org", cached) && cached.size() == 3, "Cached addresses not available");
+
+	// Failures are cached as well
+	q = r.resolve("nxdomain.example.org");
+	waitFor(q);
+	mustbe(q->error() == EAI_NONAME, "Failure not reported");
+	mustbe(r.isNegativelyCached("nxdomain.example.org"), "Failure not cached");
+	q = r.resolve("nxdomain.example.org");
+	mustbe(q->finished() && q->error() == EAI_NONAME, "Negative cache not used");
+	mustbe(lookups == 2, "Negatively cached lookup hit the resolver");
+
+	// Waiters for the same host share the lookup, and each is notified
+	r.clearCache();
+	dazeus::Resolver::QueryPtr q1 = r.resolve("irc.example.org");
+	dazeus::Resolver::QueryPtr q2 = r.resolve("irc.example.org");
+	mustbe(q1 != q2 && q1->notifyDescriptor() != q2->notifyDescriptor(), "Waiters share a notification");
+	waitFor(q1);
+	waitFor(q2);
+	mustbe(q2->addresses().size() == 3, "Second waiter got no result");
+	mustbe(lookups == 3, "Waiters didn't share the lookup");
+
+	// Expired entries are looked up again
+	r.setCacheTtl(0);
+	q = r.resolve("short.example.org");
+	waitFor(q);
+	q = r.resolve("short.example.org");
+	waitFor(q);
+	mustbe(lookups == 5, "Expired entry was not looked up again");
+	mustbe(!r.cachedAddresses("short.example.org", cached), "Expired entry still cached");
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <utils.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define mustbe(x, y) \
+	if(!(x)) { fprintf(stderr, "Test error: %s\n", y); exit(9); }
+
+int main() {
+	std::vector<dazeus::StringRef> parts;
+	split("a  b c", " ", parts);
+	mustbe(parts.size() == 4 && parts[0] == "a" && parts[1] == "" && parts[2] == "b" && parts[3] == "c", "Split wrong");
+	std::string line = "a::b::";
+	split(line, "::", parts);
+	mustbe(parts.size() == 3 && parts[1] == "b" && parts[2] == "", "Split with long separator wrong");
+	mustbe(parts[1].data == line.data() + 3, "Split copied its parts");
+	split("a:b::c", "::", parts);
+	mustbe(parts.size() == 2 && parts[0] == "a:b" && parts[1] == "c", "Split on partial separator wrong");
+	split("", " ", parts);
+	mustbe(parts.size() == 1, "Split of empty string wrong");
+	split("abc", "", parts);
+	mustbe(parts.size() == 1, "Split on empty separator wrong");
+
+	std::string padded = " \t foo bar \r\n";
+	mustbe(trim(padded) == "foo bar" && trim(padded).data == padded.data() + 3, "Trim wrong");
+	mustbe(trim("   ") == "", "Trim of whitespace wrong");
+	mustbe(trim("x") == "x", "Trim of single character wrong");
+
+	mustbe(startsWith("PRIVMSG #a", "privmsg", true), "Case insensitive prefix not found");
+	mustbe(!startsWith("PRIVMSG #a", "privmsg", false), "Case sensitive prefix found");
+	mustbe(!startsWith("PRIV", "PRIVMSG", false), "Prefix longer than string found");
+
+	mustbe(equals_ci("Nick[a]", "nick[a]"), "Case insensitive compare wrong");
+	mustbe(!equals_ci("a@", "a`"), "Non-letters folded");
+	mustbe(!equals_ci("nick", "nick_"), "Different lengths equal");
+
+	std::vector<std::string> users;
+	users << "Alice" << "bob" << "ALICE";
+	mustbe(contains_ci(users, std::string("BOB")), "User not found");
+	mustbe(find_ci(users, "alice") == users.begin(), "Wrong user found");
+	erase_ci(users, "alice");
+	mustbe(users.size() == 1 && users[0] == "bob", "Users not erased");
+
+	std::map<std::string,std::vector<std::string> > channels;
+	channels["#Chan"];
+	channels["#other"];
+	channels["#chan"];
+	mustbe(find_ci(channels, "#CHAN") != channels.end(), "Channel not found");
+	mustbe(find_ci(channels, "#chan")->first == "#chan", "Exact key not preferred");
+	erase_ci(channels, "#CHAN");
+	mustbe(channels.size() == 1 && contains(channels, std::string("#other")), "Channels not erased");
+
+	mustbe(join(users, ", ") == "bob", "Join of one wrong");
+	users << "carol";
+	mustbe(join(users, ", ") == "bob, carol", "Join wrong");
+	mustbe(join(std::vector<std::string>(), ", ") == "", "Join of none wrong");
+	split("x y z", " ", parts);
+	std::string joined = "<";
+	join(parts, "-", joined);
+	mustbe(joined == "<x-y-z", "Join of parts wrong");
+	return 0;
+}